@@ -0,0 +1,91 @@
+#include "arena.h"
+#include <stdint.h>
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : MonotonicArena
+//
+// @description         : Constructor. The first block is allocated on the first allocation.
+//-------------------------------------------------------------------------------------------------------------
+MonotonicArena::MonotonicArena()
+{
+    m_cursor = nullptr;
+    m_remaining = 0;
+    m_nextBlockSize = ARENA_MIN_BLOCK_SIZE;
+    m_allocated = 0;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : MonotonicArena
+//
+// @description         : Destructor. Releases all blocks at once, no matter how many objects they hold.
+//-------------------------------------------------------------------------------------------------------------
+MonotonicArena::~MonotonicArena()
+{
+    for (size_t i = 0; i < m_blocks.size(); i++)
+    {
+        delete[] m_blocks[i];
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : AddBlock
+//
+// @description         : Starts a new block of at least minSize bytes. The rest of the current block is
+//                        abandoned.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void MonotonicArena::AddBlock(size_t minSize)
+{
+    size_t blockSize = (minSize > m_nextBlockSize) ? minSize : m_nextBlockSize;
+    m_blocks.push_back(new char[blockSize]);
+    m_cursor = m_blocks.back();
+    m_remaining = blockSize;
+    m_allocated += blockSize;
+
+    if (m_nextBlockSize < ARENA_MAX_BLOCK_SIZE)
+    {
+        m_nextBlockSize *= 2;
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Allocate
+//
+// @description         : Allocates size bytes aligned to alignment. The memory stays valid until the arena
+//                        is destroyed.
+//
+// @param alignment     : Power of 2, at most alignof(max_align_t)
+//
+// @returns             : Uninitialized memory
+//-------------------------------------------------------------------------------------------------------------
+void* MonotonicArena::Allocate(size_t size, size_t alignment)
+{
+    size_t padding = (size_t)(-(uintptr_t)m_cursor & (alignment - 1));
+    if (m_cursor == nullptr || padding + size > m_remaining)
+    {
+        AddBlock(size);
+        padding = 0;
+    }
+
+    char *memory = m_cursor + padding;
+    m_cursor = memory + size;
+    m_remaining -= padding + size;
+    return memory;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Reserve
+//
+// @description         : Makes sure the next size bytes of allocations fit in the current block, so a bulk
+//                        load of known size costs a single block allocation.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void MonotonicArena::Reserve(size_t size)
+{
+    if (size > m_remaining)
+    {
+        AddBlock(size);
+    }
+}
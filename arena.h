@@ -0,0 +1,39 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+#include<stddef.h>
+#include<vector>
+
+using namespace std;
+
+//-------------------------------------------------------------------------------------------------------------
+// Globals
+//-------------------------------------------------------------------------------------------------------------
+const size_t ARENA_MIN_BLOCK_SIZE = 64 * 1024;
+const size_t ARENA_MAX_BLOCK_SIZE = 4 * 1024 * 1024;
+
+//-------------------------------------------------------------------------------------------------------------
+// Monotonic arena. Allocations are carved out of large blocks and are never freed individually; all blocks
+// are released together when the arena is destroyed. Block sizes double up to ARENA_MAX_BLOCK_SIZE, so the
+// no. of blocks grows with the log of the memory used. Only for objects which need no destructor. Not
+// thread safe.
+//-------------------------------------------------------------------------------------------------------------
+class MonotonicArena
+{
+private:
+    vector<char*>                           m_blocks;
+    char                                   *m_cursor;                    // Free space of the current block
+    size_t                                  m_remaining;
+    size_t                                  m_nextBlockSize;
+    size_t                                  m_allocated;                 // Bytes of all blocks
+
+    void AddBlock(size_t minSize);
+
+public:
+    MonotonicArena();
+    ~MonotonicArena();
+    void* Allocate(size_t size, size_t alignment);
+    void Reserve(size_t size);
+    size_t GetAllocatedBytes() { return m_allocated; }
+};
+
+#endif
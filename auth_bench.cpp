@@ -0,0 +1,505 @@
+#include "auth_module.h"
+#include <algorithm>
+#include <chrono>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+//-------------------------------------------------------------------------------------------------------------
+// AuthModule benchmark. Generates synthetic users and reports throughput and latency percentiles of the
+// main operations for several database sizes and thread counts. Run it before and after a change to catch
+// performance regressions.
+//
+// Usage: auth_bench [-u user counts] [-t thread counts] [-n ops per thread] [-i hash iterations]
+//                   [-m journal|snapshot] [-f off|on|off,on] [-d flush|group|sync]
+//        Counts are comma separated, e.g. auth_bench -u 1000,100000 -t 1,4,8
+//        -f runs every measurement without and/or with the negative lookup filter, e.g. to compare the
+//        login_miss latency of both
+//        -d sets the durability of mutations, e.g. to see the register latency of group commits
+//
+// The password hash work factor defaults to a single iteration so that the figures show the cost of the
+// module itself; hasher_bench measures the hashing. The benchmark runs in a temporary directory and the
+// module's own messages are discarded.
+//-------------------------------------------------------------------------------------------------------------
+const char *DEFAULT_USER_COUNTS = "1000,100000,1000000";
+const unsigned DEFAULT_OPS_PER_THREAD = 10000;
+const uint32_t DEFAULT_BENCH_HASH_ITERATIONS = 1;
+const size_t POPULATE_BATCH_SIZE = 100000;
+const unsigned PERSIST_ROUNDS = 3;
+const unsigned LOAD_ROUNDS = 3;
+
+//-------------------------------------------------------------------------------------------------------------
+// Enums
+//-------------------------------------------------------------------------------------------------------------
+typedef enum workload_tag
+{
+    WORKLOAD_LOGIN_HIT,                       // Login of existing users with their password
+    WORKLOAD_LOGIN_MISS,                      // Login of users who do not exist
+    WORKLOAD_HISTORY_CHECK,                   // IsPasswordValidAsPerHistory() with a password never used
+    WORKLOAD_UPDATE_PASSWORD,                 // UpdateUserPassword() of existing users
+    WORKLOAD_REGISTER,                        // Register() of new users
+    WORKLOAD_COUNT
+}workload_t;
+
+//-------------------------------------------------------------------------------------------------------------
+// Structs
+//-------------------------------------------------------------------------------------------------------------
+typedef struct benchConfig_tag
+{
+    vector<size_t> userCounts;
+    vector<size_t> threadCounts;
+    unsigned opsPerThread;
+    uint32_t hashIterations;
+    storageMode_t storageMode;
+    vector<bool> filterModes;                 // Runs without and/or with the negative lookup filter
+    durability_t durability;
+}benchConfig_t;
+
+static FILE *g_report = stdout;               // Results, while stdout itself is discarded
+static atomic<unsigned> g_uniqueId(0);        // Keeps generated names and passwords unique across runs
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : ParseList
+//
+// @description         : Parses a comma separated list of positive numbers.
+//
+// @returns             : True if the list is valid and not empty.
+//-------------------------------------------------------------------------------------------------------------
+bool ParseList(const char *text, vector<size_t> & values)
+{
+    values.clear();
+    while (*text != '\0')
+    {
+        char *end = nullptr;
+        unsigned long long value = strtoull(text, &end, 10);
+        if (end == text || value == 0 || (*end != ',' && *end != '\0'))
+        {
+            return false;
+        }
+
+        values.push_back((size_t)value);
+        text = (*end == ',') ? end + 1 : end;
+    }
+
+    return !values.empty();
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : ParseFilterModes
+//
+// @description         : Parses a comma separated list of "off" and "on".
+//
+// @returns             : True if the list is valid and not empty.
+//-------------------------------------------------------------------------------------------------------------
+bool ParseFilterModes(const char *text, vector<bool> & modes)
+{
+    modes.clear();
+    while (*text != '\0')
+    {
+        size_t len = strcspn(text, ",");
+        if ((len == 2 && strncmp(text, "on", 2) == 0) || (len == 3 && strncmp(text, "off", 3) == 0))
+        {
+            modes.push_back(len == 2);
+        }
+        else
+        {
+            return false;
+        }
+        text += (text[len] == ',') ? len + 1 : len;
+    }
+
+    return !modes.empty();
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : ParseArguments
+//
+// @description         : Fills the benchmark configuration from the command line.
+//
+// @returns             : True if all arguments are valid.
+//-------------------------------------------------------------------------------------------------------------
+bool ParseArguments(int argc, char *argv[], benchConfig_t & config)
+{
+    ParseList(DEFAULT_USER_COUNTS, config.userCounts);
+    config.threadCounts.clear();
+    for (size_t threads = 1; threads <= thread::hardware_concurrency(); threads *= 2)
+    {
+        config.threadCounts.push_back(threads);
+    }
+    if (config.threadCounts.empty())
+    {
+        config.threadCounts.push_back(1);
+    }
+    config.opsPerThread = DEFAULT_OPS_PER_THREAD;
+    config.hashIterations = DEFAULT_BENCH_HASH_ITERATIONS;
+    config.storageMode = STORAGE_MODE_JOURNAL;
+    config.filterModes.assign(1, false);
+    config.durability = DURABILITY_FLUSH;
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        bool valid = true;
+        if (strcmp(argv[i], "-u") == 0)
+        {
+            valid = ParseList(argv[i + 1], config.userCounts);
+        }
+        else if (strcmp(argv[i], "-t") == 0)
+        {
+            valid = ParseList(argv[i + 1], config.threadCounts);
+        }
+        else if (strcmp(argv[i], "-n") == 0)
+        {
+            config.opsPerThread = (unsigned)strtoul(argv[i + 1], nullptr, 10);
+            valid = (config.opsPerThread > 0);
+        }
+        else if (strcmp(argv[i], "-i") == 0)
+        {
+            config.hashIterations = (uint32_t)strtoul(argv[i + 1], nullptr, 10);
+            valid = (config.hashIterations > 0);
+        }
+        else if (strcmp(argv[i], "-m") == 0)
+        {
+            valid = (strcmp(argv[i + 1], "journal") == 0 || strcmp(argv[i + 1], "snapshot") == 0);
+            config.storageMode = (strcmp(argv[i + 1], "snapshot") == 0) ? STORAGE_MODE_SNAPSHOT : STORAGE_MODE_JOURNAL;
+        }
+        else if (strcmp(argv[i], "-f") == 0)
+        {
+            valid = ParseFilterModes(argv[i + 1], config.filterModes);
+        }
+        else if (strcmp(argv[i], "-d") == 0)
+        {
+            valid = (strcmp(argv[i + 1], "flush") == 0 || strcmp(argv[i + 1], "group") == 0 ||
+                     strcmp(argv[i + 1], "sync") == 0);
+            config.durability = (strcmp(argv[i + 1], "group") == 0) ? DURABILITY_GROUP :
+                                (strcmp(argv[i + 1], "sync") == 0) ? DURABILITY_SYNC : DURABILITY_FLUSH;
+        }
+        else
+        {
+            valid = false;
+        }
+
+        if (!valid)
+        {
+            return false;
+        }
+    }
+
+    return (argc % 2) == 1;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetBenchPolicy
+//
+// @description         : Auth policy of the benchmark. Passwords never expire.
+//
+// @returns             : Auth policy
+//-------------------------------------------------------------------------------------------------------------
+authPolicy_t GetBenchPolicy()
+{
+    authPolicy_t authPolicy;
+    authPolicy.useStrongPasswords = false;
+    authPolicy.passwordHistoryMax = 3;
+    authPolicy.passwordLenMin = 1;
+    authPolicy.passwordLenMax = 64;
+    authPolicy.passwordExpiryDays = 0;
+    return authPolicy;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetModuleConfig
+//
+// @description         : Module configuration for the benchmark settings.
+//
+// @returns             : Module configuration
+//-------------------------------------------------------------------------------------------------------------
+authModuleConfig_t GetModuleConfig(const benchConfig_t & config, bool useFilter)
+{
+    authModuleConfig_t moduleConfig = AuthModule::GetDefaultAuthModuleConfig();
+    moduleConfig.storageMode = config.storageMode;
+    moduleConfig.hashIterations = config.hashIterations;
+    moduleConfig.useNegativeLookupFilter = useFilter;
+    moduleConfig.durability = config.durability;
+    return moduleConfig;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : RemoveDatabaseFiles
+//
+// @description         : Deletes the files an AuthModule leaves in the working directory.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void RemoveDatabaseFiles()
+{
+    remove(USERS_DATA_FILENAME.c_str());
+    remove((USERS_DATA_FILENAME + ".tmp").c_str());
+    remove((USERS_DATA_FILENAME + NEGATIVE_FILTER_SUFFIX).c_str());
+    remove((USERS_DATA_FILENAME + NEGATIVE_FILTER_SUFFIX + ".tmp").c_str());
+    remove(USERS_JOURNAL_FILENAME.c_str());
+    remove((USERS_JOURNAL_FILENAME + ".compacting").c_str());
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : UserName / UserPassword
+//
+// @description         : Name and initial password of the index'th synthetic user.
+//-------------------------------------------------------------------------------------------------------------
+string UserName(size_t index)
+{
+    return "user" + to_string(index);
+}
+
+string UserPassword(size_t index)
+{
+    return "pwd" + to_string(index);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Report
+//
+// @description         : Prints throughput and latency percentiles of one measurement.
+//
+// @param latencies     : Latency of each operation in nanoseconds, sorted by this function
+// @param seconds       : Wall clock time of the whole measurement
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void Report(size_t users, size_t threads, const char *workload, vector<uint64_t> & latencies, double seconds)
+{
+    if (latencies.empty())
+    {
+        return;
+    }
+
+    sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p)
+    {
+        size_t index = (size_t)(p * latencies.size());
+        return latencies[min(index, latencies.size() - 1)] / 1000.0;
+    };
+
+    fprintf(g_report, "%9zu %7zu  %-16s %9zu %12.0f %10.2f %10.2f %10.2f\n", users, threads, workload,
+            latencies.size(), latencies.size() / seconds, percentile(0.50), percentile(0.99), percentile(0.999));
+    fflush(g_report);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : PopulateUsers
+//
+// @description         : Registers users 0..count-1 in batches.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void PopulateUsers(AuthModule & auth, size_t count)
+{
+    vector<registerResult_t> results;
+    for (size_t first = 0; first < count; first += POPULATE_BATCH_SIZE)
+    {
+        vector<pair<string, string>> users;
+        for (size_t i = first; i < count && i < first + POPULATE_BATCH_SIZE; i++)
+        {
+            users.push_back(make_pair(UserName(i), UserPassword(i)));
+        }
+        auth.RegisterBatch(users, results);
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : RunWorkload
+//
+// @description         : Runs opsPerThread operations of a workload on each of threads threads at once.
+//                        Each thread cycles through its own range of users, so that threads never modify
+//                        the same user as long as there are at least as many users as threads.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void RunWorkload(AuthModule & auth, workload_t workload, size_t users, size_t threads, unsigned opsPerThread)
+{
+    static const char *workloadNames[WORKLOAD_COUNT] =
+    {
+        "login_hit", "login_miss", "history_check", "update_password", "register"
+    };
+
+    unsigned runId = g_uniqueId++;
+    vector<vector<uint64_t>> threadLatencies(threads);
+    auto worker = [&](size_t threadIndex)
+    {
+        vector<uint64_t> & latencies = threadLatencies[threadIndex];
+        latencies.reserve(opsPerThread);
+
+        // Prepare the arguments up front so that only the operation is timed
+        size_t firstUser = threadIndex * users / threads;
+        size_t rangeLen = max((threadIndex + 1) * users / threads - firstUser, (size_t)1);
+        vector<pair<string, string>> args(opsPerThread);
+        for (unsigned i = 0; i < opsPerThread; i++)
+        {
+            size_t user = (firstUser + i % rangeLen) % users;
+            string suffix = to_string(runId) + "_" + to_string(threadIndex) + "_" + to_string(i);
+            switch (workload)
+            {
+            case WORKLOAD_LOGIN_HIT:       args[i] = make_pair(UserName(user), UserPassword(user)); break;
+            case WORKLOAD_LOGIN_MISS:      args[i] = make_pair("missing" + suffix, string("x")); break;
+            case WORKLOAD_HISTORY_CHECK:   args[i] = make_pair(UserName(user), "fresh" + suffix); break;
+            case WORKLOAD_UPDATE_PASSWORD: args[i] = make_pair(UserName(user), "new" + suffix); break;
+            default:                       args[i] = make_pair("bench" + suffix, "pwd" + suffix); break;
+            }
+        }
+
+        for (unsigned i = 0; i < opsPerThread; i++)
+        {
+            auto start = chrono::steady_clock::now();
+            switch (workload)
+            {
+            case WORKLOAD_LOGIN_HIT:
+            case WORKLOAD_LOGIN_MISS:       auth.Login(args[i].first, args[i].second); break;
+            case WORKLOAD_HISTORY_CHECK:    auth.IsPasswordValidAsPerHistory(args[i].first, args[i].second); break;
+            case WORKLOAD_UPDATE_PASSWORD:  auth.UpdateUserPassword(args[i].first, args[i].second); break;
+            default:                        auth.Register(args[i].first, args[i].second); break;
+            }
+            latencies.push_back((uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+        }
+    };
+
+    auto start = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (size_t i = 0; i < threads; i++)
+    {
+        workers.emplace_back(worker, i);
+    }
+    for (size_t i = 0; i < threads; i++)
+    {
+        workers[i].join();
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+    vector<uint64_t> latencies;
+    for (size_t i = 0; i < threads; i++)
+    {
+        latencies.insert(latencies.end(), threadLatencies[i].begin(), threadLatencies[i].end());
+    }
+
+    // Wall time includes the preparation of the arguments, so report the busiest thread's time
+    double busiest = 0;
+    for (size_t i = 0; i < threads; i++)
+    {
+        double busy = 0;
+        for (size_t j = 0; j < threadLatencies[i].size(); j++)
+        {
+            busy += threadLatencies[i][j] / 1e9;
+        }
+        busiest = max(busiest, busy);
+    }
+
+    Report(users, threads, workloadNames[workload], latencies, (busiest > 0) ? busiest : elapsed.count());
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : BenchmarkSize
+//
+// @description         : All measurements for one database size: persist and cold start once, then every
+//                        workload for every thread count.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void BenchmarkSize(const benchConfig_t & config, size_t users, bool useFilter)
+{
+    authPolicy_t authPolicy = GetBenchPolicy();
+    authModuleConfig_t moduleConfig = GetModuleConfig(config, useFilter);
+    RemoveDatabaseFiles();
+
+    {
+        AuthModule auth(authPolicy, moduleConfig);
+        auth.Initialize();
+        PopulateUsers(auth, users);
+
+        vector<uint64_t> latencies;
+        for (unsigned i = 0; i < PERSIST_ROUNDS; i++)
+        {
+            auto start = chrono::steady_clock::now();
+            auth.UpdateUsersDataFile();
+            latencies.push_back((uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+        }
+        double seconds = 0;
+        for (size_t i = 0; i < latencies.size(); i++)
+        {
+            seconds += latencies[i] / 1e9;
+        }
+        Report(users, 1, "persist", latencies, seconds);
+    }
+
+    vector<uint64_t> latencies;
+    double seconds = 0;
+    for (unsigned i = 0; i < LOAD_ROUNDS; i++)
+    {
+        auto start = chrono::steady_clock::now();
+        {
+            AuthModule auth(authPolicy, moduleConfig);
+            auth.Initialize();
+        }
+        latencies.push_back((uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+        seconds += latencies.back() / 1e9;
+    }
+    Report(users, 1, "load", latencies, seconds);
+
+    AuthModule auth(authPolicy, moduleConfig);
+    auth.Initialize();
+    for (size_t i = 0; i < config.threadCounts.size(); i++)
+    {
+        for (int workload = 0; workload < WORKLOAD_COUNT; workload++)
+        {
+            RunWorkload(auth, (workload_t)workload, users, config.threadCounts[i], config.opsPerThread);
+        }
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// M A I N
+//-------------------------------------------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+    benchConfig_t config;
+    if (!ParseArguments(argc, argv, config))
+    {
+        printf("Usage: %s [-u user counts] [-t thread counts] [-n ops per thread] [-i hash iterations] "
+               "[-m journal|snapshot] [-f off|on|off,on] [-d flush|group|sync]\n", argv[0]);
+        return 1;
+    }
+
+    char workDir[] = "/tmp/auth_bench.XXXXXX";
+    if (mkdtemp(workDir) == nullptr || chdir(workDir) != 0)
+    {
+        printf("Could not create a working directory\n");
+        return 1;
+    }
+
+    // Keep the results on the original stdout and discard the module's messages
+    fflush(stdout);
+    g_report = fdopen(dup(STDOUT_FILENO), "w");
+    if (g_report == nullptr || freopen("/dev/null", "w", stdout) == nullptr)
+    {
+        return 1;
+    }
+
+    static const char *durabilityNames[] = { "flush", "group", "sync" };
+    fprintf(g_report, "Hash iterations: %u, storage: %s, durability: %s, ops per thread: %u, latencies in us\n",
+            config.hashIterations, (config.storageMode == STORAGE_MODE_JOURNAL) ? "journal" : "snapshot",
+            durabilityNames[config.durability], config.opsPerThread);
+    for (size_t f = 0; f < config.filterModes.size(); f++)
+    {
+        fprintf(g_report, "Negative lookup filter: %s\n", config.filterModes[f] ? "on" : "off");
+        fprintf(g_report, "%9s %7s  %-16s %9s %12s %10s %10s %10s\n",
+                "users", "threads", "workload", "ops", "ops/sec", "p50", "p99", "p99.9");
+        for (size_t i = 0; i < config.userCounts.size(); i++)
+        {
+            BenchmarkSize(config, config.userCounts[i], config.filterModes[f]);
+        }
+    }
+
+    RemoveDatabaseFiles();
+    if (chdir("/") == 0)
+    {
+        rmdir(workDir);
+    }
+
+    return 0;
+}
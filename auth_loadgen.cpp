@@ -0,0 +1,374 @@
+#include "auth_protocol.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+//-------------------------------------------------------------------------------------------------------------
+// Load generator for auth_server. Every connection registers its share of synthetic users and then logs
+// them in, keeping up to a pipeline depth of requests in flight, and the throughput and latency
+// percentiles of the phases are reported. With -t 1 every user logs in once with a session, and the
+// requests then validate the sessions instead of logging in.
+//
+// Usage: auth_loadgen [-a address] [-p port] [-s unix socket path] [-c connections] [-d pipeline depth]
+//                     [-n requests per connection] [-u users per connection] [-t 1]
+//
+// Run it against a freshly started server, e.g. auth_server -i 1 -q 1, user names are fixed so that a
+// second run only sees rejected registrations.
+//-------------------------------------------------------------------------------------------------------------
+const unsigned DEFAULT_CONNECTIONS = 16;
+const unsigned DEFAULT_PIPELINE_DEPTH = 8;
+const unsigned DEFAULT_REQUESTS_PER_CONNECTION = 10000;
+const unsigned DEFAULT_USERS_PER_CONNECTION = 100;
+const size_t LOADGEN_READ_SIZE = 16 * 1024;
+const unsigned AUTH_STATUS_COUNT = AUTH_STATUS_BUSY + 1;
+
+//-------------------------------------------------------------------------------------------------------------
+// Structs
+//-------------------------------------------------------------------------------------------------------------
+typedef struct loadConfig_tag
+{
+    authEndpoint_t endpoint;
+    unsigned connections;
+    unsigned depth;
+    unsigned requests;
+    unsigned users;
+    bool useSessions;
+}loadConfig_t;
+
+typedef struct phaseResult_tag
+{
+    vector<uint64_t> latencies;               // ns
+    size_t statusCounts[AUTH_STATUS_COUNT];
+    bool failed;                              // Connection lost or bad response
+    vector<string> sessionTokens;             // Token of every response, if kept
+    chrono::steady_clock::time_point start;
+    chrono::steady_clock::time_point end;
+}phaseResult_t;
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : UserName / UserPassword
+//
+// @description         : Name and password of a synthetic user of a connection.
+//-------------------------------------------------------------------------------------------------------------
+string UserName(unsigned connection, unsigned index)
+{
+    return "load" + to_string(connection) + "_" + to_string(index);
+}
+
+string UserPassword(unsigned connection, unsigned index)
+{
+    return "Secret#" + to_string(connection) + "_" + to_string(index);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : RunPhase
+//
+// @description         : Sends count requests on a connection, at most depth of them unanswered at a time.
+//                        Requests are answered in order, so the send times are kept in a FIFO.
+//
+// @param makeRequest   : Fills the request of the given no.
+// @param keepSessionTokens : Keep the session token of every response in result.sessionTokens
+//
+// @returns             : Nothing, result.failed is set on errors.
+//-------------------------------------------------------------------------------------------------------------
+template<typename requestMaker_t>
+void RunPhase(int fd, const loadConfig_t & config, unsigned count, requestMaker_t makeRequest, phaseResult_t & result,
+              bool keepSessionTokens = false)
+{
+    typedef chrono::steady_clock steadyClock_t;
+    deque<steadyClock_t::time_point> sendTimes;
+    authRequest_t request;
+    string out;
+    string in(LOADGEN_READ_SIZE, '\0');
+    size_t inStart = 0;
+    size_t inEnd = 0;
+    unsigned sent = 0;
+    unsigned received = 0;
+    string sessionToken;
+
+    result.start = steadyClock_t::now();
+    while (received < count)
+    {
+        out.clear();
+        while (sent < count && sent - received < config.depth)
+        {
+            makeRequest(sent, request);
+            if (!EncodeAuthRequest(out, request))
+            {
+                result.failed = true;
+                return;
+            }
+            sendTimes.push_back(steadyClock_t::now());
+            sent++;
+        }
+
+        for (size_t offset = 0; offset < out.size();)
+        {
+            ssize_t len = send(fd, out.data() + offset, out.size() - offset, MSG_NOSIGNAL);
+            if (len <= 0)
+            {
+                result.failed = true;
+                return;
+            }
+            offset += (size_t)len;
+        }
+
+        if (inStart == inEnd)
+        {
+            inStart = 0;
+            inEnd = 0;
+        }
+        ssize_t len = recv(fd, &in[inEnd], in.size() - inEnd, 0);
+        if (len <= 0)
+        {
+            result.failed = true;
+            return;
+        }
+        inEnd += (size_t)len;
+
+        uint32_t payloadLen = 0;
+        while (PeekAuthFrame(in.data() + inStart, inEnd - inStart, payloadLen) &&
+               inEnd - inStart >= AUTH_FRAME_HEADER_SIZE + payloadLen)
+        {
+            authStatus_t status;
+            if (!DecodeAuthResponse(in.data() + inStart + AUTH_FRAME_HEADER_SIZE, payloadLen, status, sessionToken) ||
+                status >= AUTH_STATUS_COUNT)
+            {
+                result.failed = true;
+                return;
+            }
+            if (keepSessionTokens)
+            {
+                result.sessionTokens.push_back(sessionToken);
+            }
+
+            result.end = steadyClock_t::now();
+            result.latencies.push_back(chrono::duration_cast<chrono::nanoseconds>(result.end - sendTimes.front()).count());
+            sendTimes.pop_front();
+            result.statusCounts[status]++;
+            received++;
+            inStart += AUTH_FRAME_HEADER_SIZE + payloadLen;
+        }
+
+        if (inStart > 0 && inStart < inEnd)
+        {
+            memmove(&in[0], in.data() + inStart, inEnd - inStart);
+            inEnd -= inStart;
+            inStart = 0;
+        }
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : RunConnection
+//
+// @description         : One client connection: registers its users, then logs them in round robin. With
+//                        sessions, each user logs in once and its session is validated round robin.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void RunConnection(const loadConfig_t & config, unsigned connection, phaseResult_t & registerResult,
+                   phaseResult_t & sessionResult, phaseResult_t & loginResult)
+{
+    int fd = ConnectAuthEndpoint(config.endpoint);
+    if (fd < 0)
+    {
+        registerResult.failed = true;
+        return;
+    }
+
+    RunPhase(fd, config, config.users, [&](unsigned i, authRequest_t & request)
+    {
+        request.op = AUTH_OP_REGISTER;
+        request.userName = UserName(connection, i);
+        request.password = UserPassword(connection, i);
+    }, registerResult);
+
+    if (!registerResult.failed && config.useSessions)
+    {
+        RunPhase(fd, config, config.users, [&](unsigned i, authRequest_t & request)
+        {
+            request.op = AUTH_OP_LOGIN_SESSION;
+            request.userName = UserName(connection, i);
+            request.password = UserPassword(connection, i);
+        }, sessionResult, true);
+
+        if (!sessionResult.failed)
+        {
+            RunPhase(fd, config, config.requests, [&](unsigned i, authRequest_t & request)
+            {
+                request.op = AUTH_OP_VALIDATE_SESSION;
+                request.userName = UserName(connection, i % config.users);
+                request.password = sessionResult.sessionTokens[i % config.users];
+            }, loginResult);
+        }
+    }
+    else if (!registerResult.failed)
+    {
+        RunPhase(fd, config, config.requests, [&](unsigned i, authRequest_t & request)
+        {
+            request.op = AUTH_OP_LOGIN;
+            request.userName = UserName(connection, i % config.users);
+            request.password = UserPassword(connection, i % config.users);
+        }, loginResult);
+    }
+
+    close(fd);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Report
+//
+// @description         : Prints throughput, latency percentiles and response counts of a phase.
+//
+// @returns             : False if any connection failed.
+//-------------------------------------------------------------------------------------------------------------
+bool Report(const char *phase, vector<phaseResult_t> & results)
+{
+    vector<uint64_t> latencies;
+    size_t statusCounts[AUTH_STATUS_COUNT] = {};
+    bool failed = false;
+    chrono::steady_clock::time_point start = chrono::steady_clock::time_point::max();
+    chrono::steady_clock::time_point end = chrono::steady_clock::time_point::min();
+    for (phaseResult_t & result : results)
+    {
+        if (!result.latencies.empty())
+        {
+            start = min(start, result.start);
+            end = max(end, result.end);
+        }
+        latencies.insert(latencies.end(), result.latencies.begin(), result.latencies.end());
+        for (unsigned status = 0; status < AUTH_STATUS_COUNT; status++)
+        {
+            statusCounts[status] += result.statusCounts[status];
+        }
+        failed = failed || result.failed;
+    }
+
+    if (latencies.empty())
+    {
+        printf("%-10s no responses\n", phase);
+        return false;
+    }
+
+    double seconds = chrono::duration<double>(end - start).count();
+    sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p)
+    {
+        size_t index = (size_t)(p * latencies.size());
+        return latencies[min(index, latencies.size() - 1)] / 1000.0;
+    };
+
+    printf("%-10s %9zu %12.0f %10.2f %10.2f %10.2f   ok %zu, bad credentials %zu, expired %zu, rejected %zu, "
+           "bad request %zu, locked %zu, busy %zu\n", phase, latencies.size(), latencies.size() / seconds, percentile(0.50),
+           percentile(0.99), percentile(0.999), statusCounts[AUTH_STATUS_OK], statusCounts[AUTH_STATUS_BAD_CREDENTIALS],
+           statusCounts[AUTH_STATUS_PASSWORD_EXPIRED], statusCounts[AUTH_STATUS_REJECTED],
+           statusCounts[AUTH_STATUS_BAD_REQUEST], statusCounts[AUTH_STATUS_LOCKED],
+           statusCounts[AUTH_STATUS_BUSY]);
+    if (failed)
+    {
+        printf("%-10s some connections failed: %s\n", phase, strerror(errno));
+    }
+
+    return !failed;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// M A I N
+//-------------------------------------------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+    loadConfig_t config;
+    config.endpoint.host = "127.0.0.1";
+    config.endpoint.port = AUTH_DEFAULT_PORT;
+    config.connections = DEFAULT_CONNECTIONS;
+    config.depth = DEFAULT_PIPELINE_DEPTH;
+    config.requests = DEFAULT_REQUESTS_PER_CONNECTION;
+    config.users = DEFAULT_USERS_PER_CONNECTION;
+    config.useSessions = false;
+
+    bool validArgs = (argc % 2) == 1;
+    for (int i = 1; validArgs && i + 1 < argc; i += 2)
+    {
+        unsigned value = (unsigned)strtoul(argv[i + 1], nullptr, 10);
+        if (strcmp(argv[i], "-c") == 0)
+        {
+            config.connections = value;
+        }
+        else if (strcmp(argv[i], "-d") == 0)
+        {
+            config.depth = value;
+        }
+        else if (strcmp(argv[i], "-n") == 0)
+        {
+            config.requests = value;
+        }
+        else if (strcmp(argv[i], "-u") == 0)
+        {
+            config.users = value;
+        }
+        else if (strcmp(argv[i], "-t") == 0)
+        {
+            config.useSessions = (value != 0);
+            value = 1;
+        }
+        else
+        {
+            validArgs = ParseAuthEndpoint(argv[i], argv[i + 1], config.endpoint);
+            value = 1;
+        }
+        validArgs = validArgs && (value > 0);
+    }
+
+    if (!validArgs)
+    {
+        printf("Usage: %s [-a address] [-p port] [-s unix socket path] [-c connections] [-d pipeline depth] "
+               "[-n requests per connection] [-u users per connection] [-t 1]\n", argv[0]);
+        return 1;
+    }
+
+    printf("Connections: %u, pipeline depth: %u, latencies in us\n", config.connections, config.depth);
+    printf("%-10s %9s %12s %10s %10s %10s\n", "phase", "requests", "req/s", "p50", "p99", "p99.9");
+
+    vector<phaseResult_t> registerResults(config.connections);
+    vector<phaseResult_t> sessionResults(config.connections);
+    vector<phaseResult_t> loginResults(config.connections);
+    for (unsigned i = 0; i < config.connections; i++)
+    {
+        registerResults[i] = phaseResult_t();
+        sessionResults[i] = phaseResult_t();
+        loginResults[i] = phaseResult_t();
+    }
+
+    vector<thread> clients;
+    for (unsigned i = 0; i < config.connections; i++)
+    {
+        clients.emplace_back(RunConnection, cref(config), i, ref(registerResults[i]), ref(sessionResults[i]),
+                             ref(loginResults[i]));
+    }
+    for (thread & client : clients)
+    {
+        client.join();
+    }
+
+    bool isOk = Report("register", registerResults);
+    if (config.useSessions)
+    {
+        isOk = Report("session", sessionResults) && isOk;
+        isOk = Report("validate", loginResults) && isOk;
+    }
+    else
+    {
+        isOk = Report("login", loginResults) && isOk;
+    }
+    return isOk ? 0 : 1;
+}
@@ -1,15 +1,302 @@
 #include "auth_module.h"
+#include "logger.h"
+#include "users_db_format.h"
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//-------------------------------------------------------------------------------------------------------------
+// Globals
+//-------------------------------------------------------------------------------------------------------------
+const string JOURNAL_COMPACTING_SUFFIX = ".compacting";
+const string SNAPSHOT_TEMP_SUFFIX = ".tmp";
+const uint8_t JOURNAL_OP_UPSERT_USER_V1 = 1;
+const uint8_t JOURNAL_OP_UPSERT_USER = 2;
+const uint8_t JOURNAL_OP_START = 3;
+const uint32_t JOURNAL_RECORD_MAX_LEN = 1 << 20;
+const size_t JOURNAL_FRAME_HEADER_LEN = 8;
+
+//-------------------------------------------------------------------------------------------------------------
+// Structs
+//-------------------------------------------------------------------------------------------------------------
+// Passwords of a RegisterBatch() being hashed, shared with the pool's workers: a worker may only start after
+// the batch has returned, it then finds no entry left and leaves
+typedef struct batchHashing_tag
+{
+    atomic<size_t> nextEntry;                 // Next entry to be taken
+    size_t entryCount;
+    unsigned activeWorkers;                   // Workers taking entries, under lock
+    mutex lock;
+    condition_variable idle;                  // Signaled when activeWorkers drops to 0
+}batchHashing_t;
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : IsSameAuthPolicy
+//
+// @description         : Compares two auth policies field by field.
+//
+// @returns             : True if they are the same.
+//-------------------------------------------------------------------------------------------------------------
+static bool IsSameAuthPolicy(const authPolicy_t & a, const authPolicy_t & b)
+{
+    return (a.passwordHistoryMax == b.passwordHistoryMax &&
+            a.passwordLenMax == b.passwordLenMax &&
+            a.passwordLenMin == b.passwordLenMin &&
+            a.useStrongPasswords == b.useStrongPasswords &&
+            a.passwordExpiryDays == b.passwordExpiryDays);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetPasswordRules
+//
+// @description         : Rules new passwords are checked against under an auth policy. Strong passwords are
+//                        bounded in length and need a lowercase and an uppercase letter, a digit and a special
+//                        character, without control characters; otherwise any password is accepted.
+//-------------------------------------------------------------------------------------------------------------
+static passwordRules_t GetPasswordRules(const authPolicy_t & authPolicy)
+{
+    passwordRules_t rules = { 0, UINT_MAX, 0, 0 };
+    if (authPolicy.useStrongPasswords)
+    {
+        rules.lenMin = authPolicy.passwordLenMin;
+        rules.lenMax = authPolicy.passwordLenMax;
+        rules.requiredClasses = STRONG_PASSWORD_REQUIRED_CLASSES;
+        rules.forbiddenClasses = STRONG_PASSWORD_FORBIDDEN_CLASSES;
+    }
+    return rules;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : WriteAll
+//
+// @description         : Writes all of data to a file descriptor, continuing after partial writes and
+//                        interruptions.
+//
+// @returns             : True if everything was written.
+//-------------------------------------------------------------------------------------------------------------
+static bool WriteAll(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t written = write(fd, data, len);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+
+        data += written;
+        len -= (size_t)written;
+    }
+
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : ReadFile
+//
+// @description         : Reads a whole file.
+//
+// @returns             : True if the file was found.
+//-------------------------------------------------------------------------------------------------------------
+static bool ReadFile(const string & path, string & data)
+{
+    ifstream in(path, ios::in | ios::binary | ios::ate);
+    if (!in)
+    {
+        return false;
+    }
+
+    data.resize((size_t)in.tellg());
+    return in.seekg(0) && (data.empty() || in.read(&data[0], data.size()));
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : PutJournalFrame
+//
+// @description         : Appends a journal frame: the payload length, the checksum of the payload and the
+//                        payload itself.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+static void PutJournalFrame(string & frames, const string & payload)
+{
+    PutU32(frames, (uint32_t)payload.size());
+    PutU32(frames, Checksum32(payload.data(), payload.size()));
+    frames.append(payload);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : PeekJournalStart
+//
+// @description         : Reads the start frame at the beginning of a journal.
+//
+// @returns             : False if the journal does not begin with one.
+//-------------------------------------------------------------------------------------------------------------
+static bool PeekJournalStart(const string & frames, uint64_t & journalId, uint64_t & previousId)
+{
+    recordReader_t headerReader = { frames.data(), frames.size(), 0 };
+    uint32_t len = 0;
+    uint32_t checksum = 0;
+    if (!GetU32(headerReader, len) || !GetU32(headerReader, checksum) || len > frames.size() - headerReader.pos ||
+        Checksum32(frames.data() + headerReader.pos, len) != checksum)
+    {
+        return false;
+    }
+
+    recordReader_t reader = { frames.data() + headerReader.pos, len, 0 };
+    uint8_t op = 0;
+    return GetU8(reader, op) && op == JOURNAL_OP_START && GetU64(reader, journalId) && GetU64(reader, previousId);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetChunkCount
+//
+// @description         : No. of chunks a pass over count snapshot users is split into, one per worker but
+//                        none smaller than LOAD_CHUNK_MIN_USERS.
+//
+// @param workers       : Threads to use, 0 for one per core
+//
+// @returns             : No. of chunks, at least 1
+//-------------------------------------------------------------------------------------------------------------
+static unsigned GetChunkCount(uint64_t count, unsigned workers)
+{
+    if (workers == 0)
+    {
+        workers = max(thread::hardware_concurrency(), 1u);
+    }
+
+    uint64_t chunks = min((uint64_t)workers, count / LOAD_CHUNK_MIN_USERS);
+    return (chunks > 1) ? (unsigned)chunks : 1;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : RunChunks
+//
+// @description         : Splits [0, count) into chunks contiguous ranges and runs work on each of them, all
+//                        at once on their own threads. Returns once every chunk is done, so the results can
+//                        be merged in chunk order independent of the timing of the threads.
+//
+// @param work          : Called with the chunk no. and its range
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+static void RunChunks(uint64_t count, unsigned chunks, const function<void(unsigned, uint64_t, uint64_t)> & work)
+{
+    vector<thread> threads;
+    for (unsigned chunk = 1; chunk < chunks; chunk++)
+    {
+        threads.emplace_back(work, chunk, count * chunk / chunks, count * (chunk + 1) / chunks);
+    }
+
+    work(0, 0, count / chunks);
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+        threads[i].join();
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : SyncParentDirectory
+//
+// @description         : Syncs the directory holding path, which makes a rename into it durable.
+//
+// @returns             : True if the directory was synced.
+//-------------------------------------------------------------------------------------------------------------
+static bool SyncParentDirectory(const string & path)
+{
+    size_t slash = path.rfind('/');
+    string directory = (slash == string::npos) ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+    int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    bool isSynced = (fsync(fd) == 0);
+    close(fd);
+    return isSynced;
+}
 
 //-------------------------------------------------------------------------------------------------------------
 // @name                : AuthModule
 //
 // @description         : Constructor
 //-------------------------------------------------------------------------------------------------------------
-AuthModule::AuthModule(authPolicy_t authPolicy)
+AuthModule::AuthModule(authPolicy_t authPolicy, authModuleConfig_t config)
+    : m_passwordValidator(GetPasswordRules(authPolicy))
 {
     m_authPolicy = authPolicy;
-    m_usersDataFile = USERS_DATA_FILENAME;
+    m_config = config;
+    // One entry of the history is the current password. A longer history than a record can hold is not
+    // shortened: no password is accepted under such a policy.
+    m_isPolicyValid = IsPolicyValid(authPolicy);
+    if (!m_isPolicyValid)
+    {
+        LOG_ERROR("Invalid auth policy, a history of at most %u passwords is supported", PASSWORD_HISTORY_MAX + 1);
+    }
+    m_historyCapacity = (m_isPolicyValid && authPolicy.passwordHistoryMax > 1) ? authPolicy.passwordHistoryMax - 1 : 0;
+
+    // Records get room for as much history as the policy asks for, once they have any
+    m_shardCount = (config.shardCount > 0) ? config.shardCount : 1;
+    m_shards = new userShard_t[m_shardCount];
+    for (unsigned i = 0; i < m_shardCount; i++)
+    {
+        m_shards[i].usersTable.SetMetrics(&m_metrics);
+        m_shards[i].usersTable.SetHistoryCapacity(m_historyCapacity);
+        m_shards[i].frozenSize = 0;
+        if (config.residentUsersMax > 0)
+        {
+            m_shards[i].userCache.SetCapacity(max(config.residentUsersMax / m_shardCount, (size_t)1), m_historyCapacity);
+        }
+    }
+
+    string directory = config.dataDirectory.empty() ? "" : config.dataDirectory + "/";
+    m_usersDataFile = directory + USERS_DATA_FILENAME;
+    m_journalFile = directory + USERS_JOURNAL_FILENAME;
+    m_filterFile = m_usersDataFile + NEGATIVE_FILTER_SUFFIX;
     m_isUsersDataLoaded = false;
+    m_journalFd = -1;
+    m_journalRecords = 0;
+    m_journalWrites = 0;
+    m_journalId = 0;
+    m_previousJournalId = 0;
+    m_isSyncRunning = false;
+    m_journalSynced = 0;
+    m_syncFailedFrom = ~0ull;
+    m_syncFailedTo = 0;
+    m_snapshotChanges = 0;
+    m_snapshotWritten = 0;
+    m_isCompactionRunning = false;
+    m_snapshotData = nullptr;
+    m_snapshotSize = 0;
+    m_snapshotUsers = 0;
+    m_snapshotIndexOffset = 0;
+    m_snapshotPending = 0;
+    m_snapshotVersion = USERS_DB_VERSION;
+    m_snapshotPolicy = m_authPolicy;
+
+    m_ownsPasswordHasher = (config.passwordHasher == nullptr);
+    m_passwordHasher = m_ownsPasswordHasher ? new Pbkdf2PasswordHasher(config.hashIterations) : config.passwordHasher;
+    m_ownsLoginPool = (config.loginPool == nullptr);
+    m_loginPool = config.loginPool;
+    m_queuedLogins = 0;
+    m_clock = &CoarseClock::GetInstance();
+    m_negativeFilter = nullptr;
+    m_loginThrottle = nullptr;
+    if (config.useLoginThrottle)
+    {
+        m_loginThrottle = new LoginThrottle(config.throttlePolicy);
+        m_loginThrottle->SetMetrics(&m_metrics);
+    }
+    m_sessions = new SessionTokens(config.sessionKey, config.sessionLifetimeSeconds);
+    m_replicaSource = config.replicaSource.empty() ? m_journalFile : config.replicaSource;
+    m_replicaFd = -1;
+    m_replicaInode = 0;
+    m_isReplicaStopping = false;
 }
 
 //-------------------------------------------------------------------------------------------------------------
@@ -19,14 +306,167 @@ AuthModule::AuthModule(authPolicy_t authPolicy)
 //-------------------------------------------------------------------------------------------------------------
 AuthModule::~AuthModule()
 {
-    // Free memory of users' data map
-    for (auto it = m_usersDataMap.begin(); it != m_usersDataMap.end(); it++)
+    // Stop following the primary before what it applies to goes away
+    if (m_replicaThread.joinable())
+    {
+        {
+            lock_guard<mutex> replicaLock(m_replicaLock);
+            m_isReplicaStopping = true;
+        }
+        m_replicaCond.notify_all();
+        m_replicaThread.join();
+    }
+
+    if (m_replicaFd >= 0)
+    {
+        close(m_replicaFd);
+    }
+
+    // Finish the queued asynchronous logins while the users are still around
+    if (m_ownsLoginPool)
+    {
+        delete m_loginPool;
+    }
+    else
+    {
+        while (m_queuedLogins > 0)
+        {
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+    }
+
+    // Let an in-flight compaction finish writing the snapshot
+    if (m_compactionThread.joinable())
+    {
+        m_compactionThread.join();
+    }
+
+    if (m_journalFd >= 0)
+    {
+        close(m_journalFd);
+    }
+
+    UnmapUsersDataFile();
+
+    // Records are freed along with the arenas of the users' tables, without visiting them
+    delete[] m_shards;
+
+    delete m_loginThrottle;
+    delete m_sessions;
+    delete m_negativeFilter.load();
+    for (size_t i = 0; i < m_retiredFilters.size(); i++)
+    {
+        delete m_retiredFilters[i];
+    }
+
+    if (m_ownsPasswordHasher)
+    {
+        delete m_passwordHasher;
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetDefaultAuthModuleConfig
+//
+// @description         : Configuration used when none is given to the constructor. Keeps the original
+//                        behaviour of rewriting the users database file on every mutation.
+//
+// @returns             : Default module configuration
+//-------------------------------------------------------------------------------------------------------------
+authModuleConfig_t AuthModule::GetDefaultAuthModuleConfig()
+{
+    authModuleConfig_t config;
+    config.storageMode = STORAGE_MODE_SNAPSHOT;
+    config.compactionThreshold = DEFAULT_COMPACTION_THRESHOLD;
+    config.shardCount = DEFAULT_SHARD_COUNT;
+    config.passwordHasher = nullptr;
+    config.hashIterations = DEFAULT_PBKDF2_ITERATIONS;
+    config.loginPool = nullptr;
+    config.loginWorkers = 0;
+    config.loginQueueCapacity = DEFAULT_LOGIN_QUEUE_CAPACITY;
+    config.useNegativeLookupFilter = false;
+    config.useLoginThrottle = false;
+    config.throttlePolicy = LoginThrottle::GetDefaultPolicy();
+    config.sessionLifetimeSeconds = DEFAULT_SESSION_LIFETIME;
+    config.durability = DURABILITY_FLUSH;
+    config.loadWorkers = 0;
+    config.residentUsersMax = 0;
+    config.groupCommitMicros = DEFAULT_GROUP_COMMIT_MICROS;
+    config.replicaPollMillis = DEFAULT_REPLICA_POLL_MILLIS;
+    return config;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : HashUserName
+//
+// @description         : Hash of a username. Selects both the shard and the slot within the shard's table.
+//
+// @returns             : Hash of userName
+//-------------------------------------------------------------------------------------------------------------
+size_t AuthModule::HashUserName(string_view userName)
+{
+    hash<string_view> str_hash;
+    return str_hash(userName);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetShardIndex
+//
+// @description         : Selects the shard of the users' table which holds the given username.
+//
+// @returns             : Index of the shard owning userName
+//-------------------------------------------------------------------------------------------------------------
+unsigned AuthModule::GetShardIndex(string_view userName)
+{
+    return (unsigned)(HashUserName(userName) % m_shardCount);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetShard
+//
+// @description         : Shard of the users' table which holds the given username.
+//
+// @returns             : Shard owning userName
+//-------------------------------------------------------------------------------------------------------------
+userShard_t & AuthModule::GetShard(string_view userName)
+{
+    return m_shards[GetShardIndex(userName)];
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : LockAllShards
+//
+// @description         : Takes every shard lock in shared mode, always in shard order. Used when a consistent
+//                        view of all users is needed. Writers take only their own shard's lock followed by the
+//                        persist lock, so this order can not deadlock with them.
+//
+// @param locks         : Receives the held locks, released when it goes out of scope
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void AuthModule::LockAllShards(vector<shared_lock<shared_mutex>> & locks)
+{
+    locks.reserve(m_shardCount);
+    for (unsigned i = 0; i < m_shardCount; i++)
     {
-        printf("Freeing data for [%s]\n", it->first.c_str());
-        delete it->second;
+        locks.emplace_back(m_shards[i].lock);
     }
 }
 
+//-------------------------------------------------------------------------------------------------------------
+// @name                : IsPolicyValid
+//
+// @description         : Checks that an auth policy can be enforced: its password lengths form a range and
+//                        its history, less the current password, fits in a record.
+//
+// @returns             : True if the policy is valid.
+//-------------------------------------------------------------------------------------------------------------
+bool AuthModule::IsPolicyValid(const authPolicy_t & authPolicy)
+{
+    return (authPolicy.passwordLenMin <= authPolicy.passwordLenMax &&
+            authPolicy.passwordHistoryMax <= PASSWORD_HISTORY_MAX + 1);
+}
+
 //-------------------------------------------------------------------------------------------------------------
 // @name                : Initialize
 //
@@ -39,11 +479,11 @@ void AuthModule::Initialize()
     bool retval = LoadUsersDataFile();
     if (retval)
     {
-        printf("** Found %ld registered users\n", GetRegisteredUsers());
+        LOG_INFO("Found %zu registered users", GetRegisteredUsers());
     }
     else
     {
-        printf("** No records found in %s!\n", m_usersDataFile.c_str());
+        LOG_INFO("No records found in %s!", m_usersDataFile);
     }
 }
 
@@ -53,311 +493,2766 @@ void AuthModule::Initialize()
 // @description         : This function writes the updated user records in the users database file. Besides
 //                        users' informaiton it also writes down the details of Authentication Policy.
 //                        This is required to make sure that the policy change does not cause inconsistency in the 
-//                        users DB file. This function is called at the end by AddNewUser() and 
-//                        UpdateUserPassword() functions to reflect the changes in the file.
-//                         
+//                        users DB file. In snapshot storage mode this function is called at the end by
+//                        AddNewUser() and UpdateUserPassword() functions to reflect the changes in the file.
+//                        The users are frozen under all shard locks, which takes no longer than counting them;
+//                        logins and further changes go on while the frozen users are serialized and written.
+//                        Concurrent calls are coalesced: a call whose change is already in a file written
+//                        meanwhile by another call returns without writing the file again.
 //
 // @returns             : True if users database file was updated successfully.
 //                        False otherwise.
 //-------------------------------------------------------------------------------------------------------------
 bool AuthModule::UpdateUsersDataFile()
 {
-    m_fileStream.open(m_usersDataFile, ios::out);
-    if (!m_fileStream)
+    if (m_config.storageMode == STORAGE_MODE_REPLICA)
+    {
+        LOG_ERROR("Replica does not write [ %s ]", m_usersDataFile);
+        return false;
+    }
+
+    // Changes are applied before they are counted, so all counted ones are in what is frozen below.
+    // Callers wait for their turn without any shard lock, letting further changes in meanwhile.
+    uint64_t change = ++m_snapshotChanges;
+    lock_guard<mutex> writerLock(m_snapshotWriterLock);
+    if (m_snapshotWritten >= change)
+    {
+        m_metrics.Count(METRIC_SNAPSHOTS_COALESCED);
+        return true;
+    }
+
+    // A compaction still writing its snapshot has the users frozen
+    lock_guard<mutex> freezeLock(m_freezeLock);
+    if (m_compactionThread.joinable())
+    {
+        m_compactionThread.join();
+    }
+
+    uint64_t written = 0;
+    {
+        vector<shared_lock<shared_mutex>> shardLocks;
+        LockAllShards(shardLocks);
+        written = m_snapshotChanges;
+        FreezeUsers();
+    }
+
+    if (!WriteUsersDataFile())
+    {
+        return false;
+    }
+
+    m_snapshotWritten = written;
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : WriteUsersDataFile
+//
+// @description         : Writes the users database file from the frozen users, see FreezeUsers(). The new
+//                        contents are written to a temporary file which is renamed over the users database
+//                        file, so the mapping of the previous file stays valid. Caller must hold the freeze
+//                        lock and no shard lock.
+//
+// @returns             : True if users database file was written successfully.
+//-------------------------------------------------------------------------------------------------------------
+bool AuthModule::WriteUsersDataFile()
+{
+    MetricsTimer timer(m_metrics, METRIC_OP_SNAPSHOT_WRITE);
+    string snapshot;
+    SerializeUsersData(snapshot);
+    if (!ReplaceFile(m_usersDataFile, snapshot, true))
     {
-        printf("File [ %s ] NOT found!\n", m_usersDataFile.c_str());
         return false;
     }
 
-    // Write auth policy to file. This is required to make sure
-    // that the policy change does not cause inconsistency in the 
-    // users DB file.
-    m_fileStream << m_authPolicy.passwordHistoryMax << endl;
-    m_fileStream << m_authPolicy.passwordLenMax << endl;
-    m_fileStream << m_authPolicy.passwordLenMin << endl;
-    m_fileStream << m_authPolicy.useStrongPasswords << endl;
-    m_fileStream << m_authPolicy.passwordExpiryDays << endl;
+    string filterData;
+    SerializeNegativeFilter(filterData, snapshot);
+    if (!filterData.empty())
+    {
+        WriteNegativeFilterFile(filterData);
+    }
+
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : FreezeUsers
+//
+// @description         : Takes a point in time view of the users for SerializeUsersData() without copying
+//                        any record: the no. of records of each shard, and which snapshot users are in the
+//                        tables. Records added later are left out of the view, and a record changed in place
+//                        keeps its state as of now in its shard's frozenRecords, see PreserveFrozenRecord().
+//                        Caller must hold the freeze lock and all shard locks.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void AuthModule::FreezeUsers()
+{
+    for (unsigned i = 0; i < m_shardCount; i++)
+    {
+        m_shards[i].frozenSize = m_shards[i].usersTable.Size();
+    }
+
+    if (m_snapshotPending > 0)
+    {
+        m_frozenResident = m_snapshotResident;
+    }
+}
 
-    // Write down the number of users
-    m_fileStream << m_usersDataMap.size() << endl;
+//-------------------------------------------------------------------------------------------------------------
+// @name                : PreserveFrozenRecord
+//
+// @description         : Keeps the state of a record in the frozen view before it is changed in place, as
+//                        its encoding: the history block is changed in place as well. Only the first change
+//                        after freezing is preserved, that is the state of the view. Caller must hold the
+//                        exclusive lock of the shard.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void AuthModule::PreserveFrozenRecord(userShard_t & shard, const userData_t *userData)
+{
+    if (shard.frozenSize > 0)
+    {
+        auto inserted = shard.frozenRecords.emplace(userData, string());
+        if (inserted.second)
+        {
+            EncodeUserRecord(inserted.first->second, *userData);
+        }
+    }
+}
 
-    // Write the actual user details
-    for (auto it = m_usersDataMap.begin(); it != m_usersDataMap.end(); it++)
+//-------------------------------------------------------------------------------------------------------------
+// @name                : SerializeUsersData
+//
+// @description         : Builds the binary users database for the frozen view of the users, and thaws them.
+//                        The frozen records are encoded a shard at a time, FROZEN_CHUNK_RECORDS per shared
+//                        lock of the shard, so changes of the shard wait for one chunk at most. A shard is
+//                        thawed once its records are encoded. Users which were never materialized from the mapped
+//                        snapshot are unchanged, so their encoded records are copied from the mapping as is.
+//                        Caller must hold the freeze lock and no shard lock.
+//
+// @param out           : Buffer in which the users database is built
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void AuthModule::SerializeUsersData(string & out)
+{
+    size_t frozenUsers = 0;
+    for (unsigned i = 0; i < m_shardCount; i++)
     {
-        userData_t *userData = it->second;
-        m_fileStream << userData->lastPasswordChangeTimestamp << endl;
-        m_fileStream << userData->name << endl;
-        m_fileStream << userData->password << endl;
-        m_fileStream << userData->passwordHash << endl;
+        frozenUsers += m_shards[i].frozenSize;
+    }
 
-        // Previous passwords record
-        auto pwdIt = userData->prevPasswords.begin();
-        for (unsigned i = 0; i < m_authPolicy.passwordHistoryMax - 1; i++)
+    string records;
+    vector<size_t> recordEnds;
+    recordEnds.reserve(frozenUsers);
+    for (unsigned i = 0; i < m_shardCount; i++)
+    {
+        userShard_t & shard = m_shards[i];
+        for (size_t begin = 0; begin < shard.frozenSize; begin += FROZEN_CHUNK_RECORDS)
         {
-            if (pwdIt != userData->prevPasswords.end())
+            shared_lock<shared_mutex> shardLock(shard.lock);
+            for (size_t j = begin; j < min(begin + FROZEN_CHUNK_RECORDS, shard.frozenSize); j++)
             {
-                m_fileStream << *pwdIt << " ";
-                pwdIt++;
-            }
-            else
-            {
-                m_fileStream << NO_PASSWORD_IDENTIFIER <<" ";
+                const userData_t *userData = shard.usersTable.GetRecord(j);
+                auto it = shard.frozenRecords.find(userData);
+                if (it == shard.frozenRecords.end())
+                {
+                    EncodeUserRecord(records, *userData);
+                }
+                else
+                {
+                    records += it->second;
+                }
+                recordEnds.push_back(records.size());
             }
-            
         }
-        m_fileStream << endl;
 
+        unique_lock<shared_mutex> shardLock(shard.lock);
+        shard.frozenSize = 0;
+        unordered_map<const userData_t*, string>().swap(shard.frozenRecords);
+    }
+
+    vector<usersDbEntry_t> entries;
+    entries.reserve(recordEnds.size() + m_frozenResident.size());
+    for (size_t i = 0; i < recordEnds.size(); i++)
+    {
+        size_t begin = (i > 0) ? recordEnds[i - 1] : 0;
+        usersDbEntry_t entry;
+        entry.userData = nullptr;
+        entry.rawRecord = records.data() + begin;
+        entry.rawLen = (uint32_t)(recordEnds[i] - begin);
+        PeekRecordName(entry.rawRecord, entry.rawLen, entry.name, entry.nameLen);
+        entries.push_back(entry);
+    }
+
+    for (uint64_t i = 0; i < m_frozenResident.size(); i++)
+    {
+        uint64_t offset = 0;
+        usersDbEntry_t entry;
+        if (m_frozenResident[i] ||
+            !ReadUsersDbIndexEntry(m_snapshotData, m_snapshotSize, m_snapshotIndexOffset, i, offset, entry.rawLen) ||
+            !PeekRecordName(m_snapshotData + offset, entry.rawLen, entry.name, entry.nameLen))
+        {
+            continue;
+        }
+
+        entry.userData = nullptr;
+        entry.rawRecord = m_snapshotData + offset;
+        entries.push_back(entry);
+    }
+    vector<uint8_t>().swap(m_frozenResident);
+
+    WriteUsersDbSnapshot(out, m_authPolicy, entries);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : PersistUserData
+//
+// @description         : Persists a newly added or modified user record as per the configured storage mode.
+//                        In journal mode one record is appended to the journal while the shard lock is still
+//                        held, so records of a user reach the journal in the order they were applied. A
+//                        compaction is started in background once the journal holds compactionThreshold
+//                        records, or once a sync of the journal failed. In snapshot mode the whole users
+//                        database file is rewritten. Both of these
+//                        need all shards, so they run after the shard lock has been released, as does the
+//                        wait for the journal to be synced.
+//
+// @param userData      : Record that was added or modified
+// @param shardLock     : Exclusive lock of the record's shard, released by this function
+//
+// @returns             : True if the change was persisted successfully.
+//-------------------------------------------------------------------------------------------------------------
+bool AuthModule::PersistUserData(userData_t *userData, unique_lock<shared_mutex> & shardLock)
+{
+    if (m_config.storageMode != STORAGE_MODE_JOURNAL)
+    {
+        shardLock.unlock();
+        return UpdateUsersDataFile();
+    }
+
+    uint64_t syncPoint = 0;
+    bool retval = AppendJournalRecord(userData, syncPoint);
+    shardLock.unlock();
+    retval = retval && SyncJournal(syncPoint);
+
+    if (IsCompactionDue())
+    {
+        CompactJournal(true);
+    }
+
+    return retval;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : AppendJournalRecord
+//
+// @description         : Appends one framed record to the journal. Caller must hold the lock of the record's
+//                        shard.
+//
+// @param userData      : Record to be appended
+// @param syncPoint     : Receives what to pass to SyncJournal() to wait for the record to be on disk
+//
+// @returns             : True if the record was written.
+//-------------------------------------------------------------------------------------------------------------
+bool AuthModule::AppendJournalRecord(userData_t *userData, uint64_t & syncPoint)
+{
+    string frame;
+    EncodeJournalFrame(frame, userData);
+    return AppendJournalFrames(frame, 1, syncPoint);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : EncodeJournalFrame
+//
+// @description         : Appends the journal frame of a record to frames. A frame is the payload length, the
+//                        checksum of the payload and the payload itself. The payload holds the complete
+//                        state of the user so replaying a record is an idempotent upsert.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void AuthModule::EncodeJournalFrame(string & frames, userData_t *userData)
+{
+    string payload;
+    payload.push_back((char)JOURNAL_OP_UPSERT_USER);
+    EncodeUserRecord(payload, *userData);
+    PutJournalFrame(frames, payload);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : AppendJournalFrames
+//
+// @description         : Writes already encoded frames to the journal with a single write. The frames are
+//                        handed to the OS only, see SyncJournal(). A new journal is started with a frame
+//                        holding a random id for it and the id of the journal it follows, by which a replica
+//                        can tell whether it missed a journal.
+//
+// @param frames        : Encoded frames
+// @param records       : No. of records in frames
+// @param syncPoint     : Receives what to pass to SyncJournal() to wait for the frames to be on disk
+//
+// @returns             : True if the frames were written.
+//-------------------------------------------------------------------------------------------------------------
+bool AuthModule::AppendJournalFrames(const string & frames, unsigned records, uint64_t & syncPoint)
+{
+    lock_guard<mutex> persistLock(m_persistLock);
+    if (m_syncFailedFrom.load(memory_order_relaxed) != ~0ull)
+    {
+        LOG_ERROR("Journal [ %s ] failed to sync, appends are refused until it is compacted", m_journalFile);
+        return false;
+    }
+
+    if (m_journalFd < 0)
+    {
+        m_journalFd = open(m_journalFile.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (m_journalFd < 0)
+        {
+            LOG_ERROR("File [ %s ] could not be opened!", m_journalFile);
+            return false;
+        }
+    }
+
+    string start;
+    struct stat st;
+    if (fstat(m_journalFd, &st) == 0 && st.st_size == 0)
+    {
+        GenerateRandomBytes((uint8_t *)&m_journalId, sizeof(m_journalId));
+        string payload;
+        payload.push_back((char)JOURNAL_OP_START);
+        PutU64(payload, m_journalId);
+        PutU64(payload, m_previousJournalId);
+        PutJournalFrame(start, payload);
+        start.append(frames);
+    }
+
+    MetricsTimer timer(m_metrics, METRIC_OP_JOURNAL_APPEND);
+    const string & data = start.empty() ? frames : start;
+    bool isWritten = WriteAll(m_journalFd, data.data(), data.size());
+    m_metrics.Count(METRIC_FILE_WRITES);
+    m_metrics.Count(METRIC_FILE_WRITE_BYTES, data.size());
+    if (!isWritten)
+    {
+        LOG_ERROR("Failed to append to journal [ %s ]", m_journalFile);
+        close(m_journalFd);
+        m_journalFd = -1;
+        return false;
+    }
+
+    m_journalRecords += records;
+    syncPoint = ++m_journalWrites;
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : SyncJournal
+//
+// @description         : Waits, as per the configured durability, until journal appends up to syncPoint are
+//                        on disk. One waiting caller at a time leads a sync of everything appended so far,
+//                        the others wait for it and are done too if their appends were included, so a burst
+//                        of mutations costs one fdatasync(). With group durability the leader waits for
+//                        groupCommitMicros first to let more appends in. Once a sync failed, every sync of
+//                        an append after the failed ones fails too, see RecordSyncFailure(). Caller must not
+//                        hold any shard lock or the persist lock.
+//
+// @param syncPoint     : As returned by the append
+//
+// @returns             : True if the appends are durable as configured.
+//-------------------------------------------------------------------------------------------------------------
+bool AuthModule::SyncJournal(uint64_t syncPoint)
+{
+    if (m_config.durability == DURABILITY_FLUSH)
+    {
+        return true;
+    }
+
+    unique_lock<mutex> syncLock(m_syncLock);
+    m_metrics.Count(METRIC_JOURNAL_SYNC_WAITS);
+    while (m_journalSynced < syncPoint && syncPoint <= m_syncFailedFrom)
+    {
+        if (m_isSyncRunning)
+        {
+            m_syncCond.wait(syncLock);
+            continue;
+        }
+
+        m_isSyncRunning = true;
+        uint64_t syncedBefore = m_journalSynced;
+        syncLock.unlock();
+
+        if (m_config.durability == DURABILITY_GROUP && m_config.groupCommitMicros > 0)
+        {
+            this_thread::sleep_for(chrono::microseconds(m_config.groupCommitMicros));
+        }
+
+        // A duplicate stays valid if a compaction closes the journal meanwhile. Appends to a journal
+        // closed before this were synced by the compaction.
+        uint64_t target = 0;
+        int fd = -1;
+        {
+            lock_guard<mutex> persistLock(m_persistLock);
+            target = m_journalWrites;
+            fd = (m_journalFd >= 0) ? dup(m_journalFd) : -1;
+        }
+
+        bool isSynced = true;
+        if (fd >= 0)
+        {
+            MetricsTimer timer(m_metrics, METRIC_OP_FILE_SYNC);
+            isSynced = (fdatasync(fd) == 0);
+            close(fd);
+        }
+
+        if (!isSynced)
+        {
+            LOG_ERROR("Failed to sync journal [ %s ]", m_journalFile);
+            RecordSyncFailure(syncedBefore, target);
+        }
+
+        syncLock.lock();
+        m_journalSynced = max(m_journalSynced, target);
+        m_isSyncRunning = false;
+        m_syncCond.notify_all();
+    }
+
+    return (syncPoint <= m_syncFailedFrom);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : RecordSyncFailure
+//
+// @description         : Marks the appends after syncedBefore as not durable. The failure is sticky: a later
+//                        fdatasync() may succeed although the pages of the failed one were dropped, so every
+//                        later sync fails and appends are refused until a compaction has written all of the
+//                        users to a durable snapshot, see ClearSyncFailure(). Caller must not hold the sync
+//                        lock.
+//
+// @param syncedBefore  : Appends up to this one were synced before
+// @param target        : Last append the failed sync covered
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void AuthModule::RecordSyncFailure(uint64_t syncedBefore, uint64_t target)
+{
+    lock_guard<mutex> syncLock(m_syncLock);
+    m_syncFailedFrom = min(m_syncFailedFrom.load(memory_order_relaxed), syncedBefore);
+    m_syncFailedTo = max(m_syncFailedTo, target);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : ClearSyncFailure
+//
+// @description         : Called once a compaction's snapshot is durable. Failed syncs of appends included in
+//                        the snapshot no longer matter; one of an append made after the journal was set aside
+//                        keeps the journal failed from there on.
+//
+// @param compactedThrough : Last append of the journal the snapshot was compacted from
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void AuthModule::ClearSyncFailure(uint64_t compactedThrough)
+{
+    lock_guard<mutex> syncLock(m_syncLock);
+    if (m_syncFailedFrom.load(memory_order_relaxed) == ~0ull)
+    {
+        return;
+    }
+
+    if (m_syncFailedTo <= compactedThrough)
+    {
+        LOG_INFO("Journal [ %s ] compacted, appends resume", m_journalFile);
+        m_syncFailedFrom = ~0ull;
+        m_syncFailedTo = 0;
+    }
+    else
+    {
+        m_syncFailedFrom = max(m_syncFailedFrom.load(memory_order_relaxed), compactedThrough);
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : IsCompactionDue
+//
+// @description         : A background compaction is due once the journal holds compactionThreshold records,
+//                        or to recover from a failed sync.
+//
+// @returns             : True if one should be started.
+//-------------------------------------------------------------------------------------------------------------
+bool AuthModule::IsCompactionDue()
+{
+    return !m_isCompactionRunning &&
+           (m_journalRecords >= m_config.compactionThreshold || m_syncFailedFrom.load(memory_order_relaxed) != ~0ull);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : ReplaceFile
+//
+// @description         : Replaces the contents of a file atomically: data is written to a temporary file
+//                        which is then renamed over path, so a crash leaves either the old or the new file.
+//                        Unless the durability is DURABILITY_FLUSH, a durable replacement also syncs the
+//                        temporary file before and the directory after the rename.
+//
+// @param isDurable     : False for files which can be rebuilt and need not be synced
+//
+// @returns             : True if the file was replaced.
+//-------------------------------------------------------------------------------------------------------------
+bool AuthModule::ReplaceFile(const string & path, const string & data, bool isDurable)
+{
+    return ReplaceFile(path, data, isDurable && m_config.durability != DURABILITY_FLUSH, &m_metrics);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : ReplaceFile
+//
+// @description         : Replaces the contents of a file through a temporary file renamed over path. Also
+//                        used for files other than a module's, e.g. the tenant list of TenantRegistry.
+//
+// @param isSynced      : Syncs the temporary file before and the directory after the rename
+// @param metrics       : Records the write and the sync, may be NULL
+//
+// @returns             : True if the file was replaced.
+//-------------------------------------------------------------------------------------------------------------
+bool AuthModule::ReplaceFile(const string & path, const string & data, bool isSynced, AuthMetrics *metrics)
+{
+    string tempFile = path + SNAPSHOT_TEMP_SUFFIX;
+    int fd = open(tempFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        LOG_ERROR("File [ %s ] could not be created!", tempFile);
+        return false;
+    }
+
+    bool isWritten = WriteAll(fd, data.data(), data.size());
+    if (metrics != nullptr)
+    {
+        metrics->Count(METRIC_FILE_WRITES);
+        metrics->Count(METRIC_FILE_WRITE_BYTES, data.size());
+    }
+    if (isWritten && isSynced)
+    {
+        uint64_t startNs = AuthMetrics::Now();
+        isWritten = (fdatasync(fd) == 0);
+        if (metrics != nullptr)
+        {
+            metrics->RecordSince(METRIC_OP_FILE_SYNC, startNs);
+        }
+    }
+
+    if (close(fd) != 0 || !isWritten || rename(tempFile.c_str(), path.c_str()) != 0)
+    {
+        remove(tempFile.c_str());
+        return false;
+    }
+
+    if (isSynced && !SyncParentDirectory(path))
+    {
+        LOG_ERROR("Failed to sync the directory of [ %s ]", path);
+        return false;
+    }
+
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : ReplayJournalFile
+//
+// @description         : Applies the records of a journal on top of the users loaded from the snapshot.
+//                        Replay stops at the first incomplete or corrupt frame, which is what a crash in the
+//                        middle of an append leaves behind.
+//
+// @param journalFile   : Journal to be replayed
+//
+// @returns             : True if the journal was found.
+//-------------------------------------------------------------------------------------------------------------
+bool AuthModule::ReplayJournalFile(const string & journalFile)
+{
+    string frames;
+    if (!ReadFile(journalFile, frames))
+    {
+        return false;
+    }
+
+    size_t recordsApplied = 0;
+    ApplyJournalFrames(frames.data(), frames.size(), recordsApplied);
+    LOG_INFO("Replayed %zu record(s) from %s", recordsApplied, journalFile);
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : ApplyJournalFrames
+//
+// @description         : Applies journal frames in order, up to the first one which is incomplete or corrupt.
+//
+// @param frames        : Frames as read from a journal
+// @param len           : Length of frames
+// @param recordsApplied : Incremented for every record applied
+//
+// @returns             : No. of bytes of frames applied
+//-------------------------------------------------------------------------------------------------------------
+size_t AuthModule::ApplyJournalFrames(const char *frames, size_t len, size_t & recordsApplied)
+{
+    size_t applied = 0;
+    while (len - applied >= JOURNAL_FRAME_HEADER_LEN)
+    {
+        recordReader_t headerReader = { frames + applied, JOURNAL_FRAME_HEADER_LEN, 0 };
+        uint32_t payloadLen = 0;
+        uint32_t checksum = 0;
+        GetU32(headerReader, payloadLen);
+        GetU32(headerReader, checksum);
+        if (payloadLen == 0 || payloadLen > JOURNAL_RECORD_MAX_LEN ||
+            len - applied - JOURNAL_FRAME_HEADER_LEN < payloadLen)
+            break;
+
+        const char *payload = frames + applied + JOURNAL_FRAME_HEADER_LEN;
+        if (Checksum32(payload, payloadLen) != checksum)
+            break;
+
+        recordReader_t reader = { payload, payloadLen, 0 };
+        uint8_t op = 0;
+        if (!GetU8(reader, op))
+            break;
+
+        if (op == JOURNAL_OP_START)
+        {
+            uint64_t journalId = 0;
+            uint64_t previousId = 0;
+            if (!GetU64(reader, journalId) || !GetU64(reader, previousId))
+                break;
+
+            ApplyJournalStart(journalId, previousId);
+        }
+        else
+        {
+            userData_t record;
+            passwordHistoryBuffer_t history;
+            InitPasswordHistory(record.prevPasswords, &history);
+            if (op != JOURNAL_OP_UPSERT_USER && op != JOURNAL_OP_UPSERT_USER_V1)
+                break;
+
+            uint32_t version = (op == JOURNAL_OP_UPSERT_USER_V1) ? 1 : USERS_DB_VERSION;
+            if (!DecodeUserRecord(reader, version, *m_passwordHasher, record))
+                break;
+
+            ApplyJournalRecord(record);
+            recordsApplied++;
+        }
+        applied += JOURNAL_FRAME_HEADER_LEN + payloadLen;
+    }
+
+    return applied;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : ApplyJournalStart
+//
+// @description         : Notes the journal whose records follow. A replica which did not follow the journal
+//                        named as the previous one has missed at least one, it catches up first.
+//
+// @param journalId     : Id of the journal
+// @param previousId    : Id of the journal set aside before it was started, 0 if unknown
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void AuthModule::ApplyJournalStart(uint64_t journalId, uint64_t previousId)
+{
+    if (m_config.storageMode == STORAGE_MODE_REPLICA && m_journalId != 0 && journalId != m_journalId &&
+        previousId != m_journalId)
+    {
+        CatchUpReplica(previousId);
+    }
+
+    m_journalId = journalId;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : CatchUpReplica
+//
+// @description         : Applies what a replica missed while the primary compacted more than one journal.
+//                        The journal which was set aside before the one just opened is still around while its
+//                        compaction runs; if the replica followed the one before it, that is all it missed.
+//                        Otherwise every user of the primary's current snapshot is applied first, it holds
+//                        at least all journals before the set aside one. Both are read after the new journal
+//                        was opened, so nothing falls in between. Costs a pass over all users, but only a
+//                        replica which fell behind by more than a compaction pays it.
+//
+// @param previousId    : Id of the journal set aside before the one just opened
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void AuthModule::CatchUpReplica(uint64_t previousId)
+{
+    string compactingFrames;
+    uint64_t compactingId = 0;
+    uint64_t compactingPreviousId = 0;
+    if (!ReadFile(m_journalFile + JOURNAL_COMPACTING_SUFFIX, compactingFrames) ||
+        !PeekJournalStart(compactingFrames, compactingId, compactingPreviousId) || compactingId != previousId)
+    {
+        compactingFrames.clear();
+    }
+
+    if (compactingFrames.empty() || compactingPreviousId != m_journalId)
+    {
+        LOG_WARNING("Replica missed journals of the primary, catching up from %s", m_usersDataFile);
+        string snapshot;
+        usersDbHeader_t header;
+        if (!ReadFile(m_usersDataFile, snapshot) || !ReadUsersDbHeader(snapshot.data(), snapshot.size(), header))
+        {
+            LOG_ERROR("Replica could not catch up from %s", m_usersDataFile);
+            return;
+        }
+
+        for (uint64_t i = 0; i < header.userCount; i++)
+        {
+            uint64_t offset = 0;
+            uint32_t recordLen = 0;
+            userData_t record;
+            passwordHistoryBuffer_t history;
+            InitPasswordHistory(record.prevPasswords, &history);
+            if (!ReadUsersDbIndexEntry(snapshot.data(), snapshot.size(), header.indexOffset, i, offset, recordLen))
+            {
+                break;
+            }
+
+            recordReader_t reader = { snapshot.data() + offset, recordLen, 0 };
+            if (!DecodeUserRecord(reader, header.version, *m_passwordHasher, record))
+            {
+                LOG_ERROR("Corrupt record #%llu in %s", (unsigned long long)i, m_usersDataFile);
+                break;
+            }
+            ApplyJournalRecord(record);
+        }
+        m_journalId = compactingPreviousId;
+    }
+
+    size_t recordsApplied = 0;
+    ApplyJournalFrames(compactingFrames.data(), compactingFrames.size(), recordsApplied);
+    m_metrics.Count(METRIC_REPLICA_RECORDS, recordsApplied);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : ApplyJournalRecord
+//
+// @description         : Upserts the user of a journal record. A new user is added to the negative lookup
+//                        filter, if there is one yet, before it is inserted. Once loaded, a replica also ends
+//                        the sessions of a user whose password was changed, as the primary did; a rehash with
+//                        new parameters keeps the password and its sessions.
+//
+// @param record        : Decoded record, its name may point into the journal's frames
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void AuthModule::ApplyJournalRecord(userData_t & record)
+{
+    // Journaled under a policy which may have kept more history
+    TrimPasswordHistory(record.prevPasswords, m_historyCapacity);
+    string userName(record.name);
+    size_t nameHash = HashUserName(userName);
+    userShard_t & shard = m_shards[nameHash % m_shardCount];
+    unique_lock<shared_mutex> shardLock(shard.lock);
+    userData_t *userData = GetUserDataLocked(shard, userName);
+    if (userData == nullptr)
+    {
+        BloomFilter *filter = m_negativeFilter.load(memory_order_acquire);
+        if (filter != nullptr)
+        {
+            filter->Add(nameHash);
+        }
+        shard.usersTable.Insert(record, nameHash);
+        return;
+    }
+
+    const passwordHash_t & oldHash = userData->passwordHash;
+    bool isPasswordChanged = (record.lastPasswordChangeTimestamp != userData->lastPasswordChangeTimestamp) ||
+                             (oldHash.algorithm == record.passwordHash.algorithm &&
+                              oldHash.iterations == record.passwordHash.iterations &&
+                              memcmp(oldHash.digest, record.passwordHash.digest, PASSWORD_DIGEST_LEN) != 0);
+    if (m_isUsersDataLoaded && isPasswordChanged)
+    {
+        m_sessions->RevokeUser(userName, m_clock->Now());
+    }
+
+    // The record's name points into the frames, the stored one keeps its interned name
+    PreserveFrozenRecord(shard, userData);
+    record.passwordVersion = userData->passwordVersion + (isPasswordChanged ? 1 : 0);
+    shard.usersTable.Assign(userData, record);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : OpenReplicaSource
+//
+// @description         : Opens the journal or pipe a replica follows, if it exists yet. A pipe is opened
+//                        without blocking, so that it need not have a writer.
+//
+// @returns             : True if it was opened.
+//-------------------------------------------------------------------------------------------------------------
+bool AuthModule::OpenReplicaSource()
+{
+    int fd = open(m_replicaSource.c_str(), O_RDONLY | O_NONBLOCK);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    m_replicaFd = fd;
+    m_replicaInode = S_ISREG(st.st_mode) ? st.st_ino : 0;
+    m_replicaPending.clear();
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : FollowReplicaSource
+//
+// @description         : Applies what the primary appended to the followed journal since the last call. A
+//                        frame read in part is kept until the rest of it arrives. Once the journal has been
+//                        read to its end, its path is checked for a new journal: the primary closes a journal
+//                        before setting it aside for a compaction, so after one more read to the end the old
+//                        one is done with and the new one is followed from its start. Called by the load and
+//                        then by the replica's thread only.
+//
+// @returns             : No. of records applied
+//-------------------------------------------------------------------------------------------------------------
+size_t AuthModule::FollowReplicaSource()
+{
+    size_t recordsApplied = 0;
+    bool isReplaced = false;
+    char buffer[REPLICA_READ_LEN];
+    while (m_replicaFd >= 0 || OpenReplicaSource())
+    {
+        ssize_t bytes = read(m_replicaFd, buffer, sizeof(buffer));
+        if (bytes > 0)
+        {
+            m_replicaPending.append(buffer, (size_t)bytes);
+            size_t applied = ApplyJournalFrames(m_replicaPending.data(), m_replicaPending.size(), recordsApplied);
+            m_replicaPending.erase(0, applied);
+            continue;
+        }
+
+        if (bytes < 0 && errno == EINTR)
+            continue;
+
+        // Caught up. A pipe has no successor.
+        if (m_replicaInode == 0)
+            break;
+
+        if (!isReplaced)
+        {
+            struct stat st;
+            isReplaced = (stat(m_replicaSource.c_str(), &st) != 0 || st.st_ino != m_replicaInode);
+            if (!isReplaced)
+                break;
+
+            continue;
+        }
+
+        if (!m_replicaPending.empty())
+        {
+            LOG_ERROR("Skipped %zu byte(s) at the end of a journal of %s", m_replicaPending.size(), m_replicaSource);
+        }
+        close(m_replicaFd);
+        m_replicaFd = -1;
+        isReplaced = false;
+        LOG_INFO("Following the new journal %s", m_replicaSource);
+    }
+
+    if (recordsApplied > 0)
+    {
+        m_metrics.Count(METRIC_REPLICA_RECORDS, recordsApplied);
+        RebuildNegativeFilter();
+    }
+
+    return recordsApplied;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : RunReplica
+//
+// @description         : Thread of a replica. Applies the primary's journal as it grows, checking for more
+//                        records every replicaPollMillis once caught up, until the module is destroyed.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void AuthModule::RunReplica()
+{
+    unique_lock<mutex> replicaLock(m_replicaLock);
+    while (!m_isReplicaStopping)
+    {
+        replicaLock.unlock();
+        FollowReplicaSource();
+        replicaLock.lock();
+        m_replicaCond.wait_for(replicaLock, chrono::milliseconds(m_config.replicaPollMillis),
+                               [this]() { return m_isReplicaStopping; });
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : CompactJournal
+//
+// @description         : Folds the journal into a new snapshot of the users database. The active journal is
+//                        set aside and a fresh one is started, so mutations can continue to be appended while
+//                        the snapshot is written. The snapshot is written to a temporary file which is then
+//                        renamed over the users database file; only after that the old journal is removed.
+//                        A crash at any point leaves a snapshot and journals which replay to the same state.
+//
+// @param runInBackground : If true the snapshot is written by a background thread. Shard locks are only held
+//                          while the journal is set aside and the users are frozen, see FreezeUsers().
+//
+// @returns             : True if the compaction was started (or completed when run in foreground).
+//-------------------------------------------------------------------------------------------------------------
+bool AuthModule::CompactJournal(bool runInBackground)
+{
+    lock_guard<mutex> freezeLock(m_freezeLock);
+
+    // Several writers may cross the threshold together, only the first one compacts.
+    if (runInBackground && !IsCompactionDue())
+    {
+        return false;
+    }
+
+    // Only one compaction at a time, the previous one owns the set aside journal and the frozen users.
+    if (m_compactionThread.joinable())
+    {
+        m_compactionThread.join();
+    }
+
+    vector<shared_lock<shared_mutex>> shardLocks;
+    LockAllShards(shardLocks);
+    unique_lock<mutex> persistLock(m_persistLock);
+
+    // Appends waiting for a sync are covered by this one, a sync started later finds the journal closed
+    string compactingFile = m_journalFile + JOURNAL_COMPACTING_SUFFIX;
+    uint64_t compactedThrough = m_journalWrites;
+    if (m_journalFd >= 0)
+    {
+        if (m_config.durability != DURABILITY_FLUSH && fdatasync(m_journalFd) != 0)
+        {
+            // Appends not synced yet are durable only once the snapshot is
+            LOG_ERROR("Failed to sync journal [ %s ]", m_journalFile);
+            RecordSyncFailure(0, compactedThrough);
+        }
+        close(m_journalFd);
+        m_journalFd = -1;
+    }
+
+    // The next journal names this one as the one it follows
+    if (m_journalId != 0)
+    {
+        m_previousJournalId = m_journalId;
+        m_journalId = 0;
+    }
+
+    // A journal left behind by an interrupted compaction has already been replayed into the table,
+    // so it is simply folded into this snapshot along with the active journal.
+    ifstream leftover(compactingFile, ios::in | ios::binary);
+    if (leftover)
+    {
+        leftover.close();
+        ofstream merged(compactingFile, ios::out | ios::app | ios::binary);
+        ifstream active(m_journalFile, ios::in | ios::binary);
+        if (active)
+        {
+            merged << active.rdbuf();
+        }
+        merged.close();
+        remove(m_journalFile.c_str());
+    }
+    else if (rename(m_journalFile.c_str(), compactingFile.c_str()) != 0)
+    {
+        // Nothing journaled yet, still write the snapshot.
+        ofstream(compactingFile, ios::out | ios::binary).close();
+    }
+    m_journalRecords = 0;
+
+    // Freeze the point in time contents of the table. Mutations after this go to the new journal.
+    FreezeUsers();
+    persistLock.unlock();
+    shardLocks.clear();
+
+    string usersDataFile = m_usersDataFile;
+    auto writeSnapshot = [this, usersDataFile, compactingFile, compactedThrough]()
+    {
+        MetricsTimer timer(m_metrics, METRIC_OP_COMPACTION);
+        string data;
+        SerializeUsersData(data);
+        string filterData;
+        SerializeNegativeFilter(filterData, data);
+        if (!ReplaceFile(usersDataFile, data, true))
+        {
+            LOG_ERROR("Failed to compact journal into [ %s ]", usersDataFile);
+        }
+        else
+        {
+            ClearSyncFailure(compactedThrough);
+            remove(compactingFile.c_str());
+            if (!filterData.empty())
+            {
+                WriteNegativeFilterFile(filterData);
+            }
+        }
+        m_isCompactionRunning = false;
+    };
+
+    m_isCompactionRunning = true;
+    if (runInBackground)
+    {
+        m_compactionThread = thread(writeSnapshot);
+    }
+    else
+    {
+        writeSnapshot();
+    }
+
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : LoadUsersDataFile
+//
+// @description         : This function is called by the Initialize() function. It must be called after the
+//                        construction of AuthModule. This is responsible for fetching records already registered
+//                        in the users database file. If this is not called, existing users' record will be
+//                        discarded. A users database in the old text format is converted to the binary format
+//                        first. The binary file is mapped read only and users are materialized in the table
+//                        only when they are looked up. A file written under another auth policy is migrated
+//                        to the module's policy instead of being refused. A replica leaves the files as they
+//                        are, catches up with the primary's journal and then starts following it.
+//
+// @returns             : True if data from users database file were read successfully and no
+//                        ambiguity was found. 
+//                        False otherwise.
+//-------------------------------------------------------------------------------------------------------------
+bool AuthModule::LoadUsersDataFile()
+{
+    MetricsTimer timer(m_metrics, METRIC_OP_LOAD);
+    bool isReplica = (m_config.storageMode == STORAGE_MODE_REPLICA);
+    bool isJournaled = (m_config.storageMode == STORAGE_MODE_JOURNAL) || isReplica;
+
+    // A replica opens the journals before it maps the snapshot, so whatever the primary compacts meanwhile
+    // is either in the mapped snapshot or still in the journals.
+    string compactingFrames;
+    if (isReplica)
+    {
+        OpenReplicaSource();
+        ReadFile(m_journalFile + JOURNAL_COMPACTING_SUFFIX, compactingFrames);
+    }
+
+    if (!MapUsersDataFile())
+    {
+        LOG_INFO("File [ %s ] NOT found!", m_usersDataFile);
+
+        // Journaled changes may exist even before the first snapshot is written
+        if (!isJournaled)
+        {
+            InitializeNegativeFilter();
+            return false;
+        }
+    }
+    else
+    {
+        usersDbHeader_t header;
+        bool isHeaderValid = ReadUsersDbHeader(m_snapshotData, m_snapshotSize, header);
+
+        // A file written under another auth policy or format version is migrated record by record into a
+        // new file, which is then mapped in its place. Should that fail, the records are migrated as they
+        // are materialized and all of them are materialized below.
+        if (isHeaderValid &&
+            (header.version != USERS_DB_VERSION || !IsSameAuthPolicy(header.authPolicy, m_authPolicy)))
+        {
+            if (isReplica)
+            {
+                LOG_INFO("Migrating %s in memory, it is the primary's", m_usersDataFile);
+            }
+            else if (MigrateUsersDataFile())
+            {
+                isHeaderValid = ReadUsersDbHeader(m_snapshotData, m_snapshotSize, header);
+            }
+            else
+            {
+                LOG_ERROR("Failed to migrate %s, migrating in memory", m_usersDataFile);
+            }
+        }
+
+        if (!isHeaderValid)
+        {
+            LOG_ERROR("File [ %s ] is corrupt", m_usersDataFile);
+            UnmapUsersDataFile();
+            return false;
+        }
+
+        m_snapshotUsers = header.userCount;
+        m_snapshotIndexOffset = header.indexOffset;
+        m_snapshotVersion = header.version;
+        m_snapshotPolicy = header.authPolicy;
+        m_snapshotResident.assign(m_snapshotUsers, 0);
+        m_snapshotPending = m_snapshotUsers;
+    }
+
+    // Apply the changes journaled since the last snapshot. A journal set aside by a compaction
+    // that did not complete is older than the active one and is replayed first.
+    if (isReplica)
+    {
+        size_t recordsApplied = 0;
+        ApplyJournalFrames(compactingFrames.data(), compactingFrames.size(), recordsApplied);
+        recordsApplied += FollowReplicaSource();
+        LOG_INFO("Caught up with %zu record(s) journaled by the primary", recordsApplied);
+    }
+    else if (isJournaled)
+    {
+        bool isCompactionPending = ReplayJournalFile(m_journalFile + JOURNAL_COMPACTING_SUFFIX);
+        ReplayJournalFile(m_journalFile);
+        if (isCompactionPending)
+        {
+            CompactJournal(false);
+        }
+    }
+
+    InitializeNegativeFilter();
+
+    // Records the migration could not rewrite can not be copied into a new snapshot as is. Decode all of
+    // them once, applying the current policy, and write the current version.
+    if (m_snapshotData != nullptr &&
+        (m_snapshotVersion != USERS_DB_VERSION || !IsSameAuthPolicy(m_snapshotPolicy, m_authPolicy)))
+    {
+        LOG_INFO("Upgrading %s to version %u", m_usersDataFile, USERS_DB_VERSION);
+        MaterializeAllUsers();
+        if (!isReplica && !UpdateUsersDataFile())
+            LOG_ERROR("Failed to update Users database!");
+    }
+
+    m_isUsersDataLoaded = true;
+    if (isReplica)
+    {
+        m_replicaThread = thread(&AuthModule::RunReplica, this);
+    }
+
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : MapUsersDataFile
+//
+// @description         : Maps the users database file read only. A file in the old text format is converted
+//                        to the binary format in place before it is mapped.
+//
+// @returns             : True if the file was mapped.
+//-------------------------------------------------------------------------------------------------------------
+bool AuthModule::MapUsersDataFile()
+{
+    ifstream probe(m_usersDataFile, ios::in | ios::binary);
+    if (!probe)
+    {
+        return false;
+    }
+    probe.close();
+
+    if (!IsBinaryUsersDbFile(m_usersDataFile))
+    {
+        string tempFile = m_usersDataFile + SNAPSHOT_TEMP_SUFFIX;
+        if (!ConvertTextUsersDataFile(m_usersDataFile, tempFile, *m_passwordHasher) ||
+            rename(tempFile.c_str(), m_usersDataFile.c_str()) != 0)
+        {
+            return false;
+        }
+    }
+
+    int fd = open(m_usersDataFile.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    void *data = mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return false;
+    }
+
+    m_snapshotData = (const char *)data;
+    m_snapshotSize = (size_t)fileStat.st_size;
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : UnmapUsersDataFile
+//
+// @description         : Releases the mapping of the users database file. Users not yet materialized are no
+//                        longer reachable after this.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void AuthModule::UnmapUsersDataFile()
+{
+    if (m_snapshotData != nullptr)
+    {
+        munmap((void *)m_snapshotData, m_snapshotSize);
+    }
+
+    m_snapshotData = nullptr;
+    m_snapshotSize = 0;
+    m_snapshotUsers = 0;
+    m_snapshotIndexOffset = 0;
+    m_snapshotResident.clear();
+    m_snapshotPending = 0;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : MigrateUsersDataFile
+//
+// @description         : Rewrites the mapped users database, written under another auth policy or an older
+//                        format version, for the module's policy and the current version. Records are
+//                        streamed through one at a time, without materializing any user: each is decoded,
+//                        its history cut to the policy's length and encoded again. Expiry and password
+//                        rules need no change to the records, expiry is checked against the policy at login
+//                        and the password rules apply from the next password change on. Chunks of records
+//                        are migrated in parallel, version 1 records hash their passwords on the way. The
+//                        new file is written next to the old one, renamed over it and mapped in its place.
+//
+// @returns             : True if the migrated file is mapped.
+//-------------------------------------------------------------------------------------------------------------
+bool AuthModule::MigrateUsersDataFile()
+{
+    usersDbHeader_t header;
+    if (!ReadUsersDbHeader(m_snapshotData, m_snapshotSize, header))
+    {
+        return false;
+    }
+
+    LOG_INFO("Migrating %s from version %u, history %u, expiry %d days", m_usersDataFile, header.version,
+             header.authPolicy.passwordHistoryMax, header.authPolicy.passwordExpiryDays);
+    LOG_INFO("... to version %u, history %u, expiry %d days, password rules apply from the next change",
+             USERS_DB_VERSION, m_authPolicy.passwordHistoryMax, m_authPolicy.passwordExpiryDays);
+
+    // Chunks of the index are decoded and encoded again in parallel, each into its own buffer. The entries
+    // point into the buffers once they no longer grow.
+    unsigned chunks = GetChunkCount(header.userCount, m_config.loadWorkers);
+    vector<string> chunkRecords(chunks);
+    vector<usersDbEntry_t> entries(header.userCount);
+    vector<size_t> recordOffsets(header.userCount);
+    atomic<size_t> trimmedUsers(0);
+    atomic<size_t> expiredUsers(0);
+    atomic<bool> isCorrupt(false);
+    RunChunks(header.userCount, chunks, [&](unsigned chunk, uint64_t begin, uint64_t end)
+    {
+        string & records = chunkRecords[chunk];
+        size_t trimmed = 0;
+        size_t expired = 0;
+        passwordHistoryBuffer_t history;
+        for (uint64_t i = begin; i < end && !isCorrupt.load(memory_order_relaxed); i++)
+        {
+            uint64_t offset = 0;
+            uint32_t recordLen = 0;
+            userData_t record;
+            InitPasswordHistory(record.prevPasswords, &history);
+            if (!ReadUsersDbIndexEntry(m_snapshotData, m_snapshotSize, header.indexOffset, i, offset, recordLen))
+            {
+                isCorrupt = true;
+                break;
+            }
+
+            recordReader_t reader = { m_snapshotData + offset, recordLen, 0 };
+            if (!DecodeUserRecord(reader, header.version, *m_passwordHasher, record))
+            {
+                LOG_ERROR("Corrupt record #%llu in %s", (unsigned long long)i, m_usersDataFile);
+                isCorrupt = true;
+                break;
+            }
+
+            trimmed += TrimPasswordHistory(record.prevPasswords, m_historyCapacity) ? 1 : 0;
+            expired += IsPasswordExpired(record.lastPasswordChangeTimestamp) ? 1 : 0;
+            recordOffsets[i] = records.size();
+            EncodeUserRecord(records, record);
+            entries[i].rawLen = (uint32_t)(records.size() - recordOffsets[i]);
+            entries[i].userData = nullptr;
+        }
+        trimmedUsers += trimmed;
+        expiredUsers += expired;
+    });
+
+    if (isCorrupt)
+    {
+        return false;
+    }
+
+    for (unsigned chunk = 0; chunk < chunks; chunk++)
+    {
+        for (uint64_t i = header.userCount * chunk / chunks; i < header.userCount * (chunk + 1) / chunks; i++)
+        {
+            entries[i].rawRecord = chunkRecords[chunk].data() + recordOffsets[i];
+            PeekRecordName(entries[i].rawRecord, entries[i].rawLen, entries[i].name, entries[i].nameLen);
+        }
+    }
+
+    string snapshot;
+    WriteUsersDbSnapshot(snapshot, m_authPolicy, entries);
+    chunkRecords.clear();
+
+    if (!ReplaceFile(m_usersDataFile, snapshot, true))
+    {
+        return false;
+    }
+
+    LOG_INFO("Migrated %s: %zu histories shortened, %zu password(s) expired under the policy", m_usersDataFile,
+             trimmedUsers.load(), expiredUsers.load());
+
+    UnmapUsersDataFile();
+    return MapUsersDataFile();
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : FindSnapshotUser
+//
+// @description         : Binary search for a user name over the sorted index of the mapped snapshot. Names
+//                        are compared in place within the mapping.
+//
+// @param userName      : Username to be searched
+// @param index         : Position of the user in the snapshot index, if found
+//
+// @returns             : True if the snapshot holds the user.
+//-------------------------------------------------------------------------------------------------------------
+bool AuthModule::FindSnapshotUser(const string & userName, uint64_t & index)
+{
+    uint64_t low = 0;
+    uint64_t high = m_snapshotUsers;
+    while (low < high)
+    {
+        uint64_t mid = low + (high - low) / 2;
+        uint64_t offset = 0;
+        uint32_t recordLen = 0;
+        const char *name = nullptr;
+        uint32_t nameLen = 0;
+        if (!ReadUsersDbIndexEntry(m_snapshotData, m_snapshotSize, m_snapshotIndexOffset, mid, offset, recordLen) ||
+            !PeekRecordName(m_snapshotData + offset, recordLen, name, nameLen))
+        {
+            return false;
+        }
+
+        int cmp = memcmp(name, userName.data(), min((size_t)nameLen, userName.size()));
+        if (cmp == 0)
+        {
+            cmp = (nameLen < userName.size()) ? -1 : (nameLen > userName.size()) ? 1 : 0;
+        }
+
+        if (cmp == 0)
+        {
+            index = mid;
+            return true;
+        }
+        else if (cmp < 0)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    return false;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : DecodeSnapshotUser
+//
+// @description         : Decodes a user of the mapped snapshot, its name pointing into the mapping. Needs no
+//                        lock, the mapping does not change.
+//
+// @param index         : Position of the user in the snapshot index
+// @param record        : Receives the user's data, its previous passwords into its history's block
+//
+// @returns             : False if the record is corrupt.
+//-------------------------------------------------------------------------------------------------------------
+bool AuthModule::DecodeSnapshotUser(uint64_t index, userData_t & record)
+{
+    uint64_t offset = 0;
+    uint32_t recordLen = 0;
+    if (!ReadUsersDbIndexEntry(m_snapshotData, m_snapshotSize, m_snapshotIndexOffset, index, offset, recordLen))
+    {
+        return false;
+    }
+
+    recordReader_t reader = { m_snapshotData + offset, recordLen, 0 };
+    if (!DecodeUserRecord(reader, m_snapshotVersion, *m_passwordHasher, record))
+    {
+        LOG_ERROR("Corrupt record #%llu in %s", (unsigned long long)index, m_usersDataFile);
+        return false;
+    }
+
+    TrimPasswordHistory(record.prevPasswords, m_historyCapacity);
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : MaterializeSnapshotUser
+//
+// @description         : Decodes a user from the mapped snapshot and moves it into the users' table, where
+//                        it stays. Caller must hold the exclusive lock of the shard owning the user.
+//
+// @param shard         : Shard owning the user
+// @param index         : Position of the user in the snapshot index
+//
+// @returns             : User's data, NULL if the record is corrupt.
+//-------------------------------------------------------------------------------------------------------------
+userData_t* AuthModule::MaterializeSnapshotUser(userShard_t & shard, uint64_t index)
+{
+    userData_t record;
+    passwordHistoryBuffer_t history;
+    InitPasswordHistory(record.prevPasswords, &history);
+    if (!DecodeSnapshotUser(index, record))
+    {
+        return nullptr;
+    }
+
+    shard.userCache.Erase(record.name);
+    userData_t *userData = shard.usersTable.Insert(record, HashUserName(record.name));
+    m_metrics.Count(METRIC_SNAPSHOT_MATERIALIZED);
+    m_snapshotResident[index] = 1;
+    m_snapshotPending--;
+    return userData;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : MaterializeAllUsers
+//
+// @description         : Moves all users still in the mapped snapshot into the users' table. Chunks of the
+//                        snapshot's index are first sorted by shard in parallel. Then each shard's table is
+//                        sized once, so its records are taken from a single arena block, and filled by one
+//                        thread with its users in index order, several shards at once. The resulting tables
+//                        are the same whatever the no. of threads.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void AuthModule::MaterializeAllUsers()
+{
+    vector<unique_lock<shared_mutex>> shardLocks;
+    for (unsigned i = 0; i < m_shardCount; i++)
+    {
+        shardLocks.emplace_back(m_shards[i].lock);
+    }
+
+    if (m_snapshotPending == 0)
+    {
+        return;
+    }
+
+    unsigned chunks = GetChunkCount(m_snapshotUsers, m_config.loadWorkers);
+    vector<vector<vector<uint64_t>>> chunkShardUsers(chunks, vector<vector<uint64_t>>(m_shardCount));
+    RunChunks(m_snapshotUsers, chunks, [&](unsigned chunk, uint64_t begin, uint64_t end)
+    {
+        for (uint64_t i = begin; i < end; i++)
+        {
+            uint64_t offset = 0;
+            uint32_t recordLen = 0;
+            const char *name = nullptr;
+            uint32_t nameLen = 0;
+            if (!m_snapshotResident[i] &&
+                ReadUsersDbIndexEntry(m_snapshotData, m_snapshotSize, m_snapshotIndexOffset, i, offset, recordLen) &&
+                PeekRecordName(m_snapshotData + offset, recordLen, name, nameLen))
+            {
+                chunkShardUsers[chunk][GetShardIndex(string_view(name, nameLen))].push_back(i);
+            }
+        }
+    });
+
+    RunChunks(m_shardCount, min(chunks, m_shardCount), [&](unsigned, uint64_t begin, uint64_t end)
+    {
+        for (uint64_t shardIndex = begin; shardIndex < end; shardIndex++)
+        {
+            size_t shardUsers = 0;
+            for (unsigned chunk = 0; chunk < chunks; chunk++)
+            {
+                shardUsers += chunkShardUsers[chunk][shardIndex].size();
+            }
+            if (shardUsers == 0)
+                continue;
+
+            userShard_t & shard = m_shards[shardIndex];
+            shard.usersTable.Reserve(shard.usersTable.Size() + shardUsers);
+            for (unsigned chunk = 0; chunk < chunks; chunk++)
+            {
+                const vector<uint64_t> & users = chunkShardUsers[chunk][shardIndex];
+                for (size_t i = 0; i < users.size(); i++)
+                {
+                    MaterializeSnapshotUser(shard, users[i]);
+                }
+            }
+        }
+    });
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetUserData
+//
+// @description         : Checks in the table for a given username. Users which are still only in the mapped
+//                        snapshot are materialized on their first lookup. Records are never moved or freed
+//                        before the module is destroyed, but they may be updated concurrently by other
+//                        threads. The username is hashed once for the negative lookup filter, the shard and
+//                        the table lookup; a name the filter rejects is answered without taking any lock.
+//                        Every user looked up stays materialized, so only paths which do not bound the
+//                        resident users (residentUsersMax of 0) use it; others read a GetUserDataCopy().
+//
+// @param userName      : Username that needs to be checked.
+//
+// @returns             : user's data for the provided userName.
+//                        NULL if userName is not present in records.
+//-------------------------------------------------------------------------------------------------------------
+userData_t* AuthModule::GetUserData(const string & userName)
+{
+    size_t nameHash = HashUserName(userName);
+    if (IsUnknownUser(nameHash))
+    {
+        m_metrics.Count(METRIC_LOOKUPS);
+        m_metrics.Count(METRIC_LOOKUP_MISSES);
+        return nullptr;
+    }
+
+    userShard_t & shard = m_shards[nameHash % m_shardCount];
+    {
+        shared_lock<shared_mutex> shardLock(shard.lock);
+        userData_t *userData = shard.usersTable.Find(userName, nameHash);
+        m_metrics.Count(METRIC_LOOKUPS);
+        if (userData == nullptr)
+        {
+            m_metrics.Count(METRIC_LOOKUP_MISSES);
+        }
+        if (userData != nullptr || m_snapshotPending == 0)
+        {
+            return userData;
+        }
+    }
+
+    unique_lock<shared_mutex> shardLock(shard.lock);
+    return GetUserDataLocked(shard, userName);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : FindUserLocked
+//
+// @description         : Looks up a username in its shard's table only. Caller must hold the shard lock
+//                        in either mode.
+//
+// @returns             : user's data, NULL if userName is not in the table.
+//-------------------------------------------------------------------------------------------------------------
+userData_t* AuthModule::FindUserLocked(userShard_t & shard, const string & userName)
+{
+    userData_t *userData = shard.usersTable.Find(userName, HashUserName(userName));
+    m_metrics.Count(METRIC_LOOKUPS);
+    if (userData == nullptr)
+    {
+        m_metrics.Count(METRIC_LOOKUP_MISSES);
+    }
+    return userData;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetUserDataLocked
+//
+// @description         : Same as GetUserData() for a caller which already holds the exclusive lock of the
+//                        shard owning userName.
+//
+// @returns             : user's data, NULL if userName is not present in records.
+//-------------------------------------------------------------------------------------------------------------
+userData_t* AuthModule::GetUserDataLocked(userShard_t & shard, const string & userName)
+{
+    userData_t *userData = FindUserLocked(shard, userName);
+    if (userData == nullptr && m_snapshotPending > 0 && !IsUnknownUser(HashUserName(userName)))
+    {
+        uint64_t index = 0;
+        if (FindSnapshotUser(userName, index) && !m_snapshotResident[index])
+        {
+            userData = MaterializeSnapshotUser(shard, index);
+        }
+    }
+
+    return userData;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : IsUnknownUser
+//
+// @description         : Checks a username's hash against the negative lookup filter. Takes no lock.
+//
+// @returns             : True if the user is certainly not registered. False if it may be, or if no filter
+//                        is used.
+//-------------------------------------------------------------------------------------------------------------
+bool AuthModule::IsUnknownUser(size_t nameHash)
+{
+    BloomFilter *filter = m_negativeFilter.load(memory_order_acquire);
+    if (filter == nullptr || filter->MayContain(nameHash))
+    {
+        return false;
+    }
+
+    m_metrics.Count(METRIC_NEGATIVE_FILTER_REJECTS);
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : InitializeNegativeFilter
+//
+// @description         : Sets up the negative lookup filter once the users database and journal are loaded.
+//                        The filter persisted along with the mapped snapshot is used if it still belongs to
+//                        it; otherwise it is built from the names in the snapshot's records and saved. Users
+//                        journaled since the snapshot are added either way.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void AuthModule::InitializeNegativeFilter()
+{
+    if (!m_config.useNegativeLookupFilter)
+    {
+        return;
+    }
+
+    lock_guard<mutex> filterLock(m_filterLock);
+    vector<shared_lock<shared_mutex>> shardLocks;
+    LockAllShards(shardLocks);
+
+    uint32_t identity = (m_snapshotData != nullptr) ? GetUsersDbIdentity(m_snapshotData, m_snapshotSize) : 0;
+    BloomFilter *filter = nullptr;
+    if (identity != 0)
+    {
+        ifstream in(m_filterFile, ios::in | ios::binary | ios::ate);
+        string data(in ? (size_t)in.tellg() : 0, '\0');
+        if (in.seekg(0) && in.read(&data[0], data.size()))
+        {
+            filter = BloomFilter::Deserialize(data.data(), data.size(), identity);
+        }
+    }
+
+    if (filter != nullptr)
+    {
+        for (unsigned i = 0; i < m_shardCount; i++)
+        {
+            UserTable & usersTable = m_shards[i].usersTable;
+            for (size_t j = 0; j < usersTable.Size(); j++)
+            {
+                size_t nameHash = HashUserName(usersTable.GetRecord(j)->name);
+                if (!filter->MayContain(nameHash))
+                {
+                    filter->Add(nameHash);
+                }
+            }
+        }
+        m_negativeFilter.store(filter, memory_order_release);
+        LOG_INFO("Loaded negative lookup filter from %s", m_filterFile);
+    }
+
+    RebuildNegativeFilterLocked();
+    if (identity != 0 && m_negativeFilter.load(memory_order_relaxed) != filter &&
+        m_config.storageMode != STORAGE_MODE_REPLICA)
+    {
+        string data;
+        m_negativeFilter.load(memory_order_relaxed)->Serialize(data, identity);
+        WriteNegativeFilterFile(data);
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : RebuildNegativeFilter
+//
+// @description         : Replaces the negative lookup filter with a larger one once more users were added
+//                        to it than it was sized for. Called after a registration has released its locks.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void AuthModule::RebuildNegativeFilter()
+{
+    BloomFilter *filter = m_negativeFilter.load(memory_order_acquire);
+    if (filter == nullptr || !filter->IsOverCapacity())
+    {
+        return;
+    }
+
+    lock_guard<mutex> filterLock(m_filterLock);
+    vector<shared_lock<shared_mutex>> shardLocks;
+    LockAllShards(shardLocks);
+    RebuildNegativeFilterLocked();
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : RebuildNegativeFilterLocked
+//
+// @description         : Builds the negative lookup filter from all users, if there is none yet or the
+//                        current one is over capacity. The new filter is sized for twice the users. The one
+//                        it replaces may still be read by lookups which skip the locks, so it is kept until
+//                        the module is destroyed. Caller must hold the filter lock and all shard locks.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void AuthModule::RebuildNegativeFilterLocked()
+{
+    BloomFilter *current = m_negativeFilter.load(memory_order_relaxed);
+    if (current != nullptr && !current->IsOverCapacity())
+    {
+        return;
+    }
+
+    size_t users = m_snapshotPending;
+    for (unsigned i = 0; i < m_shardCount; i++)
+    {
+        users += m_shards[i].usersTable.Size();
+    }
+
+    BloomFilter *filter = new BloomFilter(max(users * 2, NEGATIVE_FILTER_MIN_CAPACITY));
+    for (unsigned i = 0; i < m_shardCount; i++)
+    {
+        UserTable & usersTable = m_shards[i].usersTable;
+        for (size_t j = 0; j < usersTable.Size(); j++)
+        {
+            filter->Add(HashUserName(usersTable.GetRecord(j)->name));
+        }
+    }
+
+    // Adds are atomic, so chunks of the snapshot's names go into the filter in parallel
+    if (m_snapshotPending > 0)
+    {
+        RunChunks(m_snapshotUsers, GetChunkCount(m_snapshotUsers, m_config.loadWorkers),
+                  [this, filter](unsigned, uint64_t begin, uint64_t end)
+        {
+            for (uint64_t i = begin; i < end; i++)
+            {
+                uint64_t offset = 0;
+                uint32_t recordLen = 0;
+                const char *name = nullptr;
+                uint32_t nameLen = 0;
+                if (!m_snapshotResident[i] &&
+                    ReadUsersDbIndexEntry(m_snapshotData, m_snapshotSize, m_snapshotIndexOffset, i, offset,
+                                          recordLen) &&
+                    PeekRecordName(m_snapshotData + offset, recordLen, name, nameLen))
+                {
+                    filter->Add(HashUserName(string_view(name, nameLen)));
+                }
+            }
+        });
+    }
+
+    m_negativeFilter.store(filter, memory_order_release);
+    if (current != nullptr)
+    {
+        m_retiredFilters.push_back(current);
+    }
+    LOG_INFO("Built negative lookup filter for %zu users", users);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : SerializeNegativeFilter
+//
+// @description         : Persisted form of the negative lookup filter, tied to the users database it is
+//                        written along with. Needs no lock: users are added to the filter before they are
+//                        inserted and it is only ever replaced by one holding all of them, so it holds at
+//                        least the users of any snapshot serialized before.
+//
+// @param out           : Left empty if no filter is used
+// @param snapshot      : Users database which was serialized under the same locks
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void AuthModule::SerializeNegativeFilter(string & out, const string & snapshot)
+{
+    BloomFilter *filter = m_negativeFilter.load(memory_order_acquire);
+    if (filter != nullptr)
+    {
+        filter->Serialize(out, GetUsersDbIdentity(snapshot.data(), snapshot.size()));
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : WriteNegativeFilterFile
+//
+// @description         : Writes the persisted negative lookup filter through a temporary file. A crash
+//                        between writing the users database and this leaves a filter of the previous users
+//                        database, which is then rebuilt on load.
+//
+// @returns             : True if the file was written.
+//-------------------------------------------------------------------------------------------------------------
+bool AuthModule::WriteNegativeFilterFile(const string & data)
+{
+    if (!ReplaceFile(m_filterFile, data, false))
+    {
+        LOG_ERROR("File [ %s ] could not be written!", m_filterFile);
+        return false;
+    }
+
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : AddNewUser
+//
+// @description         : Add new user details to record. If user is registered, this
+//                        information is updated in the users database as well. The password is hashed
+//                        before the shard lock is taken.
+//
+// @param userName      : Username to add
+// @param password      : Password that is to be used
+//
+// @returns             : true if user was added successfully.
+//-------------------------------------------------------------------------------------------------------------
+bool AuthModule::AddNewUser(const string & userName, const string & password)
+{
+    userData_t *userData = nullptr;
+    bool retval = false;
+
+    if (m_config.storageMode == STORAGE_MODE_REPLICA)
+    {
+        LOG_ERROR("Replica can not register [%s]", userName);
+        return retval;
+    }
+
+    // Avoid the cost of hashing for a user who is already registered
+    userData_t existing;
+    if (GetUserDataCopy(userName, existing))
+    {
+        LOG_INFO("User [%s] already exists", userName);
+        return retval;
+    }
+
+    passwordHash_t passwordHash;
+    m_passwordHasher->Hash(password, passwordHash);
+
+    userShard_t & shard = GetShard(userName);
+    unique_lock<shared_mutex> shardLock(shard.lock);
+
+    userData = GetUserDataLocked(shard, userName);
+    if (userData == nullptr)
+    {
+        // User not already present, add entry.
+        userData = CreateUserLocked(shard, userName, passwordHash);
+        LOG_DEBUG("User [%s] registered", userName);
+        retval = true;
+    }
+    else 
+    {
+        LOG_INFO("User [%s] already exists", userName);
+    }
+
+    // Update the file only if the user was registered successfully.
+    if (retval == true)
+    {
+        bool fileUpdated = PersistUserData(userData, shardLock);
+        if (!fileUpdated)
+            LOG_ERROR("Failed to update Users database!");
+
+        RebuildNegativeFilter();
+    }
+
+    return retval;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : CreateUserLocked
+//
+// @description         : Creates the record of a new user and inserts it in its shard and the negative lookup
+//                        filter. Caller must hold the exclusive lock of the shard and must have checked that
+//                        the user does not exist.
+//
+// @returns             : Record of the new user
+//-------------------------------------------------------------------------------------------------------------
+userData_t* AuthModule::CreateUserLocked(userShard_t & shard, const string & userName, const passwordHash_t & passwordHash)
+{
+    userData_t userData;
+    userData.lastPasswordChangeTimestamp = time(0);
+    userData.name = userName;
+    userData.passwordHash = passwordHash;
+    userData.passwordVersion = 0;
+    InitPasswordHistory(userData.prevPasswords, nullptr);
+
+    // Added before the insert, so a lookup which finds the user in the table is never rejected by the filter
+    size_t nameHash = HashUserName(userName);
+    BloomFilter *filter = m_negativeFilter.load(memory_order_acquire);
+    if (filter != nullptr)
+    {
+        filter->Add(nameHash);
+    }
+
+    return shard.usersTable.Insert(userData, nameHash);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetUserDataCopy
+//
+// @description         : Copies a user's record under the shard lock, so that it can be examined (and
+//                        passwords verified against it) without holding the lock. With residentUsersMax set,
+//                        an unchanged user of the snapshot is not materialized but decoded into the shard's
+//                        bounded cache, evicting the least recently read one when it is full.
+//
+// @param history       : Buffer for the copy's previous passwords, NULL if they are not needed
+//
+// @returns             : True if the user exists.
+//-------------------------------------------------------------------------------------------------------------
+bool AuthModule::GetUserDataCopy(const string & userName, userData_t & userData, passwordHistoryBuffer_t *history)
+{
+    if (m_config.residentUsersMax == 0)
+    {
+        userData_t *record = GetUserData(userName);
+        if (record == nullptr)
+        {
+            return false;
+        }
+
+        shared_lock<shared_mutex> shardLock(GetShard(userName).lock);
+        CopyUserData(userData, *record, history);
+        return true;
+    }
+
+    size_t nameHash = HashUserName(userName);
+    m_metrics.Count(METRIC_LOOKUPS);
+    if (IsUnknownUser(nameHash))
+    {
+        m_metrics.Count(METRIC_LOOKUP_MISSES);
+        return false;
+    }
+
+    userShard_t & shard = m_shards[nameHash % m_shardCount];
+    {
+        shared_lock<shared_mutex> shardLock(shard.lock);
+        userData_t *record = shard.usersTable.Find(userName, nameHash);
+        if (record != nullptr)
+        {
+            CopyUserData(userData, *record, history);
+            return true;
+        }
+
+        if (shard.userCache.Find(userName, userData, history))
+        {
+            m_metrics.Count(METRIC_USER_CACHE_HITS);
+            return true;
+        }
+    }
+
+    // Decoded without the lock, the user may have been changed meanwhile. The cache gets all of the history.
+    uint64_t index = 0;
+    userData_t decoded;
+    passwordHistoryBuffer_t decodedHistory;
+    InitPasswordHistory(decoded.prevPasswords, &decodedHistory);
+    if (m_snapshotPending == 0 || !FindSnapshotUser(userName, index) || !DecodeSnapshotUser(index, decoded))
+    {
+        m_metrics.Count(METRIC_LOOKUP_MISSES);
+        return false;
+    }
+
+    unique_lock<shared_mutex> shardLock(shard.lock);
+    if (m_snapshotResident[index])
+    {
+        CopyUserData(userData, *shard.usersTable.Find(userName, nameHash), history);
+        return true;
+    }
+
+    if (shard.userCache.Insert(decoded))
+    {
+        m_metrics.Count(METRIC_USER_CACHE_EVICTIONS);
+    }
+    CopyUserData(userData, decoded, history);
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : UpdateUserPassword
+//
+// @description         : This is used to update password for an already existing user. Validations are done
+//                        for existence of the user, validity of password as per auth policy. The history
+//                        check and hashing of the new password work on a copy of the record, outside of the
+//                        shard lock. The update is applied only if the password did not change meanwhile;
+//                        a concurrent rehash of the same password does not count as a change.
+//
+// @returns             : True if the password was updated.
+//-------------------------------------------------------------------------------------------------------------
+bool AuthModule::UpdateUserPassword(const string & userName, const string & password)
+{
+    MetricsTimer timer(m_metrics, METRIC_OP_UPDATE_PASSWORD);
+    userData_t current;
+    passwordHistoryBuffer_t currentHistory;
+    bool retval = false;
+
+    if (m_config.storageMode == STORAGE_MODE_REPLICA)
+    {
+        LOG_ERROR("Replica can not update the password of [%s]", userName);
+        return retval;
+    }
+
+    if (!GetUserDataCopy(userName, current, &currentHistory))
+    {
+        LOG_INFO("User [%s] not found!", userName);
+        return retval;
+    }
+
+    // The new password's hash comes out of the history check
+    passwordHash_t passwordHash;
+    if (!ValidatePassword(userName, password) || !IsPasswordValidAsPerHistory(current, password, passwordHash))
+    {
+        return retval;
+    }
+
+    userShard_t & shard = GetShard(userName);
+    unique_lock<shared_mutex> shardLock(shard.lock);
+    userData_t *userData = GetUserDataLocked(shard, userName);
+    if (userData == nullptr)
+    {
+        LOG_INFO("User [%s] not found!", userName);
+        return retval;
+    }
+
+    // Compared by version, a rehash of the password meanwhile does not change which one is current
+    if (userData->passwordVersion != current.passwordVersion)
+    {
+        LOG_INFO("Password for [%s] was updated concurrently", userName);
+        return retval;
+    }
+
+    // Store in previous passwords history, the oldest one drops out once it is full
+    PreserveFrozenRecord(shard, userData);
+    shard.usersTable.PushPasswordHistory(userData, userData->passwordHash);
+
+    // Update password, the sessions opened with the old one end along with it. Sessions carry the time of
+    // the change, so that time is made to differ from the previous one even within the same second.
+    userData->passwordHash = passwordHash;
+    userData->lastPasswordChangeTimestamp = max((long long)time(0), userData->lastPasswordChangeTimestamp + 1);
+    userData->passwordVersion++;
+    m_sessions->RevokeUser(userName, m_clock->Now());
+    LOG_DEBUG("Password updated for [%s]", userName);
+    retval = true;
+
+    // Update the file only if the user was registered successfully.
+    if (retval == true)
+    {
+        bool fileUpdated = PersistUserData(userData, shardLock);
+        if (!fileUpdated)
+            LOG_ERROR("Failed to update Users database!");
+    }
+
+    return retval;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Login
+//
+// @description         : This function helps to check if provided userName and password match as per records.
+//                        If auth policy requires password expiry validation, an expired password is reported
+//                        instead of being accepted; the caller then has to get a new password from the user
+//                        and call ChangeExpiredPassword(). Login never waits for user input. The password is
+//                        verified against a copy of the stored hash, outside of the shard lock. With login
+//                        throttling, a login of a locked out username or source is refused first thing.
+// 
+// @param userName      : Username
+// @param password      : password
+// @param sourceKey     : Where the login comes from, e.g. the client's address. Empty if unknown.
+//
+// @returns             : LOGIN_OK if Username and password match,
+//                        LOGIN_PASSWORD_EXPIRED if they match but the password has expired,
+//                        LOGIN_LOCKED if the username or source is locked out,
+//                        LOGIN_BAD_CREDENTIALS otherwise.
+//-------------------------------------------------------------------------------------------------------------
+loginResult_t AuthModule::Login(const string & userName, const string & password, string_view sourceKey)
+{
+    MetricsTimer timer(m_metrics, METRIC_OP_LOGIN);
+    if (IsLoginThrottled(userName, sourceKey))
+    {
+        return LOGIN_LOCKED;
+    }
+
+    passwordHash_t passwordHash;
+    long long lastPasswordChangeTimestamp = 0;
+    if (!CopyCredentials(userName, passwordHash, lastPasswordChangeTimestamp))
+    {
+        LOG_INFO("Invalid Username/Password for [%s]", userName);
+        RecordLoginOutcome(userName, sourceKey, LOGIN_BAD_CREDENTIALS);
+        return LOGIN_BAD_CREDENTIALS;
+    }
+
+    loginResult_t result = CheckLogin(userName, password, passwordHash, lastPasswordChangeTimestamp);
+    RecordLoginOutcome(userName, sourceKey, result);
+    return result;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : LoginAsync
+//
+// @description         : Asynchronous Login(). The throttling check and the user lookup are done on the
+//                        calling thread; only the password verification is queued to the login worker pool.
+//                        While the pool's queue is full the caller is held back until a worker frees a slot.
+//
+// @param userName      : Username
+// @param password      : password
+// @param sourceKey     : Where the login comes from, empty if unknown
+//
+// @returns             : Future set to the outcome as returned by Login().
+//-------------------------------------------------------------------------------------------------------------
+future<loginResult_t> AuthModule::LoginAsync(const string & userName, const string & password, string_view sourceKey)
+{
+    shared_ptr<promise<loginResult_t>> result = make_shared<promise<loginResult_t>>();
+    future<loginResult_t> loginResult = result->get_future();
+    uint64_t startNs = AuthMetrics::Now();
+
+    if (IsLoginThrottled(userName, sourceKey))
+    {
+        m_metrics.RecordSince(METRIC_OP_LOGIN, startNs);
+        result->set_value(LOGIN_LOCKED);
+        return loginResult;
+    }
+
+    passwordHash_t passwordHash;
+    long long lastPasswordChangeTimestamp = 0;
+    if (!CopyCredentials(userName, passwordHash, lastPasswordChangeTimestamp))
+    {
+        LOG_INFO("Invalid Username/Password for [%s]", userName);
+        RecordLoginOutcome(userName, sourceKey, LOGIN_BAD_CREDENTIALS);
+        m_metrics.RecordSince(METRIC_OP_LOGIN, startNs);
+        result->set_value(LOGIN_BAD_CREDENTIALS);
+        return loginResult;
+    }
+
+    string source(sourceKey);
+    m_queuedLogins++;
+    bool queued = GetLoginPool().Submit([this, userName, password, source, passwordHash, lastPasswordChangeTimestamp, result, startNs]()
+    {
+        loginResult_t outcome = CheckLogin(userName, password, passwordHash, lastPasswordChangeTimestamp);
+        RecordLoginOutcome(userName, source, outcome);
+        m_metrics.RecordSince(METRIC_OP_LOGIN, startNs);
+        result->set_value(outcome);
+        m_queuedLogins--;
+    });
+
+    if (!queued)
+    {
+        m_queuedLogins--;
+        result->set_value(LOGIN_BAD_CREDENTIALS);
+    }
+
+    return loginResult;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : LoginAsync
+//
+// @description         : Asynchronous Login() reporting through a callback. Unlike the future based variant
+//                        the caller is never held back: when the pool's queue is full the login is refused
+//                        and the callback is not called.
+//
+// @param userName      : Username
+// @param password      : password
+// @param callback      : Called with the outcome, on a worker thread, or on the calling thread for an
+//                        unknown user or a locked out login
+// @param sourceKey     : Where the login comes from, empty if unknown
+//
+// @returns             : False if the login was refused because the queue is full.
+//-------------------------------------------------------------------------------------------------------------
+bool AuthModule::LoginAsync(const string & userName, const string & password, function<void(loginResult_t)> callback,
+                            string_view sourceKey)
+{
+    uint64_t startNs = AuthMetrics::Now();
+    if (IsLoginThrottled(userName, sourceKey))
+    {
+        m_metrics.RecordSince(METRIC_OP_LOGIN, startNs);
+        callback(LOGIN_LOCKED);
+        return true;
+    }
+
+    passwordHash_t passwordHash;
+    long long lastPasswordChangeTimestamp = 0;
+    if (!CopyCredentials(userName, passwordHash, lastPasswordChangeTimestamp))
+    {
+        LOG_INFO("Invalid Username/Password for [%s]", userName);
+        RecordLoginOutcome(userName, sourceKey, LOGIN_BAD_CREDENTIALS);
+        m_metrics.RecordSince(METRIC_OP_LOGIN, startNs);
+        callback(LOGIN_BAD_CREDENTIALS);
+        return true;
+    }
+
+    string source(sourceKey);
+    m_queuedLogins++;
+    bool queued = GetLoginPool().TrySubmit([this, userName, password, source, passwordHash, lastPasswordChangeTimestamp, callback, startNs]()
+    {
+        loginResult_t outcome = CheckLogin(userName, password, passwordHash, lastPasswordChangeTimestamp);
+        RecordLoginOutcome(userName, source, outcome);
+        m_metrics.RecordSince(METRIC_OP_LOGIN, startNs);
+        callback(outcome);
+        m_queuedLogins--;
+    });
+
+    if (!queued)
+    {
+        m_queuedLogins--;
+    }
+
+    return queued;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : ChangeExpiredPassword
+//
+// @description         : Replaces a password, typically after Login() reported LOGIN_PASSWORD_EXPIRED. The
+//                        current password has to be given again since the expired login did not
+//                        authenticate anybody. The new password is subject to the same checks as in
+//                        UpdateUserPassword(). The current password is throttled like a login.
+//
+// @param userName      : Username
+// @param currentPassword : Password which has expired
+// @param newPassword   : Password replacing it
+// @param sourceKey     : Where the request comes from, empty if unknown
+//
+// @returns             : True if the password was changed.
+//-------------------------------------------------------------------------------------------------------------
+bool AuthModule::ChangeExpiredPassword(const string & userName, const string & currentPassword, const string & newPassword,
+                                       string_view sourceKey)
+{
+    if (IsLoginThrottled(userName, sourceKey))
+    {
+        return false;
+    }
+
+    passwordHash_t passwordHash;
+    long long lastPasswordChangeTimestamp = 0;
+    if (!CopyCredentials(userName, passwordHash, lastPasswordChangeTimestamp) ||
+        !m_passwordHasher->Verify(currentPassword, passwordHash))
+    {
+        LOG_INFO("Invalid Username/Password for [%s]", userName);
+        RecordLoginOutcome(userName, sourceKey, LOGIN_BAD_CREDENTIALS);
+        return false;
+    }
+
+    RecordLoginOutcome(userName, sourceKey, LOGIN_OK);
+    return UpdateUserPassword(userName, newPassword);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : LoginWithSession
+//
+// @description         : Login() which also issues a session token on success. Further requests of the
+//                        client can then be authenticated with ValidateSession(), without the password.
+//                        The token carries the time of the user's last password change, read before the
+//                        password is checked: a change meanwhile leaves the token with the old one, which
+//                        no longer validates.
+//
+// @param userName      : Username
+// @param password      : password
+// @param sessionToken  : Receives the token if the login succeeded, else cleared
+// @param sourceKey     : Where the login comes from, empty if unknown
+//
+// @returns             : Outcome as returned by Login(). No token is issued for an expired password.
+//-------------------------------------------------------------------------------------------------------------
+loginResult_t AuthModule::LoginWithSession(const string & userName, const string & password, string & sessionToken,
+                                           string_view sourceKey)
+{
+    sessionToken.clear();
+    passwordHash_t passwordHash;
+    long long lastPasswordChangeTimestamp = 0;
+    CopyCredentials(userName, passwordHash, lastPasswordChangeTimestamp);
+    loginResult_t result = Login(userName, password, sourceKey);
+    if (result == LOGIN_OK && m_sessions->Issue(userName, (uint64_t)lastPasswordChangeTimestamp, sessionToken))
+    {
+        m_metrics.Count(METRIC_SESSIONS_ISSUED);
+    }
+
+    return result;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : ValidateSession
+//
+// @description         : Checks a session token issued by LoginWithSession(). The token is checked by its
+//                        signature and against the revoked sessions, then the user is looked up: a token
+//                        issued before the user's last password change is revoked, also when the change
+//                        was made before a restart. The password hasher is not involved.
+//
+// @param sessionToken  : Token
+// @param userName      : Receives the user the session belongs to, if it is valid
+//
+// @returns             : SESSION_OK if the session is valid, else why it is not.
+//-------------------------------------------------------------------------------------------------------------
+sessionResult_t AuthModule::ValidateSession(const string & sessionToken, string & userName)
+{
+    MetricsTimer timer(m_metrics, METRIC_OP_VALIDATE_SESSION);
+    uint64_t generation = 0;
+    sessionResult_t result = m_sessions->Validate(sessionToken, m_clock->Now(), userName, generation);
+    if (result == SESSION_OK)
+    {
+        passwordHash_t passwordHash;
+        long long lastPasswordChangeTimestamp = 0;
+        if (!CopyCredentials(userName, passwordHash, lastPasswordChangeTimestamp))
+        {
+            result = SESSION_INVALID;
+        }
+        else if ((uint64_t)lastPasswordChangeTimestamp != generation)
+        {
+            result = SESSION_REVOKED;
+        }
+
+        if (result != SESSION_OK)
+        {
+            userName.clear();
+        }
+    }
+
+    if (result != SESSION_OK)
+    {
+        m_metrics.Count(METRIC_SESSIONS_REJECTED);
+    }
+
+    return result;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : RevokeSession
+//
+// @description         : Ends a session, e.g. on logout. Its token is refused from then on.
+//
+// @returns             : False if the token was not valid anyway.
+//-------------------------------------------------------------------------------------------------------------
+bool AuthModule::RevokeSession(const string & sessionToken)
+{
+    return m_sessions->Revoke(sessionToken, m_clock->Now());
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : RevokeUserSessions
+//
+// @description         : Ends all sessions of a user opened so far. Done on every password change.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void AuthModule::RevokeUserSessions(const string & userName)
+{
+    m_sessions->RevokeUser(userName, m_clock->Now());
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : CopyCredentials
+//
+// @description         : Copies what a login is checked against, the current password hash and the time it
+//                        was set, under the shard lock.
+//
+// @returns             : True if the user exists.
+//-------------------------------------------------------------------------------------------------------------
+bool AuthModule::CopyCredentials(const string & userName, passwordHash_t & passwordHash, long long & lastPasswordChangeTimestamp)
+{
+    if (m_config.residentUsersMax > 0)
+    {
+        userData_t userData;
+        if (!GetUserDataCopy(userName, userData))
+        {
+            return false;
+        }
+
+        passwordHash = userData.passwordHash;
+        lastPasswordChangeTimestamp = userData.lastPasswordChangeTimestamp;
+        return true;
+    }
+
+    userData_t *userData = GetUserData(userName);
+    if (userData == nullptr)
+    {
+        return false;
+    }
+
+    shared_lock<shared_mutex> shardLock(GetShard(userName).lock);
+    passwordHash = userData->passwordHash;
+    lastPasswordChangeTimestamp = userData->lastPasswordChangeTimestamp;
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : CheckLogin
+//
+// @description         : Verifies a password against a copy of the user's credentials. A hash computed with
+//                        other parameters than the hasher's current ones is replaced.
+//
+// @returns             : Outcome as returned by Login()
+//-------------------------------------------------------------------------------------------------------------
+loginResult_t AuthModule::CheckLogin(const string & userName, const string & password, const passwordHash_t & passwordHash,
+                                     long long lastPasswordChangeTimestamp)
+{
+    if (!m_passwordHasher->Verify(password, passwordHash))
+    {
+        LOG_INFO("Invalid Username/Password for [%s]", userName);
+        return LOGIN_BAD_CREDENTIALS;
+    }
+
+    if (m_passwordHasher->NeedsRehash(passwordHash))
+    {
+        RehashPassword(userName, password, passwordHash);
+    }
+
+    if (IsPasswordExpired(lastPasswordChangeTimestamp))
+    {
+        LOG_INFO("Password of [%s] has expired. Please update!", userName);
+        return LOGIN_PASSWORD_EXPIRED;
+    }
+
+    LOG_DEBUG("User [%s] logged in", userName);
+    return LOGIN_OK;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : IsPasswordExpired
+//
+// @description         : Checks a password's age against passwordExpiryDays of the auth policy. Uses the
+//                        coarse clock, a password expires within a second of the exact time.
+//
+// @returns             : True if the password has expired.
+//-------------------------------------------------------------------------------------------------------------
+bool AuthModule::IsPasswordExpired(long long lastPasswordChangeTimestamp)
+{
+    if (m_authPolicy.passwordExpiryDays <= 0)
+    {
+        return false;
+    }
+
+    long long expirySeconds = (long long)m_authPolicy.passwordExpiryDays * 60 * 60 * 24;
+    return m_clock->Now() - lastPasswordChangeTimestamp >= expirySeconds;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : IsLoginThrottled
+//
+// @description         : Checks a login against the login throttle, before any lookup or hashing is done.
+//
+// @returns             : True if the login has to be refused as locked out.
+//-------------------------------------------------------------------------------------------------------------
+bool AuthModule::IsLoginThrottled(const string & userName, string_view sourceKey)
+{
+    if (m_loginThrottle == nullptr || !m_loginThrottle->IsLocked(userName, sourceKey, m_clock->Now()))
+    {
+        return false;
     }
 
-    // Close the file
-    m_fileStream.close();
+    m_metrics.Count(METRIC_LOGINS_THROTTLED);
+    LOG_INFO("Login of [%s] refused, too many failed attempts", userName);
     return true;
 }
 
 //-------------------------------------------------------------------------------------------------------------
-// @name                : LoadUsersDataFile
+// @name                : RecordLoginOutcome
 //
-// @description         : This function is called by the Initialize() function. It must be called after the
-//                        construction of AuthModule. This is responsible for fetching records already registered
-//                        in the users database file. If this is not called, existing users' record will be
-//                        discarded.
+// @description         : Reports the outcome of a verified login to the login throttle. Bad credentials count
+//                        as a failure of the username and the source; valid ones, expired or not, clear the
+//                        username's failures.
 //
-// @returns             : True if data from users database file were read successfully and no
-//                        ambiguity was found. 
-//                        False otherwise.
+// @returns             : Nothing
 //-------------------------------------------------------------------------------------------------------------
-bool AuthModule::LoadUsersDataFile()
+void AuthModule::RecordLoginOutcome(const string & userName, string_view sourceKey, loginResult_t result)
 {
-    m_fileStream.open(m_usersDataFile, ios::in | ios::binary);
-    if (!m_fileStream)
+    if (m_loginThrottle == nullptr)
     {
-        printf("File [ %s ] NOT found!\n", m_usersDataFile.c_str());
-        return false;
+        return;
     }
 
-    // Read authentication policy details
-    authPolicy_t fileAuthPolicy;
-    m_fileStream >> fileAuthPolicy.passwordHistoryMax;
-    m_fileStream >> fileAuthPolicy.passwordLenMax;
-    m_fileStream >> fileAuthPolicy.passwordLenMin;
-    m_fileStream >> fileAuthPolicy.useStrongPasswords;
-    m_fileStream >> fileAuthPolicy.passwordExpiryDays;
-
-    // Validate it against the policy being used by this module.
-    bool isAuthPolicyConsistent = (m_authPolicy.passwordHistoryMax == fileAuthPolicy.passwordHistoryMax &&
-                                   m_authPolicy.passwordLenMax == fileAuthPolicy.passwordLenMax &&
-                                   m_authPolicy.passwordLenMin == fileAuthPolicy.passwordLenMin &&
-                                   m_authPolicy.useStrongPasswords == fileAuthPolicy.useStrongPasswords &&
-                                   m_authPolicy.passwordExpiryDays == fileAuthPolicy.passwordExpiryDays);
-
-    // Proceed only if both are same.
-    if (isAuthPolicyConsistent)
+    if (result == LOGIN_BAD_CREDENTIALS)
     {
-        size_t totalRegisteredUsers = 0;
-        m_fileStream >> totalRegisteredUsers;
-
-        for (size_t i = 0; i < totalRegisteredUsers; i++)
-        {
-            userData_t *userData = new userData_t;
-            memset(userData, 0, sizeof(userData));
-
-            m_fileStream >> userData->lastPasswordChangeTimestamp;
-            m_fileStream >> userData->name;
-            m_fileStream >> userData->password;
-            m_fileStream >> userData->passwordHash;
-
-            for (unsigned i = 0; i < m_authPolicy.passwordHistoryMax - 1; i++)
-            {
-                string pwd;
-                m_fileStream >> pwd;
-                userData->prevPasswords.push_back(pwd);
-            }
-
-            m_usersDataMap[userData->name] = userData;
-            printf("User [%s] read from file\n", userData->name.c_str());
-        }
+        m_loginThrottle->RecordFailure(userName, sourceKey, m_clock->Now());
     }
-    else
+    else if (result == LOGIN_OK || result == LOGIN_PASSWORD_EXPIRED)
     {
-        printf("ERROR: Inconsistency in auth policy\n");
+        m_loginThrottle->RecordSuccess(userName, m_clock->Now());
     }
-
-    m_isUsersDataLoaded = true;
-    
-    // Close the file
-    m_fileStream.close();
-
-    return true;
 }
 
 //-------------------------------------------------------------------------------------------------------------
-// @name                : GetUserData
-//
-// @description         : Checks in the map for a given username. 
+// @name                : GetLoginPool
 //
-// @param userName      : Username that needs to be checked.
+// @description         : Worker pool for asynchronous logins, the configured one or one started on first use.
 //
-// @returns             : user's data for the provided userName.
-//                        NULL if userName is not present in records.
+// @returns             : Login worker pool
 //-------------------------------------------------------------------------------------------------------------
-userData_t* AuthModule::GetUserData(const string & userName)
+ThreadPool & AuthModule::GetLoginPool()
 {
-    userData_t *userData = nullptr;
-    auto it = m_usersDataMap.find(userName);
-    if (it != m_usersDataMap.end())
+    if (!m_ownsLoginPool)
     {
-        userData = it->second;
+        return *m_loginPool;
     }
 
-    return userData;
+    call_once(m_loginPoolOnce, [this]()
+    {
+        unsigned workers = m_config.loginWorkers;
+        if (workers == 0)
+        {
+            workers = thread::hardware_concurrency();
+        }
+        m_loginPool = new ThreadPool(workers, m_config.loginQueueCapacity);
+    });
+
+    return *m_loginPool;
 }
 
 //-------------------------------------------------------------------------------------------------------------
-// @name                : AddNewUser
+// @name                : RehashPassword
 //
-// @description         : Add new user details to record. If user is registered, this
-//                        information is updated in the users database as well.
+// @description         : Hashes a verified password again with the hasher's current parameters. This is how
+//                        a change of the work factor reaches existing users. The salt, password change
+//                        timestamp and history are left untouched.
 //
-// @param userName      : Username to add
-// @param password      : Password that is to be used
+// @param oldHash       : Hash the password was verified against
 //
-// @returns             : true if user was added successfully.
+// @returns             : Nothing
 //-------------------------------------------------------------------------------------------------------------
-bool AuthModule::AddNewUser(const string & userName, const string & password)
+void AuthModule::RehashPassword(const string & userName, const string & password, const passwordHash_t & oldHash)
 {
-    userData_t *userData = nullptr;
-    bool retval = false;
-    hash<string> str_hash;
-
-    userData = GetUserData(userName);
-    if (userData == nullptr)
+    // Up to the primary, a replica takes the new hash from its journal
+    if (m_config.storageMode == STORAGE_MODE_REPLICA)
     {
-        // User not already present, add entry.
-        userData = new userData_t;
-        memset(userData, 0, sizeof(userData));
+        return;
+    }
 
-        userData->lastPasswordChangeTimestamp = time(&userData->lastPasswordChangeTimestamp);
-        userData->name = userName;
-        userData->password = password;
-        userData->passwordHash = str_hash(password);
+    passwordHash_t passwordHash;
+    m_passwordHasher->HashWithSalt(password, oldHash.salt, passwordHash);
 
-        m_usersDataMap[userName] = userData;
-        printf("User [%s] registered\n", userData->name.c_str());
-        retval = true;
-    }
-    else 
+    userShard_t & shard = GetShard(userName);
+    unique_lock<shared_mutex> shardLock(shard.lock);
+    userData_t *userData = GetUserDataLocked(shard, userName);
+    if (userData == nullptr ||
+        memcmp(userData->passwordHash.digest, oldHash.digest, PASSWORD_DIGEST_LEN) != 0)
     {
-        printf("User [%s] already exists\n", userName.c_str());
+        return;
     }
 
-    // Update the file only if the user was registered successfully.
-    if (retval == true)
+    PreserveFrozenRecord(shard, userData);
+    userData->passwordHash = passwordHash;
+    if (!PersistUserData(userData, shardLock))
+        LOG_ERROR("Failed to update Users database!");
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Register
+//
+// @description         : Lets add new user to database subject to validity of username and password.
+//
+// @param userName      : Username
+// @param password      : password
+//
+// @returns             : True if user is registered successfully,
+//                        False otherwise.
+//-------------------------------------------------------------------------------------------------------------
+bool AuthModule::Register(const string & userName, const string & password)
+{
+    MetricsTimer timer(m_metrics, METRIC_OP_REGISTER);
+    bool userRegistered = false;
+    if (ValidatePassword(userName, password))
     {
-        bool fileUpdated = UpdateUsersDataFile();
-        if (!fileUpdated)
-            printf("Failed to update Users database!\n");
+        userRegistered = AddNewUser(userName, password);
     }
-
-    return retval;
+    
+    return userRegistered;
 }
 
 //-------------------------------------------------------------------------------------------------------------
-// @name                : UpdateUserPassword
+// @name                : RegisterBatch
 //
-// @description         : This is used to update password for an already existing user. Validations are done
-//                        for existence of the user, validity of password as per auth policy.
+// @description         : Registers many users at once. All entries are validated and their passwords hashed
+//                        in parallel on the login pool first, then inserted shard by shard with one table
+//                        reservation per shard, and the users database is persisted once for the whole batch:
+//                        a single journal write, or a single snapshot rewrite.
+//                        Shards receiving users stay locked (in shard order) until the batch is journaled,
+//                        so no later update of a new user can reach the journal ahead of its registration.
+//
+// @param users         : Pairs of username and password
+// @param results       : Outcome for each entry of users, in the same order
 //
-// @returns             :
+// @returns             : No. of users registered
 //-------------------------------------------------------------------------------------------------------------
-bool AuthModule::UpdateUserPassword(const string & userName, const string & password)
+size_t AuthModule::RegisterBatch(const vector<pair<string, string>> & users, vector<registerResult_t> & results)
 {
-    userData_t *userData = GetUserData(userName);
-    bool retval = false;
-
-    if (userData == nullptr)
+    bool isJournaled = (m_config.storageMode == STORAGE_MODE_JOURNAL);
+    if (m_config.storageMode == STORAGE_MODE_REPLICA)
     {
-        printf("User [%s] not found!\n", userName.c_str());
-        return retval;
+        LOG_ERROR("Replica can not register %zu user(s)", users.size());
+        results.assign(users.size(), REGISTER_READ_ONLY);
+        return 0;
     }
 
-    if (ValidatePassword(userName, password) && IsPasswordValidAsPerHistory(userName, password))
+    results.assign(users.size(), REGISTER_OK);
+
+    // Validate all entries and group the valid ones by shard
+    vector<vector<size_t>> shardEntries(m_shardCount);
+    userData_t existing;
+    for (size_t i = 0; i < users.size(); i++)
     {
-        // Store in previous passwords history
-        if (userData->prevPasswords.size() == m_authPolicy.passwordHistoryMax - 1 /* -1 because current password is already included*/)
+        if (users[i].first.empty())
+        {
+            results[i] = REGISTER_INVALID_USERNAME;
+        }
+        else if (!ValidatePassword(users[i].first, users[i].second))
+        {
+            results[i] = REGISTER_INVALID_PASSWORD;
+        }
+        else if (GetUserDataCopy(users[i].first, existing))
+        {
+            results[i] = REGISTER_USER_EXISTS;
+        }
+        else
         {
-            userData->prevPasswords.pop_front();
+            shardEntries[GetShardIndex(users[i].first)].push_back(i);
         }
+    }
 
-        userData->prevPasswords.push_back(userData->password);
+    // Hash the passwords of the valid entries on the login pool, whose workers take entries as they become
+    // free. The caller takes entries too, so the batch is hashed even if no worker gets to it, e.g. when the
+    // caller is one of them; it then waits only for the workers which took entries.
+    vector<passwordHash_t> passwordHashes(users.size());
+    shared_ptr<batchHashing_t> hashing = make_shared<batchHashing_t>();
+    hashing->nextEntry = 0;
+    hashing->entryCount = users.size();
+    hashing->activeWorkers = 0;
+    auto hashEntries = [this, hashing, &users, &results, &passwordHashes]()
+    {
+        for (size_t i = hashing->nextEntry++; i < hashing->entryCount; i = hashing->nextEntry++)
+        {
+            if (results[i] == REGISTER_OK)
+            {
+                m_passwordHasher->Hash(users[i].second, passwordHashes[i]);
+            }
+        }
+    };
 
-        // Update password
-        userData->password = password;
-        userData->lastPasswordChangeTimestamp = time(&userData->lastPasswordChangeTimestamp);
-        m_usersDataMap[userName] = userData;
-        printf("Password updated for [%s]\n", userData->name.c_str());
-        retval = true;
+    ThreadPool & pool = GetLoginPool();
+    for (size_t i = 1; i < users.size() && i <= pool.GetWorkerCount(); i++)
+    {
+        bool queued = pool.TrySubmit([hashing, hashEntries]()
+        {
+            {
+                lock_guard<mutex> hashingLock(hashing->lock);
+                hashing->activeWorkers++;
+            }
+            hashEntries();
+            lock_guard<mutex> hashingLock(hashing->lock);
+            if (--hashing->activeWorkers == 0)
+            {
+                hashing->idle.notify_all();
+            }
+        });
+        if (!queued)
+            break;
     }
 
-    // Update the file only if the user was registered successfully.
-    if (retval == true)
+    hashEntries();
     {
-        bool fileUpdated = UpdateUsersDataFile();
-        if (!fileUpdated)
-            printf("Failed to update Users database!\n");
+        unique_lock<mutex> hashingLock(hashing->lock);
+        hashing->idle.wait(hashingLock, [&hashing]() { return hashing->activeWorkers == 0; });
     }
 
-    return retval;
-}
+    // Insert in one pass
+    vector<unique_lock<shared_mutex>> shardLocks;
+    string frames;
+    size_t registered = 0;
+    for (unsigned shardIndex = 0; shardIndex < m_shardCount; shardIndex++)
+    {
+        vector<size_t> & entries = shardEntries[shardIndex];
+        if (entries.empty())
+            continue;
 
-//-------------------------------------------------------------------------------------------------------------
-// @name                : Login
-//
-// @description         : This function helps to check if provided userName and password match as per records.
-//                        On successfull login, if auth policy requires password expiry validation it will also
-//                        enforce updation of password if current password has expired.
-// 
-// @param userName      : Username
-// @param password      : password
-//
-// @returns             : True if Username and password matches
-//                        False otherwise.
-//-------------------------------------------------------------------------------------------------------------
-bool AuthModule::Login(const string & userName, const string & password)
-{
-    userData_t *userData = GetUserData(userName);
-    if (userData)
+        userShard_t & shard = m_shards[shardIndex];
+        shardLocks.emplace_back(shard.lock);
+        shard.usersTable.Reserve(shard.usersTable.Size() + entries.size());
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            const string & userName = users[entries[i]].first;
+            if (GetUserDataLocked(shard, userName) != nullptr)
+            {
+                results[entries[i]] = REGISTER_USER_EXISTS;
+                continue;
+            }
+
+            userData_t *userData = CreateUserLocked(shard, userName, passwordHashes[entries[i]]);
+            if (isJournaled)
+            {
+                EncodeJournalFrame(frames, userData);
+            }
+            registered++;
+        }
+    }
+
+    // Persist once for the whole batch
+    if (registered > 0)
     {
-        if (userData->password == password)
+        bool fileUpdated = true;
+        if (isJournaled)
+        {
+            uint64_t syncPoint = 0;
+            fileUpdated = AppendJournalFrames(frames, (unsigned)registered, syncPoint);
+            shardLocks.clear();
+            fileUpdated = fileUpdated && SyncJournal(syncPoint);
+            if (IsCompactionDue())
+            {
+                CompactJournal(true);
+            }
+        }
+        else
         {
-            printf("User [%s] logged in\n", userName.c_str());
-            return HandlePasswordExpiry(userData);
+            shardLocks.clear();
+            fileUpdated = UpdateUsersDataFile();
         }
+
+        if (!fileUpdated)
+            LOG_ERROR("Failed to update Users database!");
+
+        RebuildNegativeFilter();
     }
 
-    printf("Invalid Username/Password\n");
-    return false;
+    LOG_INFO("Registered %zu of %zu user(s)", registered, users.size());
+    return registered;
 }
 
 //-------------------------------------------------------------------------------------------------------------
-// @name                : Register
+// @name                : ImportUsersCsv
 //
-// @description         : Lets add new user to database subject to validity of username and password.
+// @description         : Registers the users listed in a CSV file with RegisterBatch(). Each line holds a
+//                        username and a password separated by a comma. Empty lines, lines starting with '#'
+//                        and a leading "username,password" header are skipped. A line without a comma is
+//                        reported as an invalid username.
 //
-// @param userName      : Username
-// @param password      : password
+// @param csvFile       : File to be imported
+// @param results       : Outcome for each imported line, in file order
 //
-// @returns             : True if user is registered successfully,
-//                        False otherwise.
+// @returns             : No. of users registered
 //-------------------------------------------------------------------------------------------------------------
-bool AuthModule::Register(const string & userName, const string & password)
+size_t AuthModule::ImportUsersCsv(const string & csvFile, vector<registerResult_t> & results)
 {
-    bool userRegistered = false;
-    if (ValidatePassword(userName, password))
+    ifstream in(csvFile, ios::in);
+    if (!in)
     {
-        userRegistered = AddNewUser(userName, password);
+        LOG_ERROR("File [ %s ] NOT found!", csvFile);
+        results.clear();
+        return 0;
     }
-    
-    return userRegistered;
+
+    vector<pair<string, string>> users;
+    string line;
+    bool isFirstLine = true;
+    while (getline(in, line))
+    {
+        if (!line.empty() && line[line.size() - 1] == '\r')
+        {
+            line.erase(line.size() - 1);
+        }
+
+        bool isHeader = isFirstLine && (line == "username,password");
+        isFirstLine = false;
+        if (line.empty() || line[0] == '#' || isHeader)
+            continue;
+
+        size_t comma = line.find(',');
+        if (comma == string::npos)
+        {
+            users.push_back(make_pair(string(), string()));
+        }
+        else
+        {
+            users.push_back(make_pair(line.substr(0, comma), line.substr(comma + 1)));
+        }
+    }
+
+    return RegisterBatch(users, results);
 }
 
 //-------------------------------------------------------------------------------------------------------------
@@ -372,42 +3267,32 @@ void AuthModule::ShowUsersDetails()
     printf("+-------------------------------------------------------------------------+\n");
     printf("|                     Registered Users' Details                           |\n");
     printf("+-------------------------------------------------------------------------+\n");
+    MaterializeAllUsers();
+    vector<shared_lock<shared_mutex>> shardLocks;
+    LockAllShards(shardLocks);
     if (1)
     {
         int index = 1;
-        for (auto it = m_usersDataMap.begin(); it != m_usersDataMap.end(); it++)
-        {
-            userData_t *userData = it->second;
-            printf("User #%3d\n", index);
-            printf("Username                     : %s\n", userData->name.c_str());
-            printf("Password                     : %s\n", userData->password.c_str());
-            printf("Password last updated        : %.2lf day(s) ago\n", DaysFromTimestamp(time(0) - userData->lastPasswordChangeTimestamp));
-            printf("Previous passwords           : ");
-            if (userData->prevPasswords.size())
+        for (unsigned shardIndex = 0; shardIndex < m_shardCount; shardIndex++)
+        {
+            UserTable & usersTable = m_shards[shardIndex].usersTable;
+            for (size_t i = 0; i < usersTable.Size(); i++)
             {
-                for (auto it2 = userData->prevPasswords.begin(); it2 != userData->prevPasswords.end(); it2++)
-                {
-                    if ((*it2) != NO_PASSWORD_IDENTIFIER)
-                    {
-                        printf("%s ", (*it2).c_str());
-                    }
-                    else
-                    {
-                        printf("- ");
-                    }
-                }
+                userData_t *userData = usersTable.GetRecord(i);
+                printf("User #%3d\n", index);
+                printf("Username                     : %.*s\n", (int)userData->name.size(), userData->name.data());
+                const passwordHash_t & hash = userData->passwordHash;
+                printf("Password hash                : %s, %u iterations, %02x%02x%02x%02x...\n",
+                       GetPasswordHashAlgorithmName(hash.algorithm), hash.iterations, hash.digest[0], hash.digest[1],
+                       hash.digest[2], hash.digest[3]);
+                printf("Password last updated        : %.2lf day(s) ago\n", DaysFromTimestamp(time(0) - userData->lastPasswordChangeTimestamp));
+                printf("Previous passwords           : %u stored\n", (unsigned)userData->prevPasswords.count);
                 printf("\n");
-            }
-            else
-            {
-                printf("- ");
-            }
 
-            printf("\n");
-
-            index++;
+                index++;
+            }
         }
-        printf("\n** Users registered: %u\n", m_usersDataMap.size());
+        printf("\n** Users registered: %d\n", index - 1);
     }
 }
 
@@ -421,19 +3306,23 @@ void AuthModule::ShowUsersDetails()
 //-------------------------------------------------------------------------------------------------------------
 bool AuthModule::ValidatePassword(const string & userName, const string & password)
 {
-    if (m_authPolicy.useStrongPasswords)
+    if (!m_isPolicyValid)
     {
-        if (password.length() > m_authPolicy.passwordLenMax ||
-            password.length() < m_authPolicy.passwordLenMin)
-        {
-            printf("Password for [%s] does not meet length criteria\n", userName.c_str());
-            return false;
-        }
-
-        // TODO: special chars, numerics etc. requirement
+        LOG_ERROR("Password for [%s] rejected, the auth policy is invalid", userName);
+        return false;
     }
 
-    return true;
+    switch (m_passwordValidator.Check(password))
+    {
+    case PASSWORD_CHECK_OK:
+        return true;
+    case PASSWORD_CHECK_LENGTH:
+        LOG_INFO("Password for [%s] does not meet length criteria", userName);
+        return false;
+    default:
+        LOG_INFO("Password for [%s] does not meet character criteria", userName);
+        return false;
+    }
 }
 
 //-------------------------------------------------------------------------------------------------------------
@@ -447,82 +3336,128 @@ bool AuthModule::ValidatePassword(const string & userName, const string & passwo
 //-------------------------------------------------------------------------------------------------------------
 bool AuthModule::IsPasswordValidAsPerHistory(const string & userName, const string & password)
 {
-    userData_t *userData = GetUserData(userName);
-    if (userData)
+    userData_t userData;
+    passwordHistoryBuffer_t history;
+    if (!GetUserDataCopy(userName, userData, &history))
+    {
+        // Not a valid user/password
+        LOG_INFO("Invalid username provided for password history check!");
+        return false;
+    }
+
+    passwordHash_t passwordHash;
+    return IsPasswordValidAsPerHistory(userData, password, passwordHash);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : IsPasswordValidAsPerHistory
+//
+// @description         : History check of IsPasswordValidAsPerHistory() against a copy of the user's record.
+//                        All passwords of a user are hashed with the salt of the first one, so the password
+//                        is derived once with the parameters of the current hash and that digest is compared
+//                        against the current one and the whole history in one pass. Only entries computed
+//                        with other parameters (an older work factor, or a salt of their own from before
+//                        salts were shared) cost a derivation of their own, one per distinct set.
+//
+// @param passwordHash  : Receives the hash to be stored for password if it passes, with the user's salt and
+//                        the hasher's current parameters
+//
+// @returns             : True if valid. False otherwise.
+//-------------------------------------------------------------------------------------------------------------
+bool AuthModule::IsPasswordValidAsPerHistory(const userData_t & userData, const string & password,
+                                             passwordHash_t & passwordHash)
+{
+    const passwordHistory_t & history = userData.prevPasswords;
+    uint64_t unchecked = (m_authPolicy.passwordHistoryMax > 0 && history.count > 0) ?
+                         (~0ull >> (64 - history.count)) : 0;
+
+    // If current password is same as password being set, don't allow it
+    passwordHash_t derived = userData.passwordHash;
+    bool isDerived = m_passwordHasher->Derive(password, derived);
+    if (isDerived && ConstantTimeEquals(derived.digest, userData.passwordHash.digest, PASSWORD_DIGEST_LEN))
+    {
+        LOG_INFO("Current and new password cannot be the same");
+        return false;
+    }
+
+    // Check previous passwords history, entries sharing the current hash's parameters first
+    bool isReused = isDerived && MatchPasswordHistory(history, derived, unchecked);
+    while (!isReused && unchecked != 0)
     {
-        // If current password is same as password being set, don't allow it
-        if (userData->password == password)
+        passwordHash_t entryDerived = GetPasswordHistoryEntry(history, (unsigned)__builtin_ctzll(unchecked));
+        if (m_passwordHasher->Derive(password, entryDerived))
         {
-            printf("Current and new password cannot be the same\n");
-            return false;
+            isReused = MatchPasswordHistory(history, entryDerived, unchecked);
         }
-
-        // Check previous passwords history
-        if (m_authPolicy.passwordHistoryMax > 0)
+        else
         {
-            for (auto it = userData->prevPasswords.begin(); it != userData->prevPasswords.end(); it++)
-            {
-                if (*it == password)
-                {
-                    printf("Password for [%s] does not meet history requirement\n", userName.c_str());
-                    return false;
-                }
-            }
+            // Not computed by this hasher, can not be compared
+            unchecked &= unchecked - 1;
         }
     }
-    else
+
+    if (isReused)
     {
-        // Not a valid user/password
-        printf("Invalid username provided for password history check!\n");
+        LOG_INFO("Password for [%s] does not meet history requirement", userData.name);
         return false;
     }
 
-    // All validations passed, this password is valis as per history requirement
+    // All validations passed, this password is valid as per history requirement. The digest derived above
+    // is the new hash unless the current one is due for a rehash.
+    if (isDerived && !m_passwordHasher->NeedsRehash(userData.passwordHash))
+    {
+        passwordHash = derived;
+    }
+    else
+    {
+        m_passwordHasher->HashWithSalt(password, userData.passwordHash.salt, passwordHash);
+    }
     return true;
 }
 
 //-------------------------------------------------------------------------------------------------------------
-// @name                : HandlePasswordExpiry
+// @name                : GetRegisteredUsers
 //
-// @description         : It checks if the given user's password has expired. If yes, then he is prompted
-//                        to update the password.
+// @description         : Counts the users in all shards plus those still only in the mapped snapshot.
 //
-// @returns             : True if password updated.
+// @returns             : No. of registered users
 //-------------------------------------------------------------------------------------------------------------
-bool AuthModule::HandlePasswordExpiry(userData_t *userData)
+size_t AuthModule::GetRegisteredUsers()
 {
-    if (m_authPolicy.passwordExpiryDays > 0)
+    size_t registeredUsers = 0;
+    for (unsigned i = 0; i < m_shardCount; i++)
     {
-        time_t currentTs = time(&currentTs);
-        double days = DaysFromTimestamp(currentTs - userData->lastPasswordChangeTimestamp);
-        if (days >= m_authPolicy.passwordExpiryDays)
-        {
-            printf("Password has expired. Please update!\n");
-            bool passwordUpdated = false;
-            string newPassword;
-            string pwd1;
-            string pwd2;
+        shared_lock<shared_mutex> shardLock(m_shards[i].lock);
+        registeredUsers += m_shards[i].usersTable.Size();
+    }
 
-            do
-            {
-                printf("\n** Password Update\n");
-                printf("New password     : ");
-                cin >> pwd1;
-                printf("Confirm password : ");
-                cin >> pwd2;
-                if (pwd1 == pwd2)
-                {
-                    if (UpdateUserPassword(userData->name, pwd2))
-                    {
-                        newPassword = pwd2;
-                        passwordUpdated = true;
-                    }
-                }
-            } while (!passwordUpdated);
-        }
+    return registeredUsers + m_snapshotPending;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetMemoryUsage
+//
+// @description         : Memory held for the users: the users' tables, the snapshot's residency flags and
+//                        the negative lookup filter, plus the fixed size metrics and login throttle tables.
+//                        The mapped users database is not counted, its pages are the OS's to drop.
+//
+// @returns             : Bytes
+//-------------------------------------------------------------------------------------------------------------
+size_t AuthModule::GetMemoryUsage()
+{
+    size_t bytes = m_snapshotResident.capacity() + m_metrics.GetMemoryUsage();
+    if (m_loginThrottle != nullptr)
+    {
+        bytes += m_loginThrottle->GetMemoryUsage();
+    }
+    for (unsigned i = 0; i < m_shardCount; i++)
+    {
+        shared_lock<shared_mutex> shardLock(m_shards[i].lock);
+        bytes += m_shards[i].usersTable.GetMemoryUsage() + m_shards[i].userCache.GetMemoryUsage();
     }
 
-    return true;
+    BloomFilter *filter = m_negativeFilter.load(memory_order_acquire);
+    return bytes + ((filter != nullptr) ? filter->GetMemoryUsage() : 0);
 }
 
 //-------------------------------------------------------------------------------------------------------------
@@ -536,4 +3471,31 @@ double AuthModule::DaysFromTimestamp(long long ts)
 {
     double days = (double)ts / (60 * 60 * 24);
     return days;
-}
\ No newline at end of file
+}
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetMetrics
+//
+// @description         : Counters and latency histograms recorded since the module was constructed. Can be
+//                        called at any time from any thread, it takes no lock.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void AuthModule::GetMetrics(metricsSnapshot_t & snapshot)
+{
+    m_metrics.GetSnapshot(snapshot);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : DumpMetrics
+//
+// @description         : Appends a text dump of GetMetrics() to out.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void AuthModule::DumpMetrics(string & out)
+{
+    // Too large for the stack of the caller
+    unique_ptr<metricsSnapshot_t> snapshot(new metricsSnapshot_t);
+    m_metrics.GetSnapshot(*snapshot);
+    FormatMetrics(*snapshot, out);
+}
@@ -1,13 +1,31 @@
 #ifndef _AUTH_MODULE_H_
 #define _AUTH_MODULE_H_
 #include <fstream>
+#include<atomic>
+#include<condition_variable>
+#include<functional>
+#include<future>
 #include<iostream>
-#include<list>
-#include<unordered_map>
+#include<memory>
+#include<mutex>
+#include<shared_mutex>
+#include<stdint.h>
 #include<stdio.h>
 #include<string>
+#include<sys/types.h>
+#include<thread>
 #include<time.h>
+#include<unordered_map>
 #include<vector>
+#include "bloom_filter.h"
+#include "coarse_clock.h"
+#include "login_throttle.h"
+#include "metrics.h"
+#include "password_hasher.h"
+#include "password_policy.h"
+#include "session_tokens.h"
+#include "thread_pool.h"
+#include "user_table.h"
 
 using namespace std;
 
@@ -15,28 +33,112 @@ using namespace std;
 // Globals
 //-------------------------------------------------------------------------------------------------------------
 const string USERS_DATA_FILENAME = "users.db";
+const string USERS_JOURNAL_FILENAME = "users.journal";
+const string NEGATIVE_FILTER_SUFFIX = ".filter";
 const string NO_PASSWORD_IDENTIFIER = "~^~";
+const unsigned DEFAULT_COMPACTION_THRESHOLD = 1024;
+const unsigned DEFAULT_SHARD_COUNT = 16;
+const size_t DEFAULT_LOGIN_QUEUE_CAPACITY = 1024;
+const size_t NEGATIVE_FILTER_MIN_CAPACITY = 1024;
+const unsigned DEFAULT_GROUP_COMMIT_MICROS = 2000;
+const uint64_t LOAD_CHUNK_MIN_USERS = 16384;   // Users per chunk when the snapshot is decoded in parallel
+const unsigned DEFAULT_REPLICA_POLL_MILLIS = 20;
+const size_t REPLICA_READ_LEN = 64 * 1024;
+const size_t FROZEN_CHUNK_RECORDS = 4096;     // Records of a shard copied per lock while persisting
 //-------------------------------------------------------------------------------------------------------------
-// Structs
+// Enums
 //-------------------------------------------------------------------------------------------------------------
-typedef struct userData_tag
+typedef enum storageMode_tag
+{
+    STORAGE_MODE_SNAPSHOT,                    // Every mutation rewrites the complete users database file
+    STORAGE_MODE_JOURNAL,                     // Every mutation appends one record to the journal
+    STORAGE_MODE_REPLICA                      // Read only, the journal of a primary in journal mode is followed
+                                              // and applied as it grows. Mutations are refused
+}storageMode_t;
+
+typedef enum durability_tag
 {
-    string name;
-    string password;
-    unsigned passwordHash;
-    long long lastPasswordChangeTimestamp;
-    list<string> prevPasswords;
-}userData_t;
+    DURABILITY_FLUSH,                         // Writes are handed to the OS, they survive a crash of the process
+                                              // but not of the machine
+    DURABILITY_GROUP,                         // Mutations wait for an fdatasync() shared by all mutations of up
+                                              // to groupCommitMicros, one sync per interval under load
+    DURABILITY_SYNC                           // Mutations wait for an fdatasync() started right away, shared only
+                                              // by mutations which are already waiting
+}durability_t;
 
+typedef enum registerResult_tag
+{
+    REGISTER_OK,                              // User registered
+    REGISTER_INVALID_USERNAME,                // Empty username
+    REGISTER_INVALID_PASSWORD,                // Password does not meet the auth policy
+    REGISTER_USER_EXISTS,                     // Already registered, or repeated within the batch
+    REGISTER_READ_ONLY                        // The module is a replica
+}registerResult_t;
+
+typedef enum loginResult_tag
+{
+    LOGIN_OK,                                 // Credentials valid
+    LOGIN_BAD_CREDENTIALS,                    // Unknown user or wrong password
+    LOGIN_PASSWORD_EXPIRED,                   // Credentials valid but the password must be changed first,
+                                              // see ChangeExpiredPassword()
+    LOGIN_LOCKED                              // Too many failed logins of the user or from the source,
+}loginResult_t;                               // refused without checking the password
+
+//-------------------------------------------------------------------------------------------------------------
+// Structs
+//-------------------------------------------------------------------------------------------------------------
 typedef struct authPolicy_tag
 {
-    bool useStrongPasswords;                  // If true, password will be checked for length and special character requirements
+    bool useStrongPasswords;                  // If true, password must be passwordLenMin to passwordLenMax bytes,
+                                              // with a lowercase and an uppercase letter, a digit and a special
+                                              // character (non ASCII counts as special), and no control characters
     unsigned passwordHistoryMax;              // Maximum number of passwords which needs to be validated as per history requirement
     unsigned passwordLenMin;                  // Minimum password length
     unsigned passwordLenMax;                  // Maximum length of password
     int passwordExpiryDays;                   // Days after which the current password will expire. 
 }authPolicy_t;
 
+typedef struct authModuleConfig_tag
+{
+    storageMode_t storageMode;                // How mutations are persisted to the users database
+    unsigned compactionThreshold;             // Journal records after which a background compaction is started
+    unsigned shardCount;                      // Number of independently locked partitions of the users' table
+    PasswordHasher *passwordHasher;           // Hasher for passwords, not owned. NULL to use PBKDF2 with
+    uint32_t hashIterations;                  // this many iterations
+    ThreadPool *loginPool;                    // Pool verifying asynchronous logins, not owned. NULL to start one
+    unsigned loginWorkers;                    // with this many threads, 0 for one per core,
+    size_t loginQueueCapacity;                // and this many logins waiting for a worker before callers are held back
+    bool useNegativeLookupFilter;             // Reject lookups of unknown users with a Bloom filter, persisted
+                                              // next to the users database
+    bool useLoginThrottle;                    // Lock out usernames and sources after repeated failed logins
+    loginThrottlePolicy_t throttlePolicy;     // as per this policy
+    unsigned sessionLifetimeSeconds;          // Validity of session tokens issued by LoginWithSession()
+    string sessionKey;                        // Secret session tokens are signed with. Empty for a random one,
+                                              // tokens then do not survive a restart
+    durability_t durability;                  // When a mutation counts as persisted
+    unsigned groupCommitMicros;               // Time a group commit waits for more mutations to join
+    unsigned loadWorkers;                     // Threads decoding the users database when all of it is needed,
+                                              // 0 for one per core
+    string dataDirectory;                     // Directory of the users database files, empty for the working
+                                              // directory
+    size_t residentUsersMax;                  // Unchanged users of the users database kept decoded for reads,
+                                              // the rest stays on disk. 0 to keep every user looked up
+    string replicaSource;                     // Journal or pipe a replica follows, empty for the journal in
+                                              // dataDirectory
+    unsigned replicaPollMillis;               // Time a replica waits for more records once it has caught up
+}authModuleConfig_t;
+
+typedef struct userShard_tag
+{
+    shared_mutex lock;                        // Shared for lookups, exclusive for inserts and updates
+    UserTable usersTable;
+    UserCache userCache;                      // Unchanged users read from the snapshot, with residentUsersMax
+    size_t frozenSize;                        // Records in the table when the users being persisted were
+                                              // frozen, 0 if they are not
+    unordered_map<const userData_t*, string> frozenRecords;  // Those records as they were then, encoded,
+                                                             // of the ones changed in place since
+}userShard_t;
+
 //-------------------------------------------------------------------------------------------------------------
 // Auth Module class
 //-------------------------------------------------------------------------------------------------------------
@@ -45,27 +147,155 @@ class AuthModule
 private:
     string                                  m_usersDataFile;
     authPolicy_t                            m_authPolicy;
+    PasswordValidator                       m_passwordValidator;         // Checks of new passwords, as per m_authPolicy
+    bool                                    m_isPolicyValid;             // False to accept no password at all
     bool                                    m_isUsersDataLoaded;
-    fstream                                 m_fileStream;
-    unordered_map<string, userData_t*>      m_usersDataMap;              // Map of name and user data
+    userShard_t                            *m_shards;                    // Table of users, by shard
+    unsigned                                m_shardCount;
+    unsigned                                m_historyCapacity;           // Previous passwords kept per user
+    authModuleConfig_t                      m_config;
+    mutex                                   m_persistLock;               // Taken after shard locks, never before
+    string                                  m_journalFile;
+    int                                     m_journalFd;                 // -1 until the first append
+    atomic<unsigned>                        m_journalRecords;            // Records appended since last compaction
+    uint64_t                                m_journalWrites;             // Appends so far, under the persist lock
+    uint64_t                                m_journalId;                 // Of the active (or followed) journal, 0
+                                                                         // until it has been started
+    uint64_t                                m_previousJournalId;         // Journal set aside last
+    mutex                                   m_syncLock;                  // Never held while taking another lock
+    condition_variable                      m_syncCond;
+    bool                                    m_isSyncRunning;
+    uint64_t                                m_journalSynced;             // Appends known to be on disk
+    atomic<uint64_t>                        m_syncFailedFrom;            // Appends after this one are not
+                                                                         // durable, ~0 if no sync failed.
+                                                                         // Cleared by a compaction
+    uint64_t                                m_syncFailedTo;              // Last append of a failed sync
+    atomic<uint64_t>                        m_snapshotChanges;           // Mutations applied in snapshot mode
+    mutex                                   m_snapshotWriterLock;        // Taken before shard locks, never after
+    mutex                                   m_freezeLock;                // Taken after the writer lock and before
+                                                                         // shard locks; needed to freeze the users
+    vector<uint8_t>                         m_frozenResident;            // m_snapshotResident when frozen
+    uint64_t                                m_snapshotWritten;           // Mutations in the file, under the writer lock
+    thread                                  m_compactionThread;
+    atomic<bool>                            m_isCompactionRunning;
+    const char                             *m_snapshotData;              // Read only mapping of users database
+    size_t                                  m_snapshotSize;
+    uint64_t                                m_snapshotUsers;
+    uint64_t                                m_snapshotIndexOffset;
+    vector<uint8_t>                         m_snapshotResident;          // Snapshot users already in the table
+    atomic<size_t>                          m_snapshotPending;           // Snapshot users not yet in the table
+    uint32_t                                m_snapshotVersion;
+    authPolicy_t                            m_snapshotPolicy;            // Policy the snapshot was written under
+    PasswordHasher                         *m_passwordHasher;
+    bool                                    m_ownsPasswordHasher;
+    ThreadPool                             *m_loginPool;                 // Started on first asynchronous login
+    once_flag                               m_loginPoolOnce;
+    bool                                    m_ownsLoginPool;
+    atomic<unsigned>                        m_queuedLogins;              // Logins of this module in a shared pool
+    CoarseClock                            *m_clock;                     // Time for expiry checks
+    AuthMetrics                             m_metrics;
+    atomic<BloomFilter*>                    m_negativeFilter;            // Every known user is in it, NULL if not used
+    vector<BloomFilter*>                    m_retiredFilters;            // Replaced filters, lookups may still hold them
+    mutex                                   m_filterLock;                // Serializes rebuilds of the filter
+    string                                  m_filterFile;
+    LoginThrottle                          *m_loginThrottle;             // NULL if logins are not throttled
+    SessionTokens                          *m_sessions;
+    string                                  m_replicaSource;
+    int                                     m_replicaFd;                 // -1 while there is nothing to follow
+    ino_t                                   m_replicaInode;              // File behind m_replicaFd, 0 for a pipe
+    string                                  m_replicaPending;            // Read but not applied, a partial frame
+    thread                                  m_replicaThread;
+    mutex                                   m_replicaLock;
+    condition_variable                      m_replicaCond;
+    bool                                    m_isReplicaStopping;         // Under the replica lock
+
+    size_t HashUserName(string_view userName);
+    unsigned GetShardIndex(string_view userName);
+    userShard_t & GetShard(string_view userName);
+    void LockAllShards(vector<shared_lock<shared_mutex>> & locks);
+    userData_t* GetUserData(const string & userName);
+    userData_t* FindUserLocked(userShard_t & shard, const string & userName);
+    userData_t* GetUserDataLocked(userShard_t & shard, const string & userName);
+    userData_t* CreateUserLocked(userShard_t & shard, const string & userName, const passwordHash_t & passwordHash);
+    bool CopyCredentials(const string & userName, passwordHash_t & passwordHash, long long & lastPasswordChangeTimestamp);
+    loginResult_t CheckLogin(const string & userName, const string & password, const passwordHash_t & passwordHash,
+                             long long lastPasswordChangeTimestamp);
+    bool IsPasswordExpired(long long lastPasswordChangeTimestamp);
+    bool IsLoginThrottled(const string & userName, string_view sourceKey);
+    void RecordLoginOutcome(const string & userName, string_view sourceKey, loginResult_t result);
+    ThreadPool & GetLoginPool();
+    void FreezeUsers();
+    void PreserveFrozenRecord(userShard_t & shard, const userData_t *userData);
+    void SerializeUsersData(string & out);
+    bool WriteUsersDataFile();
+    bool MapUsersDataFile();
+    void UnmapUsersDataFile();
+    bool MigrateUsersDataFile();
+    bool FindSnapshotUser(const string & userName, uint64_t & index);
+    bool DecodeSnapshotUser(uint64_t index, userData_t & record);
+    userData_t* MaterializeSnapshotUser(userShard_t & shard, uint64_t index);
+    void MaterializeAllUsers();
+    bool IsPasswordValidAsPerHistory(const userData_t & userData, const string & password, passwordHash_t & passwordHash);
+    void RehashPassword(const string & userName, const string & password, const passwordHash_t & oldHash);
+    bool PersistUserData(userData_t *userData, unique_lock<shared_mutex> & shardLock);
+    bool AppendJournalRecord(userData_t *userData, uint64_t & syncPoint);
+    void EncodeJournalFrame(string & frames, userData_t *userData);
+    bool AppendJournalFrames(const string & frames, unsigned records, uint64_t & syncPoint);
+    void RecordSyncFailure(uint64_t syncedBefore, uint64_t target);
+    void ClearSyncFailure(uint64_t compactedThrough);
+    bool IsCompactionDue();
+    bool SyncJournal(uint64_t syncPoint);
+    bool ReplaceFile(const string & path, const string & data, bool isDurable);
+    bool ReplayJournalFile(const string & journalFile);
+    size_t ApplyJournalFrames(const char *frames, size_t len, size_t & recordsApplied);
+    void ApplyJournalStart(uint64_t journalId, uint64_t previousId);
+    void ApplyJournalRecord(userData_t & record);
+    void CatchUpReplica(uint64_t previousId);
+    bool OpenReplicaSource();
+    size_t FollowReplicaSource();
+    void RunReplica();
+    bool CompactJournal(bool runInBackground);
+    bool IsUnknownUser(size_t nameHash);
+    void InitializeNegativeFilter();
+    void RebuildNegativeFilter();
+    void RebuildNegativeFilterLocked();
+    void SerializeNegativeFilter(string & out, const string & snapshot);
+    bool WriteNegativeFilterFile(const string & data);
 
 public:
-    AuthModule(authPolicy_t authPolicy);
+    AuthModule(authPolicy_t authPolicy, authModuleConfig_t config = GetDefaultAuthModuleConfig());
     ~AuthModule();
+    static authModuleConfig_t GetDefaultAuthModuleConfig();
+    static bool ReplaceFile(const string & path, const string & data, bool isSynced, AuthMetrics *metrics);
+    static bool IsPolicyValid(const authPolicy_t & authPolicy);
     void Initialize();
     bool UpdateUsersDataFile();
     bool LoadUsersDataFile();
-    userData_t* GetUserData(const string & userName);
+    bool GetUserDataCopy(const string & userName, userData_t & userData, passwordHistoryBuffer_t *history = nullptr);
     bool AddNewUser(const string & userName, const string & password);
     bool UpdateUserPassword(const string & userName, const string & password);
-    bool Login(const string & userName, const string & password);
+    loginResult_t Login(const string & userName, const string & password, string_view sourceKey = string_view());
+    future<loginResult_t> LoginAsync(const string & userName, const string & password, string_view sourceKey = string_view());
+    bool LoginAsync(const string & userName, const string & password, function<void(loginResult_t)> callback,
+                    string_view sourceKey = string_view());
+    bool ChangeExpiredPassword(const string & userName, const string & currentPassword, const string & newPassword,
+                               string_view sourceKey = string_view());
+    loginResult_t LoginWithSession(const string & userName, const string & password, string & sessionToken,
+                                   string_view sourceKey = string_view());
+    sessionResult_t ValidateSession(const string & sessionToken, string & userName);
+    bool RevokeSession(const string & sessionToken);
+    void RevokeUserSessions(const string & userName);
     bool Register(const string & userName, const string & password);
+    size_t RegisterBatch(const vector<pair<string, string>> & users, vector<registerResult_t> & results);
+    size_t ImportUsersCsv(const string & csvFile, vector<registerResult_t> & results);
     void ShowUsersDetails();
     bool ValidatePassword(const string & userName, const string & password);
     bool IsPasswordValidAsPerHistory(const string & userName, const string & password);
-    size_t GetRegisteredUsers() { return m_usersDataMap.size(); }
+    size_t GetRegisteredUsers();
+    size_t GetMemoryUsage();
     double DaysFromTimestamp(long long ts);
-    bool HandlePasswordExpiry(userData_t *userData);
+    void GetMetrics(metricsSnapshot_t & snapshot);
+    void DumpMetrics(string & out);
 };
 
 #endif
@@ -0,0 +1,304 @@
+#include "auth_protocol.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+//-------------------------------------------------------------------------------------------------------------
+// Globals
+//-------------------------------------------------------------------------------------------------------------
+const int AUTH_LISTEN_BACKLOG = 1024;
+const size_t AUTH_SHORT_STRING_MAX = 0xFFFF;
+
+//-------------------------------------------------------------------------------------------------------------
+// Helpers for the little endian encoding
+//-------------------------------------------------------------------------------------------------------------
+static void PutFrameHeader(string & out, size_t payloadLen)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        out.push_back((char)((payloadLen >> (8 * i)) & 0xFF));
+    }
+}
+
+// The callers check the length, a longer string would not fit the u16
+static void PutShortString(string & out, const string & str)
+{
+    out.push_back((char)(str.size() & 0xFF));
+    out.push_back((char)((str.size() >> 8) & 0xFF));
+    out.append(str);
+}
+
+static bool GetShortString(const char *payload, size_t len, size_t & pos, string & str)
+{
+    if (pos + 2 > len)
+        return false;
+
+    size_t strLen = (uint8_t)payload[pos] | ((size_t)(uint8_t)payload[pos + 1] << 8);
+    if (pos + 2 + strLen > len)
+        return false;
+
+    // assign() keeps the string's capacity, so a reused request does not allocate
+    str.assign(payload + pos + 2, strLen);
+    pos += 2 + strLen;
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : EncodeAuthRequest
+//
+// @description         : Appends the frame of a request to out. A string longer than its u16 length can
+//                        describe is not truncated; the request is refused and out is left as it was.
+//
+// @returns             : True if the request was appended.
+//-------------------------------------------------------------------------------------------------------------
+bool EncodeAuthRequest(string & out, const authRequest_t & request)
+{
+    bool hasNewPassword = (request.op == AUTH_OP_UPDATE_PASSWORD);
+    if (request.userName.size() > AUTH_SHORT_STRING_MAX || request.password.size() > AUTH_SHORT_STRING_MAX ||
+        (hasNewPassword && request.newPassword.size() > AUTH_SHORT_STRING_MAX))
+        return false;
+
+    size_t payloadLen = 1 + 2 + request.userName.size() + 2 + request.password.size();
+    if (hasNewPassword)
+    {
+        payloadLen += 2 + request.newPassword.size();
+    }
+
+    PutFrameHeader(out, payloadLen);
+    out.push_back((char)request.op);
+    PutShortString(out, request.userName);
+    PutShortString(out, request.password);
+    if (hasNewPassword)
+    {
+        PutShortString(out, request.newPassword);
+    }
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : DecodeAuthRequest
+//
+// @description         : Decodes the payload of a request frame. The strings of request are reused.
+//
+// @returns             : True if the payload is a well formed request.
+//-------------------------------------------------------------------------------------------------------------
+bool DecodeAuthRequest(const char *payload, size_t len, authRequest_t & request)
+{
+    size_t pos = 1;
+    if (len < 1)
+        return false;
+
+    request.op = (uint8_t)payload[0];
+    if (!GetShortString(payload, len, pos, request.userName) || !GetShortString(payload, len, pos, request.password))
+        return false;
+
+    if (request.op == AUTH_OP_UPDATE_PASSWORD && !GetShortString(payload, len, pos, request.newPassword))
+        return false;
+
+    return pos == len;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : EncodeAuthResponse / DecodeAuthResponse
+//
+// @description         : Frame of a response, and decoding of its payload. The session token is only sent
+//                        if not empty; the variant without one skips it. A token longer than its u16 length
+//                        can describe is refused like a long request string.
+//-------------------------------------------------------------------------------------------------------------
+bool EncodeAuthResponse(string & out, authStatus_t status, const string & sessionToken)
+{
+    if (sessionToken.size() > AUTH_SHORT_STRING_MAX)
+        return false;
+
+    PutFrameHeader(out, sessionToken.empty() ? 1 : 1 + 2 + sessionToken.size());
+    out.push_back((char)status);
+    if (!sessionToken.empty())
+    {
+        PutShortString(out, sessionToken);
+    }
+    return true;
+}
+
+bool DecodeAuthResponse(const char *payload, size_t len, authStatus_t & status)
+{
+    if (len < 1)
+        return false;
+
+    size_t tokenLen = (len >= 3) ? ((uint8_t)payload[1] | ((size_t)(uint8_t)payload[2] << 8)) : 0;
+    if (len != 1 && len != 3 + tokenLen)
+        return false;
+
+    status = (authStatus_t)(uint8_t)payload[0];
+    return true;
+}
+
+bool DecodeAuthResponse(const char *payload, size_t len, authStatus_t & status, string & sessionToken)
+{
+    size_t pos = 1;
+    if (len < 1)
+        return false;
+
+    status = (authStatus_t)(uint8_t)payload[0];
+    sessionToken.clear();
+    return len == 1 || (GetShortString(payload, len, pos, sessionToken) && pos == len);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : PeekAuthFrame
+//
+// @description         : Reads the payload length of the frame at the start of data.
+//
+// @returns             : True if data holds a complete frame header.
+//-------------------------------------------------------------------------------------------------------------
+bool PeekAuthFrame(const char *data, size_t len, uint32_t & payloadLen)
+{
+    if (len < AUTH_FRAME_HEADER_SIZE)
+        return false;
+
+    payloadLen = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        payloadLen |= (uint32_t)(uint8_t)data[i] << (8 * i);
+    }
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : ParseAuthEndpoint
+//
+// @description         : Applies one endpoint command line option: -s <unix socket path>, -a <IPv4 address>
+//                        or -p <TCP port>.
+//
+// @returns             : True if option is an endpoint option with a valid value.
+//-------------------------------------------------------------------------------------------------------------
+bool ParseAuthEndpoint(const char *option, const char *value, authEndpoint_t & endpoint)
+{
+    if (strcmp(option, "-s") == 0)
+    {
+        endpoint.unixPath = value;
+        return !endpoint.unixPath.empty() && endpoint.unixPath.size() < sizeof(((sockaddr_un *)0)->sun_path);
+    }
+    else if (strcmp(option, "-a") == 0)
+    {
+        in_addr address;
+        endpoint.host = value;
+        return inet_pton(AF_INET, value, &address) == 1;
+    }
+    else if (strcmp(option, "-p") == 0)
+    {
+        unsigned long port = strtoul(value, nullptr, 10);
+        endpoint.port = (uint16_t)port;
+        return port > 0 && port <= 0xFFFF;
+    }
+
+    return false;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : OpenAuthSocket
+//
+// @description         : Creates a socket for an endpoint and fills its address.
+//
+// @returns             : Socket, -1 on failure
+//-------------------------------------------------------------------------------------------------------------
+static int OpenAuthSocket(const authEndpoint_t & endpoint, sockaddr_storage & address, socklen_t & addressLen)
+{
+    memset(&address, 0, sizeof(address));
+    if (!endpoint.unixPath.empty())
+    {
+        sockaddr_un *unixAddress = (sockaddr_un *)&address;
+        unixAddress->sun_family = AF_UNIX;
+        strncpy(unixAddress->sun_path, endpoint.unixPath.c_str(), sizeof(unixAddress->sun_path) - 1);
+        addressLen = sizeof(sockaddr_un);
+        return socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    }
+
+    sockaddr_in *inetAddress = (sockaddr_in *)&address;
+    inetAddress->sin_family = AF_INET;
+    inetAddress->sin_port = htons(endpoint.port);
+    inet_pton(AF_INET, endpoint.host.c_str(), &inetAddress->sin_addr);
+    addressLen = sizeof(sockaddr_in);
+    return socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : ListenAuthEndpoint
+//
+// @description         : Creates a non blocking listening socket. A stale unix socket file is replaced.
+//
+// @returns             : Socket, -1 on failure
+//-------------------------------------------------------------------------------------------------------------
+int ListenAuthEndpoint(const authEndpoint_t & endpoint)
+{
+    sockaddr_storage address;
+    socklen_t addressLen = 0;
+    int fd = OpenAuthSocket(endpoint, address, addressLen);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    int enable = 1;
+    if (endpoint.unixPath.empty())
+    {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    }
+    else
+    {
+        // Only a stale socket is replaced, never a file that happens to have the same path
+        struct stat status;
+        if (lstat(endpoint.unixPath.c_str(), &status) == 0 && S_ISSOCK(status.st_mode))
+        {
+            unlink(endpoint.unixPath.c_str());
+        }
+    }
+
+    if (bind(fd, (sockaddr *)&address, addressLen) != 0 || listen(fd, AUTH_LISTEN_BACKLOG) != 0 ||
+        fcntl(fd, F_SETFL, O_NONBLOCK) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : ConnectAuthEndpoint
+//
+// @description         : Connects a blocking socket to an endpoint. Nagle's algorithm is disabled on TCP,
+//                        requests are small and pipelined.
+//
+// @returns             : Socket, -1 on failure
+//-------------------------------------------------------------------------------------------------------------
+int ConnectAuthEndpoint(const authEndpoint_t & endpoint)
+{
+    sockaddr_storage address;
+    socklen_t addressLen = 0;
+    int fd = OpenAuthSocket(endpoint, address, addressLen);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    if (connect(fd, (sockaddr *)&address, addressLen) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    if (endpoint.unixPath.empty())
+    {
+        int enable = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    }
+
+    return fd;
+}
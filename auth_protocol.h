@@ -0,0 +1,81 @@
+#ifndef _AUTH_PROTOCOL_H_
+#define _AUTH_PROTOCOL_H_
+#include<stddef.h>
+#include<stdint.h>
+#include<string>
+
+using namespace std;
+
+//-------------------------------------------------------------------------------------------------------------
+// Wire protocol of auth_server (all integers little endian)
+//
+//   Frame    : payload length (u32), payload
+//   Request  : opcode (u8), username, password, new password (AUTH_OP_UPDATE_PASSWORD only)
+//   Response : status (u8), session token (AUTH_OP_LOGIN_SESSION with AUTH_STATUS_OK only)
+//   String   : length (u16), bytes
+//
+// The session operations carry the token in place of the password.
+//
+// A client may send any no. of requests without waiting; responses come back in request order.
+//-------------------------------------------------------------------------------------------------------------
+const uint32_t AUTH_FRAME_HEADER_SIZE = 4;
+const uint32_t AUTH_FRAME_MAX_PAYLOAD = 4096;
+const uint16_t AUTH_DEFAULT_PORT = 7878;
+
+//-------------------------------------------------------------------------------------------------------------
+// Enums
+//-------------------------------------------------------------------------------------------------------------
+typedef enum authOp_tag
+{
+    AUTH_OP_LOGIN = 1,                        // Login()
+    AUTH_OP_REGISTER = 2,                     // Register()
+    AUTH_OP_UPDATE_PASSWORD = 3,              // UpdateUserPassword(), authenticated by the current password
+    AUTH_OP_LOGIN_SESSION = 4,                // LoginWithSession(), the response carries the session token
+    AUTH_OP_VALIDATE_SESSION = 5,             // ValidateSession(), the session must belong to the username
+    AUTH_OP_REVOKE_SESSION = 6                // RevokeSession(), i.e. logout
+}authOp_t;
+
+typedef enum authStatus_tag
+{
+    AUTH_STATUS_OK = 0,
+    AUTH_STATUS_BAD_CREDENTIALS = 1,          // Unknown user or wrong password, or a session which is not valid
+    AUTH_STATUS_PASSWORD_EXPIRED = 2,         // Login only, the password has to be updated
+    AUTH_STATUS_REJECTED = 3,                 // Registration or update refused by the auth policy
+    AUTH_STATUS_BAD_REQUEST = 4,              // Malformed request or unknown opcode
+    AUTH_STATUS_LOCKED = 5,                   // Too many failed logins of the user or from the client's address
+    AUTH_STATUS_BUSY = 6                      // The server's workers are all busy, the request was not run; retry
+}authStatus_t;
+
+//-------------------------------------------------------------------------------------------------------------
+// Structs
+//-------------------------------------------------------------------------------------------------------------
+typedef struct authRequest_tag
+{
+    uint8_t op;
+    string userName;
+    string password;
+    string newPassword;
+}authRequest_t;
+
+typedef struct authEndpoint_tag
+{
+    string unixPath;                          // Unix domain socket if not empty, else TCP
+    string host;                              // IPv4 address
+    uint16_t port;
+}authEndpoint_t;
+
+//-------------------------------------------------------------------------------------------------------------
+// Functions
+//-------------------------------------------------------------------------------------------------------------
+bool EncodeAuthRequest(string & out, const authRequest_t & request);
+bool DecodeAuthRequest(const char *payload, size_t len, authRequest_t & request);
+bool EncodeAuthResponse(string & out, authStatus_t status, const string & sessionToken = string());
+bool DecodeAuthResponse(const char *payload, size_t len, authStatus_t & status);
+bool DecodeAuthResponse(const char *payload, size_t len, authStatus_t & status, string & sessionToken);
+bool PeekAuthFrame(const char *data, size_t len, uint32_t & payloadLen);
+
+bool ParseAuthEndpoint(const char *option, const char *value, authEndpoint_t & endpoint);
+int ListenAuthEndpoint(const authEndpoint_t & endpoint);
+int ConnectAuthEndpoint(const authEndpoint_t & endpoint);
+
+#endif
@@ -0,0 +1,713 @@
+#include "auth_module.h"
+#include "auth_protocol.h"
+#include "logger.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <unordered_set>
+
+//-------------------------------------------------------------------------------------------------------------
+// Network front end of AuthModule. Serves Login, Register, password updates and sessions over the protocol
+// of auth_protocol.h, on TCP or a unix domain socket. Session tokens are signed with a random key, they
+// end when the server is restarted.
+//
+// Usage: auth_server [-a address] [-p port] [-s unix socket path] [-t event loop threads]
+//                    [-w request worker threads] [-i hash iterations] [-q 1] [-l 0] [-d flush|group|sync] [-r 1]
+//        -q 1 logs only warnings and errors.
+//        -l 0 turns off the lockout of usernames and client addresses after repeated failed logins.
+//        -d answers registrations and password updates only once they are synced to disk, group by
+//           group or each right away. Defaults to group.
+//        -r 1 serves logins as a read only replica of the server running in the same directory, following
+//           its journal; registrations and password updates are rejected.
+//
+// Every event loop thread has its own epoll instance and serves its connections one request at a time,
+// in the order the requests arrived, so pipelined responses need no reordering. The listening socket is
+// shared with EPOLLEXCLUSIVE, which wakes a single loop per incoming connection. Connection buffers are
+// kept for the life of the connection, and so are the strings each request is decoded into.
+//
+// Requests which hash a password or wait for the disk (logins, registrations and password updates) run on
+// a pool of request workers, which the module also uses for its asynchronous logins. The connection is
+// left alone by its loop meanwhile; the worker hands it back through the loop's eventfd and the loop then
+// sends the response and goes on with the connection's next request. Session checks run on the loop. With
+// the worker queue full, such a request is not run and answered with AUTH_STATUS_BUSY, so that the loop
+// never blocks on hashing or the disk.
+//
+// A client which shuts down its sending side still gets the responses to all the requests it sent; the
+// connection is closed once they are written.
+//-------------------------------------------------------------------------------------------------------------
+const unsigned MAX_EPOLL_EVENTS = 64;
+const int EPOLL_TIMEOUT_MS = 500;
+const size_t CONNECTION_READ_SIZE = 16 * 1024;
+const size_t CONNECTION_MAX_PENDING_OUTPUT = 1024 * 1024;
+
+//-------------------------------------------------------------------------------------------------------------
+// Structs
+//-------------------------------------------------------------------------------------------------------------
+typedef struct connection_tag
+{
+    struct eventLoop_tag *loop;               // Loop serving the connection
+    int fd;
+    string peer;                              // Client's address, the source key of its logins
+    string in;                                // Received bytes, in[inStart, inEnd) not yet handled
+    size_t inStart;
+    size_t inEnd;
+    string out;                               // Responses, out[outStart, end) not yet sent
+    size_t outStart;
+    authRequest_t request;                    // Reused for every request of the connection
+    string sessionToken;                      // Token issued by the current request, if any
+    string sessionUser;                       // User of the session the current request presents
+    uint32_t events;                          // Events currently registered with epoll
+    bool isBusy;                              // Current request runs on a worker, which owns the request
+                                              // fields until it hands the connection back
+    bool isClosed;                            // Peer went away while busy, freed once the request is back
+    bool isReadClosed;                        // Peer sent all its requests, closed once they are answered
+    authStatus_t status;                      // Of the request run on a worker
+}connection_t;
+
+typedef struct eventLoop_tag
+{
+    AuthModule *auth;
+    ThreadPool *workers;
+    int epollFd;
+    int wakeFd;                               // eventfd, signalled by workers when requests are done
+    mutex lock;
+    vector<connection_t*> completed;          // Under the lock, connections handed back by workers
+    unsigned busyConnections;                 // Loop thread only
+}eventLoop_t;
+
+static atomic<bool> g_isStopping(false);           // Lock free, so safe to set from a signal handler
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : HandleSignal
+//
+// @description         : SIGINT / SIGTERM handler, asks the event loops to stop.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void HandleSignal(int)
+{
+    g_isStopping = true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : HandleRequest
+//
+// @description         : Runs the connection's current request against the module.
+//
+// @returns             : Status to be sent back, along with conn.sessionToken if that is not empty
+//-------------------------------------------------------------------------------------------------------------
+authStatus_t HandleRequest(AuthModule & auth, connection_t & conn)
+{
+    const authRequest_t & request = conn.request;
+    loginResult_t result = LOGIN_BAD_CREDENTIALS;
+    switch (request.op)
+    {
+    case AUTH_OP_LOGIN:
+    case AUTH_OP_LOGIN_SESSION:
+        if (request.op == AUTH_OP_LOGIN)
+            result = auth.Login(request.userName, request.password, conn.peer);
+        else
+            result = auth.LoginWithSession(request.userName, request.password, conn.sessionToken, conn.peer);
+
+        switch (result)
+        {
+        case LOGIN_OK:               return AUTH_STATUS_OK;
+        case LOGIN_PASSWORD_EXPIRED: return AUTH_STATUS_PASSWORD_EXPIRED;
+        case LOGIN_LOCKED:           return AUTH_STATUS_LOCKED;
+        default:                     return AUTH_STATUS_BAD_CREDENTIALS;
+        }
+
+    case AUTH_OP_REGISTER:
+        return auth.Register(request.userName, request.password) ? AUTH_STATUS_OK : AUTH_STATUS_REJECTED;
+
+    case AUTH_OP_UPDATE_PASSWORD:
+        return auth.ChangeExpiredPassword(request.userName, request.password, request.newPassword, conn.peer) ?
+               AUTH_STATUS_OK : AUTH_STATUS_REJECTED;
+
+    case AUTH_OP_VALIDATE_SESSION:
+        return (auth.ValidateSession(request.password, conn.sessionUser) == SESSION_OK &&
+                conn.sessionUser == request.userName) ? AUTH_STATUS_OK : AUTH_STATUS_BAD_CREDENTIALS;
+
+    case AUTH_OP_REVOKE_SESSION:
+        return (auth.ValidateSession(request.password, conn.sessionUser) == SESSION_OK &&
+                conn.sessionUser == request.userName && auth.RevokeSession(request.password)) ?
+               AUTH_STATUS_OK : AUTH_STATUS_BAD_CREDENTIALS;
+
+    default:
+        return AUTH_STATUS_BAD_REQUEST;
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : IsWorkerRequest
+//
+// @description         : Requests which hash a password or may wait for the disk, these are not run on the
+//                        event loop.
+//
+// @returns             : True if the request has to run on a worker.
+//-------------------------------------------------------------------------------------------------------------
+bool IsWorkerRequest(const authRequest_t & request)
+{
+    return request.op == AUTH_OP_LOGIN || request.op == AUTH_OP_LOGIN_SESSION || request.op == AUTH_OP_REGISTER ||
+           request.op == AUTH_OP_UPDATE_PASSWORD;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : SubmitRequest
+//
+// @description         : Runs the connection's current request, one of IsWorkerRequest(), on a worker. The
+//                        worker hands the connection back to its loop when done, see CompleteRequests().
+//
+// @returns             : True if the request was handed to a worker, false if the worker queue is full.
+//-------------------------------------------------------------------------------------------------------------
+bool SubmitRequest(connection_t & conn)
+{
+    connection_t *pending = &conn;
+    conn.isBusy = true;
+    bool isSubmitted = conn.loop->workers->TrySubmit([pending]()
+    {
+        eventLoop_t *loop = pending->loop;
+        pending->status = HandleRequest(*loop->auth, *pending);
+        {
+            lock_guard<mutex> guard(loop->lock);
+            loop->completed.push_back(pending);
+        }
+        uint64_t one = 1;
+        if (write(loop->wakeFd, &one, sizeof(one)) != (ssize_t)sizeof(one))
+        {
+            LOG_ERROR("Could not wake event loop: %s", strerror(errno));
+        }
+    });
+
+    if (!isSubmitted)
+    {
+        conn.isBusy = false;
+        return false;
+    }
+
+    conn.loop->busyConnections++;
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : HandleFrames
+//
+// @description         : Handles every complete request frame in the connection's input and appends the
+//                        responses to its output, up to a request handed to a worker. A request for the
+//                        workers which finds their queue full is answered with AUTH_STATUS_BUSY. Consumed
+//                        input is dropped without moving the rest unless the buffer runs out of room.
+//
+// @returns             : False if the peer sent a frame which is too large, or a response cannot be encoded.
+//-------------------------------------------------------------------------------------------------------------
+bool HandleFrames(connection_t & conn)
+{
+    uint32_t payloadLen = 0;
+    while (!conn.isBusy && PeekAuthFrame(conn.in.data() + conn.inStart, conn.inEnd - conn.inStart, payloadLen))
+    {
+        if (payloadLen > AUTH_FRAME_MAX_PAYLOAD)
+        {
+            return false;
+        }
+
+        if (conn.inEnd - conn.inStart < AUTH_FRAME_HEADER_SIZE + payloadLen)
+        {
+            break;
+        }
+
+        // The request is copied out of the frame, so the frame is consumed right away
+        const char *payload = conn.in.data() + conn.inStart + AUTH_FRAME_HEADER_SIZE;
+        authStatus_t status = AUTH_STATUS_BAD_REQUEST;
+        conn.sessionToken.clear();
+        bool isDecoded = DecodeAuthRequest(payload, payloadLen, conn.request);
+        conn.inStart += AUTH_FRAME_HEADER_SIZE + payloadLen;
+        if (isDecoded && !IsWorkerRequest(conn.request))
+        {
+            status = HandleRequest(*conn.loop->auth, conn);
+        }
+        else if (isDecoded)
+        {
+            if (SubmitRequest(conn))
+            {
+                break;
+            }
+            status = AUTH_STATUS_BUSY;
+        }
+        if (!EncodeAuthResponse(conn.out, status, conn.sessionToken))
+        {
+            return false;
+        }
+    }
+
+    if (conn.inStart == conn.inEnd)
+    {
+        conn.inStart = 0;
+        conn.inEnd = 0;
+    }
+    else if (conn.in.size() - conn.inEnd < CONNECTION_READ_SIZE)
+    {
+        memmove(&conn.in[0], conn.in.data() + conn.inStart, conn.inEnd - conn.inStart);
+        conn.inEnd -= conn.inStart;
+        conn.inStart = 0;
+    }
+
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : ReadConnection
+//
+// @description         : Reads what is available and handles the complete requests. At the end of the input
+//                        the connection stops reading; it stays open until its responses are written.
+//
+// @returns             : False if the connection has to be closed.
+//-------------------------------------------------------------------------------------------------------------
+bool ReadConnection(connection_t & conn)
+{
+    if (conn.in.size() - conn.inEnd < CONNECTION_READ_SIZE)
+    {
+        conn.in.resize(conn.inEnd + CONNECTION_READ_SIZE);
+    }
+
+    ssize_t len = recv(conn.fd, &conn.in[conn.inEnd], conn.in.size() - conn.inEnd, 0);
+    if (len == 0)
+    {
+        conn.isReadClosed = true;
+        return true;
+    }
+    if (len < 0 && errno != EAGAIN && errno != EINTR)
+    {
+        return false;
+    }
+
+    if (len > 0)
+    {
+        conn.inEnd += (size_t)len;
+        return HandleFrames(conn);
+    }
+
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : WriteConnection
+//
+// @description         : Sends as much of the pending output as the socket takes.
+//
+// @returns             : False if the connection has to be closed.
+//-------------------------------------------------------------------------------------------------------------
+bool WriteConnection(connection_t & conn)
+{
+    while (conn.outStart < conn.out.size())
+    {
+        ssize_t len = send(conn.fd, conn.out.data() + conn.outStart, conn.out.size() - conn.outStart, MSG_NOSIGNAL);
+        if (len < 0)
+        {
+            return errno == EAGAIN || errno == EINTR;
+        }
+        conn.outStart += (size_t)len;
+    }
+
+    conn.out.clear();
+    conn.outStart = 0;
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : IsConnectionDone
+//
+// @description         : A connection whose peer sent its last request is done once no request is on a
+//                        worker and all the responses are written. An incomplete frame left in its input
+//                        is never answered.
+//
+// @returns             : True if the connection can be closed.
+//-------------------------------------------------------------------------------------------------------------
+bool IsConnectionDone(const connection_t & conn)
+{
+    return conn.isReadClosed && !conn.isBusy && conn.outStart == conn.out.size();
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : UpdateEvents
+//
+// @description         : Waits for writability only while output is pending, and stops reading while too
+//                        much output is pending, which pushes back on a client that does not read, while
+//                        a request of the connection runs on a worker, or once the peer sent its last
+//                        request. The peer's shutdown is only of interest while reading, as it is seen by
+//                        the read then; a closed socket is still reported by EPOLLERR / EPOLLHUP.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void UpdateEvents(int epollFd, connection_t & conn)
+{
+    size_t pending = conn.out.size() - conn.outStart;
+    uint32_t events = 0;
+    if (pending < CONNECTION_MAX_PENDING_OUTPUT && !conn.isBusy && !conn.isReadClosed)
+    {
+        events |= EPOLLIN | EPOLLRDHUP;
+    }
+    if (pending > 0)
+    {
+        events |= EPOLLOUT;
+    }
+
+    if (events != conn.events)
+    {
+        epoll_event event;
+        event.events = events;
+        event.data.ptr = &conn;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, conn.fd, &event);
+        conn.events = events;
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : AcceptConnections
+//
+// @description         : Accepts all pending connections into this event loop. Clients on a unix domain
+//                        socket have no address, their logins are throttled by username only.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void AcceptConnections(eventLoop_t & loop, int listenFd, unordered_set<connection_t*> & connections)
+{
+    while (true)
+    {
+        sockaddr_storage address;
+        socklen_t addressLen = sizeof(address);
+        int fd = accept4(listenFd, (sockaddr *)&address, &addressLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            return;
+        }
+
+        int enable = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+        connection_t *conn = new connection_t();
+        conn->loop = &loop;
+        conn->fd = fd;
+        char peer[INET_ADDRSTRLEN];
+        if (address.ss_family == AF_INET &&
+            inet_ntop(AF_INET, &((sockaddr_in *)&address)->sin_addr, peer, sizeof(peer)) != nullptr)
+        {
+            conn->peer = peer;
+        }
+        conn->inStart = 0;
+        conn->inEnd = 0;
+        conn->outStart = 0;
+        conn->events = EPOLLIN | EPOLLRDHUP;
+        conn->isBusy = false;
+        conn->isClosed = false;
+        conn->isReadClosed = false;
+
+        epoll_event event;
+        event.events = conn->events;
+        event.data.ptr = conn;
+        if (epoll_ctl(loop.epollFd, EPOLL_CTL_ADD, fd, &event) != 0)
+        {
+            close(fd);
+            delete conn;
+            continue;
+        }
+        connections.insert(conn);
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : CloseConnection
+//
+// @description         : Closes a connection, which also removes it from epoll. One with a request on a
+//                        worker is only taken out of epoll, it is closed once the request is back.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void CloseConnection(connection_t *conn, unordered_set<connection_t*> & connections)
+{
+    if (conn->isBusy)
+    {
+        if (!conn->isClosed)
+        {
+            epoll_ctl(conn->loop->epollFd, EPOLL_CTL_DEL, conn->fd, nullptr);
+            conn->isClosed = true;
+        }
+        return;
+    }
+
+    close(conn->fd);
+    connections.erase(conn);
+    delete conn;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : CompleteRequests
+//
+// @description         : Takes back the connections whose requests the workers are done with, sends their
+//                        responses and goes on with their next requests.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void CompleteRequests(eventLoop_t & loop, unordered_set<connection_t*> & connections)
+{
+    uint64_t count = 0;
+    if (read(loop.wakeFd, &count, sizeof(count)) != (ssize_t)sizeof(count))
+    {
+        return;
+    }
+
+    vector<connection_t*> completed;
+    {
+        lock_guard<mutex> guard(loop.lock);
+        completed.swap(loop.completed);
+    }
+
+    for (size_t i = 0; i < completed.size(); i++)
+    {
+        connection_t *conn = completed[i];
+        conn->isBusy = false;
+        loop.busyConnections--;
+        if (conn->isClosed)
+        {
+            CloseConnection(conn, connections);
+            continue;
+        }
+
+        bool isOpen = !g_isStopping && EncodeAuthResponse(conn->out, conn->status, conn->sessionToken) &&
+                      HandleFrames(*conn) && WriteConnection(*conn) && !IsConnectionDone(*conn);
+        if (isOpen)
+        {
+            UpdateEvents(loop.epollFd, *conn);
+        }
+        else
+        {
+            CloseConnection(conn, connections);
+        }
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : RunEventLoop
+//
+// @description         : One event loop thread. Runs until a stop signal is received, then waits for the
+//                        requests its connections have on workers.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void RunEventLoop(AuthModule & auth, ThreadPool & workers, int listenFd)
+{
+    eventLoop_t loop;
+    loop.auth = &auth;
+    loop.workers = &workers;
+    loop.busyConnections = 0;
+    loop.epollFd = epoll_create1(EPOLL_CLOEXEC);
+    loop.wakeFd = eventfd(0, EFD_CLOEXEC);
+
+    epoll_event event;
+    event.events = EPOLLIN | EPOLLEXCLUSIVE;
+    event.data.ptr = nullptr;
+    epoll_event wakeEvent;
+    wakeEvent.events = EPOLLIN;
+    wakeEvent.data.ptr = &loop;
+    if (loop.epollFd < 0 || loop.wakeFd < 0 || epoll_ctl(loop.epollFd, EPOLL_CTL_ADD, listenFd, &event) != 0 ||
+        epoll_ctl(loop.epollFd, EPOLL_CTL_ADD, loop.wakeFd, &wakeEvent) != 0)
+    {
+        printf("Could not start event loop\n");
+        return;
+    }
+
+    unordered_set<connection_t*> connections;
+    epoll_event events[MAX_EPOLL_EVENTS];
+    while (!g_isStopping)
+    {
+        // Completions are handled after the other events, they may close connections with events pending
+        bool hasCompletions = false;
+        int count = epoll_wait(loop.epollFd, events, MAX_EPOLL_EVENTS, EPOLL_TIMEOUT_MS);
+        for (int i = 0; i < count; i++)
+        {
+            if (events[i].data.ptr == &loop)
+            {
+                hasCompletions = true;
+                continue;
+            }
+
+            connection_t *conn = (connection_t *)events[i].data.ptr;
+            if (conn == nullptr)
+            {
+                AcceptConnections(loop, listenFd, connections);
+                continue;
+            }
+
+            // Input of a busy connection waits, it is read once the request is back
+            bool isOpen = (events[i].events & (EPOLLERR | EPOLLHUP)) == 0;
+            if (isOpen && !conn->isBusy && !conn->isReadClosed && (events[i].events & (EPOLLIN | EPOLLRDHUP)))
+            {
+                isOpen = ReadConnection(*conn);
+            }
+            if (isOpen)
+            {
+                isOpen = WriteConnection(*conn) && !IsConnectionDone(*conn);
+            }
+
+            if (isOpen)
+            {
+                UpdateEvents(loop.epollFd, *conn);
+            }
+            else
+            {
+                CloseConnection(conn, connections);
+            }
+        }
+
+        if (hasCompletions)
+        {
+            CompleteRequests(loop, connections);
+        }
+    }
+
+    // Connections on workers are freed as their requests come back
+    vector<connection_t*> remaining(connections.begin(), connections.end());
+    for (size_t i = 0; i < remaining.size(); i++)
+    {
+        CloseConnection(remaining[i], connections);
+    }
+    while (loop.busyConnections > 0)
+    {
+        CompleteRequests(loop, connections);
+    }
+    close(loop.wakeFd);
+    close(loop.epollFd);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// M A I N
+//-------------------------------------------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+    authEndpoint_t endpoint;
+    endpoint.host = "127.0.0.1";
+    endpoint.port = AUTH_DEFAULT_PORT;
+    unsigned loopThreads = thread::hardware_concurrency();
+    unsigned workerThreads = thread::hardware_concurrency();
+    authModuleConfig_t authConfig = AuthModule::GetDefaultAuthModuleConfig();
+    authConfig.storageMode = STORAGE_MODE_JOURNAL;
+    authConfig.useLoginThrottle = true;
+    authConfig.durability = DURABILITY_GROUP;
+    bool isQuiet = false;
+
+    bool validArgs = (argc % 2) == 1;
+    for (int i = 1; validArgs && i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "-t") == 0)
+        {
+            loopThreads = (unsigned)strtoul(argv[i + 1], nullptr, 10);
+            validArgs = (loopThreads > 0);
+        }
+        else if (strcmp(argv[i], "-w") == 0)
+        {
+            workerThreads = (unsigned)strtoul(argv[i + 1], nullptr, 10);
+            validArgs = (workerThreads > 0);
+        }
+        else if (strcmp(argv[i], "-i") == 0)
+        {
+            authConfig.hashIterations = (uint32_t)strtoul(argv[i + 1], nullptr, 10);
+            validArgs = (authConfig.hashIterations > 0);
+        }
+        else if (strcmp(argv[i], "-q") == 0)
+        {
+            isQuiet = (atoi(argv[i + 1]) != 0);
+        }
+        else if (strcmp(argv[i], "-l") == 0)
+        {
+            authConfig.useLoginThrottle = (atoi(argv[i + 1]) != 0);
+        }
+        else if (strcmp(argv[i], "-r") == 0)
+        {
+            authConfig.storageMode = (atoi(argv[i + 1]) != 0) ? STORAGE_MODE_REPLICA : STORAGE_MODE_JOURNAL;
+        }
+        else if (strcmp(argv[i], "-d") == 0)
+        {
+            validArgs = (strcmp(argv[i + 1], "flush") == 0 || strcmp(argv[i + 1], "group") == 0 ||
+                         strcmp(argv[i + 1], "sync") == 0);
+            authConfig.durability = (strcmp(argv[i + 1], "group") == 0) ? DURABILITY_GROUP :
+                                    (strcmp(argv[i + 1], "sync") == 0) ? DURABILITY_SYNC : DURABILITY_FLUSH;
+        }
+        else
+        {
+            validArgs = ParseAuthEndpoint(argv[i], argv[i + 1], endpoint);
+        }
+    }
+
+    if (!validArgs)
+    {
+        printf("Usage: %s [-a address] [-p port] [-s unix socket path] [-t event loop threads] "
+               "[-w request worker threads] [-i hash iterations] [-q 1] [-l 0] [-d flush|group|sync] [-r 1]\n",
+               argv[0]);
+        return 1;
+    }
+
+    int listenFd = ListenAuthEndpoint(endpoint);
+    if (listenFd < 0)
+    {
+        printf("Could not listen on %s: %s\n",
+               endpoint.unixPath.empty() ? (endpoint.host + ":" + to_string(endpoint.port)).c_str() : endpoint.unixPath.c_str(),
+               strerror(errno));
+        return 1;
+    }
+
+    signal(SIGINT, HandleSignal);
+    signal(SIGTERM, HandleSignal);
+    signal(SIGPIPE, SIG_IGN);
+
+    // Same policy as the interactive front end
+    authPolicy_t authPolicy;
+    authPolicy.passwordHistoryMax = 3;
+    authPolicy.useStrongPasswords = true;
+    authPolicy.passwordLenMax = 255;
+    authPolicy.passwordLenMin = 6;
+    authPolicy.passwordExpiryDays = 30;
+
+    {
+        // Also the module's pool for asynchronous logins, it outlives the module
+        ThreadPool workers(workerThreads, DEFAULT_LOGIN_QUEUE_CAPACITY);
+        authConfig.loginPool = &workers;
+        AuthModule auth(authPolicy, authConfig);
+        auth.Initialize();
+        printf("** Serving on %s with %u event loop(s) and %u request worker(s)\n",
+               endpoint.unixPath.empty() ? (endpoint.host + ":" + to_string(endpoint.port)).c_str() : endpoint.unixPath.c_str(),
+               loopThreads, workerThreads);
+        fflush(stdout);
+        if (isQuiet)
+        {
+            Logger::GetInstance().SetLevel(LOG_LEVEL_WARNING);
+        }
+
+        vector<thread> loops;
+        for (unsigned i = 0; i < loopThreads; i++)
+        {
+            loops.emplace_back(RunEventLoop, ref(auth), ref(workers), listenFd);
+        }
+        for (unsigned i = 0; i < loopThreads; i++)
+        {
+            loops[i].join();
+        }
+
+        string metrics;
+        auth.DumpMetrics(metrics);
+        printf("%s", metrics.c_str());
+    }
+
+    close(listenFd);
+    if (!endpoint.unixPath.empty())
+    {
+        unlink(endpoint.unixPath.c_str());
+    }
+
+    return 0;
+}
@@ -0,0 +1,195 @@
+#include "bloom_filter.h"
+#include "users_db_format.h"
+#include <string_view>
+
+//-------------------------------------------------------------------------------------------------------------
+// Globals
+//-------------------------------------------------------------------------------------------------------------
+static const uint32_t BLOOM_SALTS[BLOOM_BLOCK_WORDS] =
+{
+    0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du, 0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u
+};
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetBloomHashProbe
+//
+// @description         : Hash of a fixed string with the hash AuthModule uses for usernames. A filter built
+//                        with another hash function would give false negatives.
+//
+// @returns             : Hash
+//-------------------------------------------------------------------------------------------------------------
+static uint64_t GetBloomHashProbe()
+{
+    return (uint64_t)hash<string_view>()(string_view("UABF hash probe"));
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetBloomBlock
+//
+// @description         : Block and in-block key of a hash. The hash is mixed first since AuthModule picks
+//                        shards from its low bits.
+//
+// @returns             : Index of the block's first word
+//-------------------------------------------------------------------------------------------------------------
+static inline size_t GetBloomBlock(size_t keyHash, size_t blockCount, uint32_t & blockKey)
+{
+    uint64_t mixed = (uint64_t)keyHash * 0xC2B2AE3D27D4EB4Full;
+    mixed ^= mixed >> 31;
+    blockKey = (uint32_t)mixed;
+    return (size_t)(((mixed >> 32) * (uint64_t)blockCount) >> 32) * BLOOM_BLOCK_WORDS;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : BloomFilter
+//
+// @description         : Constructor. Sized for capacity keys at BLOOM_BITS_PER_KEY bits each.
+//-------------------------------------------------------------------------------------------------------------
+BloomFilter::BloomFilter(size_t capacity)
+{
+    const size_t blockBits = BLOOM_BLOCK_WORDS * 32;
+    m_capacity = (capacity > 0) ? capacity : 1;
+    m_blockCount = (m_capacity * BLOOM_BITS_PER_KEY + blockBits - 1) / blockBits;
+    m_words = new atomic<uint32_t>[m_blockCount * BLOOM_BLOCK_WORDS];
+    for (size_t i = 0; i < m_blockCount * BLOOM_BLOCK_WORDS; i++)
+    {
+        m_words[i].store(0, memory_order_relaxed);
+    }
+    m_keys = 0;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : BloomFilter
+//
+// @description         : Destructor
+//-------------------------------------------------------------------------------------------------------------
+BloomFilter::~BloomFilter()
+{
+    delete[] m_words;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Add
+//
+// @description         : Adds a key. A lookup on another thread sees it once this returns.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void BloomFilter::Add(size_t keyHash)
+{
+    uint32_t blockKey = 0;
+    atomic<uint32_t> *block = m_words + GetBloomBlock(keyHash, m_blockCount, blockKey);
+    for (unsigned i = 0; i < BLOOM_BLOCK_WORDS; i++)
+    {
+        block[i].fetch_or(1u << ((blockKey * BLOOM_SALTS[i]) >> 27), memory_order_release);
+    }
+    m_keys.fetch_add(1, memory_order_relaxed);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : MayContain
+//
+// @description         : Checks a key. Never wrong for keys which were added.
+//
+// @returns             : False if the key was certainly never added.
+//-------------------------------------------------------------------------------------------------------------
+bool BloomFilter::MayContain(size_t keyHash) const
+{
+    uint32_t blockKey = 0;
+    const atomic<uint32_t> *block = m_words + GetBloomBlock(keyHash, m_blockCount, blockKey);
+    for (unsigned i = 0; i < BLOOM_BLOCK_WORDS; i++)
+    {
+        uint32_t bit = 1u << ((blockKey * BLOOM_SALTS[i]) >> 27);
+        if ((block[i].load(memory_order_acquire) & bit) == 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Serialize
+//
+// @description         : Appends the persisted form of the filter to out. Keys added concurrently may or may
+//                        not be included.
+//
+// @param snapshotIdentity : Identity of the users database written along with the filter
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void BloomFilter::Serialize(string & out, uint32_t snapshotIdentity) const
+{
+    size_t start = out.size();
+    size_t wordCount = m_blockCount * BLOOM_BLOCK_WORDS;
+    out.reserve(start + BLOOM_FILTER_HEADER_SIZE + wordCount * 4 + 4);
+
+    PutU32(out, BLOOM_FILTER_MAGIC);
+    PutU32(out, BLOOM_FILTER_VERSION);
+    PutU64(out, GetBloomHashProbe());
+    PutU32(out, snapshotIdentity);
+    PutU32(out, 0);
+    PutU64(out, m_capacity);
+    PutU64(out, GetKeyCount());
+    PutU64(out, m_blockCount);
+    for (size_t i = 0; i < wordCount; i++)
+    {
+        PutU32(out, m_words[i].load(memory_order_relaxed));
+    }
+    PutU32(out, Checksum32(out.data() + start, out.size() - start));
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Deserialize
+//
+// @description         : Restores a filter from its persisted form. The filter is refused if it is damaged,
+//                        was built with another hash function or for another users database.
+//
+// @param snapshotIdentity : Identity of the users database the filter is to be used with
+//
+// @returns             : New filter owned by the caller, NULL if it can not be used.
+//-------------------------------------------------------------------------------------------------------------
+BloomFilter* BloomFilter::Deserialize(const char *data, size_t len, uint32_t snapshotIdentity)
+{
+    recordReader_t reader = { data, len, 0 };
+    uint32_t magic = 0, version = 0, identity = 0, reserved = 0;
+    uint64_t hashProbe = 0, capacity = 0, keys = 0, blockCount = 0;
+    if (len < BLOOM_FILTER_HEADER_SIZE + 4 ||
+        !GetU32(reader, magic) || !GetU32(reader, version) || !GetU64(reader, hashProbe) ||
+        !GetU32(reader, identity) || !GetU32(reader, reserved) || !GetU64(reader, capacity) ||
+        !GetU64(reader, keys) || !GetU64(reader, blockCount))
+    {
+        return nullptr;
+    }
+
+    if (magic != BLOOM_FILTER_MAGIC || version != BLOOM_FILTER_VERSION || hashProbe != GetBloomHashProbe() ||
+        identity != snapshotIdentity || blockCount == 0 || blockCount > (len - BLOOM_FILTER_HEADER_SIZE) / 32)
+    {
+        return nullptr;
+    }
+
+    size_t wordCount = (size_t)blockCount * BLOOM_BLOCK_WORDS;
+    recordReader_t checksumReader = { data, len, BLOOM_FILTER_HEADER_SIZE + wordCount * 4 };
+    uint32_t checksum = 0;
+    if (!GetU32(checksumReader, checksum) || checksum != Checksum32(data, checksumReader.pos - 4))
+    {
+        return nullptr;
+    }
+
+    BloomFilter *filter = new BloomFilter((size_t)capacity);
+    if (filter->m_blockCount != blockCount)
+    {
+        delete filter;
+        return nullptr;
+    }
+
+    const unsigned char *words = (const unsigned char *)data + BLOOM_FILTER_HEADER_SIZE;
+    for (size_t i = 0; i < wordCount; i++, words += 4)
+    {
+        uint32_t word = (uint32_t)words[0] | ((uint32_t)words[1] << 8) | ((uint32_t)words[2] << 16) |
+                        ((uint32_t)words[3] << 24);
+        filter->m_words[i].store(word, memory_order_relaxed);
+    }
+    filter->m_keys = (size_t)keys;
+    return filter;
+}
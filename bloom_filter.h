@@ -0,0 +1,54 @@
+#ifndef _BLOOM_FILTER_H_
+#define _BLOOM_FILTER_H_
+#include<atomic>
+#include<stddef.h>
+#include<stdint.h>
+#include<string>
+
+using namespace std;
+
+//-------------------------------------------------------------------------------------------------------------
+// Globals
+//-------------------------------------------------------------------------------------------------------------
+const unsigned BLOOM_BLOCK_WORDS = 8;         // 256 bit blocks, one bit per word is set for a key
+const unsigned BLOOM_BITS_PER_KEY = 16;       // At capacity, ~0.1% false positives
+const uint32_t BLOOM_FILTER_MAGIC = 0x46424155;      // "UABF"
+const uint32_t BLOOM_FILTER_VERSION = 1;
+const size_t BLOOM_FILTER_HEADER_SIZE = 48;
+
+//-------------------------------------------------------------------------------------------------------------
+// Split block Bloom filter over the 64 bit hashes of the usernames. A key sets one bit in each of the 8
+// words of a single 32 byte block, so a lookup reads half a cache line. Keys can be added while other
+// threads look up, but a filter can not grow: once more keys than its capacity have been added the false
+// positive rate rises and the filter should be rebuilt with a larger capacity.
+//
+// Persisted form (little endian): magic, version, hash probe (u64), snapshot identity (u32), reserved (u32),
+// capacity (u64), keys (u64), blocks (u64), the blocks' words (u32 each), checksum of all of it (u32).
+// The hash probe detects a standard library whose string hash differs from the one the filter was built
+// with; the snapshot identity ties the filter to the users database it was written along with.
+//-------------------------------------------------------------------------------------------------------------
+class BloomFilter
+{
+private:
+    atomic<uint32_t>                       *m_words;
+    size_t                                  m_blockCount;
+    size_t                                  m_capacity;
+    atomic<size_t>                          m_keys;
+
+public:
+    BloomFilter(size_t capacity);
+    ~BloomFilter();
+    BloomFilter(const BloomFilter &) = delete;
+    BloomFilter & operator=(const BloomFilter &) = delete;
+
+    void Add(size_t keyHash);
+    bool MayContain(size_t keyHash) const;
+    size_t GetCapacity() const { return m_capacity; }
+    size_t GetKeyCount() const { return m_keys.load(memory_order_relaxed); }
+    bool IsOverCapacity() const { return GetKeyCount() > m_capacity; }
+    size_t GetMemoryUsage() const { return m_blockCount * BLOOM_BLOCK_WORDS * sizeof(uint32_t); }
+    void Serialize(string & out, uint32_t snapshotIdentity) const;
+    static BloomFilter* Deserialize(const char *data, size_t len, uint32_t snapshotIdentity);
+};
+
+#endif
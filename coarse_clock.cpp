@@ -0,0 +1,59 @@
+#include "coarse_clock.h"
+#include <chrono>
+#include <time.h>
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : CoarseClock
+//
+// @description         : Constructor. Reads the clock once and starts the ticker.
+//-------------------------------------------------------------------------------------------------------------
+CoarseClock::CoarseClock()
+{
+    m_now = (long long)time(0);
+    m_isStopping = false;
+    m_ticker = thread(&CoarseClock::TickLoop, this);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : CoarseClock
+//
+// @description         : Destructor. Stops the ticker without waiting for the end of its tick.
+//-------------------------------------------------------------------------------------------------------------
+CoarseClock::~CoarseClock()
+{
+    {
+        lock_guard<mutex> guard(m_lock);
+        m_isStopping = true;
+    }
+    m_wakeUp.notify_all();
+    m_ticker.join();
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetInstance
+//
+// @description         : The process wide clock, started on first use.
+//
+// @returns             : Clock
+//-------------------------------------------------------------------------------------------------------------
+CoarseClock & CoarseClock::GetInstance()
+{
+    static CoarseClock clock;
+    return clock;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : TickLoop
+//
+// @description         : Ticker thread, refreshes the cached time once per tick until stopped.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void CoarseClock::TickLoop()
+{
+    unique_lock<mutex> guard(m_lock);
+    while (!m_wakeUp.wait_for(guard, chrono::milliseconds(COARSE_CLOCK_TICK_MS), [this]() { return m_isStopping; }))
+    {
+        m_now.store((long long)time(0), memory_order_relaxed);
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef _COARSE_CLOCK_H_
+#define _COARSE_CLOCK_H_
+#include<atomic>
+#include<condition_variable>
+#include<mutex>
+#include<thread>
+
+using namespace std;
+
+//-------------------------------------------------------------------------------------------------------------
+// Globals
+//-------------------------------------------------------------------------------------------------------------
+const unsigned COARSE_CLOCK_TICK_MS = 1000;
+
+//-------------------------------------------------------------------------------------------------------------
+// Wall clock in seconds, refreshed by a background thread once per tick. Reading it is a single relaxed
+// atomic load, for checks such as password expiry which run on every login and only need a resolution of
+// seconds. One clock is shared by the whole process.
+//-------------------------------------------------------------------------------------------------------------
+class CoarseClock
+{
+private:
+    atomic<long long>                       m_now;
+    thread                                  m_ticker;
+    mutex                                   m_lock;
+    condition_variable                      m_wakeUp;
+    bool                                    m_isStopping;
+
+    CoarseClock();
+    void TickLoop();
+
+public:
+    ~CoarseClock();
+    static CoarseClock & GetInstance();
+    long long Now() { return m_now.load(memory_order_relaxed); }
+};
+
+#endif
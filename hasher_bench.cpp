@@ -0,0 +1,65 @@
+#include "password_hasher.h"
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+//-------------------------------------------------------------------------------------------------------------
+// Password hashing benchmark. Reports hashes/sec of the PBKDF2-HMAC-SHA256 hasher for a range of
+// iteration counts on the machine it runs on, to pick authModuleConfig_t::hashIterations.
+//
+// Usage: hasher_bench [min duration per setting in ms] [iterations ...]
+//-------------------------------------------------------------------------------------------------------------
+const unsigned DEFAULT_BENCH_DURATION_MS = 1000;
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : BenchmarkIterations
+//
+// @description         : Hashes a password repeatedly for at least durationMs with the given work factor.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void BenchmarkIterations(uint32_t iterations, unsigned durationMs)
+{
+    Pbkdf2PasswordHasher hasher(iterations);
+    passwordHash_t hash;
+    unsigned hashes = 0;
+
+    auto start = chrono::steady_clock::now();
+    chrono::duration<double> elapsed(0);
+    do
+    {
+        hasher.Hash("benchmark-password", hash);
+        hashes++;
+        elapsed = chrono::steady_clock::now() - start;
+    } while (elapsed.count() * 1000 < durationMs);
+
+    double hashesPerSec = hashes / elapsed.count();
+    printf("%12u %14.1f %16.3f\n", iterations, hashesPerSec, 1000.0 / hashesPerSec);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// M A I N
+//-------------------------------------------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+    unsigned durationMs = (argc > 1) ? (unsigned)atoi(argv[1]) : DEFAULT_BENCH_DURATION_MS;
+    vector<uint32_t> iterationCounts;
+    for (int i = 2; i < argc; i++)
+    {
+        iterationCounts.push_back((uint32_t)strtoul(argv[i], nullptr, 10));
+    }
+
+    if (iterationCounts.empty())
+    {
+        iterationCounts = { 1000, 10000, 50000, DEFAULT_PBKDF2_ITERATIONS, 310000, 600000 };
+    }
+
+    printf("%12s %14s %16s\n", "iterations", "hashes/sec", "ms/hash");
+    for (size_t i = 0; i < iterationCounts.size(); i++)
+    {
+        BenchmarkIterations(iterationCounts[i], durationMs);
+    }
+
+    return 0;
+}
@@ -0,0 +1,340 @@
+#include "logger.h"
+#include <string.h>
+#include <time.h>
+
+//-------------------------------------------------------------------------------------------------------------
+// Globals
+//-------------------------------------------------------------------------------------------------------------
+const size_t LOG_LINE_SIZE = 512;
+static const char *LOG_LEVEL_NAMES[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Logger
+//
+// @description         : Constructor. Logs to stdout from LOG_LEVEL_INFO on, asynchronously.
+//-------------------------------------------------------------------------------------------------------------
+Logger::Logger()
+{
+    m_slots = new slot_t[LOG_RING_CAPACITY];
+    for (size_t i = 0; i < LOG_RING_CAPACITY; i++)
+    {
+        m_slots[i].sequence.store(i, memory_order_relaxed);
+    }
+    m_tail = 0;
+    m_head = 0;
+    m_dropped = 0;
+    m_droppedReported = 0;
+    m_level = LOG_LEVEL_INFO;
+    m_isSynchronous = false;
+    m_output = stdout;
+    m_isStopping = false;
+    m_drainer = thread(&Logger::DrainLoop, this);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Logger
+//
+// @description         : Destructor. Writes out the records still in the ring.
+//-------------------------------------------------------------------------------------------------------------
+Logger::~Logger()
+{
+    {
+        lock_guard<mutex> guard(m_lock);
+        m_isStopping = true;
+    }
+    m_wakeUp.notify_all();
+    m_drainer.join();
+    delete[] m_slots;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetInstance
+//
+// @description         : The process wide logger, started on first use.
+//
+// @returns             : Logger
+//-------------------------------------------------------------------------------------------------------------
+Logger & Logger::GetInstance()
+{
+    static Logger logger;
+    return logger;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : SetSynchronous
+//
+// @description         : Switches between writing records on the calling thread and through the ring.
+//                        Records already in the ring are written out first.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void Logger::SetSynchronous(bool isSynchronous)
+{
+    Flush();
+    m_isSynchronous.store(isSynchronous, memory_order_relaxed);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : SetOutput
+//
+// @description         : Stream the records are written to, not owned. Records already in the ring are
+//                        written to the previous stream.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void Logger::SetOutput(FILE *output)
+{
+    Flush();
+    lock_guard<mutex> outputLock(m_outputLock);
+    m_output = output;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Flush
+//
+// @description         : Waits until every record logged before the call has been written.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void Logger::Flush()
+{
+    size_t tail = m_tail.load(memory_order_acquire);
+    while (m_head.load(memory_order_acquire) < tail)
+    {
+        m_wakeUp.notify_all();
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+
+    lock_guard<mutex> outputLock(m_outputLock);
+    fflush(m_output);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Claim
+//
+// @description         : Reserves the next free slot of the ring for a writer. The writer publishes the
+//                        slot by setting its sequence to position + 1 once the record is filled in.
+//
+// @param position      : Receives the ring position of the slot
+//
+// @returns             : Slot, NULL if the ring is full.
+//-------------------------------------------------------------------------------------------------------------
+Logger::slot_t* Logger::Claim(size_t & position)
+{
+    position = m_tail.load(memory_order_relaxed);
+    while (true)
+    {
+        slot_t *slot = &m_slots[position & (LOG_RING_CAPACITY - 1)];
+        size_t sequence = slot->sequence.load(memory_order_acquire);
+        if (sequence == position)
+        {
+            if (m_tail.compare_exchange_weak(position, position + 1, memory_order_relaxed))
+            {
+                return slot;
+            }
+        }
+        else if (sequence < position)
+        {
+            // Still holding the record from one lap ago
+            m_dropped.fetch_add(1, memory_order_relaxed);
+            return nullptr;
+        }
+        else
+        {
+            position = m_tail.load(memory_order_relaxed);
+        }
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : DrainLoop
+//
+// @description         : Background thread, writes out published records until stopped.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void Logger::DrainLoop()
+{
+    while (true)
+    {
+        bool isStopping = false;
+        if (!Drain())
+        {
+            unique_lock<mutex> guard(m_lock);
+            m_wakeUp.wait_for(guard, chrono::milliseconds(LOG_DRAIN_INTERVAL_MS), [this]()
+            {
+                size_t head = m_head.load(memory_order_relaxed);
+                return m_isStopping ||
+                       m_slots[head & (LOG_RING_CAPACITY - 1)].sequence.load(memory_order_acquire) == head + 1;
+            });
+            isStopping = m_isStopping;
+        }
+
+        if (isStopping)
+        {
+            // Writers still running at exit may publish more, those are lost
+            Drain();
+            return;
+        }
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Drain
+//
+// @description         : Writes out the records published so far, in ring order. Stops at the first claimed
+//                        slot whose writer has not finished filling it in.
+//
+// @returns             : True if any record was written.
+//-------------------------------------------------------------------------------------------------------------
+bool Logger::Drain()
+{
+    size_t head = m_head.load(memory_order_relaxed);
+    size_t written = 0;
+    lock_guard<mutex> outputLock(m_outputLock);
+    while (true)
+    {
+        slot_t & slot = m_slots[head & (LOG_RING_CAPACITY - 1)];
+        if (slot.sequence.load(memory_order_acquire) != head + 1)
+        {
+            break;
+        }
+
+        Write(slot.record);
+        slot.sequence.store(head + LOG_RING_CAPACITY, memory_order_release);
+        head++;
+        written++;
+        m_head.store(head, memory_order_release);
+    }
+
+    size_t dropped = m_dropped.load(memory_order_relaxed);
+    if (dropped != m_droppedReported)
+    {
+        fprintf(m_output, "WARN  %zu log record(s) dropped, the log ring was full\n", dropped - m_droppedReported);
+        m_droppedReported = dropped;
+    }
+
+    if (written > 0)
+    {
+        fflush(m_output);
+    }
+    return written > 0;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : WriteSynchronous
+//
+// @description         : Writes a record on the calling thread.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void Logger::WriteSynchronous(const logRecord_t & record)
+{
+    lock_guard<mutex> outputLock(m_outputLock);
+    Write(record);
+    fflush(m_output);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Write
+//
+// @description         : Formats a record as one line: local time, level and the message. The format is
+//                        walked conversion by conversion, each one printed with the matching stored argument.
+//                        Caller must hold the output lock.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void Logger::Write(const logRecord_t & record)
+{
+    char line[LOG_LINE_SIZE];
+    size_t len = 0;
+    auto append = [&](int written)
+    {
+        if (written > 0)
+        {
+            len = min(len + (size_t)written, sizeof(line) - 1);
+        }
+    };
+
+    time_t seconds = (time_t)(record.timestampMs / 1000);
+    struct tm local;
+    localtime_r(&seconds, &local);
+    append((int)strftime(line, sizeof(line), "%H:%M:%S", &local));
+    append(snprintf(line + len, sizeof(line) - len, ".%03d %-5s ", (int)(record.timestampMs % 1000),
+                    LOG_LEVEL_NAMES[min((unsigned)record.level, (unsigned)LOG_LEVEL_ERROR)]));
+
+    unsigned argIndex = 0;
+    for (const char *p = record.format; *p != '\0' && len < sizeof(line) - 1; p++)
+    {
+        if (*p != '%')
+        {
+            line[len++] = *p;
+            continue;
+        }
+        if (p[1] == '%')
+        {
+            line[len++] = '%';
+            p++;
+            continue;
+        }
+
+        // Flags, width and precision are kept, length modifiers are replaced to match the stored argument
+        char spec[32] = "%";
+        size_t specLen = 1;
+        const char *conversion = p + 1;
+        while (*conversion != '\0' && strchr("-+ #0123456789.", *conversion) != nullptr && specLen < 20)
+        {
+            spec[specLen++] = *conversion++;
+        }
+        while (*conversion != '\0' && strchr("hljztL", *conversion) != nullptr)
+        {
+            conversion++;
+        }
+        if (*conversion == '\0')
+        {
+            break;
+        }
+        p = conversion;
+
+        if (argIndex >= record.argCount)
+        {
+            append(snprintf(line + len, sizeof(line) - len, "<?>"));
+            continue;
+        }
+
+        const logArg_t & arg = record.args[argIndex++];
+        switch (arg.type)
+        {
+        case LOG_ARG_TEXT:
+            // The precision is taken by the length of the stored text
+            specLen = strcspn(spec, ".");
+            memcpy(spec + specLen, ".*s", 4);
+            append(snprintf(line + len, sizeof(line) - len, spec, (int)arg.text.len, record.text + arg.text.offset));
+            break;
+        case LOG_ARG_DOUBLE:
+            spec[specLen++] = *conversion;
+            spec[specLen] = '\0';
+            append(snprintf(line + len, sizeof(line) - len, spec, arg.d));
+            break;
+        default:
+            if (*conversion == 'c')
+            {
+                memcpy(spec + specLen, "c", 2);
+                append(snprintf(line + len, sizeof(line) - len, spec, (int)arg.i));
+                break;
+            }
+            spec[specLen++] = 'l';
+            spec[specLen++] = 'l';
+            spec[specLen++] = (*conversion == 's') ? 'd' : *conversion;
+            spec[specLen] = '\0';
+            if (arg.type == LOG_ARG_INT)
+                append(snprintf(line + len, sizeof(line) - len, spec, arg.i));
+            else
+                append(snprintf(line + len, sizeof(line) - len, spec, arg.u));
+            break;
+        }
+    }
+
+    line[len++] = '\n';
+    fwrite(line, 1, len, m_output);
+}
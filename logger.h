@@ -0,0 +1,250 @@
+#ifndef _LOGGER_H_
+#define _LOGGER_H_
+#include<algorithm>
+#include<atomic>
+#include<chrono>
+#include<condition_variable>
+#include<mutex>
+#include<stddef.h>
+#include<stdint.h>
+#include<stdio.h>
+#include<string>
+#include<string_view>
+#include<thread>
+#include<type_traits>
+
+using namespace std;
+
+//-------------------------------------------------------------------------------------------------------------
+// Enums
+//-------------------------------------------------------------------------------------------------------------
+typedef enum logLevel_tag
+{
+    LOG_LEVEL_DEBUG,                          // Per user events of the hot paths
+    LOG_LEVEL_INFO,                           // Rejected requests, startup summaries
+    LOG_LEVEL_WARNING,
+    LOG_LEVEL_ERROR,                          // Failures to read or write the users database
+    LOG_LEVEL_NONE
+}logLevel_t;
+
+typedef enum logArgType_tag
+{
+    LOG_ARG_INT,
+    LOG_ARG_UINT,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_TEXT                              // Copied into the record's text buffer
+}logArgType_t;
+
+//-------------------------------------------------------------------------------------------------------------
+// Globals
+//-------------------------------------------------------------------------------------------------------------
+#ifndef AUTH_LOG_COMPILED_LEVEL               // Messages below this level are not compiled in
+#ifdef NDEBUG
+#define AUTH_LOG_COMPILED_LEVEL LOG_LEVEL_INFO
+#else
+#define AUTH_LOG_COMPILED_LEVEL LOG_LEVEL_DEBUG
+#endif
+#endif
+const unsigned LOG_MAX_ARGS = 6;
+const size_t LOG_TEXT_SIZE = 128;             // Bytes of string arguments kept per record, longer ones are cut
+const size_t LOG_RING_CAPACITY = 4096;        // Records waiting to be written, a power of 2
+const unsigned LOG_DRAIN_INTERVAL_MS = 20;
+
+//-------------------------------------------------------------------------------------------------------------
+// Structs
+//-------------------------------------------------------------------------------------------------------------
+typedef struct logArg_tag
+{
+    logArgType_t type;
+    union
+    {
+        long long i;
+        unsigned long long u;
+        double d;
+        struct
+        {
+            uint16_t offset;
+            uint16_t len;
+        }text;
+    };
+}logArg_t;
+
+typedef struct logRecord_tag
+{
+    const char *format;                       // printf format, must be a string literal
+    logLevel_t level;
+    long long timestampMs;                    // Wall clock
+    unsigned argCount;
+    size_t textLen;
+    logArg_t args[LOG_MAX_ARGS];
+    char text[LOG_TEXT_SIZE];
+}logRecord_t;
+
+//-------------------------------------------------------------------------------------------------------------
+// Process wide logger. Log() only copies the format pointer and the raw arguments into a slot of a bounded
+// lock free ring; a background thread formats the records and writes them out. Writers never wait: when
+// the ring is full the record is dropped and counted. Formats follow printf, except that '*' widths are not
+// supported and integer length modifiers are ignored; strings and string_views are passed for %s directly.
+// In synchronous mode records are formatted and written by the calling thread instead, for interactive use
+// where messages have to appear in order with the program's own output.
+//-------------------------------------------------------------------------------------------------------------
+class Logger
+{
+private:
+    typedef struct slot_tag
+    {
+        atomic<size_t> sequence;              // Ring position the slot is ready for
+        logRecord_t record;
+    }slot_t;
+
+    slot_t                                 *m_slots;
+    alignas(64) atomic<size_t>              m_tail;                      // Next position to be claimed by a writer
+    alignas(64) atomic<size_t>              m_head;                      // Next position to be drained
+    atomic<size_t>                          m_dropped;
+    size_t                                  m_droppedReported;
+    atomic<int>                             m_level;
+    atomic<bool>                            m_isSynchronous;
+    FILE                                   *m_output;
+    mutex                                   m_outputLock;                // Serializes synchronous writers
+    thread                                  m_drainer;
+    mutex                                   m_lock;
+    condition_variable                      m_wakeUp;
+    bool                                    m_isStopping;
+
+    Logger();
+    void DrainLoop();
+    bool Drain();
+    void Write(const logRecord_t & record);
+    void WriteSynchronous(const logRecord_t & record);
+    slot_t* Claim(size_t & position);
+
+    template<typename... args_t>
+    static void Fill(logRecord_t & record, logLevel_t level, const char *format, const args_t & ... args);
+
+    static void PutArg(logRecord_t & record, string_view value);
+    template<typename arg_t> static void PutArg(logRecord_t & record, const arg_t & value);
+    static void PutArgs(logRecord_t &) {}
+    template<typename arg_t, typename... args_t>
+    static void PutArgs(logRecord_t & record, const arg_t & value, const args_t & ... values);
+
+public:
+    ~Logger();
+    static Logger & GetInstance();
+    void SetLevel(logLevel_t level) { m_level.store(level, memory_order_relaxed); }
+    bool IsEnabled(logLevel_t level) { return level >= m_level.load(memory_order_relaxed); }
+    void SetSynchronous(bool isSynchronous);
+    void SetOutput(FILE *output);
+    void Flush();
+    size_t GetDroppedCount() { return m_dropped.load(memory_order_relaxed); }
+
+    template<typename... args_t>
+    void Log(logLevel_t level, const char *format, const args_t & ... args);
+};
+
+//-------------------------------------------------------------------------------------------------------------
+// Logging macros. Levels below AUTH_LOG_COMPILED_LEVEL compile to nothing, arguments included.
+//-------------------------------------------------------------------------------------------------------------
+#define AUTH_LOG(level, ...)                                                                                  \
+    do                                                                                                        \
+    {                                                                                                         \
+        if ((level) >= AUTH_LOG_COMPILED_LEVEL && Logger::GetInstance().IsEnabled(level))                     \
+            Logger::GetInstance().Log(level, __VA_ARGS__);                                                    \
+    } while (0)
+
+#define LOG_DEBUG(...)   AUTH_LOG(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...)    AUTH_LOG(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARNING(...) AUTH_LOG(LOG_LEVEL_WARNING, __VA_ARGS__)
+#define LOG_ERROR(...)   AUTH_LOG(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+//-------------------------------------------------------------------------------------------------------------
+// Argument capture, inlined into the callers
+//-------------------------------------------------------------------------------------------------------------
+inline void Logger::PutArg(logRecord_t & record, string_view value)
+{
+    logArg_t & arg = record.args[record.argCount++];
+    size_t len = min(value.size(), LOG_TEXT_SIZE - record.textLen);
+    value.copy(record.text + record.textLen, len);
+    arg.type = LOG_ARG_TEXT;
+    arg.text.offset = (uint16_t)record.textLen;
+    arg.text.len = (uint16_t)len;
+    record.textLen += len;
+}
+
+template<typename arg_t>
+inline void Logger::PutArg(logRecord_t & record, const arg_t & value)
+{
+    if constexpr (is_convertible<const arg_t &, string_view>::value)
+    {
+        PutArg(record, string_view(value));
+    }
+    else
+    {
+        static_assert(is_arithmetic<arg_t>::value || is_enum<arg_t>::value, "Unsupported log argument type");
+        logArg_t & arg = record.args[record.argCount++];
+        if constexpr (is_floating_point<arg_t>::value)
+        {
+            arg.type = LOG_ARG_DOUBLE;
+            arg.d = value;
+        }
+        else if constexpr (is_enum<arg_t>::value || is_signed<arg_t>::value)
+        {
+            arg.type = LOG_ARG_INT;
+            arg.i = (long long)value;
+        }
+        else
+        {
+            arg.type = LOG_ARG_UINT;
+            arg.u = (unsigned long long)value;
+        }
+    }
+}
+
+template<typename arg_t, typename... args_t>
+inline void Logger::PutArgs(logRecord_t & record, const arg_t & value, const args_t & ... values)
+{
+    PutArg(record, value);
+    PutArgs(record, values...);
+}
+
+template<typename... args_t>
+inline void Logger::Fill(logRecord_t & record, logLevel_t level, const char *format, const args_t & ... args)
+{
+    static_assert(sizeof...(args) <= LOG_MAX_ARGS, "Too many log arguments");
+    record.format = format;
+    record.level = level;
+    record.timestampMs = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+    record.argCount = 0;
+    record.textLen = 0;
+    PutArgs(record, args...);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// The record is built in place in its ring slot and published to the drainer by the slot's sequence.
+//-------------------------------------------------------------------------------------------------------------
+template<typename... args_t>
+inline void Logger::Log(logLevel_t level, const char *format, const args_t & ... args)
+{
+    if (m_isSynchronous.load(memory_order_relaxed))
+    {
+        logRecord_t record;
+        Fill(record, level, format, args...);
+        WriteSynchronous(record);
+        return;
+    }
+
+    size_t position = 0;
+    slot_t *slot = Claim(position);
+    if (slot != nullptr)
+    {
+        Fill(slot->record, level, format, args...);
+        slot->sequence.store(position + 1, memory_order_release);
+
+        // Wake the drainer early during bursts instead of waiting for its interval
+        if ((position & (LOG_RING_CAPACITY / 4 - 1)) == 0)
+        {
+            m_wakeUp.notify_one();
+        }
+    }
+}
+
+#endif
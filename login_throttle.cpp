@@ -0,0 +1,440 @@
+#include "login_throttle.h"
+#include <algorithm>
+#include <functional>
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : ThrottleTable
+//
+// @description         : Constructor. The pool of entries and the buckets are allocated once, for capacity
+//                        keys spread over the shards.
+//-------------------------------------------------------------------------------------------------------------
+ThrottleTable::ThrottleTable(const throttleLimit_t & limit, size_t capacity)
+{
+    m_limit = limit;
+    m_metrics = nullptr;
+    m_shards = new shard_t[THROTTLE_SHARD_COUNT];
+
+    size_t shardCapacity = max((capacity + THROTTLE_SHARD_COUNT - 1) / THROTTLE_SHARD_COUNT, (size_t)1);
+    size_t bucketCount = 1;
+    while (bucketCount < shardCapacity * 2)
+    {
+        bucketCount *= 2;
+    }
+
+    for (unsigned i = 0; i < THROTTLE_SHARD_COUNT; i++)
+    {
+        shard_t & shard = m_shards[i];
+        shard.buckets.assign(bucketCount, -1);
+        shard.entries.resize(shardCapacity);
+        for (size_t j = 0; j < shardCapacity; j++)
+        {
+            shard.entries[j].nextInBucket = (j + 1 < shardCapacity) ? (int32_t)(j + 1) : -1;
+        }
+        shard.freeHead = 0;
+        fill(shard.wheel, shard.wheel + THROTTLE_WHEEL_SLOTS, -1);
+        shard.wheelTime = -1;
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : ThrottleTable
+//
+// @description         : Destructor
+//-------------------------------------------------------------------------------------------------------------
+ThrottleTable::~ThrottleTable()
+{
+    delete[] m_shards;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetShard
+//
+// @description         : Shard of a key. Taken from the high bits of the mixed hash, the buckets use the low
+//                        bits of the hash itself.
+//
+// @returns             : Shard owning the key
+//-------------------------------------------------------------------------------------------------------------
+ThrottleTable::shard_t & ThrottleTable::GetShard(uint64_t keyHash)
+{
+    return m_shards[((keyHash * 0x9E3779B97F4A7C15ull) >> 32) % THROTTLE_SHARD_COUNT];
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Advance
+//
+// @description         : Turns the shard's timing wheel up to now. The entries of every slot passed are freed
+//                        if they have expired, else moved to the slot of their current expiry. Caller must
+//                        hold the shard lock.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void ThrottleTable::Advance(shard_t & shard, long long now)
+{
+    if (shard.wheelTime < 0 || now < shard.wheelTime)
+    {
+        // First use, or the wall clock was set back: entries are still found at their next turn
+        shard.wheelTime = now;
+        return;
+    }
+
+    long long steps = min(now - shard.wheelTime, (long long)THROTTLE_WHEEL_SLOTS);
+    for (long long step = 1; step <= steps; step++)
+    {
+        unsigned slot = (unsigned)((shard.wheelTime + step) % THROTTLE_WHEEL_SLOTS);
+        int32_t index = shard.wheel[slot];
+        shard.wheel[slot] = -1;
+        while (index >= 0)
+        {
+            int32_t next = shard.entries[index].nextInWheel;
+            if (shard.entries[index].expiry <= now)
+            {
+                Unlink(shard, index);
+                shard.entries[index].nextInBucket = shard.freeHead;
+                shard.freeHead = index;
+            }
+            else
+            {
+                Schedule(shard, index);
+            }
+            index = next;
+        }
+    }
+
+    shard.wheelTime = now;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Schedule
+//
+// @description         : Puts an entry in the wheel slot of its expiry. Caller must hold the shard lock.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void ThrottleTable::Schedule(shard_t & shard, int32_t index)
+{
+    unsigned slot = (unsigned)(shard.entries[index].expiry % THROTTLE_WHEEL_SLOTS);
+    shard.entries[index].nextInWheel = shard.wheel[slot];
+    shard.wheel[slot] = index;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Unlink
+//
+// @description         : Removes an entry from its bucket chain. Caller must hold the shard lock.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void ThrottleTable::Unlink(shard_t & shard, int32_t index)
+{
+    int32_t *link = &shard.buckets[shard.entries[index].keyHash & (shard.buckets.size() - 1)];
+    while (*link != index)
+    {
+        link = &shard.entries[*link].nextInBucket;
+    }
+    *link = shard.entries[index].nextInBucket;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Find
+//
+// @description         : Looks up a key. Caller must hold the shard lock.
+//
+// @returns             : Index of the key's entry, -1 if it is not tracked.
+//-------------------------------------------------------------------------------------------------------------
+int32_t ThrottleTable::Find(shard_t & shard, uint64_t keyHash)
+{
+    int32_t index = shard.buckets[keyHash & (shard.buckets.size() - 1)];
+    while (index >= 0 && shard.entries[index].keyHash != keyHash)
+    {
+        index = shard.entries[index].nextInBucket;
+    }
+
+    return index;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Acquire
+//
+// @description         : Entry of a key, created if the key is not tracked yet. When the pool is exhausted
+//                        the entry at the head of the next occupied wheel slot, one of those nearest to
+//                        expiry, is dropped to make room. Caller must hold the shard lock.
+//
+// @returns             : Index of the key's entry
+//-------------------------------------------------------------------------------------------------------------
+int32_t ThrottleTable::Acquire(shard_t & shard, uint64_t keyHash, long long now)
+{
+    int32_t index = Find(shard, keyHash);
+    if (index >= 0)
+    {
+        return index;
+    }
+
+    for (unsigned step = 1; step <= THROTTLE_WHEEL_SLOTS && shard.freeHead < 0; step++)
+    {
+        unsigned slot = (unsigned)((shard.wheelTime + step) % THROTTLE_WHEEL_SLOTS);
+        int32_t victim = shard.wheel[slot];
+        if (victim >= 0)
+        {
+            shard.wheel[slot] = shard.entries[victim].nextInWheel;
+            Unlink(shard, victim);
+            shard.entries[victim].nextInBucket = -1;
+            shard.freeHead = victim;
+            if (m_metrics != nullptr)
+            {
+                m_metrics->Count(METRIC_THROTTLE_EVICTIONS);
+            }
+        }
+    }
+
+    index = shard.freeHead;
+    entry_t & entry = shard.entries[index];
+    shard.freeHead = entry.nextInBucket;
+
+    entry.keyHash = keyHash;
+    entry.updated = now;
+    entry.lockedUntil = 0;
+    entry.expiry = now + 1;
+    entry.debt = 0;
+
+    int32_t & bucket = shard.buckets[keyHash & (shard.buckets.size() - 1)];
+    entry.nextInBucket = bucket;
+    bucket = index;
+    Schedule(shard, index);
+    return index;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Drain
+//
+// @description         : Forgives the debt earned back since the entry was last updated.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void ThrottleTable::Drain(entry_t & entry, long long now)
+{
+    if (now <= entry.updated)
+    {
+        return;
+    }
+
+    uint64_t drained = (uint64_t)(now - entry.updated) * m_limit.maxFailures * THROTTLE_DEBT_UNIT /
+                       max(m_limit.windowSeconds, 1u);
+    entry.debt = (drained >= entry.debt) ? 0 : entry.debt - (uint32_t)drained;
+    entry.updated = now;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : IsLocked
+//
+// @description         : Checks whether a key is locked out.
+//
+// @returns             : True if the key is locked out.
+//-------------------------------------------------------------------------------------------------------------
+bool ThrottleTable::IsLocked(uint64_t keyHash, long long now)
+{
+    if (!IsEnabled())
+    {
+        return false;
+    }
+
+    shard_t & shard = GetShard(keyHash);
+    lock_guard<mutex> shardLock(shard.lock);
+    Advance(shard, now);
+    int32_t index = Find(shard, keyHash);
+    return index >= 0 && shard.entries[index].lockedUntil > now;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : RecordFailure
+//
+// @description         : Adds a failure to a key's debt and locks the key out once there is no room left for
+//                        another failure, i.e. at the maxFailures'th failure within a window. The lockout
+//                        lasts lockoutSeconds, and at least until one failure has been forgiven again.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void ThrottleTable::RecordFailure(uint64_t keyHash, long long now)
+{
+    if (!IsEnabled())
+    {
+        return;
+    }
+
+    uint64_t limit = (uint64_t)m_limit.maxFailures * THROTTLE_DEBT_UNIT;
+    uint64_t window = max(m_limit.windowSeconds, 1u);
+    shard_t & shard = GetShard(keyHash);
+    lock_guard<mutex> shardLock(shard.lock);
+    Advance(shard, now);
+    entry_t & entry = shard.entries[Acquire(shard, keyHash, now)];
+
+    Drain(entry, now);
+    entry.debt = (uint32_t)min((uint64_t)entry.debt + THROTTLE_DEBT_UNIT, limit);
+    if (entry.debt > limit - THROTTLE_DEBT_UNIT)
+    {
+        long long oneFailure = (long long)((window + m_limit.maxFailures - 1) / m_limit.maxFailures);
+        entry.lockedUntil = max(entry.lockedUntil, now + max((long long)m_limit.lockoutSeconds, oneFailure));
+    }
+
+    // Seconds until all of the debt is forgiven, rounded up
+    long long drainSeconds = (long long)((entry.debt * window + limit - 1) / limit);
+    entry.expiry = max(entry.lockedUntil, now + drainSeconds);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Forgive
+//
+// @description         : Clears a key's failures and lockout. Its entry is freed at its next wheel turn.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void ThrottleTable::Forgive(uint64_t keyHash, long long now)
+{
+    if (!IsEnabled())
+    {
+        return;
+    }
+
+    shard_t & shard = GetShard(keyHash);
+    lock_guard<mutex> shardLock(shard.lock);
+    Advance(shard, now);
+    int32_t index = Find(shard, keyHash);
+    if (index >= 0)
+    {
+        entry_t & entry = shard.entries[index];
+        entry.debt = 0;
+        entry.lockedUntil = 0;
+        entry.updated = now;
+        entry.expiry = now;
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetMemoryUsage
+//
+// @description         : Memory of the shards, all allocated by the constructor whether keys are tracked or
+//                        not.
+//
+// @returns             : Bytes
+//-------------------------------------------------------------------------------------------------------------
+size_t ThrottleTable::GetMemoryUsage()
+{
+    size_t bytes = THROTTLE_SHARD_COUNT * sizeof(shard_t);
+    for (unsigned i = 0; i < THROTTLE_SHARD_COUNT; i++)
+    {
+        bytes += m_shards[i].buckets.capacity() * sizeof(int32_t) + m_shards[i].entries.capacity() * sizeof(entry_t);
+    }
+    return bytes;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : LoginThrottle
+//
+// @description         : Constructor
+//-------------------------------------------------------------------------------------------------------------
+LoginThrottle::LoginThrottle(const loginThrottlePolicy_t & policy)
+    : m_users(policy.perUser, policy.capacity), m_sources(policy.perSource, policy.capacity)
+{
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetDefaultPolicy
+//
+// @description         : 5 failures of a username lock it out for 15 minutes; a source may fail 50 times a
+//                        minute, across usernames, before it is locked out for 5 minutes.
+//
+// @returns             : Default throttling policy
+//-------------------------------------------------------------------------------------------------------------
+loginThrottlePolicy_t LoginThrottle::GetDefaultPolicy()
+{
+    loginThrottlePolicy_t policy;
+    policy.perUser.maxFailures = 5;
+    policy.perUser.windowSeconds = 15 * 60;
+    policy.perUser.lockoutSeconds = 15 * 60;
+    policy.perSource.maxFailures = 50;
+    policy.perSource.windowSeconds = 60;
+    policy.perSource.lockoutSeconds = 5 * 60;
+    policy.capacity = DEFAULT_THROTTLE_CAPACITY;
+    return policy;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : SetMetrics
+//
+// @description         : Metrics the evictions of both tables are counted in, not owned.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void LoginThrottle::SetMetrics(AuthMetrics *metrics)
+{
+    m_users.SetMetrics(metrics);
+    m_sources.SetMetrics(metrics);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : HashKey
+//
+// @description         : Hash a username or source is tracked by.
+//
+// @returns             : Hash of key
+//-------------------------------------------------------------------------------------------------------------
+uint64_t LoginThrottle::HashKey(string_view key)
+{
+    return (uint64_t)hash<string_view>()(key);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : IsLocked
+//
+// @description         : Checks whether logins of a username, or from a source, are locked out.
+//
+// @param sourceKey     : Where the login comes from, empty if unknown
+// @param now           : Wall clock time in seconds
+//
+// @returns             : True if the login has to be refused.
+//-------------------------------------------------------------------------------------------------------------
+bool LoginThrottle::IsLocked(string_view userName, string_view sourceKey, long long now)
+{
+    return m_users.IsLocked(HashKey(userName), now) ||
+           (!sourceKey.empty() && m_sources.IsLocked(HashKey(sourceKey), now));
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : RecordFailure
+//
+// @description         : Counts a failed login against both the username and the source.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void LoginThrottle::RecordFailure(string_view userName, string_view sourceKey, long long now)
+{
+    m_users.RecordFailure(HashKey(userName), now);
+    if (!sourceKey.empty())
+    {
+        m_sources.RecordFailure(HashKey(sourceKey), now);
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : RecordSuccess
+//
+// @description         : Forgives the failures of a username after a successful login. Failures of the
+//                        source are kept, a source guessing many usernames does not get away by knowing one.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void LoginThrottle::RecordSuccess(string_view userName, long long now)
+{
+    m_users.Forgive(HashKey(userName), now);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetMemoryUsage
+//
+// @description         : Memory of both tables.
+//
+// @returns             : Bytes
+//-------------------------------------------------------------------------------------------------------------
+size_t LoginThrottle::GetMemoryUsage()
+{
+    return m_users.GetMemoryUsage() + m_sources.GetMemoryUsage();
+}
@@ -0,0 +1,121 @@
+#ifndef _LOGIN_THROTTLE_H_
+#define _LOGIN_THROTTLE_H_
+#include<mutex>
+#include<stddef.h>
+#include<stdint.h>
+#include<string_view>
+#include<vector>
+#include "metrics.h"
+
+using namespace std;
+
+//-------------------------------------------------------------------------------------------------------------
+// Globals
+//-------------------------------------------------------------------------------------------------------------
+const unsigned THROTTLE_SHARD_COUNT = 16;
+const unsigned THROTTLE_WHEEL_SLOTS = 256;    // One per second, expiries further out take several turns
+const uint32_t THROTTLE_DEBT_UNIT = 1000;     // Debt of one failure
+const size_t DEFAULT_THROTTLE_CAPACITY = 65536;
+
+//-------------------------------------------------------------------------------------------------------------
+// Structs
+//-------------------------------------------------------------------------------------------------------------
+typedef struct throttleLimit_tag
+{
+    unsigned maxFailures;                     // Failures after which a key is locked out, 0 for no limit
+    unsigned windowSeconds;                   // Time in which maxFailures failures are forgiven again
+    unsigned lockoutSeconds;                  // Time a key stays locked out
+}throttleLimit_t;
+
+typedef struct loginThrottlePolicy_tag
+{
+    throttleLimit_t perUser;                  // Failed logins of a username, from any source
+    throttleLimit_t perSource;                // Failed logins from a source, for any username
+    size_t capacity;                          // Keys tracked per limit, memory stays fixed beyond that
+}loginThrottlePolicy_t;
+
+//-------------------------------------------------------------------------------------------------------------
+// Failure counters of one kind of key, a token bucket per key. Every failure adds one unit of debt which
+// drains at maxFailures units per windowSeconds; the failure after which the debt has no room left for
+// another one locks the key out for lockoutSeconds. A lockout shorter than the window leaves debt behind,
+// so a key which keeps failing is locked out again sooner.
+//
+// Keys are kept by their 64 bit hash in a fixed pool of entries per shard, chained from a fixed bucket
+// array, so no memory is allocated after construction. Each entry sits in one slot of the shard's timing
+// wheel, the one of the second its state runs out. The wheel is advanced on every access, freeing the
+// entries whose time has come and moving on those whose expiry was pushed out meanwhile. When the pool is
+// full the entry nearest to expiry is dropped. All operations are O(1) amortized under the shard's lock.
+//-------------------------------------------------------------------------------------------------------------
+class ThrottleTable
+{
+private:
+    typedef struct entry_tag
+    {
+        uint64_t keyHash;
+        long long updated;                    // Time debt was last drained
+        long long lockedUntil;
+        long long expiry;                     // Time from which the entry holds no state
+        uint32_t debt;                        // In THROTTLE_DEBT_UNIT per failure
+        int32_t nextInBucket;                 // Next entry of the bucket chain, or of the free list
+        int32_t nextInWheel;
+    }entry_t;
+
+    typedef struct shard_tag
+    {
+        mutex lock;
+        vector<int32_t> buckets;
+        vector<entry_t> entries;
+        int32_t freeHead;
+        int32_t wheel[THROTTLE_WHEEL_SLOTS];
+        long long wheelTime;                  // Second up to which the wheel has been advanced
+    }shard_t;
+
+    throttleLimit_t                         m_limit;
+    shard_t                                *m_shards;
+    AuthMetrics                            *m_metrics;
+
+    shard_t & GetShard(uint64_t keyHash);
+    void Advance(shard_t & shard, long long now);
+    void Schedule(shard_t & shard, int32_t index);
+    void Unlink(shard_t & shard, int32_t index);
+    int32_t Find(shard_t & shard, uint64_t keyHash);
+    int32_t Acquire(shard_t & shard, uint64_t keyHash, long long now);
+    void Drain(entry_t & entry, long long now);
+
+public:
+    ThrottleTable(const throttleLimit_t & limit, size_t capacity);
+    ~ThrottleTable();
+    ThrottleTable(const ThrottleTable &) = delete;
+    ThrottleTable & operator=(const ThrottleTable &) = delete;
+
+    void SetMetrics(AuthMetrics *metrics) { m_metrics = metrics; }
+    bool IsEnabled() const { return m_limit.maxFailures > 0; }
+    bool IsLocked(uint64_t keyHash, long long now);
+    void RecordFailure(uint64_t keyHash, long long now);
+    void Forgive(uint64_t keyHash, long long now);
+    size_t GetMemoryUsage();
+};
+
+//-------------------------------------------------------------------------------------------------------------
+// Failed login tracking of AuthModule, by username and by source (e.g. the client's address). A login is
+// refused while either of them is locked out, before the user is looked up or any password is hashed.
+//-------------------------------------------------------------------------------------------------------------
+class LoginThrottle
+{
+private:
+    ThrottleTable                           m_users;
+    ThrottleTable                           m_sources;
+
+    static uint64_t HashKey(string_view key);
+
+public:
+    LoginThrottle(const loginThrottlePolicy_t & policy);
+    static loginThrottlePolicy_t GetDefaultPolicy();
+    void SetMetrics(AuthMetrics *metrics);
+    bool IsLocked(string_view userName, string_view sourceKey, long long now);
+    void RecordFailure(string_view userName, string_view sourceKey, long long now);
+    void RecordSuccess(string_view userName, long long now);
+    size_t GetMemoryUsage();
+};
+
+#endif
@@ -1,14 +1,17 @@
 #include "auth_module.h"
+#include "logger.h"
 
 //-------------------------------------------------------------------------------------------------------------
 // Globals
 //-------------------------------------------------------------------------------------------------------------
 const int MAX_ATTEMPTS = 3;
+const char *PASSWORD_RULES = "6 to 255 characters, with a lowercase and an uppercase letter, a digit and a\n"
+                             "                   special character";
 
 //-------------------------------------------------------------------------------------------------------------
 // @name                : DoLogin
 //
-// @description         : Login prompt.
+// @description         : Login prompt. If the password has expired, the user is prompted to update it.
 //
 // @returns             : true on success
 //-------------------------------------------------------------------------------------------------------------
@@ -21,9 +24,29 @@ bool DoLogin(AuthModule & auth)
     cin >> user;
     printf("Password: ");
     cin >> pwd;
-    bool retval = auth.Login(user, pwd);
+    loginResult_t result = auth.Login(user, pwd);
+    if (result == LOGIN_LOCKED)
+    {
+        printf("** Too many failed attempts, try again later\n");
+    }
+
+    while (result == LOGIN_PASSWORD_EXPIRED)
+    {
+        string pwd1;
+        string pwd2;
+        printf("\n** Password Update\n");
+        printf("Password rules   : %s\n", PASSWORD_RULES);
+        printf("New password     : ");
+        cin >> pwd1;
+        printf("Confirm password : ");
+        cin >> pwd2;
+        if (pwd1 == pwd2 && auth.ChangeExpiredPassword(user, pwd, pwd2))
+        {
+            result = LOGIN_OK;
+        }
+    }
 
-    return retval;
+    return result == LOGIN_OK;
 }
 
 //-------------------------------------------------------------------------------------------------------------
@@ -41,13 +64,14 @@ bool DoRegistration(AuthModule & auth)
     printf("\n** New user registration\n");
     printf("Select a username: ");
     cin >> user;
-    userData_t *userData = auth.GetUserData(user);
-    if (userData != nullptr)
+    userData_t userData;
+    if (auth.GetUserDataCopy(user, userData))
     {
         printf("User already exists!\n");
         return false;
     }
 
+    printf("Password rules   : %s\n", PASSWORD_RULES);
     printf("Choose password  : ");
     cin >> pwd1;
     printf("Confirm password : ");
@@ -84,8 +108,10 @@ bool UpdatePassword(AuthModule & auth)
     cin >> userName;
     printf("Current password : ");
     cin >> currentPwd;
-    if (auth.Login(userName, currentPwd))
+    loginResult_t result = auth.Login(userName, currentPwd);
+    if (result == LOGIN_OK || result == LOGIN_PASSWORD_EXPIRED)
     {
+        printf("Password rules   : %s\n", PASSWORD_RULES);
         printf("New password     : ");
         cin >> pwd1;
         printf("Confirm password : ");
@@ -96,6 +122,36 @@ bool UpdatePassword(AuthModule & auth)
     return false;
 }
 
+//-------------------------------------------------------------------------------------------------------------
+// @name                : ImportUsers
+//
+// @description         : Bulk registration of users listed in a CSV file (username,password per line).
+//
+// @returns             : true if at least one user was registered
+//-------------------------------------------------------------------------------------------------------------
+bool ImportUsers(AuthModule & auth)
+{
+    string csvFile;
+    vector<registerResult_t> results;
+    printf("\n** Import users\n");
+    printf("CSV file         : ");
+    cin >> csvFile;
+
+    size_t registered = auth.ImportUsersCsv(csvFile, results);
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        if (results[i] != REGISTER_OK)
+        {
+            printf("Entry #%zu rejected (%s)\n", i + 1,
+                   (results[i] == REGISTER_USER_EXISTS) ? "user exists" :
+                   (results[i] == REGISTER_INVALID_PASSWORD) ? "invalid password" :
+                   (results[i] == REGISTER_READ_ONLY) ? "read only" : "invalid username");
+        }
+    }
+
+    return registered > 0;
+}
+
 //-------------------------------------------------------------------------------------------------------------
 // M A I N 
 //-------------------------------------------------------------------------------------------------------------
@@ -118,8 +174,19 @@ int main()
     authPolicy.passwordLenMin = 6;
     authPolicy.passwordExpiryDays = 30;
 
+    // Persist changes through the journal, compacted into users.db in background
+    authModuleConfig_t authConfig = AuthModule::GetDefaultAuthModuleConfig();
+    authConfig.storageMode = STORAGE_MODE_JOURNAL;
+
+    // Lock out a username for a while after repeated failed logins, across menu attempts
+    authConfig.useLoginThrottle = true;
+
+    // Show all of the module's messages, in order with the menu
+    Logger::GetInstance().SetSynchronous(true);
+    Logger::GetInstance().SetLevel(LOG_LEVEL_DEBUG);
+
     // Creating Authentication Module
-    AuthModule auth(authPolicy);
+    AuthModule auth(authPolicy, authConfig);
     auth.Initialize();
 
     // Main menu
@@ -135,6 +202,8 @@ int main()
         printf("2> Register\n");
         printf("3> Password Update\n");
         printf("4> Show registered users\n");
+        printf("5> Import users from CSV\n");
+        printf("6> Show metrics\n");
         printf("0> Quit\n");
         printf(">> Choice: ");
         cin >> choice;
@@ -192,6 +261,17 @@ int main()
             // This is only for debug purpose
             auth.ShowUsersDetails();
         }
+        else if (choice == "5")
+        {
+            // Bulk registration
+            ImportUsers(auth);
+        }
+        else if (choice == "6")
+        {
+            string metrics;
+            auth.DumpMetrics(metrics);
+            printf("%s", metrics.c_str());
+        }
         else if (choice == "0")
         {
             printf("** Terminating...\n");
@@ -0,0 +1,186 @@
+#include "metrics.h"
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : AuthMetrics
+//
+// @description         : Constructor. All metrics start at 0.
+//-------------------------------------------------------------------------------------------------------------
+AuthMetrics::AuthMetrics()
+{
+    m_stripes = nullptr;
+#if AUTH_METRICS_ENABLED
+    m_stripes = new stripe_t[METRICS_STRIPES]();
+#endif
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : AuthMetrics
+//
+// @description         : Destructor
+//-------------------------------------------------------------------------------------------------------------
+AuthMetrics::~AuthMetrics()
+{
+    delete[] m_stripes;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetSnapshot
+//
+// @description         : Adds up the metrics recorded by all threads so far. May run concurrently with
+//                        recording.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void AuthMetrics::GetSnapshot(metricsSnapshot_t & snapshot)
+{
+    memset(&snapshot, 0, sizeof(snapshot));
+    if (m_stripes == nullptr)
+    {
+        return;
+    }
+
+    for (unsigned s = 0; s < METRICS_STRIPES; s++)
+    {
+        stripe_t & stripe = m_stripes[s];
+        for (unsigned counter = 0; counter < METRIC_COUNTER_COUNT; counter++)
+        {
+            snapshot.counters[counter] += stripe.counters[counter].load(memory_order_relaxed);
+        }
+
+        for (unsigned op = 0; op < METRIC_OP_COUNT; op++)
+        {
+            latencyHistogram_t & histogram = snapshot.latencies[op];
+            for (unsigned bucket = 0; bucket < METRICS_HISTOGRAM_BUCKETS; bucket++)
+            {
+                uint64_t count = stripe.buckets[op][bucket].load(memory_order_relaxed);
+                histogram.buckets[bucket] += count;
+                histogram.count += count;
+            }
+            histogram.totalNs += stripe.totalNs[op].load(memory_order_relaxed);
+            histogram.maxNs = max(histogram.maxNs, stripe.maxNs[op].load(memory_order_relaxed));
+        }
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetHistogramBucketValue
+//
+// @description         : Largest value counted in a histogram bucket.
+//
+// @returns             : Value
+//-------------------------------------------------------------------------------------------------------------
+uint64_t GetHistogramBucketValue(unsigned bucket)
+{
+    const uint64_t subBuckets = 1ull << METRICS_SUB_BUCKET_BITS;
+    if (bucket < subBuckets)
+    {
+        return bucket;
+    }
+
+    unsigned shift = (bucket >> METRICS_SUB_BUCKET_BITS) - 1;
+    uint64_t lowest = (subBuckets + (bucket & (subBuckets - 1))) << shift;
+    return lowest + (1ull << shift) - 1;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetHistogramPercentile
+//
+// @description         : Value below which the given share of the recorded values lies, to the precision of
+//                        the histogram buckets.
+//
+// @param percentile    : Share between 0 and 1, e.g. 0.99
+//
+// @returns             : Value, 0 for an empty histogram
+//-------------------------------------------------------------------------------------------------------------
+uint64_t GetHistogramPercentile(const latencyHistogram_t & histogram, double percentile)
+{
+    if (histogram.count == 0)
+    {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)(percentile * histogram.count);
+    if (rank >= histogram.count)
+    {
+        rank = histogram.count - 1;
+    }
+
+    uint64_t seen = 0;
+    for (unsigned bucket = 0; bucket < METRICS_HISTOGRAM_BUCKETS; bucket++)
+    {
+        seen += histogram.buckets[bucket];
+        if (seen > rank)
+        {
+            return min(GetHistogramBucketValue(bucket), histogram.maxNs);
+        }
+    }
+
+    return histogram.maxNs;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetMetricOpName / GetMetricCounterName
+//
+// @description         : Names used in the text dump.
+//-------------------------------------------------------------------------------------------------------------
+const char* GetMetricOpName(metricOp_t op)
+{
+    static const char *names[METRIC_OP_COUNT] =
+    {
+        "login", "register", "update_password", "journal_append", "snapshot_write", "compaction", "load",
+        "validate_session", "file_sync"
+    };
+    return (op < METRIC_OP_COUNT) ? names[op] : "unknown";
+}
+
+const char* GetMetricCounterName(metricCounter_t counter)
+{
+    static const char *names[METRIC_COUNTER_COUNT] =
+    {
+        "lookups", "lookup_misses", "table_rehashes", "snapshot_materialized", "file_writes", "file_write_bytes",
+        "negative_filter_rejects", "logins_throttled", "throttle_evictions",
+        "sessions_issued", "sessions_rejected", "journal_sync_waits", "snapshots_coalesced",
+        "user_cache_hits", "user_cache_evictions", "replica_records"
+    };
+    return (counter < METRIC_COUNTER_COUNT) ? names[counter] : "unknown";
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : FormatMetrics
+//
+// @description         : Appends a text dump of a snapshot to out: one line per operation with its count and
+//                        latencies in us, followed by one line per counter.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void FormatMetrics(const metricsSnapshot_t & snapshot, string & out)
+{
+    char line[256];
+#if !AUTH_METRICS_ENABLED
+    out.append("Metrics are disabled (AUTH_METRICS_ENABLED=0)\n");
+#endif
+
+    snprintf(line, sizeof(line), "%-16s %10s %10s %10s %10s %10s %10s\n",
+             "latency (us)", "count", "mean", "p50", "p99", "p99.9", "max");
+    out.append(line);
+    for (unsigned op = 0; op < METRIC_OP_COUNT; op++)
+    {
+        const latencyHistogram_t & histogram = snapshot.latencies[op];
+        double mean = (histogram.count > 0) ? (double)histogram.totalNs / histogram.count : 0;
+        snprintf(line, sizeof(line), "%-16s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+                 GetMetricOpName((metricOp_t)op), (unsigned long long)histogram.count, mean / 1000,
+                 GetHistogramPercentile(histogram, 0.50) / 1000.0, GetHistogramPercentile(histogram, 0.99) / 1000.0,
+                 GetHistogramPercentile(histogram, 0.999) / 1000.0, histogram.maxNs / 1000.0);
+        out.append(line);
+    }
+
+    for (unsigned counter = 0; counter < METRIC_COUNTER_COUNT; counter++)
+    {
+        snprintf(line, sizeof(line), "%-24s %llu\n", GetMetricCounterName((metricCounter_t)counter),
+                 (unsigned long long)snapshot.counters[counter]);
+        out.append(line);
+    }
+}
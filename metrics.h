@@ -0,0 +1,201 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_
+#include<atomic>
+#include<chrono>
+#include<stddef.h>
+#include<stdint.h>
+#include<string>
+
+using namespace std;
+
+//-------------------------------------------------------------------------------------------------------------
+// Globals
+//-------------------------------------------------------------------------------------------------------------
+#ifndef AUTH_METRICS_ENABLED
+#define AUTH_METRICS_ENABLED 1                // 0 compiles all recording out, snapshots are then all zero
+#endif
+const unsigned METRICS_SUB_BUCKET_BITS = 4;   // 16 buckets per power of 2, i.e. values within ~6%
+const unsigned METRICS_MAX_VALUE_BITS = 40;   // Latencies up to ~18 minutes (in ns), longer ones are clamped
+const unsigned METRICS_HISTOGRAM_BUCKETS = (METRICS_MAX_VALUE_BITS - METRICS_SUB_BUCKET_BITS + 1) << METRICS_SUB_BUCKET_BITS;
+const unsigned METRICS_STRIPES = 8;           // Threads are spread over this many copies of all metrics
+
+//-------------------------------------------------------------------------------------------------------------
+// Enums
+//-------------------------------------------------------------------------------------------------------------
+typedef enum metricOp_tag
+{
+    METRIC_OP_LOGIN,                          // Login() and LoginAsync(), including the password verification
+    METRIC_OP_REGISTER,                       // Register()
+    METRIC_OP_UPDATE_PASSWORD,                // UpdateUserPassword()
+    METRIC_OP_JOURNAL_APPEND,                 // Write and flush of journal records
+    METRIC_OP_SNAPSHOT_WRITE,                 // Rewrite of the users database file
+    METRIC_OP_COMPACTION,                     // Snapshot written by a journal compaction
+    METRIC_OP_LOAD,                           // LoadUsersDataFile()
+    METRIC_OP_VALIDATE_SESSION,               // ValidateSession()
+    METRIC_OP_FILE_SYNC,                      // fdatasync() of the journal or of a replaced file
+    METRIC_OP_COUNT
+}metricOp_t;
+
+typedef enum metricCounter_tag
+{
+    METRIC_LOOKUPS,                           // Lookups in the users' tables
+    METRIC_LOOKUP_MISSES,                     // Lookups which did not find the user
+    METRIC_TABLE_REHASHES,                    // Growths of a users' table
+    METRIC_SNAPSHOT_MATERIALIZED,             // Users moved from the mapped snapshot into the tables
+    METRIC_FILE_WRITES,                       // Writes to the journal or users database files
+    METRIC_FILE_WRITE_BYTES,
+    METRIC_NEGATIVE_FILTER_REJECTS,           // Lookups of unknown users answered by the negative lookup filter
+    METRIC_LOGINS_THROTTLED,                  // Logins refused as locked out, without checking the password
+    METRIC_THROTTLE_EVICTIONS,                // Failure counters dropped because the throttle's table was full
+    METRIC_SESSIONS_ISSUED,                   // Session tokens issued by LoginWithSession()
+    METRIC_SESSIONS_REJECTED,                 // Session tokens found invalid, expired or revoked
+    METRIC_JOURNAL_SYNC_WAITS,                // Journal appends which waited for a group commit
+    METRIC_SNAPSHOTS_COALESCED,               // Snapshot rewrites saved, the change was in another one's
+    METRIC_USER_CACHE_HITS,                   // Snapshot users found decoded in the bounded residency cache
+    METRIC_USER_CACHE_EVICTIONS,              // Snapshot users dropped from it for others
+    METRIC_REPLICA_RECORDS,                   // Journal records of the primary applied by a replica
+    METRIC_COUNTER_COUNT
+}metricCounter_t;
+
+//-------------------------------------------------------------------------------------------------------------
+// Structs
+//-------------------------------------------------------------------------------------------------------------
+typedef struct latencyHistogram_tag
+{
+    uint64_t buckets[METRICS_HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t totalNs;
+    uint64_t maxNs;
+}latencyHistogram_t;
+
+typedef struct metricsSnapshot_tag
+{
+    uint64_t counters[METRIC_COUNTER_COUNT];
+    latencyHistogram_t latencies[METRIC_OP_COUNT];
+}metricsSnapshot_t;
+
+//-------------------------------------------------------------------------------------------------------------
+// Functions
+//-------------------------------------------------------------------------------------------------------------
+uint64_t GetHistogramBucketValue(unsigned bucket);
+uint64_t GetHistogramPercentile(const latencyHistogram_t & histogram, double percentile);
+const char* GetMetricOpName(metricOp_t op);
+const char* GetMetricCounterName(metricCounter_t counter);
+void FormatMetrics(const metricsSnapshot_t & snapshot, string & out);
+
+//-------------------------------------------------------------------------------------------------------------
+// Counters and latency histograms of one AuthModule. Recording is a few relaxed atomic increments on the
+// calling thread's stripe, so it never takes a lock and threads rarely share a cache line. Histograms are
+// log-linear (HDR style): each power of 2 is split in 2^METRICS_SUB_BUCKET_BITS buckets. A snapshot adds
+// up the stripes; it is not atomic as a whole, but every value in it was recorded.
+//-------------------------------------------------------------------------------------------------------------
+class AuthMetrics
+{
+private:
+    typedef struct alignas(64) stripe_tag
+    {
+        atomic<uint64_t> counters[METRIC_COUNTER_COUNT];
+        atomic<uint64_t> totalNs[METRIC_OP_COUNT];
+        atomic<uint64_t> maxNs[METRIC_OP_COUNT];
+        atomic<uint64_t> buckets[METRIC_OP_COUNT][METRICS_HISTOGRAM_BUCKETS];
+    }stripe_t;
+
+    stripe_t                               *m_stripes;                   // NULL if metrics are compiled out
+
+    static stripe_t & GetStripe(stripe_t *stripes);
+
+public:
+    AuthMetrics();
+    ~AuthMetrics();
+    AuthMetrics(const AuthMetrics &) = delete;
+    AuthMetrics & operator=(const AuthMetrics &) = delete;
+
+    static uint64_t Now();
+    void Count(metricCounter_t counter, uint64_t value = 1);
+    void Record(metricOp_t op, uint64_t latencyNs);
+    void RecordSince(metricOp_t op, uint64_t startNs);
+    void GetSnapshot(metricsSnapshot_t & snapshot);
+    size_t GetMemoryUsage() const { return (m_stripes != nullptr) ? METRICS_STRIPES * sizeof(stripe_t) : 0; }
+};
+
+//-------------------------------------------------------------------------------------------------------------
+// Records the time from its construction to its destruction as a latency of op.
+//-------------------------------------------------------------------------------------------------------------
+class MetricsTimer
+{
+private:
+    AuthMetrics                            &m_metrics;
+    metricOp_t                              m_op;
+    uint64_t                                m_startNs;
+
+public:
+    MetricsTimer(AuthMetrics & metrics, metricOp_t op) : m_metrics(metrics), m_op(op), m_startNs(AuthMetrics::Now()) {}
+    ~MetricsTimer() { m_metrics.RecordSince(m_op, m_startNs); }
+};
+
+//-------------------------------------------------------------------------------------------------------------
+// Recording is inlined into the hot paths, and compiles to nothing without AUTH_METRICS_ENABLED.
+//-------------------------------------------------------------------------------------------------------------
+inline unsigned GetHistogramBucket(uint64_t value)
+{
+    const uint64_t subBuckets = 1ull << METRICS_SUB_BUCKET_BITS;
+    if (value < subBuckets)
+    {
+        return (unsigned)value;
+    }
+
+    unsigned topBit = 63 - (unsigned)__builtin_clzll(value);
+    if (topBit >= METRICS_MAX_VALUE_BITS)
+    {
+        return METRICS_HISTOGRAM_BUCKETS - 1;
+    }
+
+    unsigned shift = topBit - METRICS_SUB_BUCKET_BITS;
+    return ((shift + 1) << METRICS_SUB_BUCKET_BITS) + (unsigned)((value >> shift) & (subBuckets - 1));
+}
+
+inline AuthMetrics::stripe_t & AuthMetrics::GetStripe(stripe_t *stripes)
+{
+    static atomic<unsigned> nextStripe(0);
+    thread_local unsigned stripe = nextStripe.fetch_add(1, memory_order_relaxed) % METRICS_STRIPES;
+    return stripes[stripe];
+}
+
+inline uint64_t AuthMetrics::Now()
+{
+#if AUTH_METRICS_ENABLED
+    return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#else
+    return 0;
+#endif
+}
+
+inline void AuthMetrics::Count(metricCounter_t counter, uint64_t value)
+{
+#if AUTH_METRICS_ENABLED
+    GetStripe(m_stripes).counters[counter].fetch_add(value, memory_order_relaxed);
+#endif
+}
+
+inline void AuthMetrics::Record(metricOp_t op, uint64_t latencyNs)
+{
+#if AUTH_METRICS_ENABLED
+    stripe_t & stripe = GetStripe(m_stripes);
+    stripe.buckets[op][GetHistogramBucket(latencyNs)].fetch_add(1, memory_order_relaxed);
+    stripe.totalNs[op].fetch_add(latencyNs, memory_order_relaxed);
+
+    uint64_t maxNs = stripe.maxNs[op].load(memory_order_relaxed);
+    while (latencyNs > maxNs && !stripe.maxNs[op].compare_exchange_weak(maxNs, latencyNs, memory_order_relaxed))
+    {
+    }
+#endif
+}
+
+inline void AuthMetrics::RecordSince(metricOp_t op, uint64_t startNs)
+{
+#if AUTH_METRICS_ENABLED
+    Record(op, Now() - startNs);
+#endif
+}
+
+#endif
@@ -0,0 +1,131 @@
+#include "password_hasher.h"
+#include "sha256.h"
+#include <random>
+#include <string.h>
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GenerateRandomBytes
+//
+// @description         : Fills buf from the system's random device. Used for salts.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void GenerateRandomBytes(uint8_t *buf, size_t len)
+{
+    thread_local random_device randomDevice;
+    for (size_t i = 0; i < len; i += sizeof(unsigned int))
+    {
+        unsigned int value = randomDevice();
+        size_t chunk = (len - i < sizeof(value)) ? len - i : sizeof(value);
+        memcpy(buf + i, &value, chunk);
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetPasswordHashAlgorithmName
+//
+// @description         : Name of a PASSWORD_HASH_* algorithm, for display.
+//
+// @returns             : Name, "unknown" for an algorithm this build does not know
+//-------------------------------------------------------------------------------------------------------------
+const char* GetPasswordHashAlgorithmName(uint8_t algorithm)
+{
+    switch (algorithm)
+    {
+    case PASSWORD_HASH_NONE:
+        return "none";
+    case PASSWORD_HASH_PBKDF2_SHA256:
+        return "pbkdf2-sha256";
+    default:
+        return "unknown";
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Pbkdf2PasswordHasher
+//
+// @description         : Constructor
+//
+// @param iterations    : PBKDF2 iteration count used for new hashes. Higher values make logins slower and
+//                        offline guessing proportionally more expensive.
+//-------------------------------------------------------------------------------------------------------------
+Pbkdf2PasswordHasher::Pbkdf2PasswordHasher(uint32_t iterations)
+{
+    m_iterations = (iterations > 0) ? iterations : 1;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Hash
+//
+// @description         : Hashes a password with a new random salt and the configured iteration count.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void Pbkdf2PasswordHasher::Hash(const string & password, passwordHash_t & hash)
+{
+    uint8_t salt[PASSWORD_SALT_LEN];
+    GenerateRandomBytes(salt, sizeof(salt));
+    HashWithSalt(password, salt, hash);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : HashWithSalt
+//
+// @description         : Hashes a password with a given salt, typically the one of the user's current
+//                        password, and the configured iteration count.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void Pbkdf2PasswordHasher::HashWithSalt(const string & password, const uint8_t salt[PASSWORD_SALT_LEN], passwordHash_t & hash)
+{
+    hash.algorithm = PASSWORD_HASH_PBKDF2_SHA256;
+    hash.iterations = m_iterations;
+    memcpy(hash.salt, salt, sizeof(hash.salt));
+    Derive(password, hash);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Derive
+//
+// @description         : Computes hash.digest of a password with the algorithm, iteration count and salt
+//                        already set in hash.
+//
+// @returns             : False if hash was computed with another algorithm, its digest is then unchanged.
+//-------------------------------------------------------------------------------------------------------------
+bool Pbkdf2PasswordHasher::Derive(const string & password, passwordHash_t & hash)
+{
+    if (hash.algorithm != PASSWORD_HASH_PBKDF2_SHA256 || hash.iterations == 0)
+    {
+        return false;
+    }
+
+    Pbkdf2HmacSha256(password.data(), password.size(), hash.salt, sizeof(hash.salt),
+                     hash.iterations, hash.digest, sizeof(hash.digest));
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Verify
+//
+// @description         : Recomputes the digest with the salt and iteration count stored in hash and compares
+//                        it in constant time.
+//
+// @returns             : True if password matches hash.
+//-------------------------------------------------------------------------------------------------------------
+bool Pbkdf2PasswordHasher::Verify(const string & password, const passwordHash_t & hash)
+{
+    passwordHash_t derived = hash;
+    return Derive(password, derived) && ConstantTimeEquals(derived.digest, hash.digest, sizeof(hash.digest));
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : NeedsRehash
+//
+// @description         : Tells if a stored hash was computed with other parameters than the current ones.
+//
+// @returns             : True if the password should be hashed again on next successful login.
+//-------------------------------------------------------------------------------------------------------------
+bool Pbkdf2PasswordHasher::NeedsRehash(const passwordHash_t & hash)
+{
+    return (hash.algorithm != PASSWORD_HASH_PBKDF2_SHA256 || hash.iterations != m_iterations);
+}
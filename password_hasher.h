@@ -0,0 +1,66 @@
+#ifndef _PASSWORD_HASHER_H_
+#define _PASSWORD_HASHER_H_
+#include<stdint.h>
+#include<string>
+
+using namespace std;
+
+//-------------------------------------------------------------------------------------------------------------
+// Globals
+//-------------------------------------------------------------------------------------------------------------
+const uint8_t PASSWORD_HASH_NONE = 0;
+const uint8_t PASSWORD_HASH_PBKDF2_SHA256 = 1;
+const size_t PASSWORD_SALT_LEN = 16;
+const size_t PASSWORD_DIGEST_LEN = 32;
+const uint32_t DEFAULT_PBKDF2_ITERATIONS = 100000;
+//-------------------------------------------------------------------------------------------------------------
+// Structs
+//-------------------------------------------------------------------------------------------------------------
+typedef struct passwordHash_tag
+{
+    uint8_t algorithm;                        // PASSWORD_HASH_* used to compute the digest
+    uint32_t iterations;                      // Work factor the digest was computed with
+    uint8_t salt[PASSWORD_SALT_LEN];          // Random per password
+    uint8_t digest[PASSWORD_DIGEST_LEN];
+}passwordHash_t;
+
+//-------------------------------------------------------------------------------------------------------------
+// Password hasher interface. Hash() always uses the hasher's current work factor while Verify() uses the
+// parameters stored along with the digest, so the work factor can be changed without invalidating the
+// passwords already stored. HashWithSalt() lets all passwords of a user share one salt, so that a password
+// can be checked against the user's previous ones with a single Derive(). Implementations must be safe to
+// call from several threads at once.
+//-------------------------------------------------------------------------------------------------------------
+class PasswordHasher
+{
+public:
+    virtual ~PasswordHasher() {}
+    virtual void Hash(const string & password, passwordHash_t & hash) = 0;
+    virtual void HashWithSalt(const string & password, const uint8_t salt[PASSWORD_SALT_LEN], passwordHash_t & hash) = 0;
+    virtual bool Derive(const string & password, passwordHash_t & hash) = 0;
+    virtual bool Verify(const string & password, const passwordHash_t & hash) = 0;
+    virtual bool NeedsRehash(const passwordHash_t & hash) = 0;
+};
+
+//-------------------------------------------------------------------------------------------------------------
+// PBKDF2-HMAC-SHA256 hasher
+//-------------------------------------------------------------------------------------------------------------
+class Pbkdf2PasswordHasher : public PasswordHasher
+{
+private:
+    uint32_t                                m_iterations;
+
+public:
+    Pbkdf2PasswordHasher(uint32_t iterations = DEFAULT_PBKDF2_ITERATIONS);
+    void Hash(const string & password, passwordHash_t & hash);
+    void HashWithSalt(const string & password, const uint8_t salt[PASSWORD_SALT_LEN], passwordHash_t & hash);
+    bool Derive(const string & password, passwordHash_t & hash);
+    bool Verify(const string & password, const passwordHash_t & hash);
+    bool NeedsRehash(const passwordHash_t & hash);
+    uint32_t GetIterations() { return m_iterations; }
+};
+
+void GenerateRandomBytes(uint8_t *buf, size_t len);
+const char* GetPasswordHashAlgorithmName(uint8_t algorithm);
+
+#endif
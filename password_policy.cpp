@@ -0,0 +1,64 @@
+#include "password_policy.h"
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : CheckPassword
+//
+// @description         : Runtime counterpart of CheckPassword<Profile>(), for rules without a profile.
+//
+// @returns             : PASSWORD_CHECK_OK if the password meets the rules, the first rule it breaks otherwise.
+//-------------------------------------------------------------------------------------------------------------
+passwordCheck_t CheckPassword(const passwordRules_t & rules, const char *password, size_t len)
+{
+    if (len < rules.lenMin || len > rules.lenMax)
+    {
+        return PASSWORD_CHECK_LENGTH;
+    }
+    if (rules.requiredClasses != 0 || rules.forbiddenClasses != 0)
+    {
+        uint8_t classes = GetCharClasses(password, len);
+        if ((classes & rules.forbiddenClasses) != 0)
+        {
+            return PASSWORD_CHECK_FORBIDDEN_CLASS;
+        }
+        if ((classes & rules.requiredClasses) != rules.requiredClasses)
+        {
+            return PASSWORD_CHECK_MISSING_CLASS;
+        }
+    }
+    return PASSWORD_CHECK_OK;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : PasswordValidator
+//
+// @description         : Constructor
+//-------------------------------------------------------------------------------------------------------------
+PasswordValidator::PasswordValidator(const passwordRules_t & rules)
+{
+    m_rules = rules;
+    m_isSpecialized = SelectProfile<OpenPasswordProfile>() || SelectProfile<StrongPasswordProfile>();
+    if (!m_isSpecialized)
+    {
+        m_check = CheckPassword;
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : SelectProfile
+//
+// @description         : Uses the checks of Profile if its rules are the validator's.
+//
+// @returns             : True if selected. False otherwise.
+//-------------------------------------------------------------------------------------------------------------
+template<typename Profile>
+bool PasswordValidator::SelectProfile()
+{
+    constexpr passwordRules_t rules = Profile::rules;
+    if (m_rules.lenMin != rules.lenMin || m_rules.lenMax != rules.lenMax ||
+        m_rules.requiredClasses != rules.requiredClasses || m_rules.forbiddenClasses != rules.forbiddenClasses)
+    {
+        return false;
+    }
+    m_check = CheckProfile<Profile>;
+    return true;
+}
@@ -0,0 +1,190 @@
+#ifndef _PASSWORD_POLICY_H_
+#define _PASSWORD_POLICY_H_
+#include<limits.h>
+#include<stddef.h>
+#include<stdint.h>
+#include<string>
+
+using namespace std;
+
+//-------------------------------------------------------------------------------------------------------------
+// Enums
+//-------------------------------------------------------------------------------------------------------------
+typedef enum charClass_tag
+{
+    CHAR_CLASS_LOWER = 0x01,                  // a-z
+    CHAR_CLASS_UPPER = 0x02,                  // A-Z
+    CHAR_CLASS_DIGIT = 0x04,                  // 0-9
+    CHAR_CLASS_SPECIAL = 0x08,                // Printable ASCII punctuation and space, and every byte of a
+                                              // non ASCII (UTF-8) character
+    CHAR_CLASS_CONTROL = 0x10                 // ASCII control characters, including DEL
+}charClass_t;
+
+typedef enum passwordCheck_tag
+{
+    PASSWORD_CHECK_OK,
+    PASSWORD_CHECK_LENGTH,                    // Shorter than lenMin or longer than lenMax
+    PASSWORD_CHECK_MISSING_CLASS,             // A required character class does not occur
+    PASSWORD_CHECK_FORBIDDEN_CLASS            // A forbidden character class occurs
+}passwordCheck_t;
+
+//-------------------------------------------------------------------------------------------------------------
+// Globals
+//-------------------------------------------------------------------------------------------------------------
+const uint8_t STRONG_PASSWORD_REQUIRED_CLASSES = CHAR_CLASS_LOWER | CHAR_CLASS_UPPER | CHAR_CLASS_DIGIT |
+                                                 CHAR_CLASS_SPECIAL;
+const uint8_t STRONG_PASSWORD_FORBIDDEN_CLASSES = CHAR_CLASS_CONTROL;
+const unsigned DEFAULT_PASSWORD_LEN_MIN = 6;
+const unsigned DEFAULT_PASSWORD_LEN_MAX = 255;
+
+//-------------------------------------------------------------------------------------------------------------
+// Structs
+//-------------------------------------------------------------------------------------------------------------
+typedef struct passwordRules_tag
+{
+    unsigned lenMin;                          // Length bounds in bytes, 0 and UINT_MAX for none
+    unsigned lenMax;
+    uint8_t requiredClasses;                  // charClass_t bits of which each must occur at least once
+    uint8_t forbiddenClasses;                 // charClass_t bits of which none may occur
+}passwordRules_t;
+
+typedef struct charClassTable_tag
+{
+    uint8_t classes[256];
+}charClassTable_t;
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : MakeCharClassTable
+//
+// @description         : Builds the table of the charClass_t bit of every byte value, at compile time.
+//-------------------------------------------------------------------------------------------------------------
+constexpr charClassTable_t MakeCharClassTable()
+{
+    charClassTable_t table = {};
+    for (unsigned c = 0; c < 256; c++)
+    {
+        table.classes[c] = (c >= 'a' && c <= 'z') ? CHAR_CLASS_LOWER :
+                           (c >= 'A' && c <= 'Z') ? CHAR_CLASS_UPPER :
+                           (c >= '0' && c <= '9') ? CHAR_CLASS_DIGIT :
+                           (c < 0x20 || c == 0x7f) ? CHAR_CLASS_CONTROL : CHAR_CLASS_SPECIAL;
+    }
+    return table;
+}
+
+inline constexpr charClassTable_t CHAR_CLASS_TABLE = MakeCharClassTable();
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetCharClasses
+//
+// @description         : Single pass over the password's bytes, one table lookup per byte. Four lanes are
+//                        or'ed independently so the lookups of consecutive bytes do not wait on each other.
+//
+// @returns             : The charClass_t bits of all bytes of the password.
+//-------------------------------------------------------------------------------------------------------------
+inline uint8_t GetCharClasses(const char *password, size_t len)
+{
+    const uint8_t *bytes = (const uint8_t*)password;
+    uint8_t lanes[4] = { 0, 0, 0, 0 };
+    size_t i = 0;
+    for (; i + 4 <= len; i += 4)
+    {
+        lanes[0] |= CHAR_CLASS_TABLE.classes[bytes[i]];
+        lanes[1] |= CHAR_CLASS_TABLE.classes[bytes[i + 1]];
+        lanes[2] |= CHAR_CLASS_TABLE.classes[bytes[i + 2]];
+        lanes[3] |= CHAR_CLASS_TABLE.classes[bytes[i + 3]];
+    }
+    for (; i < len; i++)
+    {
+        lanes[0] |= CHAR_CLASS_TABLE.classes[bytes[i]];
+    }
+    return lanes[0] | lanes[1] | lanes[2] | lanes[3];
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// A password policy known at compile time. CheckPassword() of a profile contains only the checks the
+// profile actually has: bounds of 0 and UINT_MAX cost no comparison, and without required or forbidden
+// classes the password's bytes are not read at all.
+//-------------------------------------------------------------------------------------------------------------
+template<unsigned LenMin, unsigned LenMax, uint8_t RequiredClasses, uint8_t ForbiddenClasses>
+struct PasswordProfile
+{
+    static constexpr passwordRules_t rules = { LenMin, LenMax, RequiredClasses, ForbiddenClasses };
+};
+
+typedef PasswordProfile<0, UINT_MAX, 0, 0> OpenPasswordProfile;         // useStrongPasswords off
+typedef PasswordProfile<DEFAULT_PASSWORD_LEN_MIN, DEFAULT_PASSWORD_LEN_MAX, STRONG_PASSWORD_REQUIRED_CLASSES,
+                        STRONG_PASSWORD_FORBIDDEN_CLASSES> StrongPasswordProfile;
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : CheckPassword
+//
+// @description         : Checks a password against the rules of Profile, see PasswordProfile.
+//
+// @returns             : PASSWORD_CHECK_OK if the password meets them, the first rule it breaks otherwise.
+//-------------------------------------------------------------------------------------------------------------
+template<typename Profile>
+passwordCheck_t CheckPassword(const char *password, size_t len)
+{
+    constexpr passwordRules_t rules = Profile::rules;
+    if constexpr (rules.lenMin > 0)
+    {
+        if (len < rules.lenMin)
+        {
+            return PASSWORD_CHECK_LENGTH;
+        }
+    }
+    if constexpr (rules.lenMax < UINT_MAX)
+    {
+        if (len > rules.lenMax)
+        {
+            return PASSWORD_CHECK_LENGTH;
+        }
+    }
+    if constexpr (rules.requiredClasses != 0 || rules.forbiddenClasses != 0)
+    {
+        uint8_t classes = GetCharClasses(password, len);
+        if ((classes & rules.forbiddenClasses) != 0)
+        {
+            return PASSWORD_CHECK_FORBIDDEN_CLASS;
+        }
+        if ((classes & rules.requiredClasses) != rules.requiredClasses)
+        {
+            return PASSWORD_CHECK_MISSING_CLASS;
+        }
+    }
+    return PASSWORD_CHECK_OK;
+}
+
+passwordCheck_t CheckPassword(const passwordRules_t & rules, const char *password, size_t len);
+
+//-------------------------------------------------------------------------------------------------------------
+// Password checks of one set of rules, chosen once when constructed: the CheckPassword() of the matching
+// PasswordProfile if there is one, the runtime CheckPassword() of the rules otherwise. A check is then a
+// single indirect call without any branching on the policy.
+//-------------------------------------------------------------------------------------------------------------
+class PasswordValidator
+{
+private:
+    typedef passwordCheck_t (*checkFunction_t)(const passwordRules_t & rules, const char *password, size_t len);
+
+    passwordRules_t                         m_rules;
+    checkFunction_t                         m_check;
+    bool                                    m_isSpecialized;
+
+    template<typename Profile>
+    static passwordCheck_t CheckProfile(const passwordRules_t &, const char *password, size_t len)
+    {
+        return CheckPassword<Profile>(password, len);
+    }
+
+    template<typename Profile>
+    bool SelectProfile();
+
+public:
+    PasswordValidator(const passwordRules_t & rules);
+
+    passwordCheck_t Check(const string & password) const { return m_check(m_rules, password.data(), password.size()); }
+    bool IsSpecialized() const { return m_isSpecialized; }
+};
+
+#endif
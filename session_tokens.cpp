@@ -0,0 +1,431 @@
+#include "session_tokens.h"
+#include "password_hasher.h"
+#include "users_db_format.h"
+#include <algorithm>
+#include <chrono>
+#include <functional>
+
+//-------------------------------------------------------------------------------------------------------------
+// Globals
+//-------------------------------------------------------------------------------------------------------------
+static const char BASE64URL_ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+const size_t SESSION_PAYLOAD_FIXED_LEN = 1 + 8 + 4 + 8 + 8;
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : EncodeBase64Url
+//
+// @description         : Appends the base64url encoding of data to out, without padding.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+static void EncodeBase64Url(string & out, const uint8_t *data, size_t len)
+{
+    out.reserve(out.size() + (len * 4 + 2) / 3);
+    size_t i = 0;
+    for (; i + 3 <= len; i += 3)
+    {
+        uint32_t bits = ((uint32_t)data[i] << 16) | ((uint32_t)data[i + 1] << 8) | data[i + 2];
+        out.push_back(BASE64URL_ALPHABET[(bits >> 18) & 0x3F]);
+        out.push_back(BASE64URL_ALPHABET[(bits >> 12) & 0x3F]);
+        out.push_back(BASE64URL_ALPHABET[(bits >> 6) & 0x3F]);
+        out.push_back(BASE64URL_ALPHABET[bits & 0x3F]);
+    }
+
+    if (i < len)
+    {
+        uint32_t bits = (uint32_t)data[i] << 16;
+        if (i + 1 < len)
+        {
+            bits |= (uint32_t)data[i + 1] << 8;
+        }
+        out.push_back(BASE64URL_ALPHABET[(bits >> 18) & 0x3F]);
+        out.push_back(BASE64URL_ALPHABET[(bits >> 12) & 0x3F]);
+        if (i + 1 < len)
+        {
+            out.push_back(BASE64URL_ALPHABET[(bits >> 6) & 0x3F]);
+        }
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : DecodeBase64UrlChar
+//
+// @description         : Value of a base64url character.
+//
+// @returns             : 0 to 63, -1 if c is not part of the alphabet.
+//-------------------------------------------------------------------------------------------------------------
+static inline int DecodeBase64UrlChar(char c)
+{
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '-') return 62;
+    if (c == '_') return 63;
+    return -1;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : DecodeBase64Url
+//
+// @description         : Decodes unpadded base64url text into out, which must hold at least 3/4 of its
+//                        length.
+//
+// @returns             : Decoded length, 0 if text is not valid base64url.
+//-------------------------------------------------------------------------------------------------------------
+static size_t DecodeBase64Url(string_view text, uint8_t *out)
+{
+    if (text.size() % 4 == 1)
+    {
+        return 0;
+    }
+
+    size_t len = 0;
+    uint32_t bits = 0;
+    unsigned bitCount = 0;
+    for (char c : text)
+    {
+        int value = DecodeBase64UrlChar(c);
+        if (value < 0)
+        {
+            return 0;
+        }
+        bits = (bits << 6) | (uint32_t)value;
+        bitCount += 6;
+        if (bitCount >= 8)
+        {
+            bitCount -= 8;
+            out[len++] = (uint8_t)(bits >> bitCount);
+        }
+    }
+
+    // Left over bits must be zero, so that every token has exactly one encoding
+    return ((bits & ((1u << bitCount) - 1)) == 0) ? len : 0;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetTimeMs
+//
+// @description         : Wall clock in ms, the issue time of tokens. Revoking a user's sessions covers the
+//                        tokens issued up to the same ms, so it needs a finer clock than CoarseClock.
+//
+// @returns             : ms since the epoch
+//-------------------------------------------------------------------------------------------------------------
+static uint64_t GetTimeMs()
+{
+    return (uint64_t)chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : SessionTokens
+//
+// @description         : Constructor
+//
+// @param key           : Secret the tokens are signed with, a random one is generated if empty
+// @param lifetimeSeconds : Time a token is valid after it was issued
+//-------------------------------------------------------------------------------------------------------------
+SessionTokens::SessionTokens(const string & key, unsigned lifetimeSeconds)
+{
+    if (key.empty())
+    {
+        uint8_t randomKey[SESSION_KEY_LEN];
+        GenerateRandomBytes(randomKey, sizeof(randomKey));
+        HmacSha256Init(m_keyed, randomKey, sizeof(randomKey));
+    }
+    else
+    {
+        HmacSha256Init(m_keyed, key.data(), key.size());
+    }
+
+    m_lifetime = (lifetimeSeconds > 0) ? lifetimeSeconds : DEFAULT_SESSION_LIFETIME;
+    m_shards = new revocationShard_t[SESSION_REVOCATION_SHARDS];
+    for (unsigned i = 0; i < SESSION_REVOCATION_SHARDS; i++)
+    {
+        m_shards[i].sweepAt = SESSION_REVOCATION_SWEEP_MIN;
+    }
+    m_revocations = 0;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : SessionTokens
+//
+// @description         : Destructor
+//-------------------------------------------------------------------------------------------------------------
+SessionTokens::~SessionTokens()
+{
+    delete[] m_shards;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Sign
+//
+// @description         : MAC of a payload, computed from a copy of the keyed HMAC state.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void SessionTokens::Sign(const void *payload, size_t len, uint8_t mac[SHA256_DIGEST_LEN]) const
+{
+    hmacSha256Context_t ctx = m_keyed;
+    HmacSha256Update(ctx, payload, len);
+    HmacSha256Final(ctx, mac);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Issue
+//
+// @description         : Issues a token for a user, valid for the configured lifetime from now on.
+//
+// @param generation    : Of the user's password, returned along with the user by Validate()
+// @param token         : Receives the token
+//
+// @returns             : False if the username is too long to fit in a token.
+//-------------------------------------------------------------------------------------------------------------
+bool SessionTokens::Issue(string_view userName, uint64_t generation, string & token)
+{
+    token.clear();
+    if ((SESSION_PAYLOAD_FIXED_LEN + userName.size() + SESSION_MAC_LEN) * 4 > SESSION_TOKEN_MAX_LEN * 3)
+    {
+        return false;
+    }
+
+    uint64_t tokenId = 0;
+    GenerateRandomBytes((uint8_t *)&tokenId, sizeof(tokenId));
+
+    string payload;
+    payload.reserve(SESSION_PAYLOAD_FIXED_LEN + userName.size() + SESSION_MAC_LEN);
+    payload.push_back((char)SESSION_TOKEN_VERSION);
+    PutU64(payload, GetTimeMs());
+    PutU32(payload, m_lifetime);
+    PutU64(payload, tokenId);
+    PutU64(payload, generation);
+    payload.append(userName);
+
+    uint8_t mac[SHA256_DIGEST_LEN];
+    Sign(payload.data(), payload.size(), mac);
+    payload.append((const char *)mac, SESSION_MAC_LEN);
+
+    EncodeBase64Url(token, (const uint8_t *)payload.data(), payload.size());
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Decode
+//
+// @description         : Checks the signature and lifetime of a token and takes it apart. Revocations are
+//                        not checked.
+//
+// @returns             : SESSION_OK, SESSION_EXPIRED or SESSION_INVALID
+//-------------------------------------------------------------------------------------------------------------
+sessionResult_t SessionTokens::Decode(string_view token, long long now, uint64_t & issuedMs, long long & expiry,
+                                      uint64_t & tokenId, uint64_t & generation, string & userName) const
+{
+    uint8_t raw[SESSION_TOKEN_MAX_LEN];
+    size_t rawLen = 0;
+    if (token.size() > SESSION_TOKEN_MAX_LEN || (rawLen = DecodeBase64Url(token, raw)) == 0 ||
+        rawLen < SESSION_PAYLOAD_FIXED_LEN + SESSION_MAC_LEN)
+    {
+        return SESSION_INVALID;
+    }
+
+    size_t payloadLen = rawLen - SESSION_MAC_LEN;
+    uint8_t mac[SHA256_DIGEST_LEN];
+    Sign(raw, payloadLen, mac);
+    if (!ConstantTimeEquals(mac, raw + payloadLen, SESSION_MAC_LEN))
+    {
+        return SESSION_INVALID;
+    }
+
+    recordReader_t reader = { (const char *)raw, payloadLen, 0 };
+    uint8_t version = 0;
+    uint32_t lifetime = 0;
+    GetU8(reader, version);
+    GetU64(reader, issuedMs);
+    GetU32(reader, lifetime);
+    GetU64(reader, tokenId);
+    GetU64(reader, generation);
+
+    // A token signed with the same key by a module with a longer lifetime could outlive its revocation
+    if (version != SESSION_TOKEN_VERSION || lifetime > m_lifetime)
+    {
+        return SESSION_INVALID;
+    }
+
+    userName.assign((const char *)raw + reader.pos, payloadLen - reader.pos);
+    expiry = (long long)(issuedMs / 1000) + lifetime;
+    return (now < expiry) ? SESSION_OK : SESSION_EXPIRED;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Validate
+//
+// @description         : Checks a token: signature, lifetime and revocations.
+//
+// @param now           : Current time in seconds
+// @param userName      : Receives the user the token was issued to, if it is valid
+// @param generation    : Receives the password generation the token was issued with, if it is valid
+//
+// @returns             : SESSION_OK if the token is valid, else why it is not.
+//-------------------------------------------------------------------------------------------------------------
+sessionResult_t SessionTokens::Validate(string_view token, long long now, string & userName, uint64_t & generation)
+{
+    uint64_t issuedMs = 0, tokenId = 0, tokenGeneration = 0;
+    long long expiry = 0;
+    string tokenUser;
+    sessionResult_t result = Decode(token, now, issuedMs, expiry, tokenId, tokenGeneration, tokenUser);
+    if (result != SESSION_OK)
+    {
+        return result;
+    }
+
+    if (m_revocations.load(memory_order_acquire) > 0)
+    {
+        {
+            revocationShard_t & shard = GetShard(tokenId);
+            shared_lock<shared_mutex> shardLock(shard.lock);
+            if (shard.tokens.find(tokenId) != shard.tokens.end())
+            {
+                return SESSION_REVOKED;
+            }
+        }
+
+        uint64_t userHash = HashUserName(tokenUser);
+        revocationShard_t & shard = GetShard(userHash);
+        shared_lock<shared_mutex> shardLock(shard.lock);
+        auto revoked = shard.users.find(userHash);
+        if (revoked != shard.users.end() && issuedMs <= (uint64_t)revoked->second)
+        {
+            return SESSION_REVOKED;
+        }
+    }
+
+    userName.swap(tokenUser);
+    generation = tokenGeneration;
+    return SESSION_OK;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Revoke
+//
+// @description         : Revokes a single token, e.g. on logout. It is remembered until it expires.
+//
+// @param now           : Current time in seconds
+//
+// @returns             : False if the token was not valid to begin with.
+//-------------------------------------------------------------------------------------------------------------
+bool SessionTokens::Revoke(string_view token, long long now)
+{
+    uint64_t issuedMs = 0, tokenId = 0, generation = 0;
+    long long expiry = 0;
+    string userName;
+    if (Decode(token, now, issuedMs, expiry, tokenId, generation, userName) != SESSION_OK)
+    {
+        return false;
+    }
+
+    revocationShard_t & shard = GetShard(tokenId);
+    unique_lock<shared_mutex> shardLock(shard.lock);
+    if (shard.tokens.emplace(tokenId, expiry).second)
+    {
+        m_revocations.fetch_add(1, memory_order_release);
+    }
+    Sweep(shard, now);
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : RevokeUser
+//
+// @description         : Revokes all tokens issued to a user so far. Tokens issued afterwards are valid.
+//                        Remembered until the last of the revoked tokens would have expired.
+//
+// @param now           : Current time in seconds
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void SessionTokens::RevokeUser(string_view userName, long long now)
+{
+    uint64_t userHash = HashUserName(userName);
+    long long revokedMs = (long long)GetTimeMs();
+    revocationShard_t & shard = GetShard(userHash);
+    unique_lock<shared_mutex> shardLock(shard.lock);
+    auto inserted = shard.users.emplace(userHash, revokedMs);
+    if (inserted.second)
+    {
+        m_revocations.fetch_add(1, memory_order_release);
+    }
+    else
+    {
+        inserted.first->second = max(inserted.first->second, revokedMs);
+    }
+    Sweep(shard, now);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetShard
+//
+// @description         : Revocation shard of a token id or username hash.
+//
+// @returns             : Shard
+//-------------------------------------------------------------------------------------------------------------
+SessionTokens::revocationShard_t & SessionTokens::GetShard(uint64_t key)
+{
+    return m_shards[((key * 0x9E3779B97F4A7C15ull) >> 32) % SESSION_REVOCATION_SHARDS];
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Sweep
+//
+// @description         : Drops the revocations of a shard which no longer cover an unexpired token, once the
+//                        shard has doubled since the last sweep. Caller must hold the shard's lock
+//                        exclusively.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void SessionTokens::Sweep(revocationShard_t & shard, long long now)
+{
+    if (shard.tokens.size() + shard.users.size() < shard.sweepAt)
+    {
+        return;
+    }
+
+    size_t dropped = 0;
+    for (auto it = shard.tokens.begin(); it != shard.tokens.end();)
+    {
+        if (it->second <= now)
+        {
+            it = shard.tokens.erase(it);
+            dropped++;
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    for (auto it = shard.users.begin(); it != shard.users.end();)
+    {
+        if (it->second / 1000 + m_lifetime < now)
+        {
+            it = shard.users.erase(it);
+            dropped++;
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    m_revocations.fetch_sub(dropped, memory_order_release);
+    shard.sweepAt = max(SESSION_REVOCATION_SWEEP_MIN, (shard.tokens.size() + shard.users.size()) * 2);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : HashUserName
+//
+// @description         : Key of a user's revocation. Colliding names share it, which can only revoke more.
+//
+// @returns             : Hash
+//-------------------------------------------------------------------------------------------------------------
+uint64_t SessionTokens::HashUserName(string_view userName)
+{
+    return (uint64_t)hash<string_view>()(userName);
+}
@@ -0,0 +1,93 @@
+#ifndef _SESSION_TOKENS_H_
+#define _SESSION_TOKENS_H_
+#include<atomic>
+#include<shared_mutex>
+#include<stddef.h>
+#include<stdint.h>
+#include<string>
+#include<string_view>
+#include<unordered_map>
+#include "sha256.h"
+
+using namespace std;
+
+//-------------------------------------------------------------------------------------------------------------
+// Globals
+//-------------------------------------------------------------------------------------------------------------
+const uint8_t SESSION_TOKEN_VERSION = 2;
+const size_t SESSION_KEY_LEN = 32;            // Random key used when none is configured
+const size_t SESSION_MAC_LEN = 16;            // HMAC-SHA256 truncated to 128 bits
+const size_t SESSION_TOKEN_MAX_LEN = 512;     // Encoded, longer tokens are refused without decoding them
+const unsigned DEFAULT_SESSION_LIFETIME = 60 * 60;
+const unsigned SESSION_REVOCATION_SHARDS = 16;
+const size_t SESSION_REVOCATION_SWEEP_MIN = 64;
+
+//-------------------------------------------------------------------------------------------------------------
+// Enums
+//-------------------------------------------------------------------------------------------------------------
+typedef enum sessionResult_tag
+{
+    SESSION_OK,                               // Token valid
+    SESSION_INVALID,                          // Malformed, or not signed with this module's key
+    SESSION_EXPIRED,                          // Lifetime of the token is over
+    SESSION_REVOKED                           // Revoked, by itself or along with all sessions of the user
+}sessionResult_t;
+
+//-------------------------------------------------------------------------------------------------------------
+// Session tokens, issued after a successful login so that clients can authenticate further requests
+// without sending the password again. A token carries everything needed to check it:
+//
+//   Token    : base64url (no padding) of payload, MAC
+//   Payload  : version (u8), issue time in ms (u64), lifetime in seconds (u32), token id (u64), password
+//              generation (u64), username
+//   MAC      : HMAC-SHA256 of the payload, first SESSION_MAC_LEN bytes
+//
+// Validation is stateless: the key's HMAC state is computed once, so checking a token is a copy of that
+// state, one or two SHA-256 blocks and a constant time comparison, independent of the no. of users or
+// sessions. Only revocations are kept, in memory until the tokens they cover have expired anyway: single
+// tokens by their id, and all tokens of a user issued up to a given time. The password generation is
+// opaque to this class, it is returned by Validate() for the caller to compare against the user's current
+// one; AuthModule uses the persisted time of the last password change, so that the tokens opened with an
+// old password stay refused across restarts.
+//
+// Tokens are only valid for the key they were signed with; with a random key they do not survive a
+// restart. All methods are safe to call from several threads at once.
+//-------------------------------------------------------------------------------------------------------------
+class SessionTokens
+{
+private:
+    typedef struct revocationShard_tag
+    {
+        shared_mutex lock;
+        unordered_map<uint64_t, long long> tokens;      // Token id to the token's expiry (s)
+        unordered_map<uint64_t, long long> users;       // Username hash to the time (ms) up to which its tokens
+                                                        // are revoked
+        size_t sweepAt;                                 // Revocations after which expired ones are dropped
+    }revocationShard_t;
+
+    hmacSha256Context_t                     m_keyed;                     // HMAC state after absorbing the key
+    unsigned                                m_lifetime;
+    revocationShard_t                      *m_shards;
+    atomic<size_t>                          m_revocations;
+
+    void Sign(const void *payload, size_t len, uint8_t mac[SHA256_DIGEST_LEN]) const;
+    sessionResult_t Decode(string_view token, long long now, uint64_t & issuedMs, long long & expiry,
+                           uint64_t & tokenId, uint64_t & generation, string & userName) const;
+    revocationShard_t & GetShard(uint64_t key);
+    void Sweep(revocationShard_t & shard, long long now);
+    static uint64_t HashUserName(string_view userName);
+
+public:
+    SessionTokens(const string & key, unsigned lifetimeSeconds);
+    ~SessionTokens();
+    SessionTokens(const SessionTokens &) = delete;
+    SessionTokens & operator=(const SessionTokens &) = delete;
+
+    bool Issue(string_view userName, uint64_t generation, string & token);
+    sessionResult_t Validate(string_view token, long long now, string & userName, uint64_t & generation);
+    bool Revoke(string_view token, long long now);
+    void RevokeUser(string_view userName, long long now);
+    size_t GetRevocationCount() const { return m_revocations.load(memory_order_relaxed); }
+};
+
+#endif
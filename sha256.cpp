@@ -0,0 +1,273 @@
+#include "sha256.h"
+#include <string.h>
+
+//-------------------------------------------------------------------------------------------------------------
+// Globals
+//-------------------------------------------------------------------------------------------------------------
+static const uint32_t SHA256_K[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t RotateRight(uint32_t value, unsigned bits)
+{
+    return (value >> bits) | (value << (32 - bits));
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Sha256Compress
+//
+// @description         : Processes one 64 byte block into the hash state.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+static void Sha256Compress(uint32_t state[8], const uint8_t block[SHA256_BLOCK_LEN])
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++)
+    {
+        w[i] = ((uint32_t)block[4 * i] << 24) | ((uint32_t)block[4 * i + 1] << 16) |
+               ((uint32_t)block[4 * i + 2] << 8) | (uint32_t)block[4 * i + 3];
+    }
+
+    for (int i = 16; i < 64; i++)
+    {
+        uint32_t s0 = RotateRight(w[i - 15], 7) ^ RotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = RotateRight(w[i - 2], 17) ^ RotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t s1 = RotateRight(e, 6) ^ RotateRight(e, 11) ^ RotateRight(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + ch + SHA256_K[i] + w[i];
+        uint32_t s0 = RotateRight(a, 2) ^ RotateRight(a, 13) ^ RotateRight(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + maj;
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// SHA-256 (FIPS 180-4)
+//-------------------------------------------------------------------------------------------------------------
+void Sha256Init(sha256Context_t & ctx)
+{
+    static const uint32_t initialState[8] =
+    {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    memcpy(ctx.state, initialState, sizeof(initialState));
+    ctx.totalLen = 0;
+    ctx.blockLen = 0;
+}
+
+void Sha256Update(sha256Context_t & ctx, const void *data, size_t len)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    ctx.totalLen += len;
+
+    if (ctx.blockLen > 0)
+    {
+        size_t fill = SHA256_BLOCK_LEN - ctx.blockLen;
+        if (len < fill)
+        {
+            memcpy(ctx.block + ctx.blockLen, bytes, len);
+            ctx.blockLen += len;
+            return;
+        }
+
+        memcpy(ctx.block + ctx.blockLen, bytes, fill);
+        Sha256Compress(ctx.state, ctx.block);
+        ctx.blockLen = 0;
+        bytes += fill;
+        len -= fill;
+    }
+
+    while (len >= SHA256_BLOCK_LEN)
+    {
+        Sha256Compress(ctx.state, bytes);
+        bytes += SHA256_BLOCK_LEN;
+        len -= SHA256_BLOCK_LEN;
+    }
+
+    memcpy(ctx.block, bytes, len);
+    ctx.blockLen = len;
+}
+
+void Sha256Final(sha256Context_t & ctx, uint8_t digest[SHA256_DIGEST_LEN])
+{
+    uint64_t bitLen = ctx.totalLen * 8;
+
+    ctx.block[ctx.blockLen++] = 0x80;
+    if (ctx.blockLen > SHA256_BLOCK_LEN - 8)
+    {
+        memset(ctx.block + ctx.blockLen, 0, SHA256_BLOCK_LEN - ctx.blockLen);
+        Sha256Compress(ctx.state, ctx.block);
+        ctx.blockLen = 0;
+    }
+
+    memset(ctx.block + ctx.blockLen, 0, SHA256_BLOCK_LEN - 8 - ctx.blockLen);
+    for (int i = 0; i < 8; i++)
+    {
+        ctx.block[SHA256_BLOCK_LEN - 1 - i] = (uint8_t)(bitLen >> (8 * i));
+    }
+    Sha256Compress(ctx.state, ctx.block);
+
+    for (int i = 0; i < 8; i++)
+    {
+        digest[4 * i] = (uint8_t)(ctx.state[i] >> 24);
+        digest[4 * i + 1] = (uint8_t)(ctx.state[i] >> 16);
+        digest[4 * i + 2] = (uint8_t)(ctx.state[i] >> 8);
+        digest[4 * i + 3] = (uint8_t)ctx.state[i];
+    }
+}
+
+void Sha256(const void *data, size_t len, uint8_t digest[SHA256_DIGEST_LEN])
+{
+    sha256Context_t ctx;
+    Sha256Init(ctx);
+    Sha256Update(ctx, data, len);
+    Sha256Final(ctx, digest);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// HMAC-SHA256 (RFC 2104)
+//-------------------------------------------------------------------------------------------------------------
+void HmacSha256Init(hmacSha256Context_t & ctx, const void *key, size_t keyLen)
+{
+    uint8_t keyBlock[SHA256_BLOCK_LEN];
+    memset(keyBlock, 0, sizeof(keyBlock));
+    if (keyLen > SHA256_BLOCK_LEN)
+    {
+        Sha256(key, keyLen, keyBlock);
+    }
+    else
+    {
+        memcpy(keyBlock, key, keyLen);
+    }
+
+    uint8_t pad[SHA256_BLOCK_LEN];
+    for (size_t i = 0; i < SHA256_BLOCK_LEN; i++)
+    {
+        pad[i] = keyBlock[i] ^ 0x36;
+    }
+    Sha256Init(ctx.inner);
+    Sha256Update(ctx.inner, pad, sizeof(pad));
+
+    for (size_t i = 0; i < SHA256_BLOCK_LEN; i++)
+    {
+        pad[i] = keyBlock[i] ^ 0x5c;
+    }
+    Sha256Init(ctx.outer);
+    Sha256Update(ctx.outer, pad, sizeof(pad));
+}
+
+void HmacSha256Update(hmacSha256Context_t & ctx, const void *data, size_t len)
+{
+    Sha256Update(ctx.inner, data, len);
+}
+
+void HmacSha256Final(hmacSha256Context_t & ctx, uint8_t mac[SHA256_DIGEST_LEN])
+{
+    uint8_t innerDigest[SHA256_DIGEST_LEN];
+    Sha256Final(ctx.inner, innerDigest);
+    Sha256Update(ctx.outer, innerDigest, sizeof(innerDigest));
+    Sha256Final(ctx.outer, mac);
+}
+
+void HmacSha256(const void *key, size_t keyLen, const void *data, size_t len, uint8_t mac[SHA256_DIGEST_LEN])
+{
+    hmacSha256Context_t ctx;
+    HmacSha256Init(ctx, key, keyLen);
+    HmacSha256Update(ctx, data, len);
+    HmacSha256Final(ctx, mac);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Pbkdf2HmacSha256
+//
+// @description         : PBKDF2 (RFC 8018) with HMAC-SHA256 as the pseudo random function. The keyed inner and
+//                        outer states are computed once and copied for every iteration, so each iteration
+//                        costs two compressions.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void Pbkdf2HmacSha256(const void *password, size_t passwordLen, const void *salt, size_t saltLen,
+                      uint32_t iterations, uint8_t *derivedKey, size_t derivedKeyLen)
+{
+    hmacSha256Context_t keyed;
+    HmacSha256Init(keyed, password, passwordLen);
+
+    for (uint32_t blockIndex = 1; derivedKeyLen > 0; blockIndex++)
+    {
+        uint8_t counter[4] = { (uint8_t)(blockIndex >> 24), (uint8_t)(blockIndex >> 16),
+                               (uint8_t)(blockIndex >> 8), (uint8_t)blockIndex };
+        uint8_t u[SHA256_DIGEST_LEN];
+        uint8_t t[SHA256_DIGEST_LEN];
+
+        hmacSha256Context_t ctx = keyed;
+        HmacSha256Update(ctx, salt, saltLen);
+        HmacSha256Update(ctx, counter, sizeof(counter));
+        HmacSha256Final(ctx, u);
+        memcpy(t, u, sizeof(t));
+
+        for (uint32_t i = 1; i < iterations; i++)
+        {
+            ctx = keyed;
+            HmacSha256Update(ctx, u, sizeof(u));
+            HmacSha256Final(ctx, u);
+            for (size_t j = 0; j < SHA256_DIGEST_LEN; j++)
+            {
+                t[j] ^= u[j];
+            }
+        }
+
+        size_t len = (derivedKeyLen < SHA256_DIGEST_LEN) ? derivedKeyLen : SHA256_DIGEST_LEN;
+        memcpy(derivedKey, t, len);
+        derivedKey += len;
+        derivedKeyLen -= len;
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : ConstantTimeEquals
+//
+// @description         : Compares two buffers in time independent of where they differ.
+//
+// @returns             : True if equal.
+//-------------------------------------------------------------------------------------------------------------
+bool ConstantTimeEquals(const void *a, const void *b, size_t len)
+{
+    const volatile uint8_t *x = (const volatile uint8_t *)a;
+    const volatile uint8_t *y = (const volatile uint8_t *)b;
+    uint8_t diff = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        diff |= x[i] ^ y[i];
+    }
+
+    return diff == 0;
+}
@@ -0,0 +1,47 @@
+#ifndef _SHA256_H_
+#define _SHA256_H_
+#include<stddef.h>
+#include<stdint.h>
+
+//-------------------------------------------------------------------------------------------------------------
+// Globals
+//-------------------------------------------------------------------------------------------------------------
+const size_t SHA256_DIGEST_LEN = 32;
+const size_t SHA256_BLOCK_LEN = 64;
+
+//-------------------------------------------------------------------------------------------------------------
+// Structs
+//-------------------------------------------------------------------------------------------------------------
+typedef struct sha256Context_tag
+{
+    uint32_t state[8];
+    uint64_t totalLen;                        // Bytes hashed so far
+    uint8_t block[SHA256_BLOCK_LEN];          // Pending partial block
+    size_t blockLen;
+}sha256Context_t;
+
+typedef struct hmacSha256Context_tag
+{
+    sha256Context_t inner;
+    sha256Context_t outer;
+}hmacSha256Context_t;
+
+//-------------------------------------------------------------------------------------------------------------
+// Functions
+//-------------------------------------------------------------------------------------------------------------
+void Sha256Init(sha256Context_t & ctx);
+void Sha256Update(sha256Context_t & ctx, const void *data, size_t len);
+void Sha256Final(sha256Context_t & ctx, uint8_t digest[SHA256_DIGEST_LEN]);
+void Sha256(const void *data, size_t len, uint8_t digest[SHA256_DIGEST_LEN]);
+
+void HmacSha256Init(hmacSha256Context_t & ctx, const void *key, size_t keyLen);
+void HmacSha256Update(hmacSha256Context_t & ctx, const void *data, size_t len);
+void HmacSha256Final(hmacSha256Context_t & ctx, uint8_t mac[SHA256_DIGEST_LEN]);
+void HmacSha256(const void *key, size_t keyLen, const void *data, size_t len, uint8_t mac[SHA256_DIGEST_LEN]);
+
+void Pbkdf2HmacSha256(const void *password, size_t passwordLen, const void *salt, size_t saltLen,
+                      uint32_t iterations, uint8_t *derivedKey, size_t derivedKeyLen);
+
+bool ConstantTimeEquals(const void *a, const void *b, size_t len);
+
+#endif
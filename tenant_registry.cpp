@@ -0,0 +1,454 @@
+#include "tenant_registry.h"
+#include "logger.h"
+#include <algorithm>
+#include <errno.h>
+#include <sstream>
+#include <sys/stat.h>
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : MakeDirectory
+//
+// @description         : Creates a directory unless it exists already.
+//
+// @returns             : True if the directory exists.
+//-------------------------------------------------------------------------------------------------------------
+static bool MakeDirectory(const string & path)
+{
+    return (mkdir(path.c_str(), 0755) == 0 || errno == EEXIST);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : TenantRegistry
+//
+// @description         : Constructor. Call Open() before any tenant is used.
+//-------------------------------------------------------------------------------------------------------------
+TenantRegistry::TenantRegistry(const tenantRegistryConfig_t & config)
+{
+    m_config = config;
+    if (m_config.rootDirectory.empty())
+    {
+        m_config.rootDirectory = ".";
+    }
+
+    const authModuleConfig_t & moduleConfig = config.moduleConfig;
+    m_ownsPasswordHasher = (moduleConfig.passwordHasher == nullptr);
+    m_passwordHasher = m_ownsPasswordHasher ? new Pbkdf2PasswordHasher(moduleConfig.hashIterations) :
+                                              moduleConfig.passwordHasher;
+    m_ownsLoginPool = (moduleConfig.loginPool == nullptr);
+    m_loginPool = moduleConfig.loginPool;
+    if (m_ownsLoginPool)
+    {
+        unsigned workers = (moduleConfig.loginWorkers > 0) ? moduleConfig.loginWorkers : thread::hardware_concurrency();
+        m_loginPool = new ThreadPool(workers, moduleConfig.loginQueueCapacity);
+    }
+    m_clock = &CoarseClock::GetInstance();
+    m_loadedTenants = 0;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : TenantRegistry
+//
+// @description         : Destructor. Unloads all tenants before the resources they share go away.
+//-------------------------------------------------------------------------------------------------------------
+TenantRegistry::~TenantRegistry()
+{
+    m_tenants.clear();
+
+    if (m_ownsLoginPool)
+    {
+        delete m_loginPool;
+    }
+
+    if (m_ownsPasswordHasher)
+    {
+        delete m_passwordHasher;
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetDefaultTenantRegistryConfig
+//
+// @description         : Configuration with tenants under the working directory, journaled storage and the
+//                        default memory budget.
+//
+// @returns             : Default registry configuration
+//-------------------------------------------------------------------------------------------------------------
+tenantRegistryConfig_t TenantRegistry::GetDefaultTenantRegistryConfig()
+{
+    tenantRegistryConfig_t config;
+    config.rootDirectory = ".";
+    config.moduleConfig = AuthModule::GetDefaultAuthModuleConfig();
+    config.moduleConfig.storageMode = STORAGE_MODE_JOURNAL;
+    config.memoryBudget = DEFAULT_TENANT_MEMORY_BUDGET;
+    return config;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : IsValidTenantId
+//
+// @description         : Checks that a tenant id can be used as the name of its directory.
+//
+// @returns             : True if the id is valid.
+//-------------------------------------------------------------------------------------------------------------
+bool TenantRegistry::IsValidTenantId(const string & tenantId)
+{
+    if (tenantId.empty() || tenantId.size() > TENANT_ID_MAX_LEN)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < tenantId.size(); i++)
+    {
+        char c = tenantId[i];
+        if (!isalnum((unsigned char)c) && c != '-' && c != '_')
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Open
+//
+// @description         : Reads the list of tenants. No tenant is loaded, that happens on its first use. A
+//                        missing list is an empty one.
+//
+// @returns             : False if the root directory can not be created or the list is damaged.
+//-------------------------------------------------------------------------------------------------------------
+bool TenantRegistry::Open()
+{
+    if (!MakeDirectory(m_config.rootDirectory))
+    {
+        LOG_ERROR("Directory [ %s ] could not be created!", m_config.rootDirectory);
+        return false;
+    }
+
+    string listFile = m_config.rootDirectory + "/" + TENANTS_FILENAME;
+    ifstream in(listFile, ios::in);
+    if (!in)
+    {
+        LOG_INFO("File [ %s ] NOT found!", listFile);
+        return true;
+    }
+
+    lock_guard<mutex> registryLock(m_lock);
+    string line;
+    size_t lineNo = 0;
+    while (getline(in, line))
+    {
+        lineNo++;
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        istringstream fields(line);
+        string tenantId;
+        int useStrongPasswords = 0;
+        authPolicy_t policy;
+        if (!(fields >> tenantId >> useStrongPasswords >> policy.passwordHistoryMax >> policy.passwordLenMin >>
+              policy.passwordLenMax >> policy.passwordExpiryDays) || !IsValidTenantId(tenantId) ||
+            !AuthModule::IsPolicyValid(policy))
+        {
+            LOG_ERROR("Invalid tenant at line %zu of %s", lineNo, listFile);
+            return false;
+        }
+
+        policy.useStrongPasswords = (useStrongPasswords != 0);
+        unique_ptr<tenant_t> & tenant = m_tenants[tenantId];
+        if (tenant == nullptr)
+        {
+            tenant.reset(new tenant_t);
+            tenant->lastUsed = 0;
+        }
+        tenant->policy = policy;
+    }
+
+    LOG_INFO("Found %zu tenants in %s", m_tenants.size(), listFile);
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : SaveTenantList
+//
+// @description         : Replaces the list of tenants, synced whatever the modules' durability: a tenant
+//                        lost from it would take its users along. Caller must hold the registry's lock.
+//
+// @returns             : True if the list was written.
+//-------------------------------------------------------------------------------------------------------------
+bool TenantRegistry::SaveTenantList()
+{
+    string listFile = m_config.rootDirectory + "/" + TENANTS_FILENAME;
+    ostringstream out;
+    out << "# tenant strong historyMax lenMin lenMax expiryDays\n";
+    for (auto it = m_tenants.begin(); it != m_tenants.end(); ++it)
+    {
+        const authPolicy_t & policy = it->second->policy;
+        out << it->first << ' ' << (policy.useStrongPasswords ? 1 : 0) << ' ' << policy.passwordHistoryMax << ' '
+            << policy.passwordLenMin << ' ' << policy.passwordLenMax << ' ' << policy.passwordExpiryDays << '\n';
+    }
+
+    if (!AuthModule::ReplaceFile(listFile, out.str(), true, nullptr))
+    {
+        LOG_ERROR("File [ %s ] could not be written!", listFile);
+        return false;
+    }
+
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetTenantDirectory
+//
+// @description         : Directory of a tenant's users database files.
+//
+// @returns             : Path of the directory
+//-------------------------------------------------------------------------------------------------------------
+string TenantRegistry::GetTenantDirectory(const string & tenantId)
+{
+    return m_config.rootDirectory + "/" + tenantId;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : FindTenant
+//
+// @description         : Looks up a tenant. Tenants are never removed, so the entry stays valid.
+//
+// @returns             : Tenant, NULL if unknown
+//-------------------------------------------------------------------------------------------------------------
+TenantRegistry::tenant_t* TenantRegistry::FindTenant(const string & tenantId)
+{
+    lock_guard<mutex> registryLock(m_lock);
+    auto it = m_tenants.find(tenantId);
+    return (it != m_tenants.end()) ? it->second.get() : nullptr;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : AddTenant
+//
+// @description         : Adds a tenant with its auth policy and creates its directory. It is loaded on its
+//                        first use.
+//
+// @returns             : False if the id or the policy is invalid, the tenant exists already or could not be
+//                        saved.
+//-------------------------------------------------------------------------------------------------------------
+bool TenantRegistry::AddTenant(const string & tenantId, const authPolicy_t & policy)
+{
+    if (!IsValidTenantId(tenantId))
+    {
+        LOG_ERROR("Invalid tenant id [%s]", tenantId);
+        return false;
+    }
+
+    if (!AuthModule::IsPolicyValid(policy))
+    {
+        LOG_ERROR("Invalid auth policy for tenant [%s]", tenantId);
+        return false;
+    }
+
+    lock_guard<mutex> registryLock(m_lock);
+    if (m_tenants.count(tenantId) > 0)
+    {
+        return false;
+    }
+
+    if (!MakeDirectory(GetTenantDirectory(tenantId)))
+    {
+        LOG_ERROR("Directory [ %s ] could not be created!", GetTenantDirectory(tenantId));
+        return false;
+    }
+
+    unique_ptr<tenant_t> & tenant = m_tenants[tenantId];
+    tenant.reset(new tenant_t);
+    tenant->policy = policy;
+    tenant->lastUsed = 0;
+    if (!SaveTenantList())
+    {
+        m_tenants.erase(tenantId);
+        return false;
+    }
+
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : SetTenantPolicy
+//
+// @description         : Changes a tenant's auth policy. It applies from the tenant's next load, when its
+//                        users database is migrated to it; a loaded tenant nobody holds is unloaded right
+//                        away for that.
+//
+// @returns             : False if the policy is invalid, the tenant is unknown or the list could not be saved.
+//-------------------------------------------------------------------------------------------------------------
+bool TenantRegistry::SetTenantPolicy(const string & tenantId, const authPolicy_t & policy)
+{
+    if (!AuthModule::IsPolicyValid(policy))
+    {
+        LOG_ERROR("Invalid auth policy for tenant [%s]", tenantId);
+        return false;
+    }
+
+    tenant_t *tenant = nullptr;
+    {
+        lock_guard<mutex> registryLock(m_lock);
+        auto it = m_tenants.find(tenantId);
+        if (it == m_tenants.end())
+        {
+            return false;
+        }
+
+        tenant = it->second.get();
+        tenant->policy = policy;
+        if (!SaveTenantList())
+        {
+            return false;
+        }
+    }
+
+    lock_guard<mutex> loadLock(tenant->loadLock);
+    if (tenant->module != nullptr && tenant->module.use_count() == 1)
+    {
+        tenant->module.reset();
+        m_loadedTenants--;
+    }
+
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetTenant
+//
+// @description         : Module of a tenant, loaded from the tenant's directory if it is not yet. Loading
+//                        one tenant does not hold back the others. A load may unload idle tenants to stay
+//                        within the memory budget.
+//
+// @returns             : Tenant's module, NULL if the tenant is unknown.
+//-------------------------------------------------------------------------------------------------------------
+shared_ptr<AuthModule> TenantRegistry::GetTenant(const string & tenantId)
+{
+    tenant_t *tenant = FindTenant(tenantId);
+    if (tenant == nullptr)
+    {
+        return nullptr;
+    }
+
+    shared_ptr<AuthModule> module;
+    bool isLoaded = false;
+    {
+        lock_guard<mutex> loadLock(tenant->loadLock);
+        if (tenant->module == nullptr)
+        {
+            authPolicy_t policy;
+            {
+                lock_guard<mutex> registryLock(m_lock);
+                policy = tenant->policy;
+            }
+
+            authModuleConfig_t config = m_config.moduleConfig;
+            config.dataDirectory = GetTenantDirectory(tenantId);
+            config.passwordHasher = m_passwordHasher;
+            config.loginPool = m_loginPool;
+            if (!config.sessionKey.empty())
+            {
+                config.sessionKey.append(1, '\0').append(tenantId);
+            }
+
+            tenant->module = make_shared<AuthModule>(policy, config);
+            tenant->module->Initialize();
+            m_loadedTenants++;
+            isLoaded = true;
+        }
+
+        tenant->lastUsed = m_clock->Now();
+        module = tenant->module;
+    }
+
+    if (isLoaded)
+    {
+        EvictIdleTenants();
+    }
+
+    return module;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : EvictIdleTenants
+//
+// @description         : Unloads loaded tenants, least recently used first, until the loaded ones fit into
+//                        the memory budget. Tenants whose module is held by a caller are skipped. Journaled
+//                        and snapshot changes are already on disk, unloading only drops the memory.
+//
+// @returns             : No. of tenants unloaded
+//-------------------------------------------------------------------------------------------------------------
+size_t TenantRegistry::EvictIdleTenants()
+{
+    lock_guard<mutex> evictLock(m_evictLock);
+    vector<tenant_t*> tenants;
+    {
+        lock_guard<mutex> registryLock(m_lock);
+        tenants.reserve(m_tenants.size());
+        for (auto it = m_tenants.begin(); it != m_tenants.end(); ++it)
+        {
+            tenants.push_back(it->second.get());
+        }
+    }
+
+    typedef pair<long long, pair<tenant_t*, size_t>> candidate_t;
+    vector<candidate_t> candidates;
+    size_t totalBytes = 0;
+    for (size_t i = 0; i < tenants.size(); i++)
+    {
+        lock_guard<mutex> loadLock(tenants[i]->loadLock);
+        if (tenants[i]->module != nullptr)
+        {
+            size_t bytes = tenants[i]->module->GetMemoryUsage();
+            totalBytes += bytes;
+            candidates.push_back(candidate_t(tenants[i]->lastUsed.load(), make_pair(tenants[i], bytes)));
+        }
+    }
+
+    if (totalBytes <= m_config.memoryBudget)
+    {
+        return 0;
+    }
+
+    sort(candidates.begin(), candidates.end(), [](const candidate_t & a, const candidate_t & b)
+    {
+        return a.first < b.first;
+    });
+
+    size_t evicted = 0;
+    for (size_t i = 0; i < candidates.size() && totalBytes > m_config.memoryBudget; i++)
+    {
+        tenant_t *tenant = candidates[i].second.first;
+        lock_guard<mutex> loadLock(tenant->loadLock);
+        if (tenant->module == nullptr || tenant->module.use_count() > 1)
+            continue;
+
+        // Destroyed under the lock, so a reload does not open the files before they are closed
+        tenant->module.reset();
+        m_loadedTenants--;
+        totalBytes -= min(totalBytes, candidates[i].second.second);
+        evicted++;
+    }
+
+    if (evicted > 0)
+    {
+        LOG_INFO("Unloaded %zu idle tenant(s), %zu bytes in use", evicted, totalBytes);
+    }
+
+    return evicted;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetTenantCount
+//
+// @description         : No. of tenants, loaded or not.
+//
+// @returns             : No. of tenants
+//-------------------------------------------------------------------------------------------------------------
+size_t TenantRegistry::GetTenantCount()
+{
+    lock_guard<mutex> registryLock(m_lock);
+    return m_tenants.size();
+}
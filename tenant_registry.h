@@ -0,0 +1,92 @@
+#ifndef _TENANT_REGISTRY_H_
+#define _TENANT_REGISTRY_H_
+#include<atomic>
+#include<memory>
+#include<mutex>
+#include<stddef.h>
+#include<string>
+#include<unordered_map>
+#include<vector>
+#include "auth_module.h"
+
+using namespace std;
+
+//-------------------------------------------------------------------------------------------------------------
+// Globals
+//-------------------------------------------------------------------------------------------------------------
+const string TENANTS_FILENAME = "tenants.conf";
+const size_t TENANT_ID_MAX_LEN = 64;
+const size_t DEFAULT_TENANT_MEMORY_BUDGET = 256 * 1024 * 1024;
+
+//-------------------------------------------------------------------------------------------------------------
+// Structs
+//-------------------------------------------------------------------------------------------------------------
+typedef struct tenantRegistryConfig_tag
+{
+    string rootDirectory;                     // Holds the list of tenants and a directory per tenant
+    authModuleConfig_t moduleConfig;          // Configuration of every tenant's AuthModule, see TenantRegistry
+    size_t memoryBudget;                      // Memory of loaded tenants (AuthModule::GetMemoryUsage()) above
+                                              // which the least recently used idle ones are unloaded
+}tenantRegistryConfig_t;
+
+//-------------------------------------------------------------------------------------------------------------
+// Hosts the AuthModules of many tenants in one process. Every tenant has its own auth policy and its own
+// users database files in rootDirectory/<tenant id>; the tenants and their policies are listed in
+// rootDirectory/TENANTS_FILENAME, one per line:
+//
+//   <tenant id> <useStrongPasswords> <passwordHistoryMax> <passwordLenMin> <passwordLenMax> <passwordExpiryDays>
+//
+// A tenant's module is loaded on its first use and unloaded again, least recently used first, once the
+// loaded tenants use more than memoryBudget and nobody holds the module. All tenants share one password
+// hasher and one pool of asynchronous login workers, as well as the process wide clock and logger; the
+// rest of moduleConfig applies to every tenant. A configured session key is combined with the tenant id,
+// so a token of one tenant is not valid for another. Modules handed out must be released before the
+// registry is destroyed.
+//
+// Tenant ids are 1 to TENANT_ID_MAX_LEN letters, digits, '-' or '_', so they can name a directory. All
+// methods are safe to call from several threads at once.
+//-------------------------------------------------------------------------------------------------------------
+class TenantRegistry
+{
+private:
+    typedef struct tenant_tag
+    {
+        authPolicy_t policy;                  // Under the registry's lock
+        mutex loadLock;                       // Held while the module is loaded or unloaded
+        shared_ptr<AuthModule> module;        // NULL while not loaded
+        atomic<long long> lastUsed;           // Coarse time of the last GetTenant()
+    }tenant_t;
+
+    tenantRegistryConfig_t                  m_config;
+    mutex                                   m_lock;                      // Guards the map, tenants are never removed
+    unordered_map<string, unique_ptr<tenant_t>> m_tenants;
+    mutex                                   m_evictLock;                 // One eviction pass at a time
+    PasswordHasher                         *m_passwordHasher;
+    bool                                    m_ownsPasswordHasher;
+    ThreadPool                             *m_loginPool;
+    bool                                    m_ownsLoginPool;
+    CoarseClock                            *m_clock;
+    atomic<size_t>                          m_loadedTenants;
+
+    tenant_t* FindTenant(const string & tenantId);
+    bool SaveTenantList();
+    string GetTenantDirectory(const string & tenantId);
+
+public:
+    TenantRegistry(const tenantRegistryConfig_t & config);
+    ~TenantRegistry();
+    TenantRegistry(const TenantRegistry &) = delete;
+    TenantRegistry & operator=(const TenantRegistry &) = delete;
+
+    static tenantRegistryConfig_t GetDefaultTenantRegistryConfig();
+    static bool IsValidTenantId(const string & tenantId);
+    bool Open();
+    bool AddTenant(const string & tenantId, const authPolicy_t & policy);
+    bool SetTenantPolicy(const string & tenantId, const authPolicy_t & policy);
+    shared_ptr<AuthModule> GetTenant(const string & tenantId);
+    size_t EvictIdleTenants();
+    size_t GetTenantCount();
+    size_t GetLoadedTenantCount() { return m_loadedTenants.load(memory_order_relaxed); }
+};
+
+#endif
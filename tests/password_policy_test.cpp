@@ -0,0 +1,93 @@
+#include "password_policy.h"
+#include "test_util.h"
+#include <ctype.h>
+#include <stdio.h>
+
+//-------------------------------------------------------------------------------------------------------------
+// Checks the character class table against the C library and the checks specialized for the password
+// profiles against the runtime checks of the same rules.
+//-------------------------------------------------------------------------------------------------------------
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : TestCharClassTable
+//
+// @description         : Every byte value has exactly the class the C locale's classification gives it.
+//                        Bytes above ASCII are part of UTF-8 characters and count as special.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void TestCharClassTable()
+{
+    for (int c = 0; c < 256; c++)
+    {
+        uint8_t expected = (c >= 0x80) ? CHAR_CLASS_SPECIAL :
+                           islower(c) ? CHAR_CLASS_LOWER :
+                           isupper(c) ? CHAR_CLASS_UPPER :
+                           isdigit(c) ? CHAR_CLASS_DIGIT :
+                           iscntrl(c) ? CHAR_CLASS_CONTROL : CHAR_CLASS_SPECIAL;
+        CHECK(CHAR_CLASS_TABLE.classes[c] == expected);
+        if (c < 0x80 && !iscntrl(c))
+        {
+            CHECK(((CHAR_CLASS_TABLE.classes[c] & CHAR_CLASS_SPECIAL) != 0) == (ispunct(c) || c == ' '));
+            CHECK(((CHAR_CLASS_TABLE.classes[c] & (CHAR_CLASS_LOWER | CHAR_CLASS_UPPER | CHAR_CLASS_DIGIT)) != 0) ==
+                  (isalnum(c) != 0));
+        }
+
+        // A single byte as the tail of the pass, and after a full group of four
+        string single(1, (char)c);
+        string grouped = "aaaa" + single;
+        CHECK(GetCharClasses(single.data(), single.size()) == expected);
+        CHECK(GetCharClasses(grouped.data(), grouped.size()) == (expected | CHAR_CLASS_LOWER));
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : TestValidatorSelection
+//
+// @description         : The profiles' rules pick their specialized checks, other rules the runtime one, and
+//                        both agree on every password.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void TestValidatorSelection()
+{
+    passwordRules_t strongRules = StrongPasswordProfile::rules;
+    passwordRules_t openRules = OpenPasswordProfile::rules;
+    passwordRules_t otherRules = { 8, 64, CHAR_CLASS_DIGIT, CHAR_CLASS_CONTROL };
+    PasswordValidator strong(strongRules);
+    PasswordValidator open(openRules);
+    PasswordValidator other(otherRules);
+    CHECK(strong.IsSpecialized());
+    CHECK(open.IsSpecialized());
+    CHECK(!other.IsSpecialized());
+
+    const string passwords[] = { "", "Ab1#", "Secret#0_0", "secret#0_0", "SECRET#0_0", "Secret00", "Secret#ab",
+                                 "Sec\tret#0", "P\xc3\xa4ssw0rd", "abcdefgh1", string(255, 'a') + "A1#",
+                                 "Aa1#" + string(251, 'x'), string(300, 'a') };
+    for (const string & password : passwords)
+    {
+        CHECK(strong.Check(password) == CheckPassword(strongRules, password.data(), password.size()));
+        CHECK(other.Check(password) == CheckPassword(otherRules, password.data(), password.size()));
+        CHECK(open.Check(password) == PASSWORD_CHECK_OK);
+    }
+
+    CHECK(strong.Check("Secret#0_0") == PASSWORD_CHECK_OK);
+    CHECK(strong.Check("P\xc3\xa4ssw0rd") == PASSWORD_CHECK_OK);
+    CHECK(strong.Check("Aa1#" + string(251, 'x')) == PASSWORD_CHECK_OK);
+    CHECK(strong.Check("Ab1#") == PASSWORD_CHECK_LENGTH);
+    CHECK(strong.Check(string(255, 'a') + "A1#") == PASSWORD_CHECK_LENGTH);
+    CHECK(strong.Check("secret#0_0") == PASSWORD_CHECK_MISSING_CLASS);
+    CHECK(strong.Check("Secret00") == PASSWORD_CHECK_MISSING_CLASS);
+    CHECK(strong.Check("Sec\tret#0") == PASSWORD_CHECK_FORBIDDEN_CLASS);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// M A I N
+//-------------------------------------------------------------------------------------------------------------
+int main()
+{
+    TestCharClassTable();
+    TestValidatorSelection();
+    printf("%s\n", (g_failures == 0) ? "PASSED" : "FAILED");
+    return (g_failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,280 @@
+#include "auth_module.h"
+#include "logger.h"
+#include "test_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+//-------------------------------------------------------------------------------------------------------------
+// Writes the users database while passwords are updated and users registered on other threads, and checks
+// that every file written is a point in time view of the users. All users share one shard, larger than
+// FROZEN_CHUNK_RECORDS, so the frozen records are encoded in several chunks with updates in between, which
+// have to preserve the frozen version of a record first.
+//
+// Passwords are updated round by round, user by user in the order of GetUpdatedUser(), and users are
+// registered in order, so in a consistent view the users of a round form a prefix of that order, as do the
+// registered users. Every record has to be
+// one written by an update as a whole: its password is that of one round and its history holds the
+// password of the round before.
+//-------------------------------------------------------------------------------------------------------------
+const int USER_COUNT = (int)FROZEN_CHUNK_RECORDS * 4;
+const int NEW_USER_COUNT = 2000;
+const int ROUNDS = 3;
+const size_t SNAPSHOTS_MAX = 12;
+const size_t SNAPSHOTS_CHECKED = 6;
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : UserName / NewUserName / UserPassword
+//
+// @description         : Names of the initial and of the concurrently registered users, and the password of
+//                        a user in a round.
+//-------------------------------------------------------------------------------------------------------------
+string UserName(int user)
+{
+    return "user" + to_string(user);
+}
+
+string NewUserName(int user)
+{
+    return "new" + to_string(user);
+}
+
+string UserPassword(int user, int round)
+{
+    return "pwd" + to_string(user) + "_" + to_string(round);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetUpdatedUser
+//
+// @description         : User updated i-th in a round, alternately one of the first and one of the second half
+//                        of the table. A serialization copies the first half before the second, so without
+//                        the frozen versions a user of the second half would show an update made after one
+//                        of the first half which it does not show.
+//-------------------------------------------------------------------------------------------------------------
+int GetUpdatedUser(int i)
+{
+    return (i % 2 == 0) ? i / 2 : USER_COUNT / 2 + i / 2;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetTestPolicy / GetTestConfig
+//
+// @description         : Cheap hashing and a journal which is never compacted, so that only the explicit
+//                        UpdateUsersDataFile() calls write the users database.
+//-------------------------------------------------------------------------------------------------------------
+authPolicy_t GetTestPolicy()
+{
+    authPolicy_t policy;
+    policy.useStrongPasswords = false;
+    policy.passwordHistoryMax = 3;
+    policy.passwordLenMin = 1;
+    policy.passwordLenMax = 64;
+    policy.passwordExpiryDays = 0;
+    return policy;
+}
+
+authModuleConfig_t GetTestConfig(const string & directory, storageMode_t storageMode)
+{
+    authModuleConfig_t config = AuthModule::GetDefaultAuthModuleConfig();
+    config.storageMode = storageMode;
+    config.durability = DURABILITY_FLUSH;
+    config.compactionThreshold = ~0u;
+    config.shardCount = 1;
+    config.hashIterations = 1;
+    config.dataDirectory = directory;
+    return config;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : ReadFile / WriteFile
+//
+// @returns             : True on success
+//-------------------------------------------------------------------------------------------------------------
+bool ReadFile(const string & path, string & data)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    data.clear();
+    char buffer[64 * 1024];
+    size_t len = 0;
+    while ((len = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        data.append(buffer, len);
+    }
+    fclose(file);
+    return true;
+}
+
+bool WriteFile(const string & path, const string & data)
+{
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    bool isWritten = fwrite(data.data(), 1, data.size(), file) == data.size();
+    return (fclose(file) == 0) && isWritten;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetUserRound
+//
+// @description         : Finds the round whose password a user has in a loaded snapshot, and checks that the
+//                        record's history holds the password of the round before.
+//
+// @returns             : The round, -1 if the user has none of the passwords or an inconsistent history.
+//-------------------------------------------------------------------------------------------------------------
+int GetUserRound(AuthModule & auth, int user)
+{
+    for (int round = ROUNDS; round >= 0; round--)
+    {
+        if (auth.Login(UserName(user), UserPassword(user, round)) == LOGIN_OK)
+        {
+            if (round > 0 && auth.IsPasswordValidAsPerHistory(UserName(user), UserPassword(user, round - 1)))
+            {
+                return -1;
+            }
+            return round;
+        }
+    }
+
+    return -1;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : CheckSnapshot
+//
+// @description         : Loads one written users database on its own and checks it, see above.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void CheckSnapshot(const string & directory, const string & data, size_t index)
+{
+    string usersDataFile = directory + "/" + USERS_DATA_FILENAME;
+    RemoveDirectory(directory);
+    mkdir(directory.c_str(), 0755);
+    CHECK(WriteFile(usersDataFile, data));
+
+    AuthModule auth(GetTestPolicy(), GetTestConfig(directory, STORAGE_MODE_SNAPSHOT));
+    auth.Initialize();
+
+    // In the order of the updates, users of round first, then of round first - 1
+    int first = GetUserRound(auth, GetUpdatedUser(0));
+    int previous = first;
+    bool isBadRecord = (first < 0);
+    bool isBadOrder = false;
+    for (int i = 1; i < USER_COUNT && !isBadRecord && !isBadOrder; i++)
+    {
+        int round = GetUserRound(auth, GetUpdatedUser(i));
+        isBadRecord = (round < 0);
+        isBadOrder = !isBadRecord && round != previous && (round != first - 1 || previous != first);
+        previous = round;
+    }
+    if (isBadRecord || isBadOrder)
+    {
+        printf("Snapshot %zu: user %s\n", index, isBadRecord ? "record is mixed" : "rounds are out of order");
+    }
+    CHECK(!isBadRecord);
+    CHECK(!isBadOrder);
+
+    // Registered users form a prefix, each with its password
+    userData_t userData;
+    int registered = 0;
+    while (registered < NEW_USER_COUNT && auth.GetUserDataCopy(NewUserName(registered), userData))
+    {
+        CHECK(auth.Login(NewUserName(registered), UserPassword(registered, 0)) == LOGIN_OK);
+        registered++;
+    }
+    for (int user = registered; user < NEW_USER_COUNT; user++)
+    {
+        CHECK(!auth.GetUserDataCopy(NewUserName(user), userData));
+    }
+
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// M A I N
+//-------------------------------------------------------------------------------------------------------------
+int main()
+{
+    Logger::GetInstance().SetLevel(LOG_LEVEL_WARNING);
+
+    char primaryTemplate[] = "/tmp/snapshot_test_XXXXXX";
+    char checkTemplate[] = "/tmp/snapshot_check_XXXXXX";
+    if (mkdtemp(primaryTemplate) == nullptr || mkdtemp(checkTemplate) == nullptr)
+    {
+        printf("Could not create test directories\n");
+        return 1;
+    }
+    string primaryDirectory = primaryTemplate;
+    string checkDirectory = checkTemplate;
+
+    vector<string> snapshots;
+    {
+        AuthModule auth(GetTestPolicy(), GetTestConfig(primaryDirectory, STORAGE_MODE_JOURNAL));
+        auth.Initialize();
+
+        vector<pair<string, string>> users;
+        vector<registerResult_t> results;
+        for (int user = 0; user < USER_COUNT; user++)
+        {
+            users.emplace_back(UserName(user), UserPassword(user, 0));
+        }
+        CHECK(auth.RegisterBatch(users, results) == (size_t)USER_COUNT);
+
+        atomic<bool> isStopping(false);
+        thread persister([&]()
+        {
+            // Preempted often while copying the frozen records, even on a single core
+            setpriority(PRIO_PROCESS, 0, 19);
+
+            // At least one snapshot while the others are running
+            while ((!isStopping || snapshots.empty()) && snapshots.size() < SNAPSHOTS_MAX)
+            {
+                string data;
+                CHECK(auth.UpdateUsersDataFile());
+                CHECK(ReadFile(primaryDirectory + "/" + USERS_DATA_FILENAME, data));
+                snapshots.push_back(data);
+                this_thread::sleep_for(chrono::milliseconds(20));
+            }
+        });
+        thread registrar([&]()
+        {
+            for (int user = 0; user < NEW_USER_COUNT; user++)
+            {
+                CHECK(auth.Register(NewUserName(user), UserPassword(user, 0)));
+            }
+        });
+
+        for (int round = 1; round <= ROUNDS; round++)
+        {
+            for (int i = 0; i < USER_COUNT; i++)
+            {
+                int user = GetUpdatedUser(i);
+                CHECK(auth.UpdateUserPassword(UserName(user), UserPassword(user, round)));
+            }
+        }
+
+        registrar.join();
+        isStopping = true;
+        persister.join();
+    }
+
+    // Spread over all of the snapshots written
+    size_t step = max(snapshots.size() / SNAPSHOTS_CHECKED, (size_t)1);
+    for (size_t i = 0; i < snapshots.size(); i += step)
+    {
+        CheckSnapshot(checkDirectory, snapshots[i], i);
+    }
+
+    RemoveDirectory(primaryDirectory);
+    RemoveDirectory(checkDirectory);
+    printf("%zu snapshots written, %s\n", snapshots.size(), (g_failures == 0) ? "PASSED" : "FAILED");
+    return (g_failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,261 @@
+#include "tenant_registry.h"
+#include "logger.h"
+#include "test_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+//-------------------------------------------------------------------------------------------------------------
+// Checks that tenants are loaded on their first use, that the least recently used tenants nobody holds are
+// unloaded to stay within the memory budget, that a module's memory usage counts its fixed size tables, and
+// that the users and the session tokens of one tenant are not valid for another.
+//-------------------------------------------------------------------------------------------------------------
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetTestPolicy / GetTestConfig
+//
+// @description         : Cheap hashing and tenants under their own root directory.
+//-------------------------------------------------------------------------------------------------------------
+authPolicy_t GetTestPolicy()
+{
+    authPolicy_t policy;
+    policy.useStrongPasswords = false;
+    policy.passwordHistoryMax = 3;
+    policy.passwordLenMin = 1;
+    policy.passwordLenMax = 64;
+    policy.passwordExpiryDays = 0;
+    return policy;
+}
+
+tenantRegistryConfig_t GetTestConfig(const string & rootDirectory)
+{
+    tenantRegistryConfig_t config = TenantRegistry::GetDefaultTenantRegistryConfig();
+    config.rootDirectory = rootDirectory;
+    config.moduleConfig.durability = DURABILITY_FLUSH;
+    config.moduleConfig.hashIterations = 1;
+    config.moduleConfig.loginWorkers = 1;
+    config.moduleConfig.sessionKey = "registry-test-key";
+    return config;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : WaitForClockTick
+//
+// @description         : Sleeps past a tick of the coarse clock, so that the next use of a tenant is later
+//                        than the uses before.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void WaitForClockTick()
+{
+    this_thread::sleep_for(chrono::milliseconds(COARSE_CLOCK_TICK_MS * 3 / 2));
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : TestLazyLoad
+//
+// @description         : Tenants are listed, not loaded, until used; their list and their users survive a
+//                        new registry on the same directory. Policies with too long a history are rejected.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void TestLazyLoad(const string & rootDirectory)
+{
+    {
+        TenantRegistry registry(GetTestConfig(rootDirectory));
+        CHECK(registry.Open());
+        CHECK(registry.AddTenant("alpha", GetTestPolicy()));
+        CHECK(registry.AddTenant("beta", GetTestPolicy()));
+        CHECK(!registry.AddTenant("alpha", GetTestPolicy()));
+        CHECK(!registry.AddTenant("../gamma", GetTestPolicy()));
+        authPolicy_t longHistory = GetTestPolicy();
+        longHistory.passwordHistoryMax = 1000;
+        CHECK(!registry.AddTenant("gamma", longHistory));
+        CHECK(!registry.SetTenantPolicy("beta", longHistory));
+        CHECK(registry.GetTenantCount() == 2);
+        CHECK(registry.GetLoadedTenantCount() == 0);
+
+        CHECK(registry.GetTenant("gamma") == nullptr);
+        CHECK(registry.GetLoadedTenantCount() == 0);
+
+        shared_ptr<AuthModule> alpha = registry.GetTenant("alpha");
+        CHECK(alpha != nullptr);
+        CHECK(registry.GetLoadedTenantCount() == 1);
+        CHECK(registry.GetTenant("alpha") == alpha);
+        CHECK(alpha->Register("alice", "secret"));
+    }
+
+    TenantRegistry registry(GetTestConfig(rootDirectory));
+    CHECK(registry.Open());
+    CHECK(registry.GetTenantCount() == 2);
+    CHECK(registry.GetLoadedTenantCount() == 0);
+
+    shared_ptr<AuthModule> alpha = registry.GetTenant("alpha");
+    shared_ptr<AuthModule> beta = registry.GetTenant("beta");
+    CHECK(alpha != nullptr && beta != nullptr);
+    CHECK(registry.GetLoadedTenantCount() == 2);
+    CHECK(alpha->Login("alice", "secret") == LOGIN_OK);
+    CHECK(beta->Login("alice", "secret") == LOGIN_BAD_CREDENTIALS);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : TestEviction
+//
+// @description         : With room for about two tenants, loading a third one unloads the least recently
+//                        used one nobody holds, and held ones are never unloaded.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void TestEviction(const string & rootDirectory)
+{
+    size_t tenantBytes = 0;
+    {
+        TenantRegistry registry(GetTestConfig(rootDirectory));
+        CHECK(registry.Open());
+        CHECK(registry.AddTenant("a", GetTestPolicy()));
+        CHECK(registry.AddTenant("b", GetTestPolicy()));
+        CHECK(registry.AddTenant("c", GetTestPolicy()));
+        tenantBytes = registry.GetTenant("a")->GetMemoryUsage();
+    }
+
+    tenantRegistryConfig_t config = GetTestConfig(rootDirectory);
+    config.memoryBudget = tenantBytes * 5 / 2;
+    TenantRegistry registry(config);
+    CHECK(registry.Open());
+
+    weak_ptr<AuthModule> a = registry.GetTenant("a");
+    weak_ptr<AuthModule> b = registry.GetTenant("b");
+    CHECK(registry.GetLoadedTenantCount() == 2);
+
+    // a is used again after b, so b is the one to go
+    WaitForClockTick();
+    CHECK(registry.GetTenant("a") == a.lock());
+    WaitForClockTick();
+    shared_ptr<AuthModule> c = registry.GetTenant("c");
+    CHECK(registry.GetLoadedTenantCount() == 2);
+    CHECK(b.expired());
+    CHECK(!a.expired());
+
+    // Nothing can go while all are held
+    shared_ptr<AuthModule> heldA = a.lock();
+    WaitForClockTick();
+    shared_ptr<AuthModule> heldB = registry.GetTenant("b");
+    CHECK(registry.GetLoadedTenantCount() == 3);
+    CHECK(!a.expired());
+
+    // Released, the least recently used goes until the rest fit
+    b = heldB;
+    heldA.reset();
+    heldB.reset();
+    c.reset();
+    CHECK(registry.EvictIdleTenants() == 1);
+    CHECK(registry.GetLoadedTenantCount() == 2);
+    CHECK(a.expired());
+    CHECK(!b.expired());
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : TestMemoryUsage
+//
+// @description         : An empty module counts its metrics' stripes, and the throttle's tables when logins
+//                        are throttled.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void TestMemoryUsage(const string & rootDirectory)
+{
+    tenantRegistryConfig_t config = GetTestConfig(rootDirectory);
+    size_t plainBytes = 0;
+    {
+        TenantRegistry registry(config);
+        CHECK(registry.Open());
+        CHECK(registry.AddTenant("plain", GetTestPolicy()));
+        plainBytes = registry.GetTenant("plain")->GetMemoryUsage();
+    }
+#if AUTH_METRICS_ENABLED
+    CHECK(plainBytes >= METRICS_STRIPES * METRIC_OP_COUNT * METRICS_HISTOGRAM_BUCKETS * sizeof(uint64_t));
+#endif
+
+    config.moduleConfig.useLoginThrottle = true;
+    TenantRegistry throttledRegistry(config);
+    CHECK(throttledRegistry.Open());
+    size_t throttledBytes = throttledRegistry.GetTenant("plain")->GetMemoryUsage();
+    CHECK(throttledBytes >= plainBytes + 2 * config.moduleConfig.throttlePolicy.capacity * sizeof(long long));
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : TestSessionIsolation
+//
+// @description         : The same user with the same password in two tenants: a session token of one tenant
+//                        is rejected by the other, although both are configured with the same session key.
+//                        A password change revokes the user's tokens for good.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void TestSessionIsolation(const string & rootDirectory)
+{
+    TenantRegistry registry(GetTestConfig(rootDirectory));
+    CHECK(registry.Open());
+    CHECK(registry.AddTenant("red", GetTestPolicy()));
+    CHECK(registry.AddTenant("blue", GetTestPolicy()));
+
+    shared_ptr<AuthModule> red = registry.GetTenant("red");
+    shared_ptr<AuthModule> blue = registry.GetTenant("blue");
+    CHECK(red->Register("bob", "secret"));
+    CHECK(blue->Register("bob", "secret"));
+
+    string redToken;
+    string blueToken;
+    CHECK(red->LoginWithSession("bob", "secret", redToken) == LOGIN_OK);
+    CHECK(blue->LoginWithSession("bob", "secret", blueToken) == LOGIN_OK);
+    CHECK(redToken != blueToken);
+
+    string userName;
+    CHECK(red->ValidateSession(redToken, userName) == SESSION_OK && userName == "bob");
+    CHECK(blue->ValidateSession(blueToken, userName) == SESSION_OK && userName == "bob");
+    CHECK(blue->ValidateSession(redToken, userName) == SESSION_INVALID);
+    CHECK(red->ValidateSession(blueToken, userName) == SESSION_INVALID);
+
+    // Still valid after the tenant was unloaded and loaded again, the key derives from the id
+    red.reset();
+    CHECK(registry.SetTenantPolicy("red", GetTestPolicy()));
+    red = registry.GetTenant("red");
+    CHECK(red->ValidateSession(redToken, userName) == SESSION_OK);
+
+    // A password change ends the user's sessions, also once the tenant was loaded again
+    CHECK(red->UpdateUserPassword("bob", "changed"));
+    CHECK(red->ValidateSession(redToken, userName) == SESSION_REVOKED);
+    red.reset();
+    CHECK(registry.SetTenantPolicy("red", GetTestPolicy()));
+    red = registry.GetTenant("red");
+    CHECK(red->ValidateSession(redToken, userName) == SESSION_REVOKED);
+    CHECK(red->LoginWithSession("bob", "changed", redToken) == LOGIN_OK);
+    CHECK(red->ValidateSession(redToken, userName) == SESSION_OK);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// M A I N
+//-------------------------------------------------------------------------------------------------------------
+int main()
+{
+    Logger::GetInstance().SetLevel(LOG_LEVEL_WARNING);
+
+    const char *tests[] = { "lazy", "eviction", "memory", "sessions" };
+    void (*functions[])(const string &) = { TestLazyLoad, TestEviction, TestMemoryUsage, TestSessionIsolation };
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+    {
+        char rootTemplate[] = "/tmp/tenant_test_XXXXXX";
+        if (mkdtemp(rootTemplate) == nullptr)
+        {
+            printf("Could not create a test directory\n");
+            return 1;
+        }
+
+        int failures = g_failures;
+        functions[i](rootTemplate);
+        printf("%-10s %s\n", tests[i], (g_failures == failures) ? "ok" : "failed");
+        RemoveDirectory(rootTemplate);
+    }
+
+    printf("%s\n", (g_failures == 0) ? "PASSED" : "FAILED");
+    return (g_failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,63 @@
+#ifndef _TEST_UTIL_H_
+#define _TEST_UTIL_H_
+#include<atomic>
+#include<dirent.h>
+#include<stdio.h>
+#include<string.h>
+#include<string>
+#include<sys/stat.h>
+#include<unistd.h>
+
+using namespace std;
+
+//-------------------------------------------------------------------------------------------------------------
+// Helpers shared by the tests, each of which is a program of its own: CHECK() reports a failed condition
+// with its location and counts it, main() then reports PASSED or FAILED from the count.
+//-------------------------------------------------------------------------------------------------------------
+static atomic<int> g_failures(0);                // Checked on several threads by some tests
+
+#define CHECK(condition)                                                          \
+    do                                                                            \
+    {                                                                             \
+        if (!(condition))                                                         \
+        {                                                                         \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition);  \
+            g_failures++;                                                         \
+        }                                                                         \
+    } while (0)
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : RemoveDirectory
+//
+// @description         : Removes a directory and everything in it.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+inline void RemoveDirectory(const string & directory)
+{
+    DIR *dir = opendir(directory.c_str());
+    if (dir != nullptr)
+    {
+        struct dirent *entry = nullptr;
+        while ((entry = readdir(dir)) != nullptr)
+        {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+                continue;
+
+            string path = directory + "/" + entry->d_name;
+            struct stat info;
+            if (stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode))
+            {
+                RemoveDirectory(path);
+            }
+            else
+            {
+                unlink(path.c_str());
+            }
+        }
+        closedir(dir);
+    }
+    rmdir(directory.c_str());
+}
+
+#endif
@@ -0,0 +1,134 @@
+#include "thread_pool.h"
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : ThreadPool
+//
+// @description         : Constructor. Starts the worker threads.
+//
+// @param workers       : No. of worker threads, at least one is started
+// @param queueCapacity : Maximum no. of tasks waiting for a worker, at least one
+//-------------------------------------------------------------------------------------------------------------
+ThreadPool::ThreadPool(unsigned workers, size_t queueCapacity)
+{
+    m_queueCapacity = (queueCapacity > 0) ? queueCapacity : 1;
+    m_isStopping = false;
+
+    if (workers == 0)
+    {
+        workers = 1;
+    }
+
+    for (unsigned i = 0; i < workers; i++)
+    {
+        m_workers.emplace_back(&ThreadPool::WorkerLoop, this);
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : ThreadPool
+//
+// @description         : Destructor. Tasks already queued are run before the workers exit.
+//-------------------------------------------------------------------------------------------------------------
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> guard(m_lock);
+        m_isStopping = true;
+    }
+    m_notEmpty.notify_all();
+    m_notFull.notify_all();
+
+    for (size_t i = 0; i < m_workers.size(); i++)
+    {
+        m_workers[i].join();
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Submit
+//
+// @description         : Queues a task, waiting for room while the queue is full.
+//
+// @returns             : True if queued. False if the pool is shutting down.
+//-------------------------------------------------------------------------------------------------------------
+bool ThreadPool::Submit(function<void()> task)
+{
+    {
+        unique_lock<mutex> guard(m_lock);
+        m_notFull.wait(guard, [this]() { return m_isStopping || m_queue.size() < m_queueCapacity; });
+        if (m_isStopping)
+        {
+            return false;
+        }
+
+        m_queue.push_back(move(task));
+    }
+
+    m_notEmpty.notify_one();
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : TrySubmit
+//
+// @description         : Queues a task only if there is room right away.
+//
+// @returns             : True if queued. False if the queue is full or the pool is shutting down.
+//-------------------------------------------------------------------------------------------------------------
+bool ThreadPool::TrySubmit(function<void()> task)
+{
+    {
+        lock_guard<mutex> guard(m_lock);
+        if (m_isStopping || m_queue.size() >= m_queueCapacity)
+        {
+            return false;
+        }
+
+        m_queue.push_back(move(task));
+    }
+
+    m_notEmpty.notify_one();
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetQueueDepth
+//
+// @description         : No. of tasks waiting for a worker.
+//
+// @returns             : Queue depth
+//-------------------------------------------------------------------------------------------------------------
+size_t ThreadPool::GetQueueDepth()
+{
+    lock_guard<mutex> guard(m_lock);
+    return m_queue.size();
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : WorkerLoop
+//
+// @description         : Runs queued tasks until the pool is stopped and the queue is drained.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void ThreadPool::WorkerLoop()
+{
+    while (true)
+    {
+        function<void()> task;
+        {
+            unique_lock<mutex> guard(m_lock);
+            m_notEmpty.wait(guard, [this]() { return m_isStopping || !m_queue.empty(); });
+            if (m_queue.empty())
+            {
+                return;
+            }
+
+            task = move(m_queue.front());
+            m_queue.pop_front();
+        }
+
+        m_notFull.notify_one();
+        task();
+    }
+}
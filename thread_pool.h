@@ -0,0 +1,38 @@
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+#include<condition_variable>
+#include<deque>
+#include<functional>
+#include<mutex>
+#include<thread>
+#include<vector>
+
+using namespace std;
+
+//-------------------------------------------------------------------------------------------------------------
+// Fixed size pool of worker threads fed from a bounded FIFO queue. Producers either block while the queue
+// is full (Submit) or are turned away (TrySubmit), so a burst of work can not grow the queue without bound.
+//-------------------------------------------------------------------------------------------------------------
+class ThreadPool
+{
+private:
+    vector<thread>                          m_workers;
+    deque<function<void()>>                 m_queue;
+    size_t                                  m_queueCapacity;
+    mutex                                   m_lock;
+    condition_variable                      m_notEmpty;
+    condition_variable                      m_notFull;
+    bool                                    m_isStopping;
+
+    void WorkerLoop();
+
+public:
+    ThreadPool(unsigned workers, size_t queueCapacity);
+    ~ThreadPool();
+    bool Submit(function<void()> task);
+    bool TrySubmit(function<void()> task);
+    size_t GetQueueDepth();
+    size_t GetWorkerCount() { return m_workers.size(); }
+};
+
+#endif
@@ -0,0 +1,680 @@
+#include "user_table.h"
+#include <new>
+#include <string.h>
+
+//-------------------------------------------------------------------------------------------------------------
+// Globals
+//-------------------------------------------------------------------------------------------------------------
+const size_t USER_TABLE_MIN_SLOTS = 16;
+
+//-------------------------------------------------------------------------------------------------------------
+// Password history
+//-------------------------------------------------------------------------------------------------------------
+// Columns of a history's block: capacity digests, then as many salts, iterations and algorithms
+static uint8_t* GetDigest(const passwordHistory_t & history, unsigned index)
+{
+    return history.block + index * PASSWORD_DIGEST_LEN;
+}
+
+static uint8_t* GetSalt(const passwordHistory_t & history, unsigned index)
+{
+    return history.block + history.capacity * PASSWORD_DIGEST_LEN + index * PASSWORD_SALT_LEN;
+}
+
+static uint8_t* GetIterations(const passwordHistory_t & history, unsigned index)
+{
+    return history.block + history.capacity * (PASSWORD_DIGEST_LEN + PASSWORD_SALT_LEN) + index * sizeof(uint32_t);
+}
+
+static uint8_t* GetAlgorithm(const passwordHistory_t & history, unsigned index)
+{
+    return history.block + history.capacity * (PASSWORD_HISTORY_ENTRY_LEN - 1) + index;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : InitPasswordHistory
+//
+// @description         : Starts an empty history in a block with room for capacity entries, or in a buffer
+//                        with room for PASSWORD_HISTORY_MAX. Without a block or buffer the history stays empty.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void InitPasswordHistory(passwordHistory_t & history, uint8_t *block, unsigned capacity)
+{
+    history.block = block;
+    history.count = 0;
+    history.capacity = (block != nullptr) ? (uint8_t)capacity : 0;
+}
+
+void InitPasswordHistory(passwordHistory_t & history, passwordHistoryBuffer_t *buffer)
+{
+    InitPasswordHistory(history, (buffer != nullptr) ? buffer->block : nullptr, PASSWORD_HISTORY_MAX);
+}
+
+void ClearPasswordHistory(passwordHistory_t & history)
+{
+    history.count = 0;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : CopyPasswordHistory
+//
+// @description         : Copies the newest entries of a history into the block of another, as many as it has
+//                        room for.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void CopyPasswordHistory(passwordHistory_t & to, const passwordHistory_t & from)
+{
+    unsigned count = min((unsigned)from.count, (unsigned)to.capacity);
+    unsigned skipped = from.count - count;
+    to.count = (uint8_t)count;
+    if (count == 0)
+    {
+        return;
+    }
+
+    memcpy(GetDigest(to, 0), GetDigest(from, skipped), count * PASSWORD_DIGEST_LEN);
+    memcpy(GetSalt(to, 0), GetSalt(from, skipped), count * PASSWORD_SALT_LEN);
+    memcpy(GetIterations(to, 0), GetIterations(from, skipped), count * sizeof(uint32_t));
+    memcpy(GetAlgorithm(to, 0), GetAlgorithm(from, skipped), count);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : TrimPasswordHistory
+//
+// @description         : Drops the oldest entries so that at most capacity entries remain.
+//
+// @returns             : True if any entry was dropped.
+//-------------------------------------------------------------------------------------------------------------
+bool TrimPasswordHistory(passwordHistory_t & history, unsigned capacity)
+{
+    if (history.count <= capacity)
+    {
+        return false;
+    }
+
+    unsigned dropped = history.count - capacity;
+    memmove(GetDigest(history, 0), GetDigest(history, dropped), capacity * PASSWORD_DIGEST_LEN);
+    memmove(GetSalt(history, 0), GetSalt(history, dropped), capacity * PASSWORD_SALT_LEN);
+    memmove(GetIterations(history, 0), GetIterations(history, dropped), capacity * sizeof(uint32_t));
+    memmove(GetAlgorithm(history, 0), GetAlgorithm(history, dropped), capacity);
+    history.count = (uint8_t)capacity;
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : PushPasswordHistory
+//
+// @description         : Appends a hash as the newest entry of the history. The oldest entries are dropped
+//                        so that at most capacity entries remain. Pushes only happen on password changes,
+//                        so the entries are simply moved down rather than kept in a ring.
+//
+// @param capacity      : Entries to be kept, at most the capacity of the history's block
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void PushPasswordHistory(passwordHistory_t & history, const passwordHash_t & hash, unsigned capacity)
+{
+    if (capacity > history.capacity)
+    {
+        capacity = history.capacity;
+    }
+
+    if (capacity == 0)
+    {
+        history.count = 0;
+        return;
+    }
+
+    TrimPasswordHistory(history, capacity - 1);
+    unsigned index = history.count++;
+    memcpy(GetDigest(history, index), hash.digest, PASSWORD_DIGEST_LEN);
+    memcpy(GetSalt(history, index), hash.salt, PASSWORD_SALT_LEN);
+    memcpy(GetIterations(history, index), &hash.iterations, sizeof(uint32_t));
+    *GetAlgorithm(history, index) = hash.algorithm;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetPasswordHistoryEntry
+//
+// @description         : Entry of the history, 0 being the oldest. index must be less than history.count.
+//
+// @returns             : Hash of a previous password
+//-------------------------------------------------------------------------------------------------------------
+passwordHash_t GetPasswordHistoryEntry(const passwordHistory_t & history, unsigned index)
+{
+    passwordHash_t hash;
+    hash.algorithm = *GetAlgorithm(history, index);
+    memcpy(&hash.iterations, GetIterations(history, index), sizeof(uint32_t));
+    memcpy(hash.salt, GetSalt(history, index), PASSWORD_SALT_LEN);
+    memcpy(hash.digest, GetDigest(history, index), PASSWORD_DIGEST_LEN);
+    return hash;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : MatchPasswordHistory
+//
+// @description         : Compares a derived digest against the entries computed with the same parameters.
+//                        Every entry is visited and the digests are compared without branching on their
+//                        contents, so the time taken does not depend on which entry, if any, matches.
+//
+// @param derived       : Digest of a candidate password, with the parameters it was computed with
+// @param unchecked     : Mask of the entries not compared yet. The entries sharing derived's parameters are
+//                        cleared from it.
+//
+// @returns             : True if one of those entries holds the same digest.
+//-------------------------------------------------------------------------------------------------------------
+bool MatchPasswordHistory(const passwordHistory_t & history, const passwordHash_t & derived, uint64_t & unchecked)
+{
+    uint64_t matches = 0;
+    for (unsigned i = 0; i < history.count; i++)
+    {
+        uint32_t iterations = 0;
+        memcpy(&iterations, GetIterations(history, i), sizeof(uint32_t));
+        uint8_t paramDiff = (uint8_t)(*GetAlgorithm(history, i) ^ derived.algorithm);
+        paramDiff |= (uint8_t)((iterations != derived.iterations) ? 1 : 0);
+        const uint8_t *salt = GetSalt(history, i);
+        for (size_t j = 0; j < PASSWORD_SALT_LEN; j++)
+        {
+            paramDiff |= salt[j] ^ derived.salt[j];
+        }
+
+        uint8_t digestDiff = 0;
+        const uint8_t *digest = GetDigest(history, i);
+        for (size_t j = 0; j < PASSWORD_DIGEST_LEN; j++)
+        {
+            digestDiff |= digest[j] ^ derived.digest[j];
+        }
+
+        uint64_t sameParams = (paramDiff == 0) ? 1 : 0;
+        unchecked &= ~(sameParams << i);
+        matches |= (sameParams & ((digestDiff == 0) ? 1 : 0)) << i;
+    }
+
+    return matches != 0;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : CopyUserData
+//
+// @description         : Copies a record with a history of its own, so that the copy can be read after the
+//                        lock guarding the original is released.
+//
+// @param history       : Buffer for the copy's history, NULL to leave the copy without previous passwords
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void CopyUserData(userData_t & to, const userData_t & from, passwordHistoryBuffer_t *history)
+{
+    to = from;
+    InitPasswordHistory(to.prevPasswords, history);
+    CopyPasswordHistory(to.prevPasswords, from.prevPasswords);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : UserTable
+//
+// @description         : Constructor. Slots are allocated on the first insert.
+//-------------------------------------------------------------------------------------------------------------
+UserTable::UserTable()
+{
+    m_slots = nullptr;
+    m_slotMask = 0;
+    m_size = 0;
+    m_historyCapacity = 0;
+    m_metrics = nullptr;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : UserTable
+//
+// @description         : Destructor. Records hold no memory of their own, so they go with the arena.
+//-------------------------------------------------------------------------------------------------------------
+UserTable::~UserTable()
+{
+    delete[] m_slots;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetSlotIndex
+//
+// @description         : Home slot of a hash. The hash is mixed first: AuthModule picks the shard from the
+//                        low bits of the same hash, so those are alike for all names of one table.
+//
+// @returns             : Slot index
+//-------------------------------------------------------------------------------------------------------------
+size_t UserTable::GetSlotIndex(size_t nameHash)
+{
+    uint64_t mixed = (uint64_t)nameHash * 0x9E3779B97F4A7C15ull;
+    return (size_t)(mixed ^ (mixed >> 32)) & m_slotMask;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Find
+//
+// @description         : Looks up a record by name. Probing compares the stored hash tags first, names are
+//                        only compared on a tag match.
+//
+// @param nameHash      : hash<string_view> of name
+//
+// @returns             : Record, NULL if name is not in the table.
+//-------------------------------------------------------------------------------------------------------------
+userData_t* UserTable::Find(string_view name, size_t nameHash)
+{
+    if (m_slots == nullptr)
+    {
+        return nullptr;
+    }
+
+    uint32_t hashTag = (uint32_t)((uint64_t)nameHash >> 32);
+    for (size_t i = GetSlotIndex(nameHash); m_slots[i].record != 0; i = (i + 1) & m_slotMask)
+    {
+        if (m_slots[i].hashTag == hashTag)
+        {
+            userData_t *userData = GetRecord(m_slots[i].record - 1);
+            if (userData->name == name)
+            {
+                return userData;
+            }
+        }
+    }
+
+    return nullptr;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Insert
+//
+// @description         : Adds a copy of a record whose name is not yet in the table. The name and the newest
+//                        entries of the history are copied into the table's arena. Records already in the
+//                        table are never moved.
+//
+// @param userData      : Record to be copied, its name and history may point to memory owned by the caller
+// @param nameHash      : hash<string_view> of the record's name
+//
+// @returns             : Record in the table
+//-------------------------------------------------------------------------------------------------------------
+userData_t* UserTable::Insert(const userData_t & userData, size_t nameHash)
+{
+    if ((m_size + 1) * 4 > (m_slotMask + 1) * 3)
+    {
+        Grow((m_slots == nullptr) ? USER_TABLE_MIN_SLOTS : (m_slotMask + 1) * 2);
+    }
+
+    if (m_size == m_pages.size() * USER_TABLE_PAGE_RECORDS)
+    {
+        AddPage();
+    }
+
+    userData_t *record = new (GetRecord(m_size)) userData_t(userData);
+    record->name = InternName(userData.name);
+    InitPasswordHistory(record->prevPasswords, nullptr, 0);
+    SetPasswordHistory(record, userData.prevPasswords);
+    m_size++;
+
+    size_t i = GetSlotIndex(nameHash);
+    while (m_slots[i].record != 0)
+    {
+        i = (i + 1) & m_slotMask;
+    }
+    m_slots[i].hashTag = (uint32_t)((uint64_t)nameHash >> 32);
+    m_slots[i].record = (uint32_t)m_size;
+
+    return record;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Assign
+//
+// @description         : Overwrites a record of the table with a copy of another one. The record keeps its
+//                        interned name and its history block, into which the other's history is copied.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void UserTable::Assign(userData_t *record, const userData_t & userData)
+{
+    string_view name = record->name;
+    passwordHistory_t history = record->prevPasswords;
+    *record = userData;
+    record->name = name;
+    record->prevPasswords = history;
+    SetPasswordHistory(record, userData.prevPasswords);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : PushPasswordHistory
+//
+// @description         : Appends a hash to a record's history, keeping the table's history capacity.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void UserTable::PushPasswordHistory(userData_t *record, const passwordHash_t & hash)
+{
+    AllocatePasswordHistory(record);
+
+    ::PushPasswordHistory(record->prevPasswords, hash, m_historyCapacity);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Reserve
+//
+// @description         : Makes room for count records in total, so that inserting them neither rehashes nor
+//                        allocates pages. All missing pages are taken from one arena block.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void UserTable::Reserve(size_t count)
+{
+    size_t slotCount = (m_slots == nullptr) ? USER_TABLE_MIN_SLOTS : m_slotMask + 1;
+    while (count * 4 > slotCount * 3)
+    {
+        slotCount *= 2;
+    }
+
+    if (m_slots == nullptr || slotCount > m_slotMask + 1)
+    {
+        Grow(slotCount);
+    }
+
+    size_t pageCount = (count + USER_TABLE_PAGE_RECORDS - 1) / USER_TABLE_PAGE_RECORDS;
+    if (pageCount > m_pages.size())
+    {
+        m_pages.reserve(pageCount);
+        m_arena.Reserve((pageCount - m_pages.size()) * USER_TABLE_PAGE_RECORDS * sizeof(userData_t));
+        while (m_pages.size() < pageCount)
+        {
+            AddPage();
+        }
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetRecord
+//
+// @description         : Record by position, in insertion order. index must be less than Size().
+//
+// @returns             : Record
+//-------------------------------------------------------------------------------------------------------------
+userData_t* UserTable::GetRecord(size_t index)
+{
+    return &m_pages[index / USER_TABLE_PAGE_RECORDS][index % USER_TABLE_PAGE_RECORDS];
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetMemoryUsage
+//
+// @description         : Memory held by the table, its slots, page list and arena.
+//
+// @returns             : Bytes
+//-------------------------------------------------------------------------------------------------------------
+size_t UserTable::GetMemoryUsage()
+{
+    size_t slotBytes = (m_slots != nullptr) ? (m_slotMask + 1) * sizeof(slot_t) : 0;
+    return slotBytes + m_pages.capacity() * sizeof(userData_t*) + m_arena.GetAllocatedBytes();
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Grow
+//
+// @description         : Rehashes into slotCount slots. Only slots move, the stored hash tags are not enough
+//                        to place them so the names are hashed again.
+//
+// @param slotCount     : New no. of slots, a power of 2
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void UserTable::Grow(size_t slotCount)
+{
+    if (m_slots != nullptr && m_metrics != nullptr)
+    {
+        m_metrics->Count(METRIC_TABLE_REHASHES);
+    }
+
+    delete[] m_slots;
+    m_slots = new slot_t[slotCount]();
+    m_slotMask = slotCount - 1;
+
+    hash<string_view> nameHasher;
+    for (size_t record = 0; record < m_size; record++)
+    {
+        size_t nameHash = nameHasher(GetRecord(record)->name);
+        size_t i = GetSlotIndex(nameHash);
+        while (m_slots[i].record != 0)
+        {
+            i = (i + 1) & m_slotMask;
+        }
+        m_slots[i].hashTag = (uint32_t)((uint64_t)nameHash >> 32);
+        m_slots[i].record = (uint32_t)(record + 1);
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : AddPage
+//
+// @description         : Adds room for USER_TABLE_PAGE_RECORDS more records.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void UserTable::AddPage()
+{
+    void *page = m_arena.Allocate(USER_TABLE_PAGE_RECORDS * sizeof(userData_t), alignof(userData_t));
+    m_pages.push_back((userData_t *)page);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : InternName
+//
+// @description         : Copies a name into the arena.
+//
+// @returns             : Copy of the name
+//-------------------------------------------------------------------------------------------------------------
+string_view UserTable::InternName(string_view name)
+{
+    char *copy = (char *)m_arena.Allocate(name.size(), 1);
+    memcpy(copy, name.data(), name.size());
+    return string_view(copy, name.size());
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : SetPasswordHistory
+//
+// @description         : Copies the newest entries of a history into a record's own, allocating its block
+//                        if the history is not empty.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void UserTable::SetPasswordHistory(userData_t *record, const passwordHistory_t & history)
+{
+    if (history.count > 0)
+    {
+        AllocatePasswordHistory(record);
+    }
+
+    CopyPasswordHistory(record->prevPasswords, history);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : AllocatePasswordHistory
+//
+// @description         : Gives a record a history block of the table's history capacity, unless it has one.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void UserTable::AllocatePasswordHistory(userData_t *record)
+{
+    if (record->prevPasswords.block == nullptr && m_historyCapacity > 0)
+    {
+        void *block = m_arena.Allocate(m_historyCapacity * PASSWORD_HISTORY_ENTRY_LEN, sizeof(uint32_t));
+        InitPasswordHistory(record->prevPasswords, (uint8_t *)block, m_historyCapacity);
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : UserCache
+//
+// @description         : Constructor. The cache holds nothing until SetCapacity() is called.
+//-------------------------------------------------------------------------------------------------------------
+UserCache::UserCache()
+{
+    m_marks = nullptr;
+    m_historyCapacity = 0;
+    m_capacity = 0;
+    m_hand = 0;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : UserCache
+//
+// @description         : Destructor
+//-------------------------------------------------------------------------------------------------------------
+UserCache::~UserCache()
+{
+    delete[] m_marks;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : SetCapacity
+//
+// @description         : Sizes the cache for capacity records with up to historyCapacity previous passwords
+//                        each, dropping the cached ones.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void UserCache::SetCapacity(size_t capacity, unsigned historyCapacity)
+{
+    delete[] m_marks;
+    m_capacity = capacity;
+    m_hand = 0;
+    m_records.clear();
+    m_records.reserve(capacity);
+    m_historyCapacity = historyCapacity;
+    vector<uint8_t>(capacity * historyCapacity * PASSWORD_HISTORY_ENTRY_LEN).swap(m_historyBlocks);
+    m_positions.clear();
+    m_positions.reserve(capacity);
+    m_marks = (capacity > 0) ? new atomic<uint8_t>[capacity] : nullptr;
+    for (size_t i = 0; i < capacity; i++)
+    {
+        m_marks[i].store(0, memory_order_relaxed);
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Find
+//
+// @description         : Copies a cached record and marks it as used.
+//
+// @param history       : Buffer for the copy's history, NULL to leave the copy without previous passwords
+//
+// @returns             : True if the record is cached.
+//-------------------------------------------------------------------------------------------------------------
+bool UserCache::Find(string_view name, userData_t & userData, passwordHistoryBuffer_t *history)
+{
+    auto it = m_positions.find(name);
+    if (it == m_positions.end())
+    {
+        return false;
+    }
+
+    CopyUserData(userData, m_records[it->second], history);
+    m_marks[it->second].store(1, memory_order_relaxed);
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Insert
+//
+// @description         : Caches a copy of a record, replacing a cached one of the same name. When the cache
+//                        is full the record replaces the first unmarked one the hand comes by.
+//
+// @returns             : True if another record was evicted for it.
+//-------------------------------------------------------------------------------------------------------------
+bool UserCache::Insert(const userData_t & userData)
+{
+    if (m_capacity == 0)
+    {
+        return false;
+    }
+
+    auto it = m_positions.find(userData.name);
+    if (it != m_positions.end())
+    {
+        Store(it->second, userData);
+        return false;
+    }
+
+    if (m_records.size() < m_capacity)
+    {
+        m_positions[userData.name] = (uint32_t)m_records.size();
+        m_records.emplace_back();
+        Store(m_records.size() - 1, userData);
+        return false;
+    }
+
+    while (m_marks[m_hand].exchange(0, memory_order_relaxed) != 0)
+    {
+        m_hand = (m_hand + 1) % m_capacity;
+    }
+
+    // Erased records leave a hole with an empty name
+    bool isEvicted = !m_records[m_hand].name.empty();
+    if (isEvicted)
+    {
+        m_positions.erase(m_records[m_hand].name);
+    }
+
+    Store(m_hand, userData);
+    m_positions[userData.name] = (uint32_t)m_hand;
+    m_hand = (m_hand + 1) % m_capacity;
+    return isEvicted;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Erase
+//
+// @description         : Drops a record from the cache, e.g. once the record is kept elsewhere.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void UserCache::Erase(string_view name)
+{
+    auto it = m_positions.find(name);
+    if (it == m_positions.end())
+    {
+        return;
+    }
+
+    m_records[it->second].name = string_view();
+    m_marks[it->second].store(0, memory_order_relaxed);
+    m_positions.erase(it);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetMemoryUsage
+//
+// @description         : Memory held by the cache, at its full size.
+//
+// @returns             : Bytes
+//-------------------------------------------------------------------------------------------------------------
+size_t UserCache::GetMemoryUsage()
+{
+    return m_capacity * (sizeof(userData_t) + sizeof(atomic<uint8_t>) + sizeof(string_view) + 2 * sizeof(void*)) +
+           m_historyBlocks.size();
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Store
+//
+// @description         : Copies a record into a position, its newest entries of history into the position's
+//                        history block.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void UserCache::Store(size_t position, const userData_t & userData)
+{
+    userData_t & record = m_records[position];
+    record = userData;
+    uint8_t *block = m_historyBlocks.data() + position * m_historyCapacity * PASSWORD_HISTORY_ENTRY_LEN;
+    InitPasswordHistory(record.prevPasswords, (m_historyCapacity > 0) ? block : nullptr, m_historyCapacity);
+    CopyPasswordHistory(record.prevPasswords, userData.prevPasswords);
+}
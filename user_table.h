@@ -0,0 +1,154 @@
+#ifndef _USER_TABLE_H_
+#define _USER_TABLE_H_
+#include<atomic>
+#include<stddef.h>
+#include<stdint.h>
+#include<string>
+#include<string_view>
+#include<type_traits>
+#include<unordered_map>
+#include<vector>
+#include "arena.h"
+#include "metrics.h"
+#include "password_hasher.h"
+
+using namespace std;
+
+//-------------------------------------------------------------------------------------------------------------
+// Globals
+//-------------------------------------------------------------------------------------------------------------
+const unsigned PASSWORD_HISTORY_MAX = 64;     // Most previous passwords a history can hold, its entries are
+                                              // tracked in a 64 bit mask
+const size_t PASSWORD_HISTORY_ENTRY_LEN = PASSWORD_DIGEST_LEN + PASSWORD_SALT_LEN + sizeof(uint32_t) + 1;
+const size_t USER_TABLE_PAGE_RECORDS = 256;
+
+//-------------------------------------------------------------------------------------------------------------
+// Structs
+//-------------------------------------------------------------------------------------------------------------
+// Entries are kept oldest first in a block with room for capacity of them, the digests in one contiguous run
+// apart from the salts, iterations and algorithms they were computed with, so that a candidate digest is
+// compared against all of them in a single pass. The history does not own its block: records of a UserTable
+// get theirs from the table's arena with their first entry, sized for the table's history capacity, and a
+// plain copy of a record shares the block of the original. See CopyUserData() for a copy of its own.
+typedef struct passwordHistory_tag
+{
+    uint8_t *block;                           // NULL while capacity is 0
+    uint8_t count;
+    uint8_t capacity;
+}passwordHistory_t;
+
+// Room for the longest history, for copies of records and decoded records
+typedef struct passwordHistoryBuffer_tag
+{
+    uint8_t block[PASSWORD_HISTORY_MAX * PASSWORD_HISTORY_ENTRY_LEN];
+}passwordHistoryBuffer_t;
+
+typedef struct userData_tag
+{
+    string_view name;                         // Interned in the arena of the table holding the record
+    passwordHash_t passwordHash;              // Salted hash of the current password
+    long long lastPasswordChangeTimestamp;
+    passwordHistory_t prevPasswords;          // Hashes of previous passwords, oldest first
+    uint32_t passwordVersion;                 // Password changes since the record was loaded, not persisted.
+                                              // A rehash of the same password does not count
+}userData_t;
+
+// Records live in an arena which never runs destructors
+static_assert(is_trivially_destructible<userData_t>::value, "userData_t must not own memory");
+
+//-------------------------------------------------------------------------------------------------------------
+// Functions
+//-------------------------------------------------------------------------------------------------------------
+void InitPasswordHistory(passwordHistory_t & history, uint8_t *block, unsigned capacity);
+void InitPasswordHistory(passwordHistory_t & history, passwordHistoryBuffer_t *buffer);
+void ClearPasswordHistory(passwordHistory_t & history);
+void CopyPasswordHistory(passwordHistory_t & to, const passwordHistory_t & from);
+void PushPasswordHistory(passwordHistory_t & history, const passwordHash_t & hash, unsigned capacity);
+bool TrimPasswordHistory(passwordHistory_t & history, unsigned capacity);
+passwordHash_t GetPasswordHistoryEntry(const passwordHistory_t & history, unsigned index);
+bool MatchPasswordHistory(const passwordHistory_t & history, const passwordHash_t & derived, uint64_t & unchecked);
+void CopyUserData(userData_t & to, const userData_t & from, passwordHistoryBuffer_t *history);
+
+//-------------------------------------------------------------------------------------------------------------
+// Open addressing hash table of user records. Slots only hold the hash and the position of a record; the
+// records themselves are stored by value in fixed size pages and their names are interned, both in the
+// table's arena, so inserting never moves a record and lookups do not allocate. A record's password history
+// is taken from the arena too, once the user has a previous password, and is then changed in place. Users
+// are never removed, and destroying the table releases a few arena blocks whatever the no. of users. Not
+// thread safe, each shard of AuthModule guards its table with the shard lock.
+//-------------------------------------------------------------------------------------------------------------
+class UserTable
+{
+private:
+    typedef struct slot_tag
+    {
+        uint32_t hashTag;                     // Upper half of the name's hash
+        uint32_t record;                      // Position of the record + 1, 0 for an empty slot
+    }slot_t;
+
+    slot_t                                 *m_slots;
+    size_t                                  m_slotMask;                  // No. of slots - 1, a power of 2
+    size_t                                  m_size;
+    vector<userData_t*>                     m_pages;                     // USER_TABLE_PAGE_RECORDS records each
+    MonotonicArena                          m_arena;                     // Pages, names and histories
+    unsigned                                m_historyCapacity;           // Previous passwords kept per record
+    AuthMetrics                            *m_metrics;                   // Rehashes are counted here, may be NULL
+
+    size_t GetSlotIndex(size_t nameHash);
+    void Grow(size_t slotCount);
+    void AddPage();
+    string_view InternName(string_view name);
+    void AllocatePasswordHistory(userData_t *record);
+    void SetPasswordHistory(userData_t *record, const passwordHistory_t & history);
+
+public:
+    UserTable();
+    ~UserTable();
+    userData_t* Find(string_view name, size_t nameHash);
+    userData_t* Insert(const userData_t & userData, size_t nameHash);
+    void Assign(userData_t *record, const userData_t & userData);
+    void PushPasswordHistory(userData_t *record, const passwordHash_t & hash);
+    void Reserve(size_t count);
+    size_t Size() { return m_size; }
+    userData_t* GetRecord(size_t index);
+    size_t GetMemoryUsage();
+    void SetMetrics(AuthMetrics *metrics) { m_metrics = metrics; }
+    void SetHistoryCapacity(unsigned capacity) { m_historyCapacity = capacity; }
+};
+
+//-------------------------------------------------------------------------------------------------------------
+// Fixed size cache of user records, by name, evicted in CLOCK order: the hand passes over records which
+// were found since it last came by, clearing the mark, and replaces the first unmarked one. Records are
+// copies and their names are not interned, the names must stay valid while the record is cached. Each
+// position has room for a history of the cache's history capacity. Lookups
+// only set a record's mark, so they may run concurrently under a shared lock; inserts and erases need an
+// exclusive one.
+//-------------------------------------------------------------------------------------------------------------
+class UserCache
+{
+private:
+    vector<userData_t>                      m_records;
+    vector<uint8_t>                         m_historyBlocks;             // One per position
+    unsigned                                m_historyCapacity;
+    atomic<uint8_t>                        *m_marks;                     // Set when a record is found
+    unordered_map<string_view, uint32_t>    m_positions;
+    size_t                                  m_capacity;
+    size_t                                  m_hand;
+
+    void Store(size_t position, const userData_t & userData);
+
+public:
+    UserCache();
+    ~UserCache();
+    UserCache(const UserCache &) = delete;
+    UserCache & operator=(const UserCache &) = delete;
+
+    void SetCapacity(size_t capacity, unsigned historyCapacity);
+    bool Find(string_view name, userData_t & userData, passwordHistoryBuffer_t *history);
+    bool Insert(const userData_t & userData);
+    void Erase(string_view name);
+    size_t Size() { return m_positions.size(); }
+    size_t GetMemoryUsage();
+};
+
+#endif
@@ -0,0 +1,484 @@
+#include "users_db_format.h"
+#include "logger.h"
+#include <algorithm>
+#include <string.h>
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : Checksum32
+//
+// @description         : FNV-1a hash of a byte buffer. Used to detect torn or corrupt journal records.
+//
+// @param checksum      : Checksum of the preceding data, to checksum data given in several pieces
+//
+// @returns             : 32 bit checksum
+//-------------------------------------------------------------------------------------------------------------
+uint32_t Checksum32(const char *data, size_t len, uint32_t checksum)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        checksum ^= (uint8_t)data[i];
+        checksum *= 16777619u;
+    }
+
+    return checksum;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// Helpers for the little endian, length prefixed encoding
+//-------------------------------------------------------------------------------------------------------------
+void PutU32(string & buf, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        buf.push_back((char)((value >> (8 * i)) & 0xFF));
+    }
+}
+
+void PutU64(string & buf, uint64_t value)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        buf.push_back((char)((value >> (8 * i)) & 0xFF));
+    }
+}
+
+void PutString(string & buf, string_view str)
+{
+    PutU32(buf, (uint32_t)str.size());
+    buf.append(str);
+}
+
+bool GetU8(recordReader_t & reader, uint8_t & value)
+{
+    if (reader.pos + 1 > reader.len)
+        return false;
+
+    value = (uint8_t)reader.data[reader.pos];
+    reader.pos += 1;
+    return true;
+}
+
+bool GetU32(recordReader_t & reader, uint32_t & value)
+{
+    if (reader.pos + 4 > reader.len)
+        return false;
+
+    value = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        value |= (uint32_t)(uint8_t)reader.data[reader.pos + i] << (8 * i);
+    }
+    reader.pos += 4;
+    return true;
+}
+
+bool GetU64(recordReader_t & reader, uint64_t & value)
+{
+    if (reader.pos + 8 > reader.len)
+        return false;
+
+    value = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        value |= (uint64_t)(uint8_t)reader.data[reader.pos + i] << (8 * i);
+    }
+    reader.pos += 8;
+    return true;
+}
+
+bool GetString(recordReader_t & reader, string & str)
+{
+    string_view view;
+    if (!GetStringView(reader, view))
+        return false;
+
+    str.assign(view.data(), view.size());
+    return true;
+}
+
+bool GetStringView(recordReader_t & reader, string_view & str)
+{
+    uint32_t len = 0;
+    if (!GetU32(reader, len) || reader.pos + len > reader.len)
+        return false;
+
+    str = string_view(reader.data + reader.pos, len);
+    reader.pos += len;
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// Helpers for the encoding of a password hash
+//-------------------------------------------------------------------------------------------------------------
+static void PutPasswordHash(string & buf, const passwordHash_t & hash)
+{
+    buf.push_back((char)hash.algorithm);
+    PutU32(buf, hash.iterations);
+    buf.append((const char *)hash.salt, sizeof(hash.salt));
+    buf.append((const char *)hash.digest, sizeof(hash.digest));
+}
+
+static bool GetPasswordHash(recordReader_t & reader, passwordHash_t & hash)
+{
+    if (!GetU8(reader, hash.algorithm) || !GetU32(reader, hash.iterations) ||
+        reader.pos + sizeof(hash.salt) + sizeof(hash.digest) > reader.len)
+    {
+        return false;
+    }
+
+    memcpy(hash.salt, reader.data + reader.pos, sizeof(hash.salt));
+    memcpy(hash.digest, reader.data + reader.pos + sizeof(hash.salt), sizeof(hash.digest));
+    reader.pos += sizeof(hash.salt) + sizeof(hash.digest);
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : EncodeUserRecord
+//
+// @description         : Appends the encoding of one user record to buf, in the current version.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void EncodeUserRecord(string & buf, const userData_t & userData)
+{
+    PutU64(buf, (uint64_t)userData.lastPasswordChangeTimestamp);
+    PutString(buf, userData.name);
+    PutPasswordHash(buf, userData.passwordHash);
+    PutU32(buf, (uint32_t)userData.prevPasswords.count);
+    for (unsigned i = 0; i < userData.prevPasswords.count; i++)
+    {
+        PutPasswordHash(buf, GetPasswordHistoryEntry(userData.prevPasswords, i));
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : DecodeUserRecord
+//
+// @description         : Decodes one user record starting at the reader's position. All reads are bounds
+//                        checked against the reader's length. Plaintext passwords of version 1 records are
+//                        hashed with the given hasher, all with the salt of the current one. The decoded name
+//                        points into the reader's data. The previous passwords go into the block of
+//                        userData's history, the newest ones it has room for.
+//
+// @param version       : Format version the record was encoded in
+// @param hasher        : Hasher for plaintext passwords of version 1 records
+//
+// @returns             : True if a complete record was decoded.
+//-------------------------------------------------------------------------------------------------------------
+bool DecodeUserRecord(recordReader_t & reader, uint32_t version, PasswordHasher & hasher, userData_t & userData)
+{
+    uint64_t timestamp = 0;
+    uint32_t historyCount = 0;
+    bool valid = GetU64(reader, timestamp) && GetStringView(reader, userData.name);
+    userData.lastPasswordChangeTimestamp = (long long)timestamp;
+    userData.passwordVersion = 0;
+    ClearPasswordHistory(userData.prevPasswords);
+
+    if (version == 1)
+    {
+        string password;
+        uint32_t legacyHash = 0;
+        valid = valid && GetString(reader, password) && GetU32(reader, legacyHash) && GetU32(reader, historyCount);
+        if (valid)
+        {
+            hasher.Hash(password, userData.passwordHash);
+        }
+
+        for (uint32_t i = 0; valid && i < historyCount; i++)
+        {
+            valid = GetString(reader, password);
+            if (valid && password != NO_PASSWORD_IDENTIFIER)
+            {
+                passwordHash_t hash;
+                hasher.HashWithSalt(password, userData.passwordHash.salt, hash);
+                PushPasswordHistory(userData.prevPasswords, hash, PASSWORD_HISTORY_MAX);
+            }
+        }
+
+        return valid;
+    }
+
+    valid = valid && GetPasswordHash(reader, userData.passwordHash) && GetU32(reader, historyCount);
+    for (uint32_t i = 0; valid && i < historyCount; i++)
+    {
+        passwordHash_t hash;
+        valid = GetPasswordHash(reader, hash);
+        PushPasswordHistory(userData.prevPasswords, hash, PASSWORD_HISTORY_MAX);
+    }
+
+    return valid;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : PeekRecordName
+//
+// @description         : Locates the user name inside an encoded record without decoding the record.
+//
+// @returns             : True if the name lies within the record.
+//-------------------------------------------------------------------------------------------------------------
+bool PeekRecordName(const char *record, size_t len, const char *& name, uint32_t & nameLen)
+{
+    recordReader_t reader = { record, len, 8 };
+    if (!GetU32(reader, nameLen) || reader.pos + nameLen > len)
+        return false;
+
+    name = record + reader.pos;
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : ReadUsersDbHeader
+//
+// @description         : Parses the fixed size header of a binary users database and checks that the index
+//                        lies within the file.
+//
+// @returns             : True if the header is valid and of a supported version.
+//-------------------------------------------------------------------------------------------------------------
+bool ReadUsersDbHeader(const char *data, size_t len, usersDbHeader_t & header)
+{
+    recordReader_t reader = { data, len, 0 };
+    uint32_t useStrongPasswords = 0;
+    uint32_t passwordExpiryDays = 0;
+    bool valid = GetU32(reader, header.magic) &&
+                 GetU32(reader, header.version) &&
+                 GetU32(reader, header.authPolicy.passwordHistoryMax) &&
+                 GetU32(reader, header.authPolicy.passwordLenMax) &&
+                 GetU32(reader, header.authPolicy.passwordLenMin) &&
+                 GetU32(reader, useStrongPasswords) &&
+                 GetU32(reader, passwordExpiryDays) &&
+                 GetU32(reader, header.nameDigest) &&
+                 GetU64(reader, header.userCount) &&
+                 GetU64(reader, header.indexOffset);
+    if (!valid || header.magic != USERS_DB_MAGIC)
+        return false;
+
+    if (header.version < USERS_DB_MIN_VERSION || header.version > USERS_DB_VERSION)
+    {
+        LOG_ERROR("Unsupported users database version %u", header.version);
+        return false;
+    }
+
+    header.authPolicy.useStrongPasswords = (useStrongPasswords != 0);
+    header.authPolicy.passwordExpiryDays = (int)passwordExpiryDays;
+
+    return (header.indexOffset >= USERS_DB_HEADER_SIZE &&
+            header.indexOffset <= len &&
+            header.userCount <= (len - header.indexOffset) / USERS_DB_INDEX_ENTRY_SIZE);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : ReadUsersDbIndexEntry
+//
+// @description         : Reads the index entry of the index'th user (in name order).
+//
+// @returns             : True if the record referred to lies within the file.
+//-------------------------------------------------------------------------------------------------------------
+bool ReadUsersDbIndexEntry(const char *data, size_t len, uint64_t indexOffset, uint64_t index,
+                           uint64_t & offset, uint32_t & recordLen)
+{
+    recordReader_t reader = { data, len, (size_t)(indexOffset + index * USERS_DB_INDEX_ENTRY_SIZE) };
+    if (!GetU64(reader, offset) || !GetU32(reader, recordLen))
+        return false;
+
+    return (offset <= len && recordLen <= len - offset);
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : GetUsersDbIdentity
+//
+// @description         : Identifies the set of users of a binary users database from its header alone, which
+//                        holds the user count and the name digest. Changes of passwords keep the identity.
+//
+// @returns             : Identity, 0 if the file is invalid or has no name digest.
+//-------------------------------------------------------------------------------------------------------------
+uint32_t GetUsersDbIdentity(const char *data, size_t len)
+{
+    usersDbHeader_t header;
+    if (!ReadUsersDbHeader(data, len, header) || header.nameDigest == 0)
+        return 0;
+
+    uint32_t identity = Checksum32(data, USERS_DB_HEADER_SIZE);
+    return (identity != 0) ? identity : 1;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : WriteUsersDbSnapshot
+//
+// @description         : Builds a complete binary users database in out. Entries are sorted by name so that
+//                        users can be looked up with a binary search over the index of the mapped file.
+//
+// @returns             : Nothing
+//-------------------------------------------------------------------------------------------------------------
+void WriteUsersDbSnapshot(string & out, const authPolicy_t & authPolicy, vector<usersDbEntry_t> & entries)
+{
+    sort(entries.begin(), entries.end(), [](const usersDbEntry_t & a, const usersDbEntry_t & b)
+    {
+        int cmp = memcmp(a.name, b.name, min(a.nameLen, b.nameLen));
+        return (cmp != 0) ? (cmp < 0) : (a.nameLen < b.nameLen);
+    });
+
+    uint32_t nameDigest = Checksum32(nullptr, 0);
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        char nameLen[4] = { (char)entries[i].nameLen, (char)(entries[i].nameLen >> 8),
+                            (char)(entries[i].nameLen >> 16), (char)(entries[i].nameLen >> 24) };
+        nameDigest = Checksum32(nameLen, sizeof(nameLen), nameDigest);
+        nameDigest = Checksum32(entries[i].name, entries[i].nameLen, nameDigest);
+    }
+
+    out.clear();
+    PutU32(out, USERS_DB_MAGIC);
+    PutU32(out, USERS_DB_VERSION);
+    PutU32(out, authPolicy.passwordHistoryMax);
+    PutU32(out, authPolicy.passwordLenMax);
+    PutU32(out, authPolicy.passwordLenMin);
+    PutU32(out, authPolicy.useStrongPasswords ? 1 : 0);
+    PutU32(out, (uint32_t)authPolicy.passwordExpiryDays);
+    PutU32(out, (nameDigest != 0) ? nameDigest : 1);
+    PutU64(out, entries.size());
+    PutU64(out, USERS_DB_HEADER_SIZE);
+
+    // Index is filled in once the record offsets are known
+    size_t indexOffset = out.size();
+    out.resize(indexOffset + entries.size() * USERS_DB_INDEX_ENTRY_SIZE);
+
+    string entryBuf;
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        uint64_t offset = out.size();
+        if (entries[i].userData != nullptr)
+        {
+            EncodeUserRecord(out, *entries[i].userData);
+        }
+        else
+        {
+            out.append(entries[i].rawRecord, entries[i].rawLen);
+        }
+
+        entryBuf.clear();
+        PutU64(entryBuf, offset);
+        PutU32(entryBuf, (uint32_t)(out.size() - offset));
+        PutU32(entryBuf, 0);
+        out.replace(indexOffset + i * USERS_DB_INDEX_ENTRY_SIZE, USERS_DB_INDEX_ENTRY_SIZE, entryBuf);
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : IsBinaryUsersDbFile
+//
+// @description         : Checks the magic number at the start of a users database file.
+//
+// @returns             : True if the file is in binary format. False for text format or missing file.
+//-------------------------------------------------------------------------------------------------------------
+bool IsBinaryUsersDbFile(const string & fileName)
+{
+    ifstream in(fileName, ios::in | ios::binary);
+    char magic[4];
+    if (!in.read(magic, sizeof(magic)))
+        return false;
+
+    recordReader_t reader = { magic, sizeof(magic), 0 };
+    uint32_t value = 0;
+    return GetU32(reader, value) && value == USERS_DB_MAGIC;
+}
+
+//-------------------------------------------------------------------------------------------------------------
+// @name                : ConvertTextUsersDataFile
+//
+// @description         : Converts a users database in the original text format into the binary format.
+//                        The auth policy is carried over from the text file as is. Plaintext passwords of the
+//                        text file are hashed.
+//
+// @param textFile      : Users database in text format
+// @param binaryFile    : File to which the binary users database is written
+// @param hasher        : Hasher for the plaintext passwords
+//
+// @returns             : True if the conversion was successful.
+//-------------------------------------------------------------------------------------------------------------
+bool ConvertTextUsersDataFile(const string & textFile, const string & binaryFile, PasswordHasher & hasher)
+{
+    ifstream in(textFile, ios::in | ios::binary);
+    if (!in)
+    {
+        LOG_ERROR("File [ %s ] NOT found!", textFile);
+        return false;
+    }
+
+    authPolicy_t authPolicy;
+    size_t totalRegisteredUsers = 0;
+    in >> authPolicy.passwordHistoryMax;
+    in >> authPolicy.passwordLenMax;
+    in >> authPolicy.passwordLenMin;
+    in >> authPolicy.useStrongPasswords;
+    in >> authPolicy.passwordExpiryDays;
+    in >> totalRegisteredUsers;
+    if (!in)
+    {
+        LOG_ERROR("File [ %s ] is not a users database", textFile);
+        return false;
+    }
+
+    // Users are encoded as they are read, so that one history buffer does for all of them
+    string records;
+    vector<size_t> recordEnds(totalRegisteredUsers);
+    vector<string> names(totalRegisteredUsers);
+    passwordHistoryBuffer_t history;
+    for (size_t i = 0; i < totalRegisteredUsers; i++)
+    {
+        userData_t userData;
+        string password;
+        unsigned legacyHash = 0;
+        in >> userData.lastPasswordChangeTimestamp;
+        in >> names[i];
+        userData.name = names[i];
+        InitPasswordHistory(userData.prevPasswords, &history);
+        in >> password;
+        in >> legacyHash;
+        hasher.Hash(password, userData.passwordHash);
+        for (unsigned j = 0; j + 1 < authPolicy.passwordHistoryMax; j++)
+        {
+            string pwd;
+            in >> pwd;
+            if (pwd != NO_PASSWORD_IDENTIFIER)
+            {
+                passwordHash_t hash;
+                hasher.HashWithSalt(pwd, userData.passwordHash.salt, hash);
+                PushPasswordHistory(userData.prevPasswords, hash, PASSWORD_HISTORY_MAX);
+            }
+        }
+        EncodeUserRecord(records, userData);
+        recordEnds[i] = records.size();
+    }
+
+    if (!in)
+    {
+        LOG_ERROR("File [ %s ] is truncated", textFile);
+        return false;
+    }
+
+    vector<usersDbEntry_t> entries(totalRegisteredUsers);
+    for (size_t i = 0; i < totalRegisteredUsers; i++)
+    {
+        size_t begin = (i > 0) ? recordEnds[i - 1] : 0;
+        entries[i].name = names[i].data();
+        entries[i].nameLen = (uint32_t)names[i].size();
+        entries[i].userData = nullptr;
+        entries[i].rawRecord = records.data() + begin;
+        entries[i].rawLen = (uint32_t)(recordEnds[i] - begin);
+    }
+
+    string snapshot;
+    WriteUsersDbSnapshot(snapshot, authPolicy, entries);
+
+    ofstream out(binaryFile, ios::out | ios::binary | ios::trunc);
+    out.write(snapshot.data(), snapshot.size());
+    out.close();
+    if (!out)
+    {
+        LOG_ERROR("Failed to write [ %s ]", binaryFile);
+        return false;
+    }
+
+    LOG_INFO("Converted %zu user(s) from %s to binary format", totalRegisteredUsers, textFile);
+    return true;
+}
@@ -0,0 +1,83 @@
+#ifndef _USERS_DB_FORMAT_H_
+#define _USERS_DB_FORMAT_H_
+#include "auth_module.h"
+
+//-------------------------------------------------------------------------------------------------------------
+// Users database binary format (all integers little endian)
+//
+//   Header   : magic, version, auth policy, name digest, user count, index offset (USERS_DB_HEADER_SIZE bytes)
+//   Index    : one entry per user sorted by name: record offset (u64), record length (u32), reserved (u32)
+//   Records  : timestamp (u64), name (length prefixed string), password hash, history count (u32),
+//              history password hashes
+//   Hash     : algorithm (u8), iterations (u32), salt, digest
+//
+// Version 1 records held the plaintext password, a std::hash of it (u32) and plaintext history
+// passwords. They are still decoded, hashing the plaintext passwords on the way.
+//
+// The name digest is a checksum of all user names in index order, 0 in files written before it was added.
+// Together with the user count it identifies the set of users of a snapshot, see GetUsersDbIdentity().
+//
+// The journal frames use the same record encoding, so a record can be copied between the two as is.
+//-------------------------------------------------------------------------------------------------------------
+const uint32_t USERS_DB_MAGIC = 0x42444155;          // "UADB"
+const uint32_t USERS_DB_VERSION = 2;
+const uint32_t USERS_DB_MIN_VERSION = 1;
+const size_t USERS_DB_HEADER_SIZE = 48;
+const size_t USERS_DB_INDEX_ENTRY_SIZE = 16;
+
+//-------------------------------------------------------------------------------------------------------------
+// Structs
+//-------------------------------------------------------------------------------------------------------------
+typedef struct usersDbHeader_tag
+{
+    uint32_t magic;
+    uint32_t version;
+    authPolicy_t authPolicy;
+    uint32_t nameDigest;
+    uint64_t userCount;
+    uint64_t indexOffset;
+}usersDbHeader_t;
+
+typedef struct recordReader_tag
+{
+    const char *data;
+    size_t len;
+    size_t pos;
+}recordReader_t;
+
+typedef struct usersDbEntry_tag
+{
+    const char *name;                         // Points into userData or rawRecord
+    uint32_t nameLen;
+    const userData_t *userData;               // Record to be encoded, or
+    const char *rawRecord;                    // already encoded record copied as is
+    uint32_t rawLen;
+}usersDbEntry_t;
+
+//-------------------------------------------------------------------------------------------------------------
+// Functions
+//-------------------------------------------------------------------------------------------------------------
+uint32_t Checksum32(const char *data, size_t len, uint32_t checksum = 2166136261u);
+
+void PutU32(string & buf, uint32_t value);
+void PutU64(string & buf, uint64_t value);
+void PutString(string & buf, string_view str);
+bool GetU8(recordReader_t & reader, uint8_t & value);
+bool GetU32(recordReader_t & reader, uint32_t & value);
+bool GetU64(recordReader_t & reader, uint64_t & value);
+bool GetString(recordReader_t & reader, string & str);
+bool GetStringView(recordReader_t & reader, string_view & str);
+
+void EncodeUserRecord(string & buf, const userData_t & userData);
+bool DecodeUserRecord(recordReader_t & reader, uint32_t version, PasswordHasher & hasher, userData_t & userData);
+bool PeekRecordName(const char *record, size_t len, const char *& name, uint32_t & nameLen);
+
+bool ReadUsersDbHeader(const char *data, size_t len, usersDbHeader_t & header);
+bool ReadUsersDbIndexEntry(const char *data, size_t len, uint64_t indexOffset, uint64_t index,
+                           uint64_t & offset, uint32_t & recordLen);
+uint32_t GetUsersDbIdentity(const char *data, size_t len);
+void WriteUsersDbSnapshot(string & out, const authPolicy_t & authPolicy, vector<usersDbEntry_t> & entries);
+bool IsBinaryUsersDbFile(const string & fileName);
+bool ConvertTextUsersDataFile(const string & textFile, const string & binaryFile, PasswordHasher & hasher);
+
+#endif